@@ -0,0 +1,318 @@
+// End-to-end performance suite with machine-readable results
+// Trains on a corpus (or a generated synthetic one), then measures save and
+// load time, predict latency across context lengths and top-k fanouts,
+// generation speed and peak RSS. A summary goes to stdout; --json writes
+// every figure to a file so runs can be compared for regressions.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "../include/lmModel.h"
+
+#define MaxSamples 20000       // predict calls timed per (context length, k)
+#define MaxPrompts 200         // generate calls
+#define GenerateTokens 32
+#define SyntheticVocab 50000
+
+static const int ContextLengths[] = { 1, 2, 3, 6 };
+static const int Fanouts[] = { 1, 5, 20, 64 };
+#define NumContextLengths (int)(sizeof(ContextLengths) / sizeof(ContextLengths[0]))
+#define NumFanouts (int)(sizeof(Fanouts) / sizeof(Fanouts[0]))
+
+typedef struct {
+    int contextWords;
+    int k;
+    size_t calls;
+    double p50;   // seconds
+    double p99;
+    double callsPerSecond;
+} PredictResult;
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Peak resident set so far, in MiB
+static double peakRssMiB(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+    return (double)usage.ru_maxrss / 1024.0;
+}
+
+static int compareDouble(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Small deterministic PRNG (xorshift64)
+static uint64_t benchRandom(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+// Zipf-like rank in [0, n): the cube of a uniform draw skews toward 0
+static uint32_t skewedRank(uint64_t* state, uint32_t n) {
+    double u = (double)(benchRandom(state) >> 11) / 9007199254740992.0;
+    return (uint32_t)(u * u * u * n);
+}
+
+// Write lines of skewed words where each word often predicts the next
+// (half the time it is one of a few followers of the previous word), so
+// the higher orders carry signal and the corpus scales to any size
+static bool writeSyntheticCorpus(const char* filename, long lines) {
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        perror("Failed to create synthetic corpus");
+        return false;
+    }
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (long i = 0; i < lines; i++) {
+        int words = 4 + (int)(benchRandom(&state) % 16);
+        uint32_t previous = skewedRank(&state, SyntheticVocab);
+        for (int w = 0; w < words; w++) {
+            uint32_t word = previous;
+            if (w > 0) {
+                if (benchRandom(&state) & 1) {
+                    uint32_t follower = (uint32_t)(benchRandom(&state) % 4);
+                    word = (uint32_t)(((uint64_t)previous * 2654435761u + follower * 40503u) % SyntheticVocab);
+                } else {
+                    word = skewedRank(&state, SyntheticVocab);
+                }
+            }
+            fprintf(file, (w > 0) ? " w%u" : "w%u", word);
+            previous = word;
+        }
+        fputc('\n', file);
+    }
+    return fclose(file) == 0;
+}
+
+// Collect contexts of exactly `words` words (line prefixes), up to max
+static size_t loadContexts(const char* filename, int words, char** contexts, size_t max) {
+    FILE* file = fopen(filename, "r");
+    if (!file) return 0;
+
+    size_t n = 0;
+    char line[4096];
+    while (n < max && fgets(line, sizeof(line), file)) {
+        char* tokens[128];
+        int numTokens = 0;
+        for (char* t = strtok(line, " \t\r\n"); t && numTokens < 128; t = strtok(NULL, " \t\r\n")) {
+            tokens[numTokens++] = t;
+        }
+        for (int end = words; end <= numTokens && n < max; end += words) {
+            char buf[1024] = "";
+            for (int i = end - words; i < end; i++) {
+                if (i > end - words) strncat(buf, " ", sizeof(buf) - strlen(buf) - 1);
+                strncat(buf, tokens[i], sizeof(buf) - strlen(buf) - 1);
+            }
+            contexts[n] = strdup(buf);
+            if (contexts[n]) n++;
+        }
+    }
+    fclose(file);
+    return n;
+}
+
+// Time one predict call per context, then the whole run
+static void benchPredict(const LMModel* model, char** contexts, size_t n, int k, PredictResult* result) {
+    uint32_t tokens[64];
+    float scores[64];
+    PredictScratch scratch = {0};
+    double* latency = (double*)malloc(sizeof(double) * (n ? n : 1));
+    if (!latency) return;
+
+    for (size_t i = 0; i < n; i++) {
+        double t0 = nowSeconds();
+        predictNextTokenScratch(model, contexts[i], tokens, scores, k, &scratch);
+        latency[i] = nowSeconds() - t0;
+    }
+    // Throughput from a second pass without the per-call clock reads
+    double start = nowSeconds();
+    for (size_t i = 0; i < n; i++) {
+        predictNextTokenScratch(model, contexts[i], tokens, scores, k, &scratch);
+    }
+    double total = nowSeconds() - start;
+    freePredictScratch(&scratch);
+
+    qsort(latency, n, sizeof(double), compareDouble);
+    result->k = k;
+    result->calls = n;
+    result->p50 = n ? latency[n / 2] : 0.0;
+    result->p99 = n ? latency[n * 99 / 100] : 0.0;
+    result->callsPerSecond = (total > 0.0) ? (double)n / total : 0.0;
+    free(latency);
+}
+
+// Words in a generated reply
+static int countWords(const char* text) {
+    int words = 0;
+    bool inWord = false;
+    for (const char* p = text; *p; p++) {
+        bool space = (*p == ' ' || *p == '\t' || *p == '\n');
+        if (!space && !inWord) words++;
+        inWord = !space;
+    }
+    return words;
+}
+
+int main(int argc, char* argv[]) {
+    const char* corpus = NULL;
+    const char* jsonFile = NULL;
+    const char* workDir = "build/bench";
+    long syntheticLines = 0;
+    int numThreads = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--synthetic") == 0 && i + 1 < argc) {
+            syntheticLines = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            numThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonFile = argv[++i];
+        } else if (strcmp(argv[i], "--work") == 0 && i + 1 < argc) {
+            workDir = argv[++i];
+        } else {
+            corpus = argv[i];
+        }
+    }
+    if (!corpus && syntheticLines <= 0) {
+        printf("Usage: %s <corpus.txt> | --synthetic LINES [--threads N] [--work DIR] [--json FILE]\n", argv[0]);
+        return 1;
+    }
+
+    mkdir(workDir, 0755);  // may already exist
+    char syntheticFile[1024];
+    const char* name = corpus;
+    if (!corpus) {
+        snprintf(syntheticFile, sizeof(syntheticFile), "%s/synthetic.txt", workDir);
+        if (!writeSyntheticCorpus(syntheticFile, syntheticLines)) return 1;
+        corpus = syntheticFile;
+        name = "synthetic";
+    }
+
+    // Training
+    LMModel* model = createLMModel(4);
+    if (!model) return 1;
+    double t0 = nowSeconds();
+    trainFromFileParallel(model, corpus, numThreads);
+    double trainSeconds = nowSeconds() - t0;
+    double trainRss = peakRssMiB();
+    uint64_t tokens = model->totalTokens;
+    if (tokens == 0 || !model->frozen) {
+        fprintf(stderr, "Training produced no model\n");
+        freeLMModel(model);
+        return 1;
+    }
+
+    // Save both formats, then load each: the mapped image and the rebuilt trie
+    char prefix[1024], countsPrefix[1024], frozenFile[1100];
+    snprintf(prefix, sizeof(prefix), "%s/bench_model", workDir);
+    snprintf(countsPrefix, sizeof(countsPrefix), "%s/bench_counts", workDir);
+    snprintf(frozenFile, sizeof(frozenFile), "%s%s", prefix, FrozenExtension);
+    t0 = nowSeconds();
+    saveModel(model, prefix);
+    saveFrozenModel(model, frozenFile);
+    double saveSeconds = nowSeconds() - t0;
+    saveModel(model, countsPrefix);
+    freeLMModel(model);
+
+    LMModel* counts = createLMModel(4);
+    t0 = nowSeconds();
+    if (counts) loadModel(counts, countsPrefix);
+    double loadCountsSeconds = nowSeconds() - t0;
+    freeLMModel(counts);
+
+    model = createLMModel(4);
+    if (!model) return 1;
+    t0 = nowSeconds();
+    loadModel(model, prefix);
+    double loadFrozenSeconds = nowSeconds() - t0;
+
+    // Predict latency by context length and fanout
+    PredictResult predict[NumContextLengths * NumFanouts];
+    memset(predict, 0, sizeof(predict));
+    char** contexts = (char**)malloc(sizeof(char*) * MaxSamples);
+    if (!contexts) return 1;
+    for (int c = 0; c < NumContextLengths; c++) {
+        size_t n = loadContexts(corpus, ContextLengths[c], contexts, MaxSamples);
+        for (int f = 0; f < NumFanouts; f++) {
+            PredictResult* r = &predict[c * NumFanouts + f];
+            r->contextWords = ContextLengths[c];
+            benchPredict(model, contexts, n, Fanouts[f], r);
+        }
+        for (size_t i = 0; i < n; i++) free(contexts[i]);
+    }
+
+    // Generation from two-word prompts
+    size_t prompts = loadContexts(corpus, 2, contexts, MaxPrompts);
+    char* reply = (char*)malloc(GenerateOutputSize);
+    long generated = 0;
+    t0 = nowSeconds();
+    for (size_t i = 0; reply && i < prompts; i++) {
+        generateResponse(model, contexts[i], reply, GenerateTokens, 0.7f);
+        generated += countWords(reply);
+    }
+    double generateSeconds = nowSeconds() - t0;
+    for (size_t i = 0; i < prompts; i++) free(contexts[i]);
+    free(contexts);
+    free(reply);
+    double finalRss = peakRssMiB();
+
+    // Summary
+    printf("Benchmark: %s (%llu tokens, %d thread%s)\n", name, (unsigned long long)tokens,
+           numThreads, numThreads == 1 ? "" : "s");
+    printf("  train     %8.2f s  %12.0f tokens/s  peak RSS %.1f MiB\n", trainSeconds,
+           (double)tokens / trainSeconds, trainRss);
+    printf("  save      %8.1f ms\n", saveSeconds * 1e3);
+    printf("  load      %8.1f ms (.cvm)  %8.1f ms (.vocab/.ngrams)\n", loadFrozenSeconds * 1e3,
+           loadCountsSeconds * 1e3);
+    printf("  predict   words   k    calls     p50 us     p99 us      calls/s\n");
+    for (int i = 0; i < NumContextLengths * NumFanouts; i++) {
+        const PredictResult* r = &predict[i];
+        printf("            %5d %3d %8zu %10.2f %10.2f %12.0f\n", r->contextWords, r->k, r->calls,
+               r->p50 * 1e6, r->p99 * 1e6, r->callsPerSecond);
+    }
+    printf("  generate  %8zu replies  %10.0f tokens/s\n", prompts,
+           generateSeconds > 0.0 ? (double)generated / generateSeconds : 0.0);
+    printf("  peak RSS  %8.1f MiB\n", finalRss);
+
+    if (jsonFile) {
+        FILE* json = fopen(jsonFile, "w");
+        if (!json) {
+            perror("Failed to create JSON results");
+        } else {
+            fprintf(json, "{\n  \"corpus\": \"%s\",\n  \"tokens\": %llu,\n  \"threads\": %d,\n", name,
+                    (unsigned long long)tokens, numThreads);
+            fprintf(json, "  \"train\": {\"seconds\": %.4f, \"tokens_per_sec\": %.0f, \"peak_rss_mib\": %.1f},\n",
+                    trainSeconds, (double)tokens / trainSeconds, trainRss);
+            fprintf(json, "  \"save_ms\": %.2f,\n", saveSeconds * 1e3);
+            fprintf(json, "  \"load_ms\": {\"frozen\": %.2f, \"counts\": %.2f},\n", loadFrozenSeconds * 1e3,
+                    loadCountsSeconds * 1e3);
+            fprintf(json, "  \"predict\": [\n");
+            for (int i = 0; i < NumContextLengths * NumFanouts; i++) {
+                const PredictResult* r = &predict[i];
+                fprintf(json, "    {\"context_words\": %d, \"k\": %d, \"calls\": %zu, \"p50_us\": %.3f, "
+                        "\"p99_us\": %.3f, \"calls_per_sec\": %.0f}%s\n", r->contextWords, r->k, r->calls,
+                        r->p50 * 1e6, r->p99 * 1e6, r->callsPerSecond,
+                        (i + 1 < NumContextLengths * NumFanouts) ? "," : "");
+            }
+            fprintf(json, "  ],\n");
+            fprintf(json, "  \"generate\": {\"replies\": %zu, \"tokens\": %ld, \"tokens_per_sec\": %.0f},\n",
+                    prompts, generated, generateSeconds > 0.0 ? (double)generated / generateSeconds : 0.0);
+            fprintf(json, "  \"peak_rss_mib\": %.1f\n}\n", finalRss);
+            if (fclose(json) != 0) perror("Failed to write JSON results");
+        }
+    }
+
+    freeLMModel(model);
+    return 0;
+}
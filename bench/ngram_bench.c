@@ -0,0 +1,142 @@
+// N-gram lookup latency benchmark
+// Compares the sorted child-array trie against the previous linked-list
+// sibling layout at several vocabulary sizes.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/ngram.h"
+
+// Reference: the previous linked-list sibling node layout
+typedef struct ListNode {
+    uint32_t tokenId;
+    uint32_t count;
+    struct ListNode* next;
+    struct ListNode* children;
+} ListNode;
+
+static ListNode* listPushChild(ListNode* parent, uint32_t tokenId) {
+    ListNode* node = (ListNode*)calloc(1, sizeof(ListNode));
+    if (!node) return NULL;
+    node->tokenId = tokenId;
+    node->next = parent->children;
+    parent->children = node;
+    return node;
+}
+
+static ListNode* listAddChild(ListNode* parent, uint32_t tokenId) {
+    for (ListNode* p = parent->children; p; p = p->next) {
+        if (p->tokenId == tokenId) return p;
+    }
+    return listPushChild(parent, tokenId);
+}
+
+static const ListNode* listFindChild(const ListNode* parent, uint32_t tokenId) {
+    const ListNode* p = parent->children;
+    while (p && p->tokenId != tokenId) p = p->next;
+    return p;
+}
+
+static void listFree(ListNode* node) {
+    while (node) {
+        ListNode* nxt = node->next;
+        listFree(node->children);
+        free(node);
+        node = nxt;
+    }
+}
+
+// Small deterministic PRNG (xorshift32)
+static uint32_t benchRandom(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Build both tries with every unigram plus a few random bigrams per token
+// Unigrams are inserted in ID order, as training assigns IDs in first-seen order.
+static void runBenchmark(uint32_t vocabSize) {
+    const int BigramsPerToken = 4;
+    uint32_t seed = 0x9E3779B9u ^ vocabSize;
+
+    NgramIndex* index = createNgramIndex(2);
+    ListNode* listRoot = (ListNode*)calloc(1, sizeof(ListNode));
+    if (!index || !listRoot) return;
+
+    double t0 = nowSeconds();
+    for (uint32_t i = 0; i < vocabSize; i++) {
+        uint32_t pair[2] = { i, 0 };
+        addNgram(index, pair, 1);
+        for (int b = 0; b < BigramsPerToken; b++) {
+            pair[1] = benchRandom(&seed) % vocabSize;
+            addNgram(index, pair, 2);
+        }
+    }
+    double buildSorted = nowSeconds() - t0;
+
+    seed = 0x9E3779B9u ^ vocabSize;
+    t0 = nowSeconds();
+    for (uint32_t i = 0; i < vocabSize; i++) {
+        // Unigrams are unique here, so skip the O(vocab) duplicate scan
+        ListNode* first = listPushChild(listRoot, i);
+        if (!first) break;
+        first->count++;
+        for (int b = 0; b < BigramsPerToken; b++) {
+            ListNode* second = listAddChild(first, benchRandom(&seed) % vocabSize);
+            if (second) second->count++;
+        }
+    }
+    double buildList = nowSeconds() - t0;
+
+    // Keep the total list work bounded: it is O(vocab) per lookup
+    const uint32_t sortedLookups = 2000000;
+    uint32_t listLookups = (uint32_t)(200000000ull / vocabSize);
+    if (listLookups > sortedLookups) listLookups = sortedLookups;
+    if (listLookups < 100) listLookups = 100;
+
+    uint64_t checksum = 0;
+    uint32_t lookupSeed = 12345;
+    t0 = nowSeconds();
+    for (uint32_t i = 0; i < sortedLookups; i++) {
+        uint32_t token = benchRandom(&lookupSeed) % vocabSize;
+        const NgramNode* node = findPrefixNode(index, &token, 1);
+        if (node) checksum += node->count + node->numChildren;
+    }
+    double sortedNs = (nowSeconds() - t0) * 1e9 / sortedLookups;
+
+    lookupSeed = 12345;
+    t0 = nowSeconds();
+    for (uint32_t i = 0; i < listLookups; i++) {
+        uint32_t token = benchRandom(&lookupSeed) % vocabSize;
+        const ListNode* node = listFindChild(listRoot, token);
+        if (node) checksum += node->count;
+    }
+    double listNs = (nowSeconds() - t0) * 1e9 / listLookups;
+
+    printf("vocab=%-8u build sorted=%.3fs list=%.3fs | lookup sorted=%.1fns list=%.1fns speedup=%.0fx (checksum %llu)\n",
+           vocabSize, buildSorted, buildList, sortedNs, listNs,
+           sortedNs > 0.0 ? listNs / sortedNs : 0.0, (unsigned long long)checksum);
+
+    freeNgramIndex(index);
+    listFree(listRoot);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) runBenchmark((uint32_t)strtoul(argv[i], NULL, 10));
+        return 0;
+    }
+    runBenchmark(10000);
+    runBenchmark(100000);
+    runBenchmark(1000000);
+    return 0;
+}
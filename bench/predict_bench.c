@@ -0,0 +1,164 @@
+// Prediction throughput benchmark
+// Compares looped cevia_predict (re-tokenizes, mallocs and strdups per
+// call) with cevia_predict_batch at several batch sizes, then measures the
+// skip-gram backoff stage against the trie alone (hit rate and latency),
+// and the inference loops compiled for the model's order against the
+// order-generic ones.
+// Contexts are every word prefix (up to the last seven words) of each
+// corpus line.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/cevia.h"
+
+#define TopK 5
+#define ContextWords 7
+#define MaxContexts 200000
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int compareDouble(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Collect word-prefix contexts from the corpus
+static size_t loadContexts(const char* filename, char** contexts, size_t maxContexts) {
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        perror("Failed to open corpus");
+        return 0;
+    }
+
+    size_t n = 0;
+    char line[4096];
+    while (n < maxContexts && fgets(line, sizeof(line), file)) {
+        char* words[128];
+        int numWords = 0;
+        for (char* w = strtok(line, " \t\r\n"); w && numWords < 128; w = strtok(NULL, " \t\r\n")) {
+            words[numWords++] = w;
+        }
+        for (int end = 1; end <= numWords && n < maxContexts; end++) {
+            int start = (end > ContextWords) ? end - ContextWords : 0;
+            char buf[1024] = "";
+            for (int i = start; i < end; i++) {
+                if (i > start) strncat(buf, " ", sizeof(buf) - strlen(buf) - 1);
+                strncat(buf, words[i], sizeof(buf) - strlen(buf) - 1);
+            }
+            contexts[n] = strdup(buf);
+            if (contexts[n]) n++;
+        }
+    }
+    fclose(file);
+    return n;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s <model_prefix> <corpus.txt> [repeat]\n", argv[0]);
+        return 1;
+    }
+    int repeat = (argc > 3) ? atoi(argv[3]) : 5;
+    if (repeat < 1) repeat = 1;
+
+    CeviaModel* model = cevia_create(4);
+    if (!model) return 1;
+    cevia_load(model, argv[1]);
+
+    char** contexts = (char**)malloc(sizeof(char*) * MaxContexts);
+    uint32_t* ids = (uint32_t*)malloc(sizeof(uint32_t) * MaxContexts * TopK);
+    float* scores = (float*)malloc(sizeof(float) * MaxContexts * TopK);
+    if (!contexts || !ids || !scores) return 1;
+
+    size_t n = loadContexts(argv[2], contexts, MaxContexts);
+    if (n == 0) return 1;
+    printf("contexts=%zu k=%d repeat=%d\n", n, TopK, repeat);
+
+    // Baseline: one cevia_predict per context
+    uint64_t checksum = 0;
+    double t0 = nowSeconds();
+    for (int r = 0; r < repeat; r++) {
+        for (size_t i = 0; i < n; i++) {
+            char* tokens[TopK] = { NULL };
+            float s[TopK];
+            cevia_predict(model, contexts[i], tokens, s, TopK);
+            if (tokens[0]) checksum += (unsigned char)tokens[0][0];
+            for (int j = 0; j < TopK; j++) free(tokens[j]);
+        }
+    }
+    double loopSec = nowSeconds() - t0;
+    printf("%-22s %10.0f ctx/s (checksum %llu)\n", "cevia_predict loop",
+           (double)n * repeat / loopSec, (unsigned long long)checksum);
+
+    // Batched, at increasing batch sizes
+    const size_t batchSizes[] = { 1, 16, 256, 4096, MaxContexts };
+    for (size_t b = 0; b < sizeof(batchSizes) / sizeof(batchSizes[0]); b++) {
+        size_t batch = batchSizes[b];
+        checksum = 0;
+        t0 = nowSeconds();
+        for (int r = 0; r < repeat; r++) {
+            for (size_t i = 0; i < n; i += batch) {
+                size_t count = (n - i < batch) ? n - i : batch;
+                cevia_predict_batch(model, (const char* const*)contexts + i, count, TopK,
+                                    ids + i * TopK, scores + i * TopK);
+            }
+            for (size_t i = 0; i < n * TopK; i += TopK) {
+                checksum += (unsigned char)cevia_token_text(model, ids[i])[0];
+            }
+        }
+        double sec = nowSeconds() - t0;
+        char label[32];
+        snprintf(label, sizeof(label), "batch=%zu", batch < n ? batch : n);
+        printf("%-22s %10.0f ctx/s (checksum %llu)\n", label,
+               (double)n * repeat / sec, (unsigned long long)checksum);
+    }
+
+    // Skip-gram backoff on and off: top-k hit rate and per-context latency
+    double* latency = (double*)malloc(sizeof(double) * n);
+    if (!latency) return 1;
+    for (int enabled = 1; enabled >= 0; enabled--) {
+        cevia_set_skipgrams(model, enabled);
+        float hitRate = cevia_evaluate(model, argv[2], TopK);
+        for (size_t i = 0; i < n; i++) {
+            double start = nowSeconds();
+            cevia_predict_batch(model, (const char* const*)contexts + i, 1, TopK, ids, scores);
+            latency[i] = nowSeconds() - start;
+        }
+        qsort(latency, n, sizeof(double), compareDouble);
+        printf("skipgrams=%-3s hit rate %6.2f%%  p50 %7.2f us  p99 %7.2f us\n", enabled ? "on" : "off",
+               100.0 * hitRate, latency[n / 2] * 1e6, latency[n * 99 / 100] * 1e6);
+    }
+    free(latency);
+
+    // Order-specialized kernels against the generic loops: best of `repeat`
+    // passes over all contexts, alternating so both see the same cache state
+    double best[2] = { 0.0, 0.0 };
+    uint64_t sums[2] = { 0, 0 };
+    for (int r = 0; r < repeat; r++) {
+        for (int specialized = 1; specialized >= 0; specialized--) {
+            cevia_set_specialized(model, specialized);
+            t0 = nowSeconds();
+            cevia_predict_batch(model, (const char* const*)contexts, n, TopK, ids, scores);
+            double rate = (double)n / (nowSeconds() - t0);
+            if (rate > best[specialized]) best[specialized] = rate;
+            sums[specialized] = 0;
+            for (size_t i = 0; i < n * TopK; i++) sums[specialized] += ids[i];
+        }
+    }
+    cevia_set_specialized(model, 1);
+    printf("kernels specialized %10.0f ctx/s  generic %10.0f ctx/s  (%+.1f%%, %s)\n", best[1], best[0],
+           100.0 * (best[1] / best[0] - 1.0), (sums[0] == sums[1]) ? "same predictions" : "PREDICTIONS DIFFER");
+
+    for (size_t i = 0; i < n; i++) free(contexts[i]);
+    free(contexts);
+    free(ids);
+    free(scores);
+    cevia_free(model);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef ArenaHeader
+#define ArenaHeader
+
+#include "common.h"
+
+// Bytes per regular chunk
+#define ArenaChunkSize (1u << 20)
+
+// Requests above this get a dedicated chunk that is released on free
+#define ArenaLargeBlock (ArenaChunkSize / 4)
+
+// Alignment of arenaAlloc/arenaAllocBlock results
+#define ArenaAlignment 8
+
+// Distinct block sizes that are recycled through free lists
+#define ArenaSizeClasses 32
+
+// Chunk of arena memory; data follows the header
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    struct ArenaChunk* prev;  // only used on the large-block list
+    size_t used;
+    size_t capacity;
+    unsigned char data[];
+} ArenaChunk;
+
+// Recycled block, threaded through its own first bytes
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+} ArenaBlock;
+
+// Free list for one exact block size
+typedef struct {
+    size_t size;
+    ArenaBlock* head;
+} ArenaFreeList;
+
+// Bump allocator with exact-size free lists for blocks that get replaced
+// (e.g. trie child arrays that grow by doubling). Apart from large blocks,
+// nothing goes back to the system until freeArena, which costs O(chunks).
+typedef struct Arena {
+    ArenaChunk* chunks;  // regular chunks, newest first
+    ArenaChunk* large;   // dedicated chunks for large blocks
+    ArenaFreeList freeLists[ArenaSizeClasses];
+    size_t bytesReserved;  // bytes obtained from the system
+    size_t bytesInUse;     // bytes handed out and not recycled
+} Arena;
+
+// Function declarations
+Arena* createArena(void);
+void freeArena(Arena* arena);
+void* arenaAlloc(Arena* arena, size_t size);
+void* arenaAllocBlock(Arena* arena, size_t size);
+void arenaFreeBlock(Arena* arena, void* block, size_t size);
+const char* arenaStrdup(Arena* arena, const char* str, size_t length);
+
+// Move every chunk and free block of src into dst; src is left empty
+void arenaAdopt(Arena* dst, Arena* src);
+
+#endif // ArenaHeader
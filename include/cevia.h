@@ -2,6 +2,7 @@
 #define CEVIA_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -10,6 +11,26 @@ extern "C" {
 // Opaque handle to model (forward declaration)
 typedef struct LMModel CeviaModel;
 
+// Opaque incremental context for streaming prediction
+typedef struct CeviaCursor CeviaCursor;
+
+// Opaque reloadable model and a pinned version of it
+typedef struct ModelHandle CeviaHandle;
+typedef struct ModelVersion CeviaSnapshot;
+
+// Thread safety
+// Any number of threads may call the functions taking a `const CeviaModel*`
+// (cevia_predict, cevia_predict_batch, cevia_generate, cevia_token_text,
+// cevia_evaluate, cevia_save, ...) on one shared model at once. They never
+// change the counts and keep their scratch state on the stack. The one
+// exception is the prediction cache (cevia_cache_enable). When it is on,
+// predictions and cursors insert into it behind the const pointer. That
+// is still safe, because each cache shard takes its own mutex. Functions
+// taking a non-const model (training, loading, cevia_cache_enable,
+// cevia_set_*, cevia_free) must not run concurrently with any other call
+// on the same model, so enable the cache before sharing the model. A
+// cursor belongs to one thread at a time.
+
 // ============================================================================
 // Model Lifecycle
 // ============================================================================
@@ -39,19 +60,88 @@ void cevia_free(CeviaModel* model);
 void cevia_train_from_file(CeviaModel* model, const char* corpus_file);
 
 /**
- * Save model to disk (creates .vocab, .uni, .bi, .tri files)
+ * Train model from a corpus file using worker threads
+ * Produces exactly the same model as cevia_train_from_file
+ * @param model Model to train
+ * @param corpus_file Path to corpus file (one sentence per line)
+ * @param num_threads Number of worker threads (<= 1 trains single-threaded)
+ */
+void cevia_train_parallel(CeviaModel* model, const char* corpus_file, int num_threads);
+
+/**
+ * Save model to disk (creates .vocab and .ngrams, all orders, plus .skip)
  * @param model Model to save
  * @param prefix Path prefix (e.g., "data/bin/model")
  */
 void cevia_save(const CeviaModel* model, const char* prefix);
 
+/**
+ * Save model as a single read-only frozen image (mmap-able, query in place)
+ * @param model Model to save
+ * @param path Output file (conventionally "<prefix>.cvm")
+ * @return 1 on success, 0 on failure
+ */
+int cevia_save_frozen(const CeviaModel* model, const char* path);
+
 /**
  * Load model from disk
+ * Maps "<prefix>.cvm" read-only when present (near-instant, pages shared
+ * across processes); otherwise rebuilds from the .vocab/.ngrams files, or
+ * the legacy .uni/.bi/.tri files (trigrams at most).
  * @param model Model to load into
  * @param prefix Path prefix (e.g., "data/bin/model")
  */
 void cevia_load(CeviaModel* model, const char* prefix);
 
+// ============================================================================
+// Hot Reload
+// ============================================================================
+
+/**
+ * Wrap a loaded model so it can be replaced while other threads use it
+ * @param model Loaded model; the handle takes ownership of it
+ * @return Handle, or NULL on failure (the model is then still the caller's)
+ */
+CeviaHandle* cevia_handle_create(CeviaModel* model);
+
+/**
+ * Free a handle and its current model
+ * @param handle Handle with no snapshot still acquired
+ */
+void cevia_handle_free(CeviaHandle* handle);
+
+/**
+ * Pin the current model for one request (lock-free)
+ * The pinned model stays valid, even across reloads, until released.
+ * @param handle Handle
+ * @return Snapshot to pass to cevia_snapshot_model and cevia_release
+ */
+CeviaSnapshot* cevia_acquire(CeviaHandle* handle);
+
+/**
+ * Model of a snapshot, for any function taking a const CeviaModel*
+ * @param snapshot Acquired snapshot
+ * @return Model, valid until the snapshot is released
+ */
+const CeviaModel* cevia_snapshot_model(const CeviaSnapshot* snapshot);
+
+/**
+ * Release a snapshot; a replaced model is freed by its last release
+ * @param snapshot Snapshot from cevia_acquire
+ */
+void cevia_release(CeviaSnapshot* snapshot);
+
+/**
+ * Load a model from disk and make it current
+ * Loading happens on the calling thread (run it off the request path)
+ * while readers keep using the current model; the swap itself is one
+ * pointer store. Settings (order, skip-gram backoff) carry over.
+ * @param handle Handle
+ * @param prefix Path prefix of the new model
+ * @return 1 on success, 0 if it could not be loaded (the current model stays)
+ */
+int cevia_reload(CeviaHandle* handle, const char* prefix);
+
 // ============================================================================
 // Inference
 // ============================================================================
@@ -70,6 +160,138 @@ void cevia_predict(const CeviaModel* model,
                    float* scores,
                    int k);
 
+/**
+ * Enable or disable the skip-gram backoff stage (disabled by default)
+ * When the full context was never seen in training, gapped contexts learned
+ * from the training patterns ("a b _") add continuation candidates. Models
+ * saved without a .skip file never use it.
+ * @param model Model (not thread-safe: call before sharing the model)
+ * @param enabled Nonzero to enable
+ */
+void cevia_set_skipgrams(CeviaModel* model, int enabled);
+
+/**
+ * Choose between inference loops compiled for the model's n-gram order
+ * (the default, picked at cevia_create) and the order-generic ones.
+ * Both give identical predictions; the switch exists for benchmarking.
+ * Cursors created earlier keep the loops they started with.
+ * @param model Model (not thread-safe: call before sharing the model)
+ * @param enabled Nonzero for the specialized loops
+ */
+void cevia_set_specialized(CeviaModel* model, int enabled);
+
+/**
+ * Cache counters (see cevia_cache_stats)
+ */
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint32_t entries;   // cached predictions
+    uint32_t capacity;  // maximum cached predictions
+    size_t bytes;       // memory held by the cache
+} CeviaCacheStats;
+
+/**
+ * Cache final predictions in front of the scorer
+ * Results are keyed on the last maxN - 1 context token IDs, k and the
+ * skip-gram setting; calls with k > 16 always score. The cache is
+ * bounded, safe for concurrent predictions, evicts least recently used
+ * entries, and is cleared whenever the model is retrained or reloaded
+ * (cevia_reload gives the new model an empty cache of the same size).
+ * @param model Model (not thread-safe: call before sharing the model)
+ * @param max_entries Maximum cached predictions (0: no entry limit)
+ * @param max_bytes Maximum cache memory (0: no byte limit); both 0 disables the cache
+ * @return 1 on success, 0 on allocation failure
+ */
+int cevia_cache_enable(CeviaModel* model, size_t max_entries, size_t max_bytes);
+
+/**
+ * Read the cache counters (all zero when the cache is disabled)
+ * @param model Model
+ * @param stats Output counters
+ */
+void cevia_cache_stats(const CeviaModel* model, CeviaCacheStats* stats);
+
+/**
+ * Predict next tokens for many contexts at once
+ * Contexts are spread across a shared thread pool and scoring buffers are
+ * reused within the batch. Results are token IDs (see cevia_token_text);
+ * row i of the outputs holds the predictions for contexts[i]. Rows for
+ * empty or NULL contexts are zero-filled.
+ * @param model Trained model
+ * @param contexts Array of n context strings
+ * @param n Number of contexts
+ * @param k Number of top predictions per context
+ * @param out_ids Output token IDs, n * k entries (caller allocates)
+ * @param out_scores Output scores, n * k entries (caller allocates)
+ * @return 0 on success, -1 on invalid arguments
+ */
+int cevia_predict_batch(const CeviaModel* model,
+                        const char* const* contexts,
+                        size_t n,
+                        int k,
+                        uint32_t* out_ids,
+                        float* out_scores);
+
+/**
+ * Get the text of a token ID
+ * @param model Model
+ * @param token_id Token ID (e.g., from cevia_predict_batch)
+ * @return Borrowed string owned by the model, valid until it is freed or reloaded
+ */
+const char* cevia_token_text(const CeviaModel* model, uint32_t token_id);
+
+/**
+ * Create a cursor with an empty context
+ * A cursor keeps the model's trie position for the current context, so
+ * appending a token costs one lookup per n-gram order instead of
+ * re-querying the whole context. It stays valid until the model is
+ * retrained, reloaded or freed; call cevia_cursor_reset after a reload.
+ * @param model Trained model (must outlive the cursor)
+ * @return Cursor, or NULL on failure
+ */
+CeviaCursor* cevia_cursor_create(const CeviaModel* model);
+
+/**
+ * Free a cursor
+ * @param cursor Cursor to free
+ */
+void cevia_cursor_free(CeviaCursor* cursor);
+
+/**
+ * Clear the cursor's context (also re-syncs it with a reloaded model)
+ * @param cursor Cursor
+ */
+void cevia_cursor_reset(CeviaCursor* cursor);
+
+/**
+ * Append text to the context, tokenized like training data
+ * Only complete words should be pushed; unknown words are kept as gaps.
+ * @param cursor Cursor
+ * @param text Text holding zero or more tokens
+ * @return Number of tokens appended
+ */
+int cevia_cursor_push(CeviaCursor* cursor, const char* text);
+
+/**
+ * Append one token by ID (e.g., a prediction that was accepted)
+ * @param cursor Cursor
+ * @param token_id Token ID (0 for an unknown token)
+ */
+void cevia_cursor_push_id(CeviaCursor* cursor, uint32_t token_id);
+
+/**
+ * Predict next tokens for the cursor's context
+ * Outputs are zero-filled when the context is empty.
+ * @param cursor Cursor
+ * @param k Number of top predictions
+ * @param out_ids Output token IDs, k entries (caller allocates)
+ * @param out_scores Output scores, k entries (caller allocates)
+ * @return 0 on success, -1 on invalid arguments
+ */
+int cevia_cursor_predict(CeviaCursor* cursor, int k, uint32_t* out_ids, float* out_scores);
+
 /**
  * Generate text response using auto-regressive generation
  * @param model Trained model
@@ -84,12 +306,36 @@ void cevia_generate(const CeviaModel* model,
                    int max_tokens,
                    float temperature);
 
+/**
+ * Generate several candidate replies with beam search, best first
+ * Hypotheses share their prefix lookups and use the same stopping rules as
+ * cevia_generate; finished replies are reranked by length, repetition and
+ * mean token score. One call is much cheaper than n cevia_generate calls.
+ * @param model Trained model
+ * @param input Input prompt
+ * @param outputs Array of n output buffers (caller allocates, min 2048 bytes each)
+ * @param scores Output reranking score per reply (higher is better), may be NULL
+ * @param n Number of replies wanted (at most 16)
+ * @param max_tokens Maximum tokens per reply
+ * @param beam_width Open hypotheses kept per step (<= 0 uses n, at most 16)
+ * @return Number of replies written; unused outputs are set to ""
+ */
+int cevia_generate_nbest(const CeviaModel* model,
+                         const char* input,
+                         char** outputs,
+                         float* scores,
+                         int n,
+                         int max_tokens,
+                         int beam_width);
+
 // ============================================================================
 // Evaluation
 // ============================================================================
 
 /**
  * Evaluate model on a test corpus
+ * Every token after the first of a line is predicted from the full
+ * context before it; the corpus is split across all CPUs.
  * @param model Trained model
  * @param corpus_file Path to test corpus
  * @param top_k Top-k accuracy to compute
@@ -99,6 +345,70 @@ float cevia_evaluate(const CeviaModel* model,
                     const char* corpus_file,
                     int top_k);
 
+// ============================================================================
+// Statistics
+// ============================================================================
+
+/**
+ * Latency of one kind of operation (quantiles are power-of-two bucket bounds)
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+} CeviaLatency;
+
+/**
+ * Process-wide hot-path counters plus one model's memory (see cevia_stats)
+ */
+typedef struct {
+    int enabled;                 // 0 when the library was built with STATS=0
+    uint64_t predictions;        // cache hits included
+    uint64_t predict_fallbacks;  // scored predictions padded from the unigram ranking
+    uint64_t predict_skipgrams;  // scored predictions that backed off to skip-grams
+    uint64_t cursor_advances;    // tokens appended to prediction cursors
+    uint64_t child_searches;     // trie child searches made by those appends
+    uint64_t trie_lookups;       // lookups in a mutable (training) trie
+    uint64_t trie_nodes;         // nodes visited by them
+    uint64_t hash_lookups;       // vocabulary hash map lookups
+    uint64_t hash_probes;        // slots probed by them
+    uint64_t generate_steps;     // tokens produced by generation
+    uint64_t backoff_depth[5];   // scored predictions by longest context matched (0: none)
+    CeviaLatency predict;
+    CeviaLatency generate_step;
+    CeviaLatency serve_request;
+    size_t vocab_bytes;          // memory by subsystem
+    size_t ngram_bytes;
+    size_t pattern_bytes;
+    size_t skipgram_bytes;
+    size_t frozen_bytes;         // frozen image (file-backed when frozen_mapped) and derived tables
+    size_t cache_bytes;
+    int frozen_mapped;
+} CeviaStats;
+
+/**
+ * Read the counters, summed over all threads (cheap; safe while others predict)
+ * Each thread counts into its own block without locked instructions.
+ * @param model Model whose memory to report, or NULL for counters only
+ * @param stats Output
+ */
+void cevia_stats(const CeviaModel* model, CeviaStats* stats);
+
+/**
+ * Zero the process-wide counters and histograms
+ */
+void cevia_stats_reset(void);
+
+/**
+ * Format the counters and the model's memory in the Prometheus text format
+ * @param model Model whose memory to report, or NULL
+ * @param out Output buffer (may be NULL when size is 0)
+ * @param size Buffer size; output is truncated and NUL-terminated to fit
+ * @return Length of the full text, excluding the NUL (as snprintf)
+ */
+size_t cevia_stats_prometheus(const CeviaModel* model, char* out, size_t size);
+
 // ============================================================================
 // Utilities
 // ============================================================================
@@ -13,7 +13,7 @@
 #define MaxTokens 128
 #define MaxWordLen 32
 #define MaxN 5  // Maximum n-gram size
-#define HashTableSize 1024
+#define HashMapInitialCapacity 64  // Slots in a new hash map (power of two)
 // Application metadata
 #define AppVersion "0.1.0"
 #define DefaultModelPrefix "data/bin/ceviamodel"
@@ -29,29 +29,37 @@ typedef struct {
     int length;
 } Sentence;
 
-// Key-Value pair for hash map
-typedef struct KeyValuePair {
-    char* key;
+// Hash map slot; hash == 0 marks an empty slot
+typedef struct {
+    uint64_t hash;    // cached full hash of key
+    const char* key;  // interned key (owned by the map)
+    uint32_t length;  // strlen(key)
     uint32_t value;
-    struct KeyValuePair* next; // linked list for collision resolution
-} KeyValuePair;
+} HashMapSlot;
+
+struct Arena;
 
-// HashMap structure
+// HashMap structure: open addressing with Robin Hood probing
+// Keys are copied once into the map's arena, so interned pointers
+// stay valid until the map is freed, even across resizes.
 typedef struct {
-    KeyValuePair* table[HashTableSize];
-    int size;
+    HashMapSlot* slots;
+    uint32_t capacity;  // power of two
+    uint32_t size;
+    struct Arena* keys;  // interned keys
 } HashMap;
 
 // Function declarations
-uint32_t hashFunction(const char* str);
+uint64_t hashString(const char* str, size_t length);
 HashMap* createHashMap();
-void hashMapPut(HashMap* map, const char* key, uint32_t value);
-uint32_t hashMapGet(HashMap* map, const char* key);
+bool hashMapReserve(HashMap* map, uint32_t count);
+const char* hashMapPut(HashMap* map, const char* key, uint32_t value);
+bool hashMapFind(const HashMap* map, const char* key, uint32_t* value);
+uint32_t hashMapGet(const HashMap* map, const char* key);
 void freeHashMap(HashMap* map);
 
 // Sentence functions
 Sentence initSentence(void);
-Sentence addToken(Sentence s, const char word[]);
 void tokenizeLine(const char line[], Sentence* s);
 
 #endif // CommonHeader
@@ -0,0 +1,108 @@
+#ifndef CompactModelHeader
+#define CompactModelHeader
+
+#include "common.h"
+#include "frozen.h"
+
+// Compact n-gram image: the frozen trie levels with every column
+// bit-packed at the narrowest width that holds it, queried in place.
+// Token IDs take as many bits as the vocabulary needs, child offsets as
+// many as the next level needs, and ranks are stored relative to their
+// sibling group. Counts and child totals use a per-level width chosen
+// to minimize size; the few values that do not fit are escaped into a
+// full-width overflow array found by a popcount rank. The vocabulary
+// strings stay in <prefix>.vocab.
+#define CompactMagic "CEVIACMP"
+#define CompactVersion 1
+#define CompactExtension ".cvc"
+
+// Fixed-width unsigned values packed back to back in 64-bit words
+typedef struct {
+    const uint64_t* words;
+    uint32_t bits;
+} PackedArray;
+
+// Packed values with escapes for the ones too wide for the column
+typedef struct {
+    PackedArray values;          // the value, or all ones if escaped
+    const uint64_t* escaped;     // one bit per entry; NULL if nothing is escaped
+    const uint32_t* escapeRank;  // escaped entries before each 64-entry word
+    const uint32_t* overflow;    // full values of the escaped entries, in order
+    uint32_t numOverflow;
+} PackedCounts;
+
+// One order of the compact trie (same entry order as FrozenLevel)
+typedef struct {
+    PackedArray tokenIds;
+    PackedCounts counts;
+    PackedArray firstChild;    // words NULL for the highest order
+    PackedCounts childTotals;  // values.words NULL for the highest order
+    PackedArray rankOffsets;   // ranked entry minus the first entry of its group
+    uint32_t size;
+} CompactLevel;
+
+// Read-only view over a compact image
+typedef struct {
+    CompactLevel levels[MaxN];
+    int maxN;
+    uint64_t totalTokens;
+    uint64_t totalNgrams;
+    uint32_t vocabSize;
+    const unsigned char* image;
+    size_t imageSize;
+    bool mapped;
+} CompactIndex;
+
+// Function declarations
+CompactIndex* compactFrozenIndex(const FrozenIndex* frozen);
+CompactIndex* mapCompactFile(const char* filename);
+bool writeCompactFile(const CompactIndex* index, const char* filename);
+void freeCompactIndex(CompactIndex* index);
+
+// Image bytes spent on one level (all of its columns)
+size_t compactLevelBytes(const CompactIndex* index, int level);
+
+// True if every column of every level reads back as in the frozen index
+bool verifyCompactIndex(const CompactIndex* index, const FrozenIndex* frozen);
+
+static inline uint32_t packedGet(const PackedArray* array, uint64_t i) {
+    uint64_t bit = i * array->bits;
+    const uint64_t* w = &array->words[bit >> 6];
+    unsigned shift = (unsigned)(bit & 63);
+    // Words are padded by one, so the second read is always in bounds
+    uint64_t value = (w[0] >> shift) | ((shift + array->bits > 64) ? (w[1] << (64 - shift)) : 0);
+    return (uint32_t)(value & ((1ull << array->bits) - 1));
+}
+
+static inline uint32_t packedCountGet(const PackedCounts* counts, uint64_t i) {
+    uint32_t value = packedGet(&counts->values, i);
+    if (!counts->escaped || value != (uint32_t)((1ull << counts->values.bits) - 1)) return value;
+    uint64_t below = counts->escaped[i >> 6] & ((1ull << (i & 63)) - 1);
+    return counts->overflow[counts->escapeRank[i >> 6] + (uint32_t)__builtin_popcountll(below)];
+}
+
+static inline uint32_t compactToken(const CompactIndex* index, int level, uint32_t entry) {
+    return packedGet(&index->levels[level].tokenIds, entry);
+}
+
+static inline uint32_t compactCount(const CompactIndex* index, int level, uint32_t entry) {
+    return packedCountGet(&index->levels[level].counts, entry);
+}
+
+// Sum of the children's counts (0 for the highest order)
+static inline uint32_t compactChildTotal(const CompactIndex* index, int level, uint32_t entry) {
+    const CompactLevel* lv = &index->levels[level];
+    return lv->childTotals.values.words ? packedCountGet(&lv->childTotals, entry) : 0;
+}
+
+// Entry at rank position `position` of the group starting at `begin`
+static inline uint32_t compactRanked(const CompactIndex* index, int level, uint32_t begin, uint32_t position) {
+    return begin + packedGet(&index->levels[level].rankOffsets, position);
+}
+
+// Same contracts as the frozen lookups
+uint32_t compactFindChild(const CompactIndex* index, int level, uint32_t begin, uint32_t end, uint32_t tokenId);
+uint32_t compactFindPrefix(const CompactIndex* index, const uint32_t* tokens, int n);
+bool compactChildRange(const CompactIndex* index, int level, uint32_t entry, uint32_t* begin, uint32_t* end);
+
+#endif // CompactModelHeader
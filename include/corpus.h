@@ -0,0 +1,53 @@
+#ifndef CorpusHeader
+#define CorpusHeader
+
+#include "common.h"
+
+// Minimum bytes requested per read when streaming a pipe
+#define CorpusReadSize (1u << 20)
+
+// Path that selects standard input
+#define CorpusStdin "-"
+
+// Lowercased, NUL-terminated token; text points into TokenList.chars
+typedef struct {
+    const char* text;
+    uint32_t length;
+} TokenSpan;
+
+// Reusable tokenizer output; grows to the longest line seen and is never shrunk
+typedef struct {
+    TokenSpan* spans;
+    uint32_t* ids;      // scratch for the caller's token IDs, one per span
+    uint32_t count;
+    uint32_t capacity;  // entries in spans and ids
+    char* chars;        // backing store for the span texts
+    size_t charCapacity;
+} TokenList;
+
+// Line source over a regular file (mapped whole) or a stream read in chunks
+typedef struct {
+    int fd;
+    bool ownsFd;      // false for standard input
+    bool mapped;      // data is the file mapping
+    bool eof;         // no more input will be read
+    const char* data; // mapping or buffer
+    size_t size;      // valid bytes in data
+    size_t pos;       // first unconsumed byte
+    char* buffer;     // stream buffer, NULL when mapped
+    size_t capacity;
+} CorpusReader;
+
+// Corpus reading; blocks and lines are valid until the next call
+CorpusReader* openCorpus(const char* path);
+void closeCorpus(CorpusReader* reader);
+bool nextCorpusBlock(CorpusReader* reader, size_t minBytes, const char** block, size_t* length);
+bool nextCorpusLine(CorpusReader* reader, const char** line, size_t* length);
+
+// Tokenization
+size_t scanToken(const char* text, size_t length, size_t* pos, char* out);
+void initTokenList(TokenList* list);
+void freeTokenList(TokenList* list);
+uint32_t tokenizeText(TokenList* list, const char* text, size_t length);
+
+#endif // CorpusHeader
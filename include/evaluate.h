@@ -0,0 +1,35 @@
+#ifndef EvaluateHeader
+#define EvaluateHeader
+
+#include "lmModel.h"
+
+// Largest top-k the evaluator checks
+#define EvalMaxTopK 64
+
+// Corpus bytes per slice; each batch holds a few slices per thread
+#define EvalSliceBytes (1u << 20)
+
+// Results of evaluating next-token prediction over a corpus
+// Every token after the first of a line is predicted from the full
+// (maxN - 1)-token context before it. orderPredictions[L] counts the
+// predictions whose longest context found in the model had L tokens
+// (0: unigram fallback only).
+typedef struct {
+    int topK;
+    uint64_t lines;
+    uint64_t predictions;
+    uint64_t hits;         // gold token within the top k
+    uint64_t oov;          // gold token not in the vocabulary
+    double logProbSum;     // sum of ln P(gold), Witten-Bell interpolated
+    uint64_t orderPredictions[MaxN];
+    uint64_t orderHits[MaxN];
+} EvalStats;
+
+// Evaluate a corpus file ("-" for stdin) with numThreads threads (<= 0: all CPUs)
+bool evaluateFile(const LMModel* model, const char* filename, int topK, int numThreads, EvalStats* stats);
+
+// Derived figures (0 when nothing was evaluated)
+double evalHitRate(const EvalStats* stats);
+double evalPerplexity(const EvalStats* stats);
+
+#endif // EvaluateHeader
@@ -0,0 +1,170 @@
+#ifndef FrozenModelHeader
+#define FrozenModelHeader
+
+#include "common.h"
+#include "vocab.h"
+#include "ngram.h"
+
+// Frozen model image: one read-only, position-independent blob holding the
+// vocabulary string table and the n-gram trie flattened into one sorted
+// array per order. The same bytes are written to disk, mmap'd back, or
+// embedded into the release binary, and queried in place.
+// Version 2 adds per-entry child totals and count-ranked child orders;
+// version 3 adds each token's unigram log-probability, the prior the
+// scorer adds to every candidate. Older images are still accepted and get
+// the missing tables built on load.
+#define FrozenMagic "CEVIAFRZ"
+#define FrozenVersion 3
+#define FrozenExtension ".cvm"
+#define FrozenNotFound 0xFFFFFFFF
+
+// Where the image bytes live
+typedef enum {
+    FrozenBackingHeap,    // built in memory, owned by the index
+    FrozenBackingMmap,    // mapped from a file, shared read-only pages
+    FrozenBackingStatic   // borrowed (e.g. embedded in the executable)
+} FrozenBacking;
+
+// On-disk header; all offsets are byte offsets from the start of the image
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t maxN;
+    uint64_t totalTokens;
+    uint64_t totalNgrams;
+    uint64_t imageSize;
+    uint32_t vocabSize;
+    uint32_t reserved;
+    uint64_t vocabOffsetsOff;   // uint32_t[vocabSize + 1] into the string table
+    uint64_t vocabSortedOff;    // uint32_t[vocabSize] token IDs sorted by string
+    uint64_t vocabStringsOff;   // NUL-terminated token strings
+    uint64_t vocabStringsSize;
+    uint32_t levelSize[MaxN];   // number of n-grams of order level + 1
+    uint32_t padding;
+    uint64_t levelTokenOff[MaxN];  // uint32_t[levelSize] token IDs
+    uint64_t levelCountOff[MaxN];  // uint32_t[levelSize] counts
+    uint64_t levelChildOff[MaxN];  // uint32_t[levelSize + 1] first child in the next level
+    // Version 2
+    uint64_t levelTotalOff[MaxN];  // uint32_t[levelSize] sum of child counts
+    uint64_t levelRankOff[MaxN];   // uint32_t[levelSize] entries ranked by count per parent
+    // Version 3
+    uint64_t unigramLogProbOff;    // float[vocabSize] log P(token), by token ID
+} FrozenFileHeader;
+
+// One order of the flattened trie
+// Entries are grouped by parent (in parent order) and sorted by tokenId
+// within each group, so the children of entry i are the index range
+// [firstChild[i], firstChild[i + 1]) of the next level.
+// ranked[] permutes each such group by count (descending, ties by tokenId),
+// so ranked[firstChild[i]] is the most frequent continuation of entry i.
+// For the unigram level the whole level is one group.
+typedef struct {
+    const uint32_t* tokenIds;
+    const uint32_t* counts;
+    const uint32_t* firstChild;   // NULL for the highest order
+    const uint32_t* childTotals;  // sum of children's counts; NULL for the highest order
+    const uint32_t* ranked;       // entry indices of this level in rank order
+    uint32_t size;
+} FrozenLevel;
+
+// Read-only view over a frozen image
+typedef struct {
+    FrozenLevel levels[MaxN];  // levels[l] holds n-grams of order l + 1
+    int maxN;
+    uint64_t totalTokens;
+    uint64_t totalNgrams;
+    uint32_t vocabSize;
+    const uint32_t* vocabOffsets;
+    const uint32_t* vocabSorted;
+    const char* vocabStrings;
+    const float* unigramLogProb;  // vocabSize entries; see frozenUnigramLogProb
+    const unsigned char* image;
+    size_t imageSize;
+    FrozenBacking backing;
+    uint32_t* derived;  // heap copy of the version 2 tables for version 1 images
+    float* derivedLogProb;  // heap copy of the version 3 table for older images
+} FrozenIndex;
+
+// Function declarations
+FrozenIndex* freezeNgrams(const NgramIndex* ngrams, const Vocabulary* vocab, uint64_t totalTokens);
+
+// Add the counts of delta (token IDs extending base's) to base into a new
+// heap image; the cost beyond copying base follows the size of delta
+FrozenIndex* mergeFrozenIndexes(const FrozenIndex* base, const FrozenIndex* delta, const Vocabulary* vocab,
+                                uint64_t totalTokens);
+
+// N-grams of every order in lexicographic token-ID order, one cursor per
+// pass, for writing an image without a trie; cursors are independent
+typedef struct {
+    void* state;
+    void* (*open)(void* state, int order);  // NULL on failure
+    bool (*next)(void* cursor, uint32_t* tokens, uint32_t* count);  // false at the end
+    void (*close)(void* cursor);
+} FrozenRunSource;
+
+// Stream the runs into filename; memory stays bounded by the vocabulary
+bool writeFrozenFromRuns(const FrozenRunSource* source, const Vocabulary* vocab, int maxN, uint64_t totalTokens,
+                         uint64_t totalNgrams, const char* filename);
+FrozenIndex* mapFrozenFile(const char* filename);
+FrozenIndex* attachFrozenImage(const void* data, size_t size);
+bool writeFrozenFile(const FrozenIndex* index, const char* filename);
+void freeFrozenIndex(FrozenIndex* index);
+size_t frozenIndexMemory(const FrozenIndex* index);
+
+// Point a vocabulary at the image's string table (no copies)
+void attachFrozenVocabulary(const FrozenIndex* index, Vocabulary* vocab);
+
+// Rebuild mutable trie counts from the image (used before retraining)
+void thawFrozenNgrams(const FrozenIndex* index, NgramIndex* ngrams);
+
+// Sibling runs this short are scanned rather than bisected
+#define FrozenLinearSearch 8
+
+// Find tokenId among entries [begin, end) of a level; FrozenNotFound if absent
+// (inline, like frozenChildRange: both run once per order in every prediction)
+static inline uint32_t frozenFindChild(const FrozenIndex* index, int level, uint32_t begin, uint32_t end,
+                                       uint32_t tokenId) {
+    const uint32_t* ids = index->levels[level].tokenIds;
+    uint32_t lo = begin;
+    uint32_t hi = end;
+
+    while (hi - lo > FrozenLinearSearch) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ids[mid] < tokenId) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    while (lo < hi && ids[lo] < tokenId) lo++;
+    return (lo < end && ids[lo] == tokenId) ? lo : FrozenNotFound;
+}
+
+// Find the entry for an n-gram of length n (stored in level n - 1)
+uint32_t frozenFindPrefix(const FrozenIndex* index, const uint32_t* tokens, int n);
+
+// Children of entry `entry` in `level` as a range of level + 1; false if none
+static inline bool frozenChildRange(const FrozenIndex* index, int level, uint32_t entry, uint32_t* begin,
+                                    uint32_t* end) {
+    if (!index || level + 1 >= index->maxN) return false;
+
+    const uint32_t* firstChild = index->levels[level].firstChild;
+    *begin = firstChild[entry];
+    *end = firstChild[entry + 1];
+    return *end > *begin;
+}
+
+// Count of a unigram, 0 if never seen
+uint32_t frozenUnigramCount(const FrozenIndex* index, uint32_t tokenId);
+
+// log P(token) from the unigram counts, floored at log(1e-9); unseen tokens
+// get probability 1 / (totalTokens + 1)
+float frozenUnigramLogProbOf(uint32_t count, uint64_t totalTokens);
+
+// The same, read from the precomputed table
+static inline float frozenUnigramLogProb(const FrozenIndex* index, uint32_t tokenId) {
+    return (tokenId < index->vocabSize) ? index->unigramLogProb[tokenId]
+                                        : frozenUnigramLogProbOf(0, index->totalTokens);
+}
+
+#endif // FrozenModelHeader
@@ -4,6 +4,15 @@
 #include "vocab.h"
 #include "ngram.h"
 #include "pattern.h"
+#include "skipgram.h"
+#include "frozen.h"
+#include "ngramFile.h"
+#include "corpus.h"
+#include "predictCache.h"
+#include "stats.h"
+
+// Inference loops compiled for one context order (private to lmModel.c)
+struct OrderKernels;
 
 // Language model structure
 typedef struct {
@@ -12,20 +21,94 @@ typedef struct {
     PatternIndex* patterns; // Pattern index
     int maxN;              // Maximum n-gram order
     uint64_t totalTokens;   // Total number of tokens in the training data
+    FrozenIndex* frozen;    // Read-only view used for inference
+    bool frozenOnly;        // Counts live only in a mapped/embedded image, not in ngrams
+    SkipGramIndex* skipGrams; // Gapped-context continuations from the patterns (may be NULL)
+    bool useSkipGrams;      // Back off to skip-grams when the full context is unseen
+    PredictCache* cache;    // Recent predictions (NULL: disabled); cleared on retrain and reload
+    const struct OrderKernels* kernels;  // Specialized for maxN at creation, or the generic loops
 } LMModel;
 
 // Function declarations
+// Functions taking `const LMModel*` are reentrant and may run concurrently
+// on the same model; the others require exclusive access.
 LMModel* createLMModel(int maxN);
 void freeLMModel(LMModel* model);
 void trainFromFile(LMModel* model, const char* filename);
+void trainFromFileParallel(LMModel* model, const char* filename, int numThreads);
+bool trainIncremental(LMModel* model, const char* filename, int numThreads);  // adds to the loaded counts
+void thawModel(LMModel* model);
 void saveModel(const LMModel* model, const char* basePath);
 void loadModel(LMModel* model, const char* basePath);
+void finalizeModel(LMModel* model);
+bool setPredictCache(LMModel* model, uint32_t maxEntries);
+void setOrderKernels(LMModel* model, bool specialized);  // false: order-generic loops (benchmarking)
+bool usesSpecializedKernels(const LMModel* model);
+void modelMemoryStats(const LMModel* model, ModelMemoryStats* stats);
+
+// Single-file frozen format (<basePath>.cvm), mmap'd on load
+bool saveFrozenModel(const LMModel* model, const char* filename);
+bool mapFrozenModel(LMModel* model, const char* filename);
 void predictNextToken(const LMModel* model, const char* context, 
                      uint32_t* topTokens, float* scores, int k);
 
+// Reusable buffers for repeated predictions; zero-initialize before first use
+// One scratch area per thread: it is written by every call.
+typedef struct {
+    void* sortBuffer;       // top-k heap
+    size_t sortCapacity;
+    void* candSlots;        // candidate lookup table, reset by bumping candEpoch
+    uint32_t candEpoch;
+} PredictScratch;
+
+void predictNextTokenScratch(const LMModel* model, const char* context,
+                             uint32_t* topTokens, float* scores, int k,
+                             PredictScratch* scratch);
+void predictNextTokenIds(const LMModel* model, const uint32_t* contextIds, int length,
+                         uint32_t* topTokens, float* scores, int k,
+                         PredictScratch* scratch);
+void freePredictScratch(PredictScratch* scratch);
+
+// Incremental context: the image entry of every context suffix, advanced
+// one token at a time (one child search per order instead of a walk from
+// the root per backoff length). Valid while model->frozen is unchanged,
+// i.e. until the model is retrained, reloaded or freed.
+typedef struct {
+    const FrozenIndex* frozen;      // image the entries refer to
+    uint32_t entries[MaxN - 1];    // entries[L - 1]: last L tokens in level L - 1, or FrozenNotFound
+    uint32_t tokens[MaxN - 1];     // the last length tokens, oldest first
+    int length;                    // context tokens seen, capped at order
+    int order;                     // context tokens used (maxN - 1)
+    const struct OrderKernels* kernels;  // the model's, fixed at init
+} PredictCursor;
+
+void initPredictCursor(PredictCursor* cursor, const LMModel* model);
+void advancePredictCursor(PredictCursor* cursor, uint32_t tokenId);
+void predictFromCursor(const LMModel* model, const PredictCursor* cursor,
+                       uint32_t* topTokens, float* scores, int k,
+                       PredictScratch* scratch);
+
 // Auto-regressive text generation
+#define GenerateOutputSize 2048  // bytes of a reply buffer, including the NUL
+#define MaxGeneratedTokens 100   // hard cap on tokens per reply
 void generateResponse(const LMModel* model, const char* input,
                      char* output, int maxTokens, float temperature);
 
+// N-best generation by beam search
+#define MaxBeamWidth 16
+#define BeamBranching 8  // continuations tried per hypothesis and step
+#define BeamCacheSize 256  // predictions remembered per search (power of two)
+
+// One candidate reply
+typedef struct {
+    uint32_t tokens[MaxGeneratedTokens];
+    int length;
+    float score;  // reranking score, higher is better
+} GeneratedReply;
+
+int generateNBest(const LMModel* model, const char* input, int beamWidth, int maxTokens,
+                  GeneratedReply* replies, int n);
+void formatReply(const LMModel* model, const GeneratedReply* reply, char* output, size_t size);
+
 #endif // LmModelHeader
 
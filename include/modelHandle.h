@@ -0,0 +1,42 @@
+#ifndef ModelHandleHeader
+#define ModelHandleHeader
+
+#include "lmModel.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Reloadable model: readers pin the current version for the length of a
+// request while a reload builds its replacement off to the side, swaps
+// one pointer, and leaves the old version to whichever reader finishes
+// with it last. Readers never take a lock; the two pin counters only
+// tell the reloader when no reader can still be reaching for the old
+// pointer (an RCU grace period), which lasts a few instructions.
+typedef struct ModelVersion {
+    LMModel* model;
+    _Atomic uint32_t refs;   // readers plus one for being current
+    uint64_t generation;     // 0 for the first model, +1 per reload
+} ModelVersion;
+
+typedef struct ModelHandle {
+    _Atomic(ModelVersion*) current;
+    _Atomic uint64_t epoch;
+    _Atomic uint32_t pins[2];  // readers between loading current and taking a reference, by epoch parity
+    pthread_mutex_t reloadLock;  // one reload at a time
+} ModelHandle;
+
+// Function declarations
+ModelHandle* createModelHandle(LMModel* model);  // takes ownership of model
+void freeModelHandle(ModelHandle* handle);        // no version may still be acquired
+
+// Pin the current version; every acquire needs a matching release
+ModelVersion* acquireModel(ModelHandle* handle);
+void releaseModel(ModelVersion* version);
+
+// Make model current (taking ownership); the old one is freed once released
+bool swapModel(ModelHandle* handle, LMModel* model);
+
+// Load <prefix> into a new model with the current one's settings and swap
+// it in; the current model stays if the files cannot be loaded
+bool reloadModel(ModelHandle* handle, const char* prefix);
+
+#endif // ModelHandleHeader
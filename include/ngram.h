@@ -3,26 +3,39 @@
 
 #include "common.h"
 #include "vocab.h"
+#include "arena.h"
 
 // N-gram node structure
+// Children are stored as one contiguous array sorted by tokenId, so lookups
+// are a binary search over a single cache-friendly run instead of a
+// pointer chase through siblings.
 typedef struct NgramNode {
     uint32_t tokenId;           // Token ID
     uint32_t count;             // Count of this n-gram
-    struct NgramNode* next;     // Next node in the linked list
-    struct NgramNode* children; // Child nodes for next token in sequence
+    uint32_t numChildren;       // Number of children in use
+    uint32_t capacity;          // Allocated child slots
+    struct NgramNode* children; // Child nodes sorted by tokenId
 } NgramNode;
 
 // N-gram index structure
+// Every node and child array lives in the index's arena, so freeing the
+// index releases whole chunks instead of walking the trie.
 typedef struct {
     NgramNode* root;            // Root of the n-gram tree
     int maxN;                   // Maximum n-gram order
     uint64_t totalNgrams;       // Total number of n-grams
+    Arena* arena;               // Backing memory for the trie
 } NgramIndex;
 
-// N-gram iterator for traversal
+// N-gram iterator: depth-first, each n-gram before its extensions
+// All state lives in the iterator, so any number of iterators may walk
+// the same (unmodified) index concurrently. It may live on the stack.
 typedef struct {
-    NgramNode* node;
-    int depth;
+    const NgramNode* stack[MaxN];  // stack[d]: node whose children are visited at depth d
+    uint32_t pos[MaxN];            // next child position at each depth
+    uint32_t tokens[MaxN];         // tokens of the current path
+    int depth;                     // current depth, -1 once exhausted
+    int maxN;                      // longest n-gram to return
 } NgramIterator;
 
 // Function declarations
@@ -32,10 +45,25 @@ void addNgram(NgramIndex* index, const uint32_t* tokens, int n);
 void addNgramWithCount(NgramIndex* index, const uint32_t* tokens, int n, uint32_t count);
 uint32_t getNgramCount(const NgramIndex* index, const uint32_t* tokens, int n);
 NgramIterator* ngramIterator(const NgramIndex* index);
+void initNgramIterator(NgramIterator* it, const NgramIndex* index, int maxN);
 int nextNgram(NgramIterator* it, uint32_t* tokens, int maxN, uint32_t* count);
 void freeNgramIterator(NgramIterator* it);
 void updateNgrams(NgramIndex* index, const uint32_t* tokens, int length);
 
+// Helper: find the direct child of a node with the given token ID
+// Returns NULL if not found.
+NgramNode* findChildNode(const NgramNode* node, uint32_t tokenId);
+
+// Helper: find or insert the direct child of a node, keeping children sorted
+// Child arrays come from arena (normally the owning index's). Returns NULL
+// on allocation failure.
+NgramNode* getOrAddChildNode(Arena* arena, NgramNode* node, uint32_t tokenId);
+
+// Helper: add every descendant count of src into dst, remapping token IDs
+// through idMap (src ID -> dst ID), allocating from arena. Returns the
+// number of counts added.
+uint64_t mergeNgramChildren(Arena* arena, NgramNode* dst, const NgramNode* src, const uint32_t* idMap);
+
 // Helper: find the node corresponding to a prefix sequence (length n)
 // Returns NULL if not found. Depth corresponds to n.
 NgramNode* findPrefixNode(const NgramIndex* index, const uint32_t* tokens, int n);
@@ -0,0 +1,23 @@
+#ifndef NgramFileHeader
+#define NgramFileHeader
+
+#include "common.h"
+#include "ngram.h"
+#include "frozen.h"
+
+// Compact n-gram counts (<basePath>.ngrams), every order up to maxN
+// After the header come the levels in order. Each level is a run of
+// groups, one per entry of the level above (a single group for unigrams):
+// the group's child count, then for every child its token ID as a delta
+// from the previous sibling (the first from 0) and its count, all as
+// LEB128 varints. This is the frozen trie layout with the sorted token
+// runs delta-encoded, so typical records take 2-4 bytes instead of 12-20.
+#define NgramFileExtension ".ngrams"
+#define NgramFileMagic "CEVIANGM"
+#define NgramFileVersion 1
+
+// Function declarations
+bool saveNgramFile(const FrozenIndex* index, const char* filename);
+bool loadNgramFile(NgramIndex* ngrams, const char* filename, uint32_t vocabSize, uint64_t* totalTokens);
+
+#endif // NgramFileHeader
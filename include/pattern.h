@@ -3,37 +3,54 @@
 
 #include "common.h"
 #include "vocab.h"
+#include "arena.h"
 
 // Wildcard token
 #define WildcardToken 0xFFFFFFFF
 
-// Pattern token
-typedef struct {
-    uint32_t tokenId;  // Token ID or WildcardToken
-    bool isWildcard;   // True if this is a wildcard
-} PatternToken;
+// Extracted patterns replace every third token with a wildcard
+#define PatternWildcardAt(position) (((position) + 1) % 3 == 0)
+
+// Maximum number of matching patterns findMatchingPatterns returns
+#define MaxMatchingPatterns 100
+
+// Empty slot in the pattern hash table
+#define PatternEmptySlot 0xFFFFFFFF
 
 // Pattern structure
 typedef struct {
-    PatternToken* tokens;  // Array of tokens in the pattern
-    int length;            // Number of tokens in the pattern
-    uint32_t count;        // Frequency count of this pattern
+    uint32_t* tokens;  // Token IDs, WildcardToken for wildcards (arena-owned)
+    int length;        // Number of tokens in the pattern
+    uint32_t count;    // Frequency count of this pattern
 } Pattern;
 
 // Pattern index structure
+// Each distinct pattern is stored once, in first-seen order, and found
+// through an open-addressing table keyed on its length and tokens. A query
+// matches exactly the patterns equal to it with some of its positions
+// masked by wildcards, so matching probes the table once per mask instead
+// of scanning every pattern.
 typedef struct {
     Pattern* patterns;     // Array of patterns
     int size;             // Number of patterns
     int capacity;         // Current capacity of the array
     int maxPatternLength;  // Maximum pattern length
+    Arena* arena;         // Backing store for pattern tokens
+    uint32_t* slots;       // Hash table of pattern IDs (PatternEmptySlot: empty)
+    uint32_t slotMask;     // Table size - 1 (power of two)
 } PatternIndex;
 
 // Function declarations
 PatternIndex* createPatternIndex(int initialCapacity, int maxPatternLength);
 void freePatternIndex(PatternIndex* index);
 void addPattern(PatternIndex* index, const uint32_t* tokens, int length);
+void addPatternCount(PatternIndex* index, const uint32_t* tokens, int length, uint32_t count);
+int findPattern(const PatternIndex* index, const uint32_t* tokens, int length);
 void findMatchingPatterns(const PatternIndex* index, const uint32_t* tokens, int length, 
                          uint32_t* matches, int* numMatches);
 void extractPatternsFromSequence(PatternIndex* index, const uint32_t* tokens, int length);
 
+// Bytes held by the index (pattern array, tokens and hash table)
+size_t patternIndexMemory(const PatternIndex* index);
+
 #endif // PatternHeader
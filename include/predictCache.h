@@ -0,0 +1,76 @@
+#ifndef PredictCacheHeader
+#define PredictCacheHeader
+
+#include "common.h"
+#include <pthread.h>
+
+// Bounded cache of final predictions, keyed on the context token IDs the
+// scorer conditions on (the last maxN - 1), k and the skip-gram setting.
+// Entries are split over independently locked shards, each an LRU list
+// threaded through a fixed pool, so concurrent readers rarely meet and
+// memory never grows past the configured size.
+#define PredictCacheMaxK 16       // larger k bypasses the cache
+#define PredictCacheShards 16
+#define PredictCacheNoEntry UINT32_MAX
+
+typedef struct {
+    uint32_t tokens[MaxN - 1];
+    uint8_t length;
+    uint8_t k;
+    uint8_t skipGrams;
+} PredictCacheKey;
+
+typedef struct {
+    PredictCacheKey key;
+    uint64_t hash;
+    uint32_t chain;   // next entry in the same bucket
+    uint32_t newer;   // LRU neighbours
+    uint32_t older;
+    uint32_t topTokens[PredictCacheMaxK];
+    float scores[PredictCacheMaxK];
+} PredictCacheEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    PredictCacheEntry* entries;
+    uint32_t* buckets;     // head entry per bucket
+    uint32_t bucketMask;
+    uint32_t capacity;
+    uint32_t used;
+    uint32_t newest;
+    uint32_t oldest;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} PredictCacheShard;
+
+typedef struct {
+    PredictCacheShard shards[PredictCacheShards];
+    int numShards;
+    uint32_t capacity;  // entries over all shards
+} PredictCache;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint32_t entries;
+    uint32_t capacity;
+    size_t bytes;
+} PredictCacheStats;
+
+// Function declarations
+PredictCache* createPredictCache(uint32_t maxEntries);
+void freePredictCache(PredictCache* cache);
+void clearPredictCache(PredictCache* cache);  // drops entries, keeps counters
+
+// Entries that fit in maxBytes (counting the hash buckets)
+uint32_t predictCacheEntriesForBytes(size_t maxBytes);
+
+// On a hit, copies the k results out and returns true
+bool predictCacheLookup(PredictCache* cache, const PredictCacheKey* key, uint32_t* topTokens, float* scores);
+void predictCacheInsert(PredictCache* cache, const PredictCacheKey* key, const uint32_t* topTokens,
+                        const float* scores);
+void predictCacheStats(PredictCache* cache, PredictCacheStats* stats);
+
+#endif // PredictCacheHeader
@@ -0,0 +1,47 @@
+#ifndef PruneHeader
+#define PruneHeader
+
+#include "lmModel.h"
+#include "evaluate.h"
+
+// Bytes a frozen image spends per n-gram: token, count and rank, plus the
+// first-child offset and child total for every order but the highest
+#define FrozenLeafEntryBytes (3 * sizeof(uint32_t))
+#define FrozenInnerEntryBytes (5 * sizeof(uint32_t))
+
+// How to shrink the trie after training
+// Count thresholds run first. The byte budget then drops the rarest n-grams
+// until the frozen n-gram tables fit; among equal counts the ones closest
+// to their backoff go first, by |ln P(w|h) / P(w|h')| with h' the context
+// minus its oldest token. (Ranking by relative entropy alone keeps fewer
+// frequent continuations and costs top-k hit rate.) A parent always
+// scores at least as high as its children, so it is never dropped while
+// one of them stays. Unigrams are always kept, and child totals are
+// recomputed from the survivors when the model is frozen again, which
+// renormalizes every backoff distribution.
+typedef struct {
+    uint32_t minCount[MaxN];  // n-grams of order l + 1 seen fewer times are dropped (0 or 1: keep all)
+    uint64_t byteBudget;      // frozen n-gram table bytes to fit in (0: no budget)
+} PruneOptions;
+
+// Size and quality of a model under one pruning setting
+typedef struct {
+    uint64_t ngrams;       // n-grams kept, all orders
+    uint64_t tableBytes;   // frozen n-gram table bytes
+    uint64_t imageBytes;   // whole frozen image, vocabulary included
+    EvalStats eval;        // held-out results
+} PruneResult;
+
+// Function declarations
+uint64_t frozenTableBytes(const uint32_t* levelSize, int maxN);
+uint64_t pruneByCount(NgramIndex* ngrams, const uint32_t* minCount);
+uint64_t pruneToBudget(NgramIndex* ngrams, uint64_t totalTokens, uint64_t byteBudget);
+
+// Prune the model's trie and rebuild its frozen view; returns n-grams removed
+uint64_t pruneModel(LMModel* model, const PruneOptions* options);
+
+// Evaluate a pruned copy of the model on a held-out file (the model is unchanged)
+bool evaluatePruning(const LMModel* model, const PruneOptions* options, const char* heldout,
+                     int topK, int numThreads, PruneResult* result);
+
+#endif // PruneHeader
@@ -0,0 +1,41 @@
+#ifndef SerializeHeader
+#define SerializeHeader
+
+#include "common.h"
+
+// Bytes collected before each write to the file
+#define WriterBufferSize (1u << 16)
+
+// Longest LEB128 encoding of a 64-bit value
+#define MaxVarintBytes 10
+
+// Output file with a private buffer, so records cost memcpys, not calls
+// into stdio; the first failure sticks and is reported by closeWriter.
+typedef struct {
+    FILE* file;
+    unsigned char buffer[WriterBufferSize];
+    size_t used;
+    bool failed;
+} BufferedWriter;
+
+// Read-only view of a whole file (mapped); reads past the end set failed
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+    bool failed;
+} ByteReader;
+
+// Writing
+BufferedWriter* openWriter(const char* filename);
+void writeBytes(BufferedWriter* writer, const void* data, size_t length);
+void writeVarint(BufferedWriter* writer, uint64_t value);
+bool closeWriter(BufferedWriter* writer);
+
+// Reading
+bool openReader(ByteReader* reader, const char* filename);
+void closeReader(ByteReader* reader);
+bool readBytes(ByteReader* reader, void* out, size_t length);
+uint64_t readVarint(ByteReader* reader);
+
+#endif // SerializeHeader
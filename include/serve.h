@@ -0,0 +1,40 @@
+#ifndef ServeHeader
+#define ServeHeader
+
+#include "modelHandle.h"
+
+// Persistent server: one loaded model answering line-delimited requests
+// over TCP or a Unix socket. Every request is one line and gets exactly
+// one response line, in request order, so clients may pipeline.
+//
+//   PING                                  -> OK
+//   INFO                                  -> OK <maxN> <vocab size> <training tokens> <generation>
+//   PREDICT <k> <context>                 -> OK <n> <token> <score> ... (n pairs)
+//   GENERATE <max tokens> <temp> <input>  -> OK <reply>
+//   QUIT                                  -> OK, then the server closes the connection
+//   GET /metrics HTTP/1.1                 -> HTTP response with the stats in the
+//                                            Prometheus text format, then close
+//
+// Malformed requests get "ERR <reason>"; the connection stays open.
+// SIGHUP reloads the model prefix in the background; requests keep being
+// answered by the old model until the new one is swapped in, and the
+// generation in INFO counts the reloads.
+#define DefaultServeHost "127.0.0.1"
+#define DefaultServePort 7070
+#define ServeLineSize 4096          // longest request line, including the newline
+#define ServeMaxTopK 64
+#define ServeMaxPending (1 << 20)   // queued response bytes before a client stops being read
+#define MaxServeThreads 64
+
+typedef struct {
+    const char* modelPrefix;  // reloaded on SIGHUP (NULL: no reload)
+    const char* socketPath;  // Unix socket path; NULL listens on TCP
+    const char* host;        // TCP bind address (NULL: DefaultServeHost)
+    int port;                // TCP port (0: DefaultServePort)
+    int numThreads;          // workers (<= 0: one per online CPU)
+} ServeOptions;
+
+// Serve until SIGINT or SIGTERM; returns 0 on a clean shutdown
+int serveModel(ModelHandle* handle, const ServeOptions* options);
+
+#endif // ServeHeader
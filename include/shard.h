@@ -0,0 +1,43 @@
+#ifndef ShardHeader
+#define ShardHeader
+
+#include "frozen.h"
+
+// Count shard: one node's n-gram counts as sorted runs, to be merged with
+// the shards of other nodes into a single model. Token strings are stored
+// in key order (the reserved tokens first, then by strcmp) and records
+// refer to tokens by their index in that table, so a run sorted by index
+// is sorted by string too: shards trained on different vocabularies merge
+// without a shared ID space, and the merged vocabulary is numbered in the
+// same key order.
+//
+// Layout: header, one run per order (records of order token indexes
+// followed by the count, sorted by tokens), then the string table.
+#define ShardMagic "CEVIACSH"
+#define ShardVersion 1
+#define ShardExtension ".cvs"
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t maxN;
+    uint64_t totalTokens;
+    uint64_t totalNgrams;
+    uint32_t vocabSize;
+    uint32_t reserved;
+    uint64_t runSize[MaxN];       // records of order level + 1
+    uint64_t runOff[MaxN];        // uint32_t[runSize * (level + 2)]
+    uint64_t vocabOffsetsOff;     // uint32_t[vocabSize + 1] into the string table, in key order
+    uint64_t vocabStringsOff;     // NUL-terminated token strings
+    uint64_t vocabStringsSize;
+    uint64_t fileSize;
+} ShardFileHeader;
+
+// Function declarations
+bool writeCountShard(const FrozenIndex* index, const char* filename);
+
+// k-way merge the shards into one frozen model file without building a
+// trie; all shards must have the same order
+bool mergeCountShards(const char* const* shardFiles, int numShards, const char* filename);
+
+#endif // ShardHeader
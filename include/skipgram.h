@@ -0,0 +1,54 @@
+#ifndef SkipGramHeader
+#define SkipGramHeader
+
+#include "common.h"
+#include "pattern.h"
+
+// Skip-gram continuations distilled from the training patterns
+// A pattern whose last token is concrete and whose earlier tokens contain a
+// wildcard ("a b _ w") says that w followed the gapped context "a b _".
+// Keys are such gapped contexts; each key owns a run of continuations
+// ranked by count (descending, ties by token ID), like a frozen trie level.
+#define SkipGramExtension ".skip"
+#define SkipGramMagic "CEVIASKP"
+#define SkipGramVersion 2  // 2 adds the model stamp
+#define SkipGramKeyStride (MaxN - 1)  // tokens stored per key, unused ones 0
+#define SkipGramMinCount 2            // rarer skip-grams are dropped
+
+typedef struct {
+    uint32_t numKeys;
+    uint32_t numEntries;
+    uint8_t* keyLengths;   // numKeys context lengths
+    uint32_t* keyTokens;   // numKeys * SkipGramKeyStride, WildcardToken at the gaps
+    uint32_t* firstEntry;  // numKeys + 1 offsets into tokenIds/counts
+    uint32_t* totals;      // numKeys sums of continuation counts
+    uint32_t* tokenIds;    // numEntries continuations, ranked per key
+    uint32_t* counts;
+    uint32_t* slots;       // hash table of key indices (PatternEmptySlot: empty)
+    uint32_t slotMask;
+} SkipGramIndex;
+
+// The model a table was built for. Token IDs only mean something next to
+// that model's image: a merge or another training run renumbers them.
+typedef struct {
+    uint64_t totalTokens;
+    uint64_t vocabHash;   // vocabularyFingerprint
+    uint32_t vocabSize;
+    uint32_t reserved;
+} SkipGramStamp;
+
+// Function declarations
+SkipGramIndex* buildSkipGrams(const PatternIndex* patterns);
+void addSkipGramPatterns(const SkipGramIndex* index, PatternIndex* patterns);
+void freeSkipGrams(SkipGramIndex* index);
+size_t skipGramMemory(const SkipGramIndex* index);
+bool saveSkipGrams(const SkipGramIndex* index, const SkipGramStamp* stamp, const char* filename);
+// NULL if missing, malformed, or stamped for another model than expected
+// (version 1 files carry no stamp and are only checked against its vocabulary size)
+SkipGramIndex* loadSkipGrams(const char* filename, const SkipGramStamp* expected);
+
+// Continuations [begin, end) of a gapped context of length tokens; false if unseen
+bool findSkipGram(const SkipGramIndex* index, const uint32_t* key, int length,
+                  uint32_t* begin, uint32_t* end, uint32_t* total);
+
+#endif // SkipGramHeader
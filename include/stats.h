@@ -0,0 +1,132 @@
+#ifndef StatsHeader
+#define StatsHeader
+
+#include "common.h"
+#include <stdatomic.h>
+#include <time.h>
+
+// Hot-path counters and latency histograms. Every thread bumps its own
+// block with a relaxed load and store (no locked instruction, no cache
+// line shared with other threads); readers sum the blocks of live threads
+// and the totals left by exited ones. Building with -DCEVIA_NO_STATS
+// (make STATS=0) compiles every StatCount, StatAdd and StatTimer away.
+typedef enum {
+    StatPredictions,       // predictFromCursor calls (cache hits included)
+    StatPredictFallback,   // scored predictions padded from the unigram ranking
+    StatPredictSkipGrams,  // scored predictions that backed off to skip-grams
+    StatCursorAdvances,    // tokens appended to prediction cursors
+    StatChildSearches,     // frozen child searches made by those appends
+    StatTrieLookups,       // findPrefixNode calls
+    StatTrieNodes,         // trie nodes visited by them
+    StatHashLookups,       // hash map lookups (finds and inserts)
+    StatHashProbes,        // slots probed by them
+    StatGenerateSteps,     // tokens produced by generateResponse
+    StatCounterCount
+} StatCounter;
+
+typedef enum {
+    StatLatencyPredict,       // predictFromCursor
+    StatLatencyGenerateStep,  // one generateResponse token
+    StatLatencyServeRequest,  // one serve request line
+    StatLatencyCount
+} StatLatency;
+
+// Power-of-two buckets: bucket b counts observations below 2^b ns, the last one the rest
+#define StatLatencyBuckets 32
+
+typedef struct {
+    uint64_t count;
+    uint64_t sumNanos;
+    uint64_t buckets[StatLatencyBuckets];
+} StatHistogram;
+
+// Totals over all threads
+typedef struct {
+    bool enabled;                  // false when compiled out
+    uint64_t counters[StatCounterCount];
+    uint64_t backoffDepth[MaxN];   // scored predictions by longest context matched (0: none)
+    StatHistogram latency[StatLatencyCount];
+} StatsSnapshot;
+
+// One thread's counters; only the owning thread writes them
+typedef struct StatsBlock {
+    _Atomic uint64_t counters[StatCounterCount];
+    _Atomic uint64_t backoffDepth[MaxN];
+    _Atomic uint64_t latencyCount[StatLatencyCount];
+    _Atomic uint64_t latencySum[StatLatencyCount];
+    _Atomic uint64_t latencyBuckets[StatLatencyCount][StatLatencyBuckets];
+    struct StatsBlock* prev;
+    struct StatsBlock* next;
+} StatsBlock;
+
+#ifndef CEVIA_NO_STATS
+
+extern __thread StatsBlock* statsLocal;
+StatsBlock* registerStatsThread(void);  // never NULL
+
+static inline StatsBlock* statsBlock(void) {
+    StatsBlock* block = statsLocal;
+    return __builtin_expect(block != NULL, 1) ? block : registerStatsThread();
+}
+
+static inline void statBump(_Atomic uint64_t* word, uint64_t n) {
+    atomic_store_explicit(word, atomic_load_explicit(word, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline uint64_t statNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline void statObserve(StatLatency which, uint64_t nanos) {
+    StatsBlock* block = statsBlock();
+    int bucket = nanos ? 64 - __builtin_clzll(nanos) : 0;
+    if (bucket >= StatLatencyBuckets) bucket = StatLatencyBuckets - 1;
+    statBump(&block->latencyCount[which], 1);
+    statBump(&block->latencySum[which], nanos);
+    statBump(&block->latencyBuckets[which][bucket], 1);
+}
+
+#define StatAdd(counter, n) statBump(&statsBlock()->counters[counter], (n))
+#define StatCount(counter) StatAdd(counter, 1)
+#define StatBackoffDepth(depth) statBump(&statsBlock()->backoffDepth[depth], 1)
+#define StatTimerStart(name) uint64_t name = statNow()
+#define StatTimerStop(which, name) statObserve((which), statNow() - (name))
+
+#else
+
+// Arguments are still evaluated, so values computed only for a count stay used
+#define StatAdd(counter, n) ((void)(n))
+#define StatCount(counter) ((void)0)
+#define StatBackoffDepth(depth) ((void)(depth))
+#define StatTimerStart(name) ((void)0)
+#define StatTimerStop(which, name) ((void)0)
+
+#endif // CEVIA_NO_STATS
+
+// Memory held by one model, by subsystem
+typedef struct {
+    size_t vocabBytes;
+    size_t ngramBytes;     // mutable trie (a mapped model keeps its counts in the image)
+    size_t patternBytes;
+    size_t skipGramBytes;
+    size_t frozenBytes;    // frozen image plus tables derived on load
+    bool frozenMapped;     // image pages are file-backed and shared between processes
+    size_t cacheBytes;
+} ModelMemoryStats;
+
+// Function declarations
+void readStats(StatsSnapshot* snapshot);  // all zero when compiled out
+void resetStats(void);                    // updates racing with it may survive
+
+// Mean and approximate quantile (upper bucket bound) of a histogram, in nanoseconds
+double statMeanNanos(const StatHistogram* histogram);
+uint64_t statQuantileNanos(const StatHistogram* histogram, double quantile);
+
+// Prometheus text format of a snapshot and, if not NULL, a model's memory;
+// returns the length needed (as snprintf does), writing at most size bytes
+size_t formatPrometheusStats(const StatsSnapshot* snapshot, const ModelMemoryStats* memory, char* out,
+                             size_t size);
+
+#endif // StatsHeader
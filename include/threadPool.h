@@ -0,0 +1,45 @@
+#ifndef ThreadPoolHeader
+#define ThreadPoolHeader
+
+#include "common.h"
+#include <pthread.h>
+
+// Upper bound on pool workers
+#define MaxPoolThreads 64
+
+// Work function over the index range [begin, end)
+typedef void (*ThreadPoolRangeFn)(void* ctx, size_t begin, size_t end);
+
+// One parallel-for call; lives on the caller's stack while it runs
+typedef struct ThreadPoolTask {
+    ThreadPoolRangeFn fn;
+    void* ctx;
+    size_t count;
+    size_t grain;
+    size_t next;       // next unclaimed index (guarded by the pool lock)
+    size_t remaining;  // indices not yet finished
+    pthread_cond_t done;
+    struct ThreadPoolTask* link;
+} ThreadPoolTask;
+
+// Fixed set of workers pulling chunks from a queue of tasks
+// Several threads may submit tasks at once; the submitting thread also
+// works on its own task, so a pool of zero workers runs everything inline.
+typedef struct {
+    pthread_t threads[MaxPoolThreads];
+    int numThreads;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    ThreadPoolTask* head;
+    bool stopping;
+} ThreadPool;
+
+// Function declarations
+ThreadPool* createThreadPool(int numThreads);
+void freeThreadPool(ThreadPool* pool);
+void threadPoolFor(ThreadPool* pool, size_t count, size_t grain, ThreadPoolRangeFn fn, void* ctx);
+
+// Process-wide pool sized to the online CPUs, created on first use
+ThreadPool* sharedThreadPool(void);
+
+#endif // ThreadPoolHeader
@@ -5,12 +5,20 @@
 
 #define MaxVocabSize 65536  // Maximum number of unique tokens
 
+// Read-only string table borrowed from a frozen model image
+typedef struct {
+    const uint32_t* offsets;  // offsets[id] into strings (size + 1 entries)
+    const uint32_t* sorted;   // token IDs sorted by string, for lookup
+    const char* strings;      // NUL-terminated token strings
+} VocabularyView;
+
 // Vocabulary structure
 typedef struct {
-    HashMap* tokenToId;  // token string -> token ID
-    char** idToToken;    // array of token strings
-    uint32_t size;       // current number of tokens
-    uint32_t capacity;   // maximum capacity
+    HashMap* tokenToId;      // token string -> token ID (owns the strings)
+    const char** idToToken;  // token ID -> interned string in tokenToId
+    uint32_t size;           // current number of tokens
+    uint32_t capacity;       // maximum capacity
+    VocabularyView view;     // borrowed string table (view.strings != NULL when attached)
 } Vocabulary;
 
 // Function declarations
@@ -18,8 +26,13 @@ Vocabulary* createVocabulary();
 void freeVocabulary(Vocabulary* vocab);
 uint32_t getOrAddToken(Vocabulary* vocab, const char* token);
 const char* getTokenById(const Vocabulary* vocab, uint32_t id);
+uint32_t lookupToken(const Vocabulary* vocab, const char* token);
+void attachVocabularyView(Vocabulary* vocab, uint32_t size, VocabularyView view);
+bool thawVocabulary(Vocabulary* vocab);
 void buildVocabularyFromFile(Vocabulary* vocab, const char* filename);
 void saveVocabulary(const Vocabulary* vocab, const char* filename);
 void loadVocabulary(Vocabulary* vocab, const char* filename);
+size_t vocabularyMemory(const Vocabulary* vocab);  // bytes held, hash map included
+uint64_t vocabularyFingerprint(const Vocabulary* vocab);
 
 #endif // VocabHeader
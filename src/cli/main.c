@@ -4,6 +4,12 @@
 #include "../include/common.h"
 #include "../include/lmModel.h"
 #include "../include/vocab.h"
+#include "../include/evaluate.h"
+#include "../include/compact.h"
+#include "../include/prune.h"
+#include "../include/serve.h"
+#include "../include/shard.h"
+#include <time.h>
 
 // Print usage information
 void printUsage(const char* programName) {
@@ -11,64 +17,197 @@ void printUsage(const char* programName) {
     printf("Commands:\n");
     printf("  -h, --help                              Show this help message\n");
     printf("  -v, --version                           Show application version\n");
-    printf("  train <corpus.txt> [--model-prefix P]   Train model (default prefix if omitted)\n");
+    printf("  train <corpus.txt|-> [--model-prefix P] [--threads N]  Train model (\"-\" reads stdin)\n");
+    printf("        [--prune-min C1,C2,..] [--prune-budget BYTES[K|M|G]] [--prune HELDOUT]\n");
+    printf("        Prune by per-order minimum counts and/or to a table size; --prune reports\n");
+    printf("        size vs held-out hit rate for a range of settings before saving.\n");
+    printf("        [--base PREFIX] adds the corpus to an existing model instead of starting over;\n");
+    printf("        [--shard FILE] writes a count shard for 'merge' instead of a model.\n");
     printf("  run [--model-prefix P] [--top-k N]      Run interactive inference\n");
     printf("  predict <model_prefix> <context> [--top-k N]  Predict next token\n");
-    printf("  eval <corpus.txt> [--model-prefix P] [--top-k N]  Evaluate top-k hit rate\n");
+    printf("  eval <corpus.txt|-> [--model-prefix P] [--top-k N] [--threads N]  Evaluate hit rate and perplexity\n");
     printf("  chat [--model-prefix P] [--temp T] [--max-tokens N]  Chat mode (full responses)\n");
-    printf("  generate <model_prefix> <input> [--temp T] [--max-tokens N]  Generate single response\n");
+    printf("  generate <model_prefix> <input> [--temp T] [--max-tokens N] [--nbest N [--beam W]]  Generate response(s)\n");
+    printf("  freeze <model_prefix>                   Write mmap-able single-file model (<prefix>.cvm)\n");
+    printf("  merge <model_prefix> <shard.cvs>...     Merge count shards from many nodes into <prefix>.cvm\n");
+    printf("  compact <model_prefix>                  Write bit-packed n-gram image (<prefix>.cvc), report bytes per n-gram\n");
+    printf("  serve [--model-prefix P] [--socket PATH | --host H --port N] [--threads N] [--cache ENTRIES]\n");
+    printf("        Load the model once and answer PREDICT/GENERATE request lines (see serve.h);\n");
+    printf("        SIGHUP reloads the model without dropping requests\n");
+    printf("  stats [--model-prefix P] [--eval CORPUS] [--threads N] [--cache ENTRIES] [--prometheus]\n");
+    printf("        Hot-path counters, latency and memory by subsystem, after evaluating CORPUS\n");
+    printf("        as a workload; --prometheus prints the text exposition format\n");
     printf("  interactive                              Alias of 'run' (deprecated)\n");
+    printf("Inference commands (run, predict, eval, chat, generate, serve, stats) accept --skipgrams\n");
+    printf("to add the skip-gram backoff stage to the n-gram trie.\n");
 }
 
-// Evaluate top-k unigram hit rate on a corpus file
-static void evaluateCorpus(LMModel* model, const char* filename, int topK) {
-    if (!model || !filename) return;
-    if (topK <= 0) topK = 5;
-    if (topK > 64) topK = 64;
-
-    FILE* f = fopen(filename, "r");
-    if (!f) {
-        perror("Failed to open corpus for eval");
-        return;
+// True if flag appears among the arguments
+static bool hasFlag(int argc, char* argv[], const char* flag) {
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], flag) == 0) return true;
     }
+    return false;
+}
 
-    uint64_t total = 0; // number of next-token predictions evaluated
-    uint64_t hits = 0;  // number of times gold token is in top-k
-
-    char line[4096];
-    while (fgets(line, sizeof(line), f)) {
-        Sentence s = initSentence();
-        tokenizeLine(line, &s);
-        if (s.length <= 1) continue;
-        for (int i = 1; i < s.length; i++) {
-            // Context: previous token text
-            char context[256];
-            snprintf(context, sizeof(context), "%s", s.sequence[i - 1].text);
+// Parse "1,1,2,2" into per-order minimum counts; false on a malformed list
+static bool parseMinCounts(const char* text, uint32_t* minCount) {
+    memset(minCount, 0, MaxN * sizeof(uint32_t));
+    for (int l = 0; l < MaxN && *text; l++) {
+        char* end;
+        unsigned long value = strtoul(text, &end, 10);
+        if (end == text || value > UINT32_MAX) return false;
+        minCount[l] = (uint32_t)value;
+        if (*end == ',') end++;
+        else if (*end != '\0') return false;
+        text = end;
+    }
+    return *text == '\0';
+}
 
-            uint32_t topTokens[64] = {0};
-            float scores[64] = {0};
-            predictNextToken(model, context, topTokens, scores, topK);
+// Parse a byte count with an optional K, M or G suffix (0 if malformed)
+static uint64_t parseByteSize(const char* text) {
+    char* end;
+    double value = strtod(text, &end);
+    if (end == text || value <= 0.0) return 0;
+    switch (toupper((unsigned char)*end)) {
+        case 'K': value *= 1024.0; break;
+        case 'M': value *= 1024.0 * 1024.0; break;
+        case 'G': value *= 1024.0 * 1024.0 * 1024.0; break;
+        case '\0': break;
+        default: return 0;
+    }
+    return (uint64_t)value;
+}
 
-            // Gold token id
-            const char* gold = s.sequence[i].text;
-            uint32_t goldId = hashMapGet(model->vocab->tokenToId, gold);
+// Print size against held-out quality for a ladder of pruning settings
+static void reportPruning(const LMModel* model, const char* heldout, int topK, int numThreads) {
+    // Count ladders are nested, so each row prunes at least as much as the last
+    static const uint32_t ladders[][MaxN] = {
+        { 0, 0, 0, 0 }, { 0, 0, 0, 2 }, { 0, 0, 2, 2 }, { 0, 2, 2, 2 }, { 0, 2, 2, 3 }, { 0, 2, 3, 4 },
+    };
+    static const double budgets[] = { 0.5, 0.25, 0.1 };
 
-            int matched = 0;
-            for (int k = 0; k < topK && scores[k] > 0.0f; k++) {
-                if (topTokens[k] == goldId) { matched = 1; break; }
+    printf("Pruning trade-off on %s (top-%d):\n", heldout, topK);
+    printf("  %-18s %12s %12s %11s %9s %11s\n", "Setting", "N-grams", "Tables MiB", "Image MiB",
+           "Hit rate", "Perplexity");
+    uint64_t fullTables = 0;
+    int rows = (int)(sizeof(ladders) / sizeof(ladders[0]) + sizeof(budgets) / sizeof(budgets[0]));
+    for (int row = 0; row < rows; row++) {
+        PruneOptions options;
+        memset(&options, 0, sizeof(options));
+        char label[64];
+        if (row < (int)(sizeof(ladders) / sizeof(ladders[0]))) {
+            memcpy(options.minCount, ladders[row], sizeof(options.minCount));
+            if (row == 0) {
+                snprintf(label, sizeof(label), "none");
+            } else {
+                const uint32_t* m = ladders[row];
+                snprintf(label, sizeof(label), "min %u,%u,%u,%u", m[0] ? m[0] : 1, m[1] ? m[1] : 1,
+                         m[2] ? m[2] : 1, m[3] ? m[3] : 1);
             }
-            if (matched) hits++;
-            total++;
+        } else {
+            double fraction = budgets[row - (int)(sizeof(ladders) / sizeof(ladders[0]))];
+            options.byteBudget = (uint64_t)((double)fullTables * fraction);
+            snprintf(label, sizeof(label), "budget %.0f%%", fraction * 100.0);
         }
+
+        PruneResult result;
+        if (!evaluatePruning(model, &options, heldout, topK, numThreads, &result)) {
+            printf("  %-18s (evaluation failed)\n", label);
+            continue;
+        }
+        if (row == 0) fullTables = result.tableBytes;
+        printf("  %-18s %12llu %12.1f %11.1f %8.2f%% %11.2f\n", label, (unsigned long long)result.ngrams,
+               (double)result.tableBytes / (1024.0 * 1024.0), (double)result.imageBytes / (1024.0 * 1024.0),
+               100.0 * evalHitRate(&result.eval), evalPerplexity(&result.eval));
     }
-    fclose(f);
+}
+
+// Evaluate next-token prediction on a corpus file and print the results
+static void evaluateCorpus(const LMModel* model, const char* filename, int topK, int numThreads) {
+    if (!model || !filename) return;
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    EvalStats stats;
+    if (!evaluateFile(model, filename, topK, numThreads, &stats)) return;
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double seconds = (double)(stop.tv_sec - start.tv_sec) + (double)(stop.tv_nsec - start.tv_nsec) / 1e9;
 
-    double hitRate = (total > 0) ? (100.0 * (double)hits / (double)total) : 0.0;
     printf("Eval results on %s\n", filename);
-    printf("  Pairs evaluated: %llu\n", (unsigned long long)total);
-    printf("  Top-%d hits: %llu\n", topK, (unsigned long long)hits);
-    printf("  Hit rate: %.2f%%\n", hitRate);
+    printf("  Pairs evaluated: %llu\n", (unsigned long long)stats.predictions);
+    printf("  Top-%d hits: %llu\n", stats.topK, (unsigned long long)stats.hits);
+    printf("  Hit rate: %.2f%%\n", 100.0 * evalHitRate(&stats));
+    printf("  Perplexity: %.2f\n", evalPerplexity(&stats));
+    printf("  OOV rate: %.2f%%\n",
+           stats.predictions ? 100.0 * (double)stats.oov / (double)stats.predictions : 0.0);
+    printf("  By matched context length:\n");
+    for (int L = 0; L < MaxN; L++) {
+        if (stats.orderPredictions[L] == 0) continue;
+        printf("    %d: %llu pairs, hit rate %.2f%%\n", L,
+               (unsigned long long)stats.orderPredictions[L],
+               100.0 * (double)stats.orderHits[L] / (double)stats.orderPredictions[L]);
+    }
+    if (seconds > 0.0) {
+        printf("  Throughput: %.0f predictions/s (%.2fs)\n", (double)stats.predictions / seconds, seconds);
+    }
 }
+
+// Print a latency histogram as one table row
+static void printLatency(const char* label, const StatHistogram* histogram) {
+    if (histogram->count == 0) {
+        printf("  %-16s %12s\n", label, "-");
+        return;
+    }
+    printf("  %-16s %12llu %10.2f %10.2f %10.2f\n", label, (unsigned long long)histogram->count,
+           statMeanNanos(histogram) / 1000.0, (double)statQuantileNanos(histogram, 0.5) / 1000.0,
+           (double)statQuantileNanos(histogram, 0.99) / 1000.0);
+}
+
+// Print the counters and the model's memory as tables
+static void printStats(const StatsSnapshot* snapshot, const ModelMemoryStats* memory) {
+    static const char* const counterLabels[StatCounterCount] = {
+        "Predictions", "Unigram fallback", "Skip-gram backoff", "Cursor advances", "Child searches",
+        "Trie lookups", "Trie nodes", "Hash lookups", "Hash probes", "Generated tokens",
+    };
+    
+    if (!snapshot->enabled) {
+        printf("Counters: compiled out (built with STATS=0)\n");
+    } else {
+        printf("Counters:\n");
+        for (int c = 0; c < StatCounterCount; c++) {
+            printf("  %-18s %14llu\n", counterLabels[c], (unsigned long long)snapshot->counters[c]);
+        }
+        uint64_t scored = 0;
+        for (int d = 0; d < MaxN; d++) scored += snapshot->backoffDepth[d];
+        printf("Longest context matched (scored predictions):\n");
+        for (int d = 0; d < MaxN; d++) {
+            if (snapshot->backoffDepth[d] == 0) continue;
+            printf("  %d: %14llu (%.2f%%)\n", d, (unsigned long long)snapshot->backoffDepth[d],
+                   100.0 * (double)snapshot->backoffDepth[d] / (double)scored);
+        }
+        if (snapshot->counters[StatHashLookups] > 0) {
+            printf("  Mean hash probes per lookup: %.3f\n",
+                   (double)snapshot->counters[StatHashProbes] / (double)snapshot->counters[StatHashLookups]);
+        }
+        printf("Latency (us):\n");
+        printf("  %-16s %12s %10s %10s %10s\n", "", "Count", "Mean", "p50", "p99");
+        printLatency("Predict", &snapshot->latency[StatLatencyPredict]);
+        printLatency("Generate step", &snapshot->latency[StatLatencyGenerateStep]);
+        printLatency("Serve request", &snapshot->latency[StatLatencyServeRequest]);
+    }
+    
+    printf("Memory:\n");
+    printf("  %-18s %14zu bytes\n", "Vocabulary", memory->vocabBytes);
+    printf("  %-18s %14zu bytes\n", "N-gram trie", memory->ngramBytes);
+    printf("  %-18s %14zu bytes\n", "Patterns", memory->patternBytes);
+    printf("  %-18s %14zu bytes\n", "Skip-grams", memory->skipGramBytes);
+    printf("  %-18s %14zu bytes%s\n", "Frozen image", memory->frozenBytes,
+           memory->frozenMapped ? " (file-backed, shared)" : "");
+    printf("  %-18s %14zu bytes\n", "Prediction cache", memory->cacheBytes);
+}
+
 // Interactive mode
 void interactiveMode(LMModel* model, int topK) {
     if (!model) return;
@@ -147,16 +286,49 @@ int main(int argc, char* argv[]) {
         
         const char* trainingFile = argv[2];
         const char* modelPrefix = DefaultModelPrefix;
-        // Optional flags: --model-prefix PREFIX
+        int numThreads = 1;
+        PruneOptions prune;
+        memset(&prune, 0, sizeof(prune));
+        bool pruning = false;
+        const char* pruneHeldout = NULL;
+        const char* basePrefix = NULL;
+        const char* shardFile = NULL;
+        // Optional flags: --model-prefix PREFIX, --threads N, --prune-min LIST,
+        // --prune-budget BYTES, --prune HELDOUT, --base PREFIX, --shard FILE
         for (int i = 3; i < argc; i++) {
             if (strcmp(argv[i], "--model-prefix") == 0 && (i + 1) < argc) {
                 modelPrefix = argv[i + 1];
                 i++;
+            } else if (strcmp(argv[i], "--threads") == 0 && (i + 1) < argc) {
+                numThreads = atoi(argv[i + 1]);
+                i++;
+            } else if (strcmp(argv[i], "--prune-min") == 0 && (i + 1) < argc) {
+                if (!parseMinCounts(argv[i + 1], prune.minCount)) {
+                    printf("Error: Invalid --prune-min list '%s'\n", argv[i + 1]);
+                    return 1;
+                }
+                pruning = true;
+                i++;
+            } else if (strcmp(argv[i], "--prune-budget") == 0 && (i + 1) < argc) {
+                prune.byteBudget = parseByteSize(argv[i + 1]);
+                if (prune.byteBudget == 0) {
+                    printf("Error: Invalid --prune-budget size '%s'\n", argv[i + 1]);
+                    return 1;
+                }
+                pruning = true;
+                i++;
+            } else if (strcmp(argv[i], "--prune") == 0 && (i + 1) < argc) {
+                pruneHeldout = argv[i + 1];
+                i++;
+            } else if (strcmp(argv[i], "--base") == 0 && (i + 1) < argc) {
+                basePrefix = argv[i + 1];
+                i++;
+            } else if (strcmp(argv[i], "--shard") == 0 && (i + 1) < argc) {
+                shardFile = argv[i + 1];
+                i++;
             }
         }
         
-        printf("Training new model from file: %s\n", trainingFile);
-        
         // Create and train model
         LMModel* model = createLMModel(4);  // Use 4-grams
         if (!model) {
@@ -164,9 +336,61 @@ int main(int argc, char* argv[]) {
             return 1;
         }
         
-        trainFromFile(model, trainingFile);
+        if (basePrefix) {
+            printf("Adding %s to model: %s\n", trainingFile, basePrefix);
+            loadModel(model, basePrefix);
+            // A missing model loads as an empty one; updating that would silently start over
+            if (!model->frozen || model->totalTokens == 0) {
+                printf("Error: Failed to load base model '%s'\n", basePrefix);
+                freeLMModel(model);
+                return 1;
+            }
+            uint64_t baseTokens = model->totalTokens;
+            if (!trainIncremental(model, trainingFile, numThreads)) {
+                printf("Error: Failed to update model '%s'\n", basePrefix);
+                freeLMModel(model);
+                return 1;
+            }
+            printf("Added %llu tokens to %llu, %llu n-grams in total\n",
+                   (unsigned long long)(model->totalTokens - baseTokens), (unsigned long long)baseTokens,
+                   (unsigned long long)model->frozen->totalNgrams);
+        } else {
+            printf("Training new model from file: %s\n", trainingFile);
+            trainFromFileParallel(model, trainingFile, numThreads);
+            printf("Trie memory: %.1f MiB\n", (double)model->ngrams->arena->bytesReserved / (1024.0 * 1024.0));
+        }
+        printf("Pattern index: %d distinct patterns, %.1f MiB\n", model->patterns->size,
+               (double)patternIndexMemory(model->patterns) / (1024.0 * 1024.0));
+        if (pruneHeldout) reportPruning(model, pruneHeldout, 5, numThreads);
+        if (pruning) {
+            uint64_t removed = pruneModel(model, &prune);
+            uint64_t kept = 0;
+            uint32_t levelSize[MaxN] = { 0 };
+            for (int l = 0; model->frozen && l < model->frozen->maxN; l++) {
+                levelSize[l] = model->frozen->levels[l].size;
+                kept += levelSize[l];
+            }
+            printf("Pruned %llu n-grams, %llu kept (tables %.1f MiB)\n", (unsigned long long)removed,
+                   (unsigned long long)kept,
+                   model->frozen ? (double)frozenTableBytes(levelSize, model->frozen->maxN) / (1024.0 * 1024.0) : 0.0);
+        }
+        if (shardFile) {
+            // Another node's model is merged later; only the counts are kept
+            if (!model->frozen || !writeCountShard(model->frozen, shardFile)) {
+                printf("Error: Failed to write count shard '%s'\n", shardFile);
+                freeLMModel(model);
+                return 1;
+            }
+            printf("Training complete. Count shard written: %s\n", shardFile);
+            freeLMModel(model);
+            return 0;
+        }
         saveModel(model, modelPrefix);
         
+        char frozenFile[1024];
+        snprintf(frozenFile, sizeof(frozenFile), "%s%s", modelPrefix, FrozenExtension);
+        saveFrozenModel(model, frozenFile);
+        
         printf("Training complete. Model saved with prefix: %s\n", modelPrefix);
         freeLMModel(model);
         
@@ -208,6 +432,7 @@ int main(int argc, char* argv[]) {
         }
         
         loadModel(model, modelPrefix);
+        model->useSkipGrams = hasFlag(argc, argv, "--skipgrams");
         
         // Normalize context similar to training: tokenize and take last token
         {
@@ -259,6 +484,7 @@ int main(int argc, char* argv[]) {
         }
         
         loadModel(model, modelPrefix);
+        model->useSkipGrams = hasFlag(argc, argv, "--skipgrams");
         
         // Start interactive mode
         interactiveMode(model, topK);
@@ -272,7 +498,8 @@ int main(int argc, char* argv[]) {
         const char* modelPrefix = DefaultModelPrefix;
         const char* evalFile = NULL;
         int topK = 5;
-        // Parse positional and optional args: eval <corpus.txt> [--model-prefix P] [--top-k N]
+        int numThreads = 0;  // all CPUs
+        // Parse positional and optional args: eval <corpus.txt> [--model-prefix P] [--top-k N] [--threads N]
         if (argc >= 3) {
             evalFile = argv[2];
         }
@@ -283,6 +510,9 @@ int main(int argc, char* argv[]) {
             } else if (strcmp(argv[i], "--top-k") == 0 && (i + 1) < argc) {
                 topK = atoi(argv[i + 1]);
                 i++;
+            } else if (strcmp(argv[i], "--threads") == 0 && (i + 1) < argc) {
+                numThreads = atoi(argv[i + 1]);
+                i++;
             }
         }
         if (!evalFile) {
@@ -298,7 +528,8 @@ int main(int argc, char* argv[]) {
             return 1;
         }
         loadModel(model, modelPrefix);
-        evaluateCorpus(model, evalFile, topK);
+        model->useSkipGrams = hasFlag(argc, argv, "--skipgrams");
+        evaluateCorpus(model, evalFile, topK, numThreads);
         freeLMModel(model);
     } else if (strcmp(command, "chat") == 0) {
         const char* modelPrefix = DefaultModelPrefix;
@@ -326,6 +557,7 @@ int main(int argc, char* argv[]) {
             return 1;
         }
         loadModel(model, modelPrefix);
+        model->useSkipGrams = hasFlag(argc, argv, "--skipgrams");
         
         // Chat mode
         printf("Cevia Chat Mode (type 'exit' to quit)\n");
@@ -366,6 +598,8 @@ int main(int argc, char* argv[]) {
         char inputBuf[1024] = {0};
         float temperature = 0.7f;
         int maxTokens = 20;
+        int nbest = 0;
+        int beamWidth = 0;
         
         // Concatenate input until option flag
         {
@@ -386,6 +620,12 @@ int main(int argc, char* argv[]) {
             } else if (strcmp(argv[i], "--max-tokens") == 0 && (i + 1) < argc) {
                 maxTokens = atoi(argv[i + 1]);
                 i++;
+            } else if (strcmp(argv[i], "--nbest") == 0 && (i + 1) < argc) {
+                nbest = atoi(argv[i + 1]);
+                i++;
+            } else if (strcmp(argv[i], "--beam") == 0 && (i + 1) < argc) {
+                beamWidth = atoi(argv[i + 1]);
+                i++;
             }
         }
         
@@ -396,16 +636,254 @@ int main(int argc, char* argv[]) {
             return 1;
         }
         loadModel(model, modelPrefix);
-        
-        // Generate response
-        char response[2048];
-        generateResponse(model, inputBuf, response, maxTokens, temperature);
+        model->useSkipGrams = hasFlag(argc, argv, "--skipgrams");
         
         printf("Input: %s\n", inputBuf);
-        printf("Response: %s\n", response);
+        if (nbest > 0) {
+            // Ranked candidates from beam search
+            GeneratedReply replies[MaxBeamWidth];
+            int found = generateNBest(model, inputBuf, beamWidth, maxTokens, replies, nbest);
+            for (int i = 0; i < found; i++) {
+                char response[GenerateOutputSize];
+                formatReply(model, &replies[i], response, sizeof(response));
+                printf("Response %d (%.3f): %s\n", i + 1, replies[i].score, response);
+            }
+        } else {
+            // Generate response
+            char response[GenerateOutputSize];
+            generateResponse(model, inputBuf, response, maxTokens, temperature);
+            printf("Response: %s\n", response);
+        }
+        
+        freeLMModel(model);
+        
+    } else if (strcmp(command, "freeze") == 0) {
+        if (argc < 3) {
+            printf("Error: Missing model prefix for freeze command\n");
+            printUsage(argv[0]);
+            return 1;
+        }
+        
+        const char* modelPrefix = argv[2];
+        LMModel* model = createLMModel(4);
+        if (!model) {
+            printf("Error: Failed to create model\n");
+            return 1;
+        }
+        loadModel(model, modelPrefix);
+        
+        char frozenFile[1024];
+        snprintf(frozenFile, sizeof(frozenFile), "%s%s", modelPrefix, FrozenExtension);
+        if (!saveFrozenModel(model, frozenFile)) {
+            freeLMModel(model);
+            return 1;
+        }
+        printf("Frozen model written: %s (%zu bytes)\n", frozenFile, model->frozen ? model->frozen->imageSize : 0);
+        freeLMModel(model);
+        
+    } else if (strcmp(command, "merge") == 0) {
+        if (argc < 4) {
+            printf("Error: merge needs a model prefix and at least one count shard\n");
+            printUsage(argv[0]);
+            return 1;
+        }
         
+        const char* modelPrefix = argv[2];
+        char frozenFile[1024];
+        snprintf(frozenFile, sizeof(frozenFile), "%s%s", modelPrefix, FrozenExtension);
+        if (!mergeCountShards((const char* const*)&argv[3], argc - 3, frozenFile)) {
+            printf("Error: Failed to merge count shards\n");
+            return 1;
+        }
+        
+        // The merge renumbers tokens, so count and skip-gram files left by an
+        // earlier train under this prefix no longer match the image
+        static const char* const staleExtensions[] = { ".vocab", NgramFileExtension, SkipGramExtension };
+        for (size_t e = 0; e < sizeof(staleExtensions) / sizeof(staleExtensions[0]); e++) {
+            char staleFile[1024];
+            snprintf(staleFile, sizeof(staleFile), "%s%s", modelPrefix, staleExtensions[e]);
+            if (remove(staleFile) == 0) printf("Removed stale %s\n", staleFile);
+        }
+        
+        FrozenIndex* merged = mapFrozenFile(frozenFile);
+        if (merged) {
+            printf("Merged %d shards: %llu tokens, %u words, %llu n-grams\n", argc - 3,
+                   (unsigned long long)merged->totalTokens, merged->vocabSize,
+                   (unsigned long long)merged->totalNgrams);
+            printf("Frozen model written: %s (%zu bytes)\n", frozenFile, merged->imageSize);
+            freeFrozenIndex(merged);
+        }
+        
+    } else if (strcmp(command, "compact") == 0) {
+        if (argc < 3) {
+            printf("Error: Missing model prefix for compact command\n");
+            printUsage(argv[0]);
+            return 1;
+        }
+        
+        const char* modelPrefix = argv[2];
+        LMModel* model = createLMModel(4);
+        if (!model) {
+            printf("Error: Failed to create model\n");
+            return 1;
+        }
+        loadModel(model, modelPrefix);
+        
+        const FrozenIndex* fz = model->frozen;
+        CompactIndex* compact = fz ? compactFrozenIndex(fz) : NULL;
+        if (!compact || !verifyCompactIndex(compact, fz)) {
+            printf("Error: Failed to build compact image\n");
+            freeCompactIndex(compact);
+            freeLMModel(model);
+            return 1;
+        }
+        
+        printf("Compact image verified against the frozen trie (%d orders)\n", fz->maxN);
+        
+        // Before: a trie node or a frozen entry (token, count, rank, child, total) per n-gram
+        printf("Order    N-grams   Trie B/ng  Frozen B/ng  Compact B/ng  (token/count/child/total/rank bits)\n");
+        uint64_t ngrams = 0;
+        uint64_t frozenBytes = 0;
+        for (int l = 0; l < fz->maxN; l++) {
+            const CompactLevel* lv = &compact->levels[l];
+            uint64_t n = lv->size;
+            uint64_t frozenLevel = n * 3 * sizeof(uint32_t);
+            if (l + 1 < fz->maxN) frozenLevel += (2 * n + 1) * sizeof(uint32_t);
+            ngrams += n;
+            frozenBytes += frozenLevel;
+            double perNgram = n ? (double)compactLevelBytes(compact, l) / (double)n : 0.0;
+            printf("  %d  %11llu  %10zu  %11.2f  %12.2f  (%u/%u/%u/%u/%u)\n", l + 1, (unsigned long long)n,
+                   sizeof(NgramNode), n ? (double)frozenLevel / (double)n : 0.0, perNgram,
+                   lv->tokenIds.bits, lv->counts.values.bits, lv->firstChild.bits,
+                   lv->childTotals.values.bits, lv->rankOffsets.bits);
+        }
+        double denom = ngrams ? (double)ngrams : 1.0;
+        printf("Total %11llu  %10zu  %11.2f  %12.2f\n", (unsigned long long)ngrams, sizeof(NgramNode),
+               (double)frozenBytes / denom, (double)compact->imageSize / denom);
+        
+        char compactFile[1024];
+        snprintf(compactFile, sizeof(compactFile), "%s%s", modelPrefix, CompactExtension);
+        bool ok = writeCompactFile(compact, compactFile);
+        if (ok) printf("Compact image written: %s (%zu bytes)\n", compactFile, compact->imageSize);
+        freeCompactIndex(compact);
+        freeLMModel(model);
+        if (!ok) return 1;
+        
+    } else if (strcmp(command, "stats") == 0) {
+        const char* modelPrefix = DefaultModelPrefix;
+        const char* evalFile = NULL;
+        int numThreads = 0;  // all CPUs
+        uint32_t cacheEntries = 0;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--model-prefix") == 0 && (i + 1) < argc) {
+                modelPrefix = argv[i + 1];
+                i++;
+            } else if (strcmp(argv[i], "--eval") == 0 && (i + 1) < argc) {
+                evalFile = argv[i + 1];
+                i++;
+            } else if (strcmp(argv[i], "--threads") == 0 && (i + 1) < argc) {
+                numThreads = atoi(argv[i + 1]);
+                i++;
+            } else if (strcmp(argv[i], "--cache") == 0 && (i + 1) < argc) {
+                cacheEntries = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+                i++;
+            }
+        }
+        bool prometheus = hasFlag(argc, argv, "--prometheus");
+        
+        LMModel* model = createLMModel(4);
+        if (!model) {
+            printf("Error: Failed to create model\n");
+            return 1;
+        }
+        loadModel(model, modelPrefix);
+        model->useSkipGrams = hasFlag(argc, argv, "--skipgrams");
+        if (!setPredictCache(model, cacheEntries)) {
+            printf("Error: Failed to create prediction cache\n");
+            freeLMModel(model);
+            return 1;
+        }
+        
+        // Count the workload only, not the load
+        resetStats();
+        if (evalFile) {
+            EvalStats eval;
+            if (!evaluateFile(model, evalFile, 5, numThreads, &eval)) {
+                freeLMModel(model);
+                return 1;
+            }
+        }
+        StatsSnapshot snapshot;
+        readStats(&snapshot);
+        ModelMemoryStats memory;
+        modelMemoryStats(model, &memory);
+        
+        if (prometheus) {
+            size_t length = formatPrometheusStats(&snapshot, &memory, NULL, 0);
+            char* text = (char*)malloc(length + 1);
+            if (text) {
+                formatPrometheusStats(&snapshot, &memory, text, length + 1);
+                fputs(text, stdout);
+                free(text);
+            }
+        } else {
+            printStats(&snapshot, &memory);
+        }
         freeLMModel(model);
         
+    } else if (strcmp(command, "serve") == 0) {
+        const char* modelPrefix = DefaultModelPrefix;
+        uint32_t cacheEntries = 0;
+        ServeOptions options;
+        memset(&options, 0, sizeof(options));
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--model-prefix") == 0 && (i + 1) < argc) {
+                modelPrefix = argv[i + 1];
+                i++;
+            } else if (strcmp(argv[i], "--socket") == 0 && (i + 1) < argc) {
+                options.socketPath = argv[i + 1];
+                i++;
+            } else if (strcmp(argv[i], "--host") == 0 && (i + 1) < argc) {
+                options.host = argv[i + 1];
+                i++;
+            } else if (strcmp(argv[i], "--port") == 0 && (i + 1) < argc) {
+                options.port = atoi(argv[i + 1]);
+                i++;
+            } else if (strcmp(argv[i], "--threads") == 0 && (i + 1) < argc) {
+                options.numThreads = atoi(argv[i + 1]);
+                i++;
+            } else if (strcmp(argv[i], "--cache") == 0 && (i + 1) < argc) {
+                cacheEntries = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+                i++;
+            }
+        }
+        
+        // Load model once for every request
+        LMModel* model = createLMModel(4);
+        if (!model) {
+            printf("Error: Failed to create model\n");
+            return 1;
+        }
+        loadModel(model, modelPrefix);
+        model->useSkipGrams = hasFlag(argc, argv, "--skipgrams");
+        if (!setPredictCache(model, cacheEntries)) {
+            printf("Error: Failed to create prediction cache\n");
+            freeLMModel(model);
+            return 1;
+        }
+        
+        // Wrapped so SIGHUP can swap in a retrained model
+        ModelHandle* handle = createModelHandle(model);
+        if (!handle) {
+            printf("Error: Failed to create model\n");
+            freeLMModel(model);
+            return 1;
+        }
+        options.modelPrefix = modelPrefix;
+        int status = serveModel(handle, &options);
+        freeModelHandle(handle);
+        if (status != 0) return status;
+        
     } else {
         printf("Error: Unknown command '%s'\n", command);
         printUsage(argv[0]);
@@ -0,0 +1,579 @@
+#include "../include/serve.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// One client connection; owned by at most one worker at a time (EPOLLONESHOT)
+typedef struct ServeConnection {
+    int fd;
+    char in[ServeLineSize];
+    size_t inUsed;
+    char* out;                // responses not yet sent
+    size_t outUsed;
+    size_t outSent;
+    size_t outCapacity;
+    bool closing;             // answer nothing more; close once the queued responses are sent
+    bool eof;                 // the client sent everything it will send
+    struct ServeConnection* prev;
+    struct ServeConnection* next;
+} ServeConnection;
+
+typedef struct {
+    ModelHandle* handle;
+    const char* modelPrefix;  // reloaded on SIGHUP
+    int epollFd;
+    int listenFd;
+    int wakePipe[2];          // written on SIGINT/SIGTERM; readable means stop
+    int reloadPipe[2];        // 'h' per SIGHUP, 'q' to stop the reloader
+    pthread_mutex_t lock;     // guards the connection list
+    ServeConnection* connections;
+    _Atomic uint64_t requests;
+    _Atomic uint64_t accepted;
+} Server;
+
+// Registration tags for the two non-connection descriptors
+static int listenTag;
+static int wakeTag;
+
+static int stopFd = -1;
+static int reloadFd = -1;
+
+static void handleSignal(int sig) {
+    int saved = errno;
+    int fd = (sig == SIGHUP) ? reloadFd : stopFd;
+    if (fd >= 0 && write(fd, "h", 1) < 0) {
+        // Nothing to do: a full pipe already has a wake-up queued
+    }
+    errno = saved;
+}
+
+static bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Bind a listening Unix socket, replacing a stale socket file
+static int listenUnix(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("Failed to create socket");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        perror("Failed to listen on socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Bind a listening TCP socket to the first usable address of host:port
+static int listenTcp(const char* host, int port) {
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo* list = NULL;
+    int rc = getaddrinfo(host, service, &hints, &list);
+    if (rc != 0) {
+        fprintf(stderr, "Cannot resolve %s: %s\n", host, gai_strerror(rc));
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* ai = list; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, SOMAXCONN) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(list);
+    if (fd < 0) perror("Failed to listen on TCP port");
+    return fd;
+}
+
+// (Re-)arm a descriptor for one event delivery
+static bool armDescriptor(Server* server, int fd, void* tag, uint32_t events, bool add) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = tag;
+    return epoll_ctl(server->epollFd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+static void closeConnection(Server* server, ServeConnection* conn) {
+    pthread_mutex_lock(&server->lock);
+    if (conn->prev) conn->prev->next = conn->next;
+    else server->connections = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    pthread_mutex_unlock(&server->lock);
+
+    close(conn->fd);
+    free(conn->out);
+    free(conn);
+}
+
+// Accept every pending connection, then re-arm the listener
+static void acceptConnections(Server* server) {
+    while (1) {
+        int fd = accept(server->listenFd, NULL, NULL);
+        if (fd < 0) break;  // EAGAIN, or a connection that vanished
+
+        ServeConnection* conn = (ServeConnection*)calloc(1, sizeof(ServeConnection));
+        if (!conn || !setNonBlocking(fd)) {
+            free(conn);
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // fails harmlessly on Unix sockets
+        conn->fd = fd;
+
+        pthread_mutex_lock(&server->lock);
+        conn->next = server->connections;
+        if (conn->next) conn->next->prev = conn;
+        server->connections = conn;
+        pthread_mutex_unlock(&server->lock);
+
+        server->accepted++;
+        if (!armDescriptor(server, fd, conn, EPOLLIN | EPOLLRDHUP, true)) closeConnection(server, conn);
+    }
+    armDescriptor(server, server->listenFd, &listenTag, EPOLLIN, false);
+}
+
+// Room for `length` more response bytes; NULL if out of memory
+static char* reserveOutput(ServeConnection* conn, size_t length) {
+    if (conn->outUsed + length > conn->outCapacity) {
+        size_t capacity = conn->outCapacity ? conn->outCapacity : 4096;
+        while (capacity < conn->outUsed + length) capacity *= 2;
+        char* grown = (char*)realloc(conn->out, capacity);
+        if (!grown) return NULL;
+        conn->out = grown;
+        conn->outCapacity = capacity;
+    }
+    return conn->out + conn->outUsed;
+}
+
+static void appendOutput(ServeConnection* conn, const char* text, size_t length) {
+    char* out = reserveOutput(conn, length);
+    if (!out) {
+        conn->closing = true;
+        return;
+    }
+    memcpy(out, text, length);
+    conn->outUsed += length;
+}
+
+static void appendText(ServeConnection* conn, const char* text) {
+    appendOutput(conn, text, strlen(text));
+}
+
+// Parse a decimal integer word; advances *text past it and its trailing spaces
+static bool parseIntWord(char** text, long low, long high, long* value) {
+    char* end;
+    errno = 0;
+    long v = strtol(*text, &end, 10);
+    if (end == *text || errno != 0 || (*end != '\0' && !isspace((unsigned char)*end)) || v < low || v > high) {
+        return false;
+    }
+    while (isspace((unsigned char)*end)) end++;
+    *text = end;
+    *value = v;
+    return true;
+}
+
+static void handlePredict(const LMModel* model, ServeConnection* conn, char* args, PredictScratch* scratch) {
+    long k;
+    if (!parseIntWord(&args, 1, ServeMaxTopK, &k)) {
+        appendText(conn, "ERR usage: PREDICT <k 1-64> <context>\n");
+        return;
+    }
+    uint32_t topTokens[ServeMaxTopK] = { 0 };
+    float scores[ServeMaxTopK] = { 0 };
+    predictNextTokenScratch(model, args, topTokens, scores, (int)k, scratch);
+
+    int n = 0;
+    while (n < k && scores[n] > 0.0f) n++;
+    // Each pair is a token of under MaxWordLen bytes and a %.6g score
+    char* out = reserveOutput(conn, 32 + (size_t)n * (MaxWordLen + 24));
+    if (!out) {
+        conn->closing = true;
+        return;
+    }
+    size_t length = (size_t)sprintf(out, "OK %d", n);
+    for (int i = 0; i < n; i++) {
+        const char* token = getTokenById(model->vocab, topTokens[i]);
+        length += (size_t)sprintf(out + length, " %.*s %.6g", MaxWordLen, token ? token : "", scores[i]);
+    }
+    out[length++] = '\n';
+    conn->outUsed += length;
+}
+
+static void handleGenerate(const LMModel* model, ServeConnection* conn, char* args) {
+    long maxTokens;
+    char* end;
+    float temperature = 0.0f;
+    bool ok = parseIntWord(&args, 1, MaxGeneratedTokens, &maxTokens);
+    if (ok) {
+        temperature = strtof(args, &end);
+        ok = end != args && (*end == '\0' || isspace((unsigned char)*end)) && temperature >= 0.0f;
+        args = end;
+    }
+    if (!ok) {
+        appendText(conn, "ERR usage: GENERATE <max tokens 1-100> <temperature> <input>\n");
+        return;
+    }
+
+    char reply[GenerateOutputSize];
+    generateResponse(model, args, reply, (int)maxTokens, temperature);
+    // Replies are space-joined tokens, so they never contain a newline
+    size_t length = strlen(reply);
+    char* out = reserveOutput(conn, length + 5);
+    if (!out) {
+        conn->closing = true;
+        return;
+    }
+    memcpy(out, "OK ", 3);
+    memcpy(out + 3, reply, length);
+    out[3 + length] = '\n';
+    conn->outUsed += length + 4;
+}
+
+// Answer "GET /metrics" (an HTTP/1.x request line) in the Prometheus text
+// format, so a scraper can poll the request port; the headers that follow
+// are never read, since the connection closes after the response
+static void handleMetrics(Server* server, const ModelVersion* version, ServeConnection* conn, const char* args) {
+    size_t pathLength = strcspn(args, " ?");
+    if (pathLength != 8 || strncmp(args, "/metrics", 8) != 0) {
+        appendText(conn, "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\n"
+                         "Connection: close\r\n\r\nNot Found\n");
+        conn->closing = true;
+        return;
+    }
+
+    StatsSnapshot snapshot;
+    readStats(&snapshot);
+    ModelMemoryStats memory;
+    modelMemoryStats(version->model, &memory);
+    // The snapshot is fixed, so the measured length holds; 1 KiB more fits the serve counters
+    size_t capacity = formatPrometheusStats(&snapshot, &memory, NULL, 0) + 1024;
+    char* body = (char*)malloc(capacity);
+    if (!body) {
+        conn->closing = true;
+        return;
+    }
+    size_t length = formatPrometheusStats(&snapshot, &memory, body, capacity);
+    length += (size_t)snprintf(body + length, capacity - length,
+                               "# HELP cevia_serve_requests_total Request lines answered\n"
+                               "# TYPE cevia_serve_requests_total counter\ncevia_serve_requests_total %llu\n"
+                               "# HELP cevia_serve_connections_total Connections accepted\n"
+                               "# TYPE cevia_serve_connections_total counter\ncevia_serve_connections_total %llu\n"
+                               "# HELP cevia_model_generation Reloads since the server started\n"
+                               "# TYPE cevia_model_generation gauge\ncevia_model_generation %llu\n",
+                               (unsigned long long)server->requests, (unsigned long long)server->accepted,
+                               (unsigned long long)version->generation);
+
+    char header[160];
+    int headerLength = snprintf(header, sizeof(header),
+                                "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                "Content-Length: %zu\r\nConnection: close\r\n\r\n", length);
+    appendOutput(conn, header, (size_t)headerLength);
+    appendOutput(conn, body, length);
+    free(body);
+    conn->closing = true;
+}
+
+// Answer one request line (without its newline)
+static void handleRequest(Server* server, const ModelVersion* version, ServeConnection* conn, char* line,
+                          PredictScratch* scratch) {
+    const LMModel* model = version->model;
+    while (isspace((unsigned char)*line)) line++;
+    if (*line == '\0') return;  // blank lines get no response
+
+    char* args = line;
+    while (*args && !isspace((unsigned char)*args)) args++;
+    if (*args) *args++ = '\0';
+    while (isspace((unsigned char)*args)) args++;
+
+    server->requests++;
+    StatTimerStart(started);
+    if (strcasecmp(line, "PREDICT") == 0) {
+        handlePredict(model, conn, args, scratch);
+    } else if (strcasecmp(line, "GENERATE") == 0) {
+        handleGenerate(model, conn, args);
+    } else if (strcasecmp(line, "PING") == 0) {
+        appendText(conn, "OK\n");
+    } else if (strcasecmp(line, "INFO") == 0) {
+        char info[96];
+        int length = snprintf(info, sizeof(info), "OK %d %u %llu %llu\n", model->maxN,
+                              model->vocab ? model->vocab->size : 0, (unsigned long long)model->totalTokens,
+                              (unsigned long long)version->generation);
+        appendOutput(conn, info, (size_t)length);
+    } else if (strcasecmp(line, "QUIT") == 0) {
+        appendText(conn, "OK\n");
+        conn->closing = true;
+    } else if (strcmp(line, "GET") == 0) {
+        handleMetrics(server, version, conn, args);
+    } else {
+        appendText(conn, "ERR unknown command\n");
+    }
+    StatTimerStop(StatLatencyServeRequest, started);
+}
+
+// Answer every complete line in the input buffer, keeping a partial tail
+// One pass answers from one model version, even if a reload lands meanwhile.
+static void processInput(Server* server, ServeConnection* conn, PredictScratch* scratch) {
+    if (!memchr(conn->in, '\n', conn->inUsed)) {
+        if (conn->inUsed == sizeof(conn->in)) {
+            appendText(conn, "ERR line too long\n");
+            conn->closing = true;
+        }
+        return;
+    }
+    ModelVersion* version = acquireModel(server->handle);
+    size_t start = 0;
+    while (!conn->closing && conn->outUsed - conn->outSent < ServeMaxPending) {
+        char* newline = (char*)memchr(conn->in + start, '\n', conn->inUsed - start);
+        if (!newline) break;
+        *newline = '\0';
+        if (newline > conn->in + start && newline[-1] == '\r') newline[-1] = '\0';
+        handleRequest(server, version, conn, conn->in + start, scratch);
+        start = (size_t)(newline - conn->in) + 1;
+    }
+    releaseModel(version);
+    memmove(conn->in, conn->in + start, conn->inUsed - start);
+    conn->inUsed -= start;
+}
+
+// Send queued responses; false if the peer is gone
+static bool flushOutput(ServeConnection* conn) {
+    while (conn->outSent < conn->outUsed) {
+        ssize_t sent = send(conn->fd, conn->out + conn->outSent, conn->outUsed - conn->outSent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn->outSent += (size_t)sent;
+    }
+    conn->outUsed = 0;
+    conn->outSent = 0;
+    return true;
+}
+
+// Read what is available, answer it, and hand the connection back to epoll
+static void serviceConnection(Server* server, ServeConnection* conn, uint32_t events, PredictScratch* scratch) {
+    bool alive = !(events & EPOLLERR);
+
+    if (alive && !conn->closing && !conn->eof && conn->outUsed - conn->outSent < ServeMaxPending) {
+        ssize_t got = recv(conn->fd, conn->in + conn->inUsed, sizeof(conn->in) - conn->inUsed, 0);
+        if (got > 0) {
+            conn->inUsed += (size_t)got;
+        } else if (got == 0) {
+            // Half-closed: answer what was sent, including an unterminated last line
+            if (conn->inUsed > 0 && conn->inUsed < sizeof(conn->in)) conn->in[conn->inUsed++] = '\n';
+            conn->eof = true;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            alive = false;
+        }
+    }
+    // Pipelined lines left over from an earlier pass are answered here too
+    if (alive) processInput(server, conn, scratch);
+    if (alive) alive = flushOutput(conn);
+
+    bool pending = conn->outUsed > conn->outSent;
+    bool finished = conn->closing || (conn->eof && !memchr(conn->in, '\n', conn->inUsed));
+    if (!alive || (finished && !pending)) {
+        closeConnection(server, conn);
+        return;
+    }
+
+    // A full output queue stops reading until the client catches up
+    uint32_t want = pending ? EPOLLOUT : 0;
+    if (!conn->closing && !conn->eof && conn->outUsed - conn->outSent < ServeMaxPending) want |= EPOLLIN | EPOLLRDHUP;
+    if (!armDescriptor(server, conn->fd, conn, want, false)) closeConnection(server, conn);
+}
+
+static void* serveWorker(void* arg) {
+    Server* server = (Server*)arg;
+    PredictScratch scratch = { 0 };
+    struct epoll_event events[16];
+
+    bool running = true;
+    while (running) {
+        int n = epoll_wait(server->epollFd, events, 16, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == &wakeTag) {
+                running = false;  // the pipe stays readable, so every worker sees it
+            } else if (tag == &listenTag) {
+                acceptConnections(server);
+            } else {
+                serviceConnection(server, (ServeConnection*)tag, events[i].events, &scratch);
+            }
+        }
+    }
+    freePredictScratch(&scratch);
+    return NULL;
+}
+
+// Reload the model on every SIGHUP, off the request path
+static void* reloadWorker(void* arg) {
+    Server* server = (Server*)arg;
+    char byte;
+    while (1) {
+        ssize_t got = read(server->reloadPipe[0], &byte, 1);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0 || byte == 'q') break;
+
+        printf("Reloading %s\n", server->modelPrefix);
+        fflush(stdout);
+        if (reloadModel(server->handle, server->modelPrefix)) {
+            ModelVersion* version = acquireModel(server->handle);
+            printf("Model generation %llu is live (%u tokens in vocabulary)\n",
+                   (unsigned long long)version->generation, version->model->vocab->size);
+            releaseModel(version);
+        }
+        fflush(stdout);
+    }
+    return NULL;
+}
+
+// Serve until SIGINT or SIGTERM; returns 0 on a clean shutdown
+int serveModel(ModelHandle* handle, const ServeOptions* options) {
+    ModelVersion* first = acquireModel(handle);
+    bool loaded = first && first->model->frozen;
+    releaseModel(first);
+    if (!loaded || !options) {
+        fprintf(stderr, "Cannot serve: no model loaded\n");
+        return 1;
+    }
+
+    Server server;
+    memset(&server, 0, sizeof(server));
+    server.handle = handle;
+    server.modelPrefix = options->modelPrefix;
+    server.epollFd = -1;
+    server.listenFd = -1;
+    server.wakePipe[0] = server.wakePipe[1] = -1;
+    server.reloadPipe[0] = server.reloadPipe[1] = -1;
+    pthread_mutex_init(&server.lock, NULL);
+
+    const char* host = options->host ? options->host : DefaultServeHost;
+    int port = options->port > 0 ? options->port : DefaultServePort;
+    int status = 1;
+    server.listenFd = options->socketPath ? listenUnix(options->socketPath) : listenTcp(host, port);
+    if (server.listenFd < 0) goto done;
+
+    struct epoll_event wake;
+    memset(&wake, 0, sizeof(wake));
+    wake.events = EPOLLIN;  // level-triggered and never drained: wakes every worker
+    wake.data.ptr = &wakeTag;
+    server.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (server.epollFd < 0 || pipe(server.wakePipe) != 0 || pipe(server.reloadPipe) != 0 ||
+        !setNonBlocking(server.listenFd) ||
+        !armDescriptor(&server, server.listenFd, &listenTag, EPOLLIN, true) ||
+        epoll_ctl(server.epollFd, EPOLL_CTL_ADD, server.wakePipe[0], &wake) != 0) {
+        perror("Failed to set up server");
+        goto done;
+    }
+
+    pthread_t reloader;
+    bool reloading = server.modelPrefix && pthread_create(&reloader, NULL, reloadWorker, &server) == 0;
+    stopFd = server.wakePipe[1];
+    reloadFd = reloading ? server.reloadPipe[1] : -1;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    if (reloading) sigaction(SIGHUP, &sa, NULL);
+
+    int numThreads = options->numThreads;
+    if (numThreads <= 0) numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (numThreads < 1) numThreads = 1;
+    if (numThreads > MaxServeThreads) numThreads = MaxServeThreads;
+
+    pthread_t threads[MaxServeThreads];
+    int started = 0;
+    while (started < numThreads && pthread_create(&threads[started], NULL, serveWorker, &server) == 0) started++;
+    if (started == 0) {
+        fprintf(stderr, "Failed to start server workers\n");
+    } else {
+        if (options->socketPath) printf("Serving on %s with %d workers\n", options->socketPath, started);
+        else printf("Serving on %s:%d with %d workers\n", host, port, started);
+        fflush(stdout);
+
+        for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+        printf("Server stopped: %llu requests on %llu connections\n", (unsigned long long)server.requests,
+               (unsigned long long)server.accepted);
+        ModelVersion* last = acquireModel(handle);
+        if (last->model->cache) {
+            PredictCacheStats cache;
+            predictCacheStats(last->model->cache, &cache);
+            printf("Prediction cache: %llu hits, %llu misses, %u of %u entries\n", (unsigned long long)cache.hits,
+                   (unsigned long long)cache.misses, cache.entries, cache.capacity);
+        }
+        releaseModel(last);
+        status = 0;
+    }
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    stopFd = -1;
+    reloadFd = -1;
+    if (reloading) {
+        // A reload in progress finishes first
+        if (write(server.reloadPipe[1], "q", 1) == 1) pthread_join(reloader, NULL);
+        else pthread_detach(reloader);
+    }
+
+done:
+    while (server.connections) closeConnection(&server, server.connections);
+    if (server.listenFd >= 0) {
+        close(server.listenFd);
+        if (options->socketPath) unlink(options->socketPath);
+    }
+    if (server.epollFd >= 0) close(server.epollFd);
+    for (int i = 0; i < 2; i++) {
+        if (server.wakePipe[i] >= 0) close(server.wakePipe[i]);
+        if (server.reloadPipe[i] >= 0) close(server.reloadPipe[i]);
+    }
+    pthread_mutex_destroy(&server.lock);
+    return status;
+}
@@ -0,0 +1,189 @@
+#include "../include/arena.h"
+#include <stddef.h>
+
+static size_t alignSize(size_t size) {
+    return (size + (ArenaAlignment - 1)) & ~(size_t)(ArenaAlignment - 1);
+}
+
+// Create an empty arena; chunks are allocated on first use
+Arena* createArena(void) {
+    return (Arena*)calloc(1, sizeof(Arena));
+}
+
+static void freeChunkList(ArenaChunk* chunk) {
+    while (chunk) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+// Release every chunk at once
+void freeArena(Arena* arena) {
+    if (!arena) return;
+    freeChunkList(arena->chunks);
+    freeChunkList(arena->large);
+    free(arena);
+}
+
+// Carve bytes from the newest chunk, starting a new one when it is full
+static void* bumpAlloc(Arena* arena, size_t size, size_t align) {
+    ArenaChunk* chunk = arena->chunks;
+    size_t offset = chunk ? (chunk->used + (align - 1)) & ~(align - 1) : 0;
+    if (!chunk || offset + size > chunk->capacity) {
+        chunk = (ArenaChunk*)malloc(sizeof(ArenaChunk) + ArenaChunkSize);
+        if (!chunk) return NULL;
+        chunk->next = arena->chunks;
+        chunk->prev = NULL;
+        chunk->used = 0;
+        chunk->capacity = ArenaChunkSize;
+        arena->chunks = chunk;
+        arena->bytesReserved += ArenaChunkSize;
+        offset = 0;
+    }
+    chunk->used = offset + size;
+    return chunk->data + offset;
+}
+
+// Give a large block its own chunk so it can be returned to the system
+static void* largeAlloc(Arena* arena, size_t size) {
+    ArenaChunk* chunk = (ArenaChunk*)malloc(sizeof(ArenaChunk) + size);
+    if (!chunk) return NULL;
+    chunk->prev = NULL;
+    chunk->next = arena->large;
+    if (arena->large) arena->large->prev = chunk;
+    chunk->used = size;
+    chunk->capacity = size;
+    arena->large = chunk;
+    arena->bytesReserved += size;
+    return chunk->data;
+}
+
+static void largeFree(Arena* arena, void* block) {
+    ArenaChunk* chunk = (ArenaChunk*)((unsigned char*)block - offsetof(ArenaChunk, data));
+    if (chunk->prev) {
+        chunk->prev->next = chunk->next;
+    } else {
+        arena->large = chunk->next;
+    }
+    if (chunk->next) chunk->next->prev = chunk->prev;
+    arena->bytesReserved -= chunk->capacity;
+    free(chunk);
+}
+
+// Free list for an exact size; claims an empty slot if create is set
+static ArenaFreeList* findFreeList(Arena* arena, size_t size, bool create) {
+    for (int i = 0; i < ArenaSizeClasses; i++) {
+        ArenaFreeList* list = &arena->freeLists[i];
+        if (list->size == size) return list;
+        if (list->size == 0) {
+            if (!create) return NULL;
+            list->size = size;
+            return list;
+        }
+    }
+    return NULL;
+}
+
+// Allocate memory that lives until the arena is freed
+void* arenaAlloc(Arena* arena, size_t size) {
+    if (!arena) return NULL;
+    size = alignSize(size ? size : 1);
+
+    void* p = (size > ArenaLargeBlock) ? largeAlloc(arena, size) : bumpAlloc(arena, size, ArenaAlignment);
+    if (p) arena->bytesInUse += size;
+    return p;
+}
+
+// Allocate a block that may later be handed back with arenaFreeBlock
+void* arenaAllocBlock(Arena* arena, size_t size) {
+    if (!arena) return NULL;
+    size = alignSize(size ? size : 1);
+
+    void* p = NULL;
+    if (size > ArenaLargeBlock) {
+        p = largeAlloc(arena, size);
+    } else {
+        ArenaFreeList* list = findFreeList(arena, size, false);
+        if (list && list->head) {
+            ArenaBlock* block = list->head;
+            list->head = block->next;
+            p = block;
+        } else {
+            p = bumpAlloc(arena, size, ArenaAlignment);
+        }
+    }
+    if (p) arena->bytesInUse += size;
+    return p;
+}
+
+// Recycle a block from arenaAllocBlock for the next request of the same size
+void arenaFreeBlock(Arena* arena, void* block, size_t size) {
+    if (!arena || !block) return;
+    size = alignSize(size ? size : 1);
+    arena->bytesInUse -= size;
+
+    if (size > ArenaLargeBlock) {
+        largeFree(arena, block);
+        return;
+    }
+
+    // With every size class taken the block simply stays reserved
+    ArenaFreeList* list = findFreeList(arena, size, true);
+    if (!list) return;
+    ArenaBlock* node = (ArenaBlock*)block;
+    node->next = list->head;
+    list->head = node;
+}
+
+// Copy a string (length bytes plus NUL), packed without alignment padding
+const char* arenaStrdup(Arena* arena, const char* str, size_t length) {
+    if (!arena || !str) return NULL;
+
+    char* copy = (length + 1 > ArenaLargeBlock) ? (char*)largeAlloc(arena, length + 1)
+                                                : (char*)bumpAlloc(arena, length + 1, 1);
+    if (!copy) return NULL;
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    arena->bytesInUse += length + 1;
+    return copy;
+}
+
+// Move every chunk and free block of src into dst; src is left empty
+void arenaAdopt(Arena* dst, Arena* src) {
+    if (!dst || !src || dst == src) return;
+
+    // Regular chunks go behind dst's current chunk so it keeps bumping there
+    if (src->chunks) {
+        ArenaChunk* tail = src->chunks;
+        while (tail->next) tail = tail->next;
+        if (dst->chunks) {
+            tail->next = dst->chunks->next;
+            dst->chunks->next = src->chunks;
+        } else {
+            dst->chunks = src->chunks;
+        }
+    }
+
+    if (src->large) {
+        ArenaChunk* tail = src->large;
+        while (tail->next) tail = tail->next;
+        tail->next = dst->large;
+        if (dst->large) dst->large->prev = tail;
+        dst->large = src->large;
+    }
+
+    for (int i = 0; i < ArenaSizeClasses && src->freeLists[i].size; i++) {
+        ArenaFreeList* from = &src->freeLists[i];
+        ArenaFreeList* to = findFreeList(dst, from->size, true);
+        if (!to || !from->head) continue;
+        ArenaBlock* tail = from->head;
+        while (tail->next) tail = tail->next;
+        tail->next = to->head;
+        to->head = from->head;
+    }
+
+    dst->bytesReserved += src->bytesReserved;
+    dst->bytesInUse += src->bytesInUse;
+    memset(src, 0, sizeof(Arena));
+}
@@ -1,7 +1,13 @@
 #include "../include/cevia.h"
 #include "../include/lmModel.h"
+#include "../include/evaluate.h"
+#include "../include/threadPool.h"
+#include "../include/modelHandle.h"
 #include <string.h>
 
+// Contexts handed to a pool worker at a time
+#define PredictBatchGrain 32
+
 // Version information
 const char* cevia_version(void) {
     return "1.0.0";
@@ -20,7 +26,13 @@ void cevia_free(CeviaModel* model) {
 void cevia_train_from_file(CeviaModel* model, const char* corpus_file) {
     if (!model || !corpus_file) return;
     LMModel* lm = (LMModel*)model;
-    trainModel(lm, corpus_file);
+    trainFromFile(lm, corpus_file);
+}
+
+void cevia_train_parallel(CeviaModel* model, const char* corpus_file, int num_threads) {
+    if (!model || !corpus_file) return;
+    LMModel* lm = (LMModel*)model;
+    trainFromFileParallel(lm, corpus_file, num_threads);
 }
 
 void cevia_save(const CeviaModel* model, const char* prefix) {
@@ -28,11 +40,42 @@ void cevia_save(const CeviaModel* model, const char* prefix) {
     saveModel((const LMModel*)model, prefix);
 }
 
+int cevia_save_frozen(const CeviaModel* model, const char* path) {
+    if (!model || !path) return 0;
+    return saveFrozenModel((const LMModel*)model, path) ? 1 : 0;
+}
+
 void cevia_load(CeviaModel* model, const char* prefix) {
     if (!model || !prefix) return;
     loadModel((LMModel*)model, prefix);
 }
 
+// Hot reload
+CeviaHandle* cevia_handle_create(CeviaModel* model) {
+    return (CeviaHandle*)createModelHandle((LMModel*)model);
+}
+
+void cevia_handle_free(CeviaHandle* handle) {
+    freeModelHandle((ModelHandle*)handle);
+}
+
+CeviaSnapshot* cevia_acquire(CeviaHandle* handle) {
+    return (CeviaSnapshot*)acquireModel((ModelHandle*)handle);
+}
+
+const CeviaModel* cevia_snapshot_model(const CeviaSnapshot* snapshot) {
+    if (!snapshot) return NULL;
+    return (const CeviaModel*)((const ModelVersion*)snapshot)->model;
+}
+
+void cevia_release(CeviaSnapshot* snapshot) {
+    releaseModel((ModelVersion*)snapshot);
+}
+
+int cevia_reload(CeviaHandle* handle, const char* prefix) {
+    return reloadModel((ModelHandle*)handle, prefix) ? 1 : 0;
+}
+
 // Inference
 void cevia_predict(const CeviaModel* model,
                    const char* context,
@@ -55,6 +98,148 @@ void cevia_predict(const CeviaModel* model,
     }
 }
 
+void cevia_set_skipgrams(CeviaModel* model, int enabled) {
+    if (!model) return;
+    ((LMModel*)model)->useSkipGrams = (enabled != 0);
+}
+
+void cevia_set_specialized(CeviaModel* model, int enabled) {
+    if (!model) return;
+    setOrderKernels((LMModel*)model, enabled != 0);
+}
+
+int cevia_cache_enable(CeviaModel* model, size_t max_entries, size_t max_bytes) {
+    if (!model) return 0;
+    
+    // The tighter of the two limits wins
+    uint32_t entries = (max_entries > UINT32_MAX / 2) ? UINT32_MAX / 2 : (uint32_t)max_entries;
+    if (max_bytes > 0) {
+        uint32_t fit = predictCacheEntriesForBytes(max_bytes);
+        if (entries == 0 || fit < entries) entries = fit;
+        if (fit == 0) return 0;
+    }
+    return setPredictCache((LMModel*)model, entries) ? 1 : 0;
+}
+
+void cevia_cache_stats(const CeviaModel* model, CeviaCacheStats* stats) {
+    if (!stats) return;
+    
+    PredictCacheStats cache;
+    predictCacheStats(model ? ((const LMModel*)model)->cache : NULL, &cache);
+    stats->hits = cache.hits;
+    stats->misses = cache.misses;
+    stats->evictions = cache.evictions;
+    stats->entries = cache.entries;
+    stats->capacity = cache.capacity;
+    stats->bytes = cache.bytes;
+}
+
+// Shared state for one cevia_predict_batch call
+typedef struct {
+    const LMModel* model;
+    const char* const* contexts;
+    int k;
+    uint32_t* outIds;
+    float* outScores;
+} PredictBatchJob;
+
+// Predict contexts [begin, end) with one scratch area for the whole chunk
+static void predictBatchRange(void* ctx, size_t begin, size_t end) {
+    const PredictBatchJob* job = (const PredictBatchJob*)ctx;
+    PredictScratch scratch = {0};
+    
+    for (size_t i = begin; i < end; i++) {
+        uint32_t* ids = job->outIds + i * (size_t)job->k;
+        float* scores = job->outScores + i * (size_t)job->k;
+        // Rows stay zeroed when a context has no tokens
+        memset(ids, 0, sizeof(uint32_t) * (size_t)job->k);
+        memset(scores, 0, sizeof(float) * (size_t)job->k);
+        if (!job->contexts[i]) continue;
+        predictNextTokenScratch(job->model, job->contexts[i], ids, scores, job->k, &scratch);
+    }
+    
+    freePredictScratch(&scratch);
+}
+
+int cevia_predict_batch(const CeviaModel* model,
+                        const char* const* contexts,
+                        size_t n,
+                        int k,
+                        uint32_t* out_ids,
+                        float* out_scores) {
+    if (!model || !contexts || !out_ids || !out_scores || k <= 0) return -1;
+    
+    PredictBatchJob job;
+    job.model = (const LMModel*)model;
+    job.contexts = contexts;
+    job.k = k;
+    job.outIds = out_ids;
+    job.outScores = out_scores;
+    
+    threadPoolFor(sharedThreadPool(), n, PredictBatchGrain, predictBatchRange, &job);
+    return 0;
+}
+
+const char* cevia_token_text(const CeviaModel* model, uint32_t token_id) {
+    if (!model) return "<unk>";
+    return getTokenById(((const LMModel*)model)->vocab, token_id);
+}
+
+// Streaming context with its own prediction buffers
+struct CeviaCursor {
+    const LMModel* model;
+    PredictCursor cursor;
+    PredictScratch scratch;
+};
+
+CeviaCursor* cevia_cursor_create(const CeviaModel* model) {
+    if (!model) return NULL;
+    CeviaCursor* cursor = (CeviaCursor*)calloc(1, sizeof(CeviaCursor));
+    if (!cursor) return NULL;
+    cursor->model = (const LMModel*)model;
+    initPredictCursor(&cursor->cursor, cursor->model);
+    return cursor;
+}
+
+void cevia_cursor_free(CeviaCursor* cursor) {
+    if (!cursor) return;
+    freePredictScratch(&cursor->scratch);
+    free(cursor);
+}
+
+void cevia_cursor_reset(CeviaCursor* cursor) {
+    if (!cursor) return;
+    initPredictCursor(&cursor->cursor, cursor->model);
+}
+
+int cevia_cursor_push(CeviaCursor* cursor, const char* text) {
+    if (!cursor || !text) return 0;
+    
+    size_t length = strlen(text);
+    size_t pos = 0;
+    char word[MaxWordLen];
+    int pushed = 0;
+    while (scanToken(text, length, &pos, word) > 0) {
+        advancePredictCursor(&cursor->cursor, lookupToken(cursor->model->vocab, word));
+        pushed++;
+    }
+    return pushed;
+}
+
+void cevia_cursor_push_id(CeviaCursor* cursor, uint32_t token_id) {
+    if (!cursor) return;
+    advancePredictCursor(&cursor->cursor, token_id);
+}
+
+int cevia_cursor_predict(CeviaCursor* cursor, int k, uint32_t* out_ids, float* out_scores) {
+    if (!cursor || !out_ids || !out_scores || k <= 0) return -1;
+    
+    memset(out_ids, 0, sizeof(uint32_t) * (size_t)k);
+    memset(out_scores, 0, sizeof(float) * (size_t)k);
+    predictFromCursor(cursor->model, &cursor->cursor, out_ids, out_scores, k, &cursor->scratch);
+    return 0;
+}
+
 void cevia_generate(const CeviaModel* model,
                    const char* input,
                    char* output,
@@ -64,17 +249,94 @@ void cevia_generate(const CeviaModel* model,
     generateResponse((const LMModel*)model, input, output, max_tokens, temperature);
 }
 
+int cevia_generate_nbest(const CeviaModel* model,
+                         const char* input,
+                         char** outputs,
+                         float* scores,
+                         int n,
+                         int max_tokens,
+                         int beam_width) {
+    if (!model || !input || !outputs || n <= 0) return 0;
+    
+    const LMModel* lm = (const LMModel*)model;
+    GeneratedReply replies[MaxBeamWidth];
+    int found = generateNBest(lm, input, beam_width, max_tokens, replies, n);
+    
+    for (int i = 0; i < n; i++) {
+        if (!outputs[i]) continue;
+        if (i < found) {
+            formatReply(lm, &replies[i], outputs[i], GenerateOutputSize);
+        } else {
+            outputs[i][0] = '\0';
+        }
+        if (scores) scores[i] = (i < found) ? replies[i].score : 0.0f;
+    }
+    return found;
+}
+
 // Evaluation
 float cevia_evaluate(const CeviaModel* model,
                     const char* corpus_file,
                     int top_k) {
     if (!model || !corpus_file) return 0.0f;
+
+    EvalStats stats;
+    if (!evaluateFile((const LMModel*)model, corpus_file, top_k, 0, &stats)) return 0.0f;
+    return (float)evalHitRate(&stats);
+}
+
+// Statistics
+_Static_assert(MaxN == 5, "CeviaStats.backoff_depth must have MaxN entries");
+
+static void copyLatency(const StatHistogram* histogram, CeviaLatency* latency) {
+    latency->count = histogram->count;
+    latency->sum_ns = histogram->sumNanos;
+    latency->p50_ns = statQuantileNanos(histogram, 0.5);
+    latency->p99_ns = statQuantileNanos(histogram, 0.99);
+}
+
+void cevia_stats(const CeviaModel* model, CeviaStats* stats) {
+    if (!stats) return;
+    
+    StatsSnapshot snapshot;
+    readStats(&snapshot);
+    stats->enabled = snapshot.enabled ? 1 : 0;
+    stats->predictions = snapshot.counters[StatPredictions];
+    stats->predict_fallbacks = snapshot.counters[StatPredictFallback];
+    stats->predict_skipgrams = snapshot.counters[StatPredictSkipGrams];
+    stats->cursor_advances = snapshot.counters[StatCursorAdvances];
+    stats->child_searches = snapshot.counters[StatChildSearches];
+    stats->trie_lookups = snapshot.counters[StatTrieLookups];
+    stats->trie_nodes = snapshot.counters[StatTrieNodes];
+    stats->hash_lookups = snapshot.counters[StatHashLookups];
+    stats->hash_probes = snapshot.counters[StatHashProbes];
+    stats->generate_steps = snapshot.counters[StatGenerateSteps];
+    for (int d = 0; d < MaxN; d++) stats->backoff_depth[d] = snapshot.backoffDepth[d];
+    copyLatency(&snapshot.latency[StatLatencyPredict], &stats->predict);
+    copyLatency(&snapshot.latency[StatLatencyGenerateStep], &stats->generate_step);
+    copyLatency(&snapshot.latency[StatLatencyServeRequest], &stats->serve_request);
     
-    // This would need to be implemented based on existing eval logic
-    // For now, return 0.0
-    // TODO: Implement proper evaluation
-    (void)top_k;  // Suppress warning
-    return 0.0f;
+    ModelMemoryStats memory;
+    modelMemoryStats((const LMModel*)model, &memory);
+    stats->vocab_bytes = memory.vocabBytes;
+    stats->ngram_bytes = memory.ngramBytes;
+    stats->pattern_bytes = memory.patternBytes;
+    stats->skipgram_bytes = memory.skipGramBytes;
+    stats->frozen_bytes = memory.frozenBytes;
+    stats->cache_bytes = memory.cacheBytes;
+    stats->frozen_mapped = memory.frozenMapped ? 1 : 0;
+}
+
+void cevia_stats_reset(void) {
+    resetStats();
+}
+
+size_t cevia_stats_prometheus(const CeviaModel* model, char* out, size_t size) {
+    StatsSnapshot snapshot;
+    readStats(&snapshot);
+    ModelMemoryStats memory;
+    modelMemoryStats((const LMModel*)model, &memory);
+    return formatPrometheusStats(&snapshot, model ? &memory : NULL, out, size);
 }
 
 // Utilities
@@ -1,13 +1,35 @@
 #include "../include/common.h"
+#include "../include/arena.h"
+#include "../include/corpus.h"
+#include "../include/stats.h"
 
-// Hash function for strings (djb2 algorithm)
-uint32_t hashFunction(const char* str) {
-    uint32_t hash = 5381;
-    int c;
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+// Final avalanche for 64-bit values (splitmix64 finalizer)
+static inline uint64_t mixHash(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Hash a string eight bytes at a time; never returns 0 (the empty-slot marker)
+uint64_t hashString(const char* str, size_t length) {
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ ((uint64_t)length * 0xff51afd7ed558ccdULL);
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, str, 8);
+        hash = (hash ^ mixHash(word)) * 0x9e3779b97f4a7c15ULL;
+        str += 8;
+        length -= 8;
+    }
+    if (length > 0) {
+        uint64_t word = 0;
+        memcpy(&word, str, length);
+        hash = (hash ^ mixHash(word)) * 0x9e3779b97f4a7c15ULL;
     }
-    return hash % HashTableSize;
+    hash = mixHash(hash);
+    return hash ? hash : 1;
 }
 
 // Create a new hash map
@@ -15,62 +37,142 @@ HashMap* createHashMap() {
     HashMap* map = (HashMap*)malloc(sizeof(HashMap));
     if (!map) return NULL;
     
-    for (int i = 0; i < HashTableSize; i++) {
-        map->table[i] = NULL;
+    map->slots = (HashMapSlot*)calloc(HashMapInitialCapacity, sizeof(HashMapSlot));
+    if (!map->slots) {
+        free(map);
+        return NULL;
     }
+    map->capacity = HashMapInitialCapacity;
     map->size = 0;
+    map->keys = createArena();
+    if (!map->keys) {
+        free(map->slots);
+        free(map);
+        return NULL;
+    }
     return map;
 }
 
-// Insert or update a key-value pair (separate chaining)
-void hashMapPut(HashMap* map, const char* key, uint32_t value) {
-    if (!map || !key) return;
-    uint32_t index = hashFunction(key);
-    KeyValuePair* head = map->table[index];
-    // Check if key exists, update
-    for (KeyValuePair* p = head; p != NULL; p = p->next) {
-        if (strcmp(p->key, key) == 0) {
-            p->value = value;
+// Distance of the entry in slot pos from its home slot
+static inline uint32_t probeDistance(uint64_t hash, uint32_t pos, uint32_t mask) {
+    return (pos - (uint32_t)hash) & mask;
+}
+
+// Locate an existing key, NULL if absent
+static HashMapSlot* findSlot(const HashMap* map, const char* key, uint32_t length, uint64_t hash) {
+    uint32_t mask = map->capacity - 1;
+    uint32_t pos = (uint32_t)hash & mask;
+    HashMapSlot* found = NULL;
+    uint32_t dist = 0;
+    for (; ; dist++, pos = (pos + 1) & mask) {
+        HashMapSlot* slot = &map->slots[pos];
+        if (slot->hash == 0) break;
+        // Robin Hood invariant: a key is never stored past a poorer entry
+        if (probeDistance(slot->hash, pos, mask) < dist) break;
+        if (slot->hash == hash && slot->length == length && memcmp(slot->key, key, length) == 0) {
+            found = slot;
+            break;
+        }
+    }
+    StatCount(StatHashLookups);
+    StatAdd(StatHashProbes, dist + 1);
+    return found;
+}
+
+// Place an entry, displacing richer entries along the probe sequence
+static void insertSlot(HashMapSlot* slots, uint32_t capacity, HashMapSlot entry) {
+    uint32_t mask = capacity - 1;
+    uint32_t pos = (uint32_t)entry.hash & mask;
+    uint32_t dist = 0;
+    while (1) {
+        HashMapSlot* slot = &slots[pos];
+        if (slot->hash == 0) {
+            *slot = entry;
             return;
         }
+        uint32_t slotDist = probeDistance(slot->hash, pos, mask);
+        if (slotDist < dist) {
+            HashMapSlot displaced = *slot;
+            *slot = entry;
+            entry = displaced;
+            dist = slotDist;
+        }
+        pos = (pos + 1) & mask;
+        dist++;
+    }
+}
+
+// Make room for count keys while keeping the load factor at or below 3/4
+bool hashMapReserve(HashMap* map, uint32_t count) {
+    if (!map) return false;
+    
+    uint64_t needed = (uint64_t)count + count / 3 + 1;
+    uint64_t capacity = map->capacity;
+    while (capacity < needed) capacity *= 2;
+    if (capacity == map->capacity) return true;
+    if (capacity > 0x80000000ULL) return false;
+    
+    HashMapSlot* slots = (HashMapSlot*)calloc((size_t)capacity, sizeof(HashMapSlot));
+    if (!slots) return false;
+    
+    // Cached hashes make rehashing a pure move
+    for (uint32_t i = 0; i < map->capacity; i++) {
+        if (map->slots[i].hash) insertSlot(slots, (uint32_t)capacity, map->slots[i]);
     }
-    // Insert new node at head
-    KeyValuePair* node = (KeyValuePair*)malloc(sizeof(KeyValuePair));
-    if (!node) return;
-    node->key = strdup(key);
-    if (!node->key) { free(node); return; }
-    node->value = value;
-    node->next = head;
-    map->table[index] = node;
+    free(map->slots);
+    map->slots = slots;
+    map->capacity = (uint32_t)capacity;
+    return true;
+}
+
+// Insert or update a key-value pair; returns the interned key, NULL on failure
+const char* hashMapPut(HashMap* map, const char* key, uint32_t value) {
+    if (!map || !key) return NULL;
+    
+    size_t length = strlen(key);
+    if (length >= UINT32_MAX) return NULL;
+    uint64_t hash = hashString(key, length);
+    
+    HashMapSlot* slot = findSlot(map, key, (uint32_t)length, hash);
+    if (slot) {
+        slot->value = value;
+        return slot->key;
+    }
+    
+    if (!hashMapReserve(map, map->size + 1)) return NULL;
+    const char* interned = arenaStrdup(map->keys, key, length);
+    if (!interned) return NULL;
+    
+    HashMapSlot entry = { hash, interned, (uint32_t)length, value };
+    insertSlot(map->slots, map->capacity, entry);
     map->size++;
+    return interned;
+}
+
+// Look up a key; false if absent
+bool hashMapFind(const HashMap* map, const char* key, uint32_t* value) {
+    if (!map || !key) return false;
+    
+    size_t length = strlen(key);
+    if (length >= UINT32_MAX) return false;
+    const HashMapSlot* slot = findSlot(map, key, (uint32_t)length, hashString(key, length));
+    if (!slot) return false;
+    if (value) *value = slot->value;
+    return true;
 }
 
 // Get value by key, returns 0 if not found
-uint32_t hashMapGet(HashMap* map, const char* key) {
-    if (!map || !key) return 0;
-    uint32_t index = hashFunction(key);
-    KeyValuePair* p = map->table[index];
-    while (p) {
-        if (strcmp(p->key, key) == 0) return p->value;
-        p = p->next;
-    }
-    return 0; // Not found
+uint32_t hashMapGet(const HashMap* map, const char* key) {
+    uint32_t value = 0;
+    return hashMapFind(map, key, &value) ? value : 0;
 }
 
 // Free hash map memory
 void freeHashMap(HashMap* map) {
     if (!map) return;
     
-    for (int i = 0; i < HashTableSize; i++) {
-        KeyValuePair* p = map->table[i];
-        while (p) {
-            KeyValuePair* nxt = p->next;
-            if (p->key) free(p->key);
-            free(p);
-            p = nxt;
-        }
-        map->table[i] = NULL;
-    }
+    freeArena(map->keys);
+    free(map->slots);
     free(map);
 }
 
@@ -81,45 +183,15 @@ Sentence initSentence(void) {
     return s;
 }
 
-// Add a token to a sentence
-Sentence addToken(Sentence s, const char word[]) {
-    if (s.length < MaxTokens) {
-        // Ensure the string is null-terminated without triggering truncation warnings
-        size_t wordLen = strlen(word);
-        size_t copyLen = (wordLen < MaxWordLen) ? wordLen : (MaxWordLen - 1);
-        if (copyLen > 0) {
-            memcpy(s.sequence[s.length].text, word, copyLen);
-        }
-        s.sequence[s.length].text[copyLen] = '\0';
-        s.length++;
-    }
-    return s;
-}
-
-// Tokenize a line of text into a sentence
+// Tokenize a C string, appending up to MaxTokens tokens to a sentence
+// Uses the same rules as tokenizeText so contexts match the training data.
 void tokenizeLine(const char line[], Sentence* s) {
     if (!line || !s) return;
     
-    int i = 0, j = 0;
-    char word[MaxWordLen] = {0};
-    
-    while (line[i] != '\0' && j < MaxWordLen - 1) {
-        if (isspace((unsigned char)line[i]) || ispunct((unsigned char)line[i])) {
-            if (j > 0) {
-                word[j] = '\0';
-                *s = addToken(*s, word);
-                j = 0;
-            }
-        } else {
-            // Normalize to lowercase for consistent vocabulary
-            word[j++] = (char)tolower((unsigned char)line[i]);
-        }
-        i++;
-    }
-    
-    // Add the last word if exists
-    if (j > 0) {
-        word[j] = '\0';
-        *s = addToken(*s, word);
+    size_t length = strlen(line);
+    size_t pos = 0;
+    while (s->length < MaxTokens &&
+           scanToken(line, length, &pos, s->sequence[s->length].text) > 0) {
+        s->length++;
     }
 }
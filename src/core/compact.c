@@ -0,0 +1,456 @@
+#include "../include/compact.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Child runs at or below this size are scanned linearly; larger runs use binary search
+#define LinearSearchThreshold 8
+
+// Sections of one level; offsets are 0 for absent sections
+typedef struct {
+    uint64_t tokenOff;
+    uint64_t countOff;
+    uint64_t countEscapeOff;    // uint64_t bitmap, then uint32_t rank per word
+    uint64_t countOverflowOff;
+    uint64_t childOff;
+    uint64_t totalOff;
+    uint64_t totalEscapeOff;
+    uint64_t totalOverflowOff;
+    uint64_t rankOff;
+    uint32_t size;
+    uint32_t tokenBits;
+    uint32_t countBits;
+    uint32_t countOverflow;
+    uint32_t childBits;
+    uint32_t totalBits;
+    uint32_t totalOverflow;
+    uint32_t rankBits;
+} CompactLevelHeader;
+
+// On-disk header; all offsets are byte offsets from the start of the image
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t maxN;
+    uint64_t totalTokens;
+    uint64_t totalNgrams;
+    uint64_t imageSize;
+    uint32_t vocabSize;
+    uint32_t reserved;
+    CompactLevelHeader levels[MaxN];
+} CompactFileHeader;
+
+// Bits needed for values up to maxValue (at least one)
+static uint32_t bitsFor(uint64_t maxValue) {
+    return maxValue ? 64 - (uint32_t)__builtin_clzll(maxValue) : 1;
+}
+
+// Packed words plus one word of padding for the straddling read
+static uint64_t packedBytes(uint64_t n, uint32_t bits) {
+    return ((n * bits + 63) / 64 + 1) * sizeof(uint64_t);
+}
+
+static uint64_t escapeWords(uint64_t n) {
+    return (n + 63) / 64;
+}
+
+// Escape bitmap plus its rank table, rounded up to whole words
+static uint64_t escapeBytes(uint64_t n) {
+    uint64_t words = escapeWords(n);
+    return words * sizeof(uint64_t) + (words * sizeof(uint32_t) + 7) / 8 * 8;
+}
+
+static uint64_t maxValue(const uint32_t* values, uint64_t n) {
+    uint32_t largest = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        if (values[i] > largest) largest = values[i];
+    }
+    return largest;
+}
+
+// OR a value into zeroed packed words
+static void packedSet(uint64_t* words, uint32_t bits, uint64_t i, uint32_t value) {
+    uint64_t bit = i * bits;
+    unsigned shift = (unsigned)(bit & 63);
+    words[bit >> 6] |= (uint64_t)value << shift;
+    if (shift + bits > 64) words[(bit >> 6) + 1] |= (uint64_t)value >> (64 - shift);
+}
+
+// Width that minimizes inline bits plus escapes; sets the escape count
+static uint32_t chooseCountBits(const uint32_t* values, uint64_t n, uint32_t* numOverflow) {
+    // A value stays inline at width b if value + 1 fits, keeping all ones free as the escape
+    uint64_t histogram[34] = { 0 };
+    for (uint64_t i = 0; i < n; i++) histogram[bitsFor((uint64_t)values[i] + 1)]++;
+
+    uint32_t best = 32;
+    uint64_t bestCost = UINT64_MAX;
+    uint64_t fits = histogram[0];
+    for (uint32_t bits = 1; bits <= 32; bits++) {
+        fits += histogram[bits];
+        uint64_t escaped = n - fits;
+        uint64_t cost = n * bits + (escaped ? escapeBytes(n) * 8 + escaped * 32 : 0);
+        if (cost < bestCost) {
+            bestCost = cost;
+            best = bits;
+            *numOverflow = (uint32_t)escaped;
+        }
+    }
+    return best;
+}
+
+// Reserve the sections of a counts column
+static uint64_t layoutCounts(uint64_t offset, const uint32_t* values, uint64_t n, uint32_t* bits,
+                             uint32_t* overflow, uint64_t* valueOff, uint64_t* escapeOff,
+                             uint64_t* overflowOff) {
+    *bits = chooseCountBits(values, n, overflow);
+    *valueOff = offset;
+    offset += packedBytes(n, *bits);
+    if (*overflow > 0) {
+        *escapeOff = offset;
+        offset += escapeBytes(n);
+        *overflowOff = offset;
+        offset += ((uint64_t)*overflow * sizeof(uint32_t) + 7) / 8 * 8;
+    }
+    return offset;
+}
+
+static void fillPacked(unsigned char* image, uint64_t offset, uint32_t bits,
+                       const uint32_t* values, uint64_t n) {
+    uint64_t* words = (uint64_t*)(image + offset);
+    for (uint64_t i = 0; i < n; i++) packedSet(words, bits, i, values[i]);
+}
+
+static void fillCounts(unsigned char* image, uint64_t valueOff, uint64_t escapeOff, uint64_t overflowOff,
+                       uint32_t bits, const uint32_t* values, uint64_t n) {
+    uint64_t* words = (uint64_t*)(image + valueOff);
+    uint32_t escape = (uint32_t)((1ull << bits) - 1);
+    uint64_t* escaped = escapeOff ? (uint64_t*)(image + escapeOff) : NULL;
+    uint32_t* rank = escapeOff ? (uint32_t*)(image + escapeOff + escapeWords(n) * sizeof(uint64_t)) : NULL;
+    uint32_t* overflow = overflowOff ? (uint32_t*)(image + overflowOff) : NULL;
+
+    uint32_t numEscaped = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        if (escaped && (i & 63) == 0) rank[i >> 6] = numEscaped;
+        if (escaped && values[i] >= escape) {
+            packedSet(words, bits, i, escape);
+            escaped[i >> 6] |= 1ull << (i & 63);
+            overflow[numEscaped++] = values[i];
+        } else {
+            packedSet(words, bits, i, values[i]);
+        }
+    }
+}
+
+// Point a counts column at its sections; false if they do not fit the image
+static bool attachCounts(PackedCounts* counts, const unsigned char* image, size_t size, uint64_t n,
+                         uint32_t bits, uint32_t numOverflow, uint64_t valueOff,
+                         uint64_t escapeOff, uint64_t overflowOff) {
+    memset(counts, 0, sizeof(PackedCounts));
+    if (bits < 1 || bits > 32 || valueOff + packedBytes(n, bits) > size) return false;
+    counts->values.words = (const uint64_t*)(image + valueOff);
+    counts->values.bits = bits;
+    if (numOverflow == 0) return true;
+
+    if (escapeOff + escapeBytes(n) > size || overflowOff + (uint64_t)numOverflow * sizeof(uint32_t) > size) {
+        return false;
+    }
+    counts->escaped = (const uint64_t*)(image + escapeOff);
+    counts->escapeRank = (const uint32_t*)(image + escapeOff + escapeWords(n) * sizeof(uint64_t));
+    counts->overflow = (const uint32_t*)(image + overflowOff);
+    counts->numOverflow = numOverflow;
+
+    // Ranks must agree with the bitmap so lookups stay inside the overflow array
+    uint32_t seen = 0;
+    for (uint64_t w = 0; w < escapeWords(n); w++) {
+        if (counts->escapeRank[w] != seen) return false;
+        seen += (uint32_t)__builtin_popcountll(counts->escaped[w]);
+    }
+    return seen == numOverflow;
+}
+
+static bool attachPacked(PackedArray* array, const unsigned char* image, size_t size, uint64_t n,
+                         uint32_t bits, uint64_t offset) {
+    if (bits < 1 || bits > 32 || offset + packedBytes(n, bits) > size) return false;
+    array->words = (const uint64_t*)(image + offset);
+    array->bits = bits;
+    return true;
+}
+
+// Fill in the runtime view from the header of a validated image
+static CompactIndex* createCompactView(const unsigned char* image, size_t size, bool mapped) {
+    if (!image || size < sizeof(CompactFileHeader)) return NULL;
+
+    const CompactFileHeader* header = (const CompactFileHeader*)image;
+    if (memcmp(header->magic, CompactMagic, sizeof(header->magic)) != 0 ||
+        header->version != CompactVersion || header->imageSize != size ||
+        header->maxN < 1 || header->maxN > MaxN) {
+        fprintf(stderr, "Corrupt compact model image\n");
+        return NULL;
+    }
+
+    CompactIndex* index = (CompactIndex*)calloc(1, sizeof(CompactIndex));
+    if (!index) return NULL;
+
+    index->maxN = (int)header->maxN;
+    index->totalTokens = header->totalTokens;
+    index->totalNgrams = header->totalNgrams;
+    index->vocabSize = header->vocabSize;
+    bool ok = true;
+    for (int l = 0; ok && l < index->maxN; l++) {
+        const CompactLevelHeader* lh = &header->levels[l];
+        CompactLevel* level = &index->levels[l];
+        uint64_t n = lh->size;
+        level->size = lh->size;
+        ok = attachPacked(&level->tokenIds, image, size, n, lh->tokenBits, lh->tokenOff) &&
+             attachCounts(&level->counts, image, size, n, lh->countBits, lh->countOverflow,
+                          lh->countOff, lh->countEscapeOff, lh->countOverflowOff) &&
+             attachPacked(&level->rankOffsets, image, size, n, lh->rankBits, lh->rankOff);
+        if (ok && l + 1 < index->maxN) {
+            ok = attachPacked(&level->firstChild, image, size, n + 1, lh->childBits, lh->childOff) &&
+                 attachCounts(&level->childTotals, image, size, n, lh->totalBits, lh->totalOverflow,
+                              lh->totalOff, lh->totalEscapeOff, lh->totalOverflowOff);
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Corrupt compact model image\n");
+        free(index);
+        return NULL;
+    }
+    index->image = image;
+    index->imageSize = size;
+    index->mapped = mapped;
+    return index;
+}
+
+// Pack a frozen index into a heap-backed compact image
+CompactIndex* compactFrozenIndex(const FrozenIndex* frozen) {
+    if (!frozen || frozen->maxN < 1) return NULL;
+
+    CompactFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CompactMagic, sizeof(header.magic));
+    header.version = CompactVersion;
+    header.maxN = (uint32_t)frozen->maxN;
+    header.totalTokens = frozen->totalTokens;
+    header.totalNgrams = frozen->totalNgrams;
+    header.vocabSize = frozen->vocabSize;
+
+    // Ranks relative to their group, level by level
+    uint32_t* rankOffsets[MaxN] = { NULL };
+    bool ok = true;
+    for (int l = 0; ok && l < frozen->maxN; l++) {
+        const FrozenLevel* lv = &frozen->levels[l];
+        rankOffsets[l] = (uint32_t*)malloc(((size_t)lv->size + 1) * sizeof(uint32_t));
+        if (!rankOffsets[l]) {
+            ok = false;
+            break;
+        }
+        if (l == 0) {
+            memcpy(rankOffsets[0], lv->ranked, (size_t)lv->size * sizeof(uint32_t));
+            continue;
+        }
+        const FrozenLevel* parent = &frozen->levels[l - 1];
+        for (uint32_t p = 0; p < parent->size; p++) {
+            for (uint32_t r = parent->firstChild[p]; r < parent->firstChild[p + 1]; r++) {
+                rankOffsets[l][r] = lv->ranked[r] - parent->firstChild[p];
+            }
+        }
+    }
+
+    // Lay out the sections
+    uint64_t offset = (sizeof(CompactFileHeader) + 7) / 8 * 8;
+    for (int l = 0; ok && l < frozen->maxN; l++) {
+        const FrozenLevel* lv = &frozen->levels[l];
+        CompactLevelHeader* lh = &header.levels[l];
+        uint64_t n = lv->size;
+        bool hasChildren = (l + 1 < frozen->maxN);
+
+        lh->size = lv->size;
+        lh->tokenBits = bitsFor(maxValue(lv->tokenIds, n));
+        lh->tokenOff = offset;
+        offset += packedBytes(n, lh->tokenBits);
+        offset = layoutCounts(offset, lv->counts, n, &lh->countBits, &lh->countOverflow,
+                              &lh->countOff, &lh->countEscapeOff, &lh->countOverflowOff);
+        if (hasChildren) {
+            lh->childBits = bitsFor(frozen->levels[l + 1].size);
+            lh->childOff = offset;
+            offset += packedBytes(n + 1, lh->childBits);
+            offset = layoutCounts(offset, lv->childTotals, n, &lh->totalBits, &lh->totalOverflow,
+                                  &lh->totalOff, &lh->totalEscapeOff, &lh->totalOverflowOff);
+        }
+        lh->rankBits = bitsFor(maxValue(rankOffsets[l], n));
+        lh->rankOff = offset;
+        offset += packedBytes(n, lh->rankBits);
+    }
+    header.imageSize = offset;
+
+    unsigned char* image = ok ? (unsigned char*)calloc(1, (size_t)offset) : NULL;
+    if (image) {
+        memcpy(image, &header, sizeof(header));
+        for (int l = 0; l < frozen->maxN; l++) {
+            const FrozenLevel* lv = &frozen->levels[l];
+            const CompactLevelHeader* lh = &header.levels[l];
+            uint64_t n = lv->size;
+            fillPacked(image, lh->tokenOff, lh->tokenBits, lv->tokenIds, n);
+            fillCounts(image, lh->countOff, lh->countEscapeOff, lh->countOverflowOff,
+                       lh->countBits, lv->counts, n);
+            if (l + 1 < frozen->maxN) {
+                fillPacked(image, lh->childOff, lh->childBits, lv->firstChild, n + 1);
+                fillCounts(image, lh->totalOff, lh->totalEscapeOff, lh->totalOverflowOff,
+                           lh->totalBits, lv->childTotals, n);
+            }
+            fillPacked(image, lh->rankOff, lh->rankBits, rankOffsets[l], n);
+        }
+    }
+    for (int l = 0; l < MaxN; l++) free(rankOffsets[l]);
+    if (!image) return NULL;
+
+    CompactIndex* index = createCompactView(image, (size_t)offset, false);
+    if (!index) free(image);
+    return index;
+}
+
+// Map a compact image read-only; NULL if absent or invalid
+CompactIndex* mapCompactFile(const char* filename) {
+    if (!filename) return NULL;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CompactFileHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Failed to map compact model file");
+        return NULL;
+    }
+
+    CompactIndex* index = createCompactView((const unsigned char*)map, size, true);
+    if (!index) munmap(map, size);
+    return index;
+}
+
+// Write the image bytes unchanged
+bool writeCompactFile(const CompactIndex* index, const char* filename) {
+    if (!index || !filename) return false;
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        perror("Failed to create compact model file");
+        return false;
+    }
+    bool ok = fwrite(index->image, 1, index->imageSize, file) == index->imageSize;
+    if (fclose(file) != 0) ok = false;
+    if (!ok) perror("Failed to write compact model file");
+    return ok;
+}
+
+void freeCompactIndex(CompactIndex* index) {
+    if (!index) return;
+
+    if (index->mapped) {
+        munmap((void*)index->image, index->imageSize);
+    } else {
+        free((void*)index->image);
+    }
+    free(index);
+}
+
+static uint64_t countsBytes(const PackedCounts* counts, uint64_t n) {
+    if (!counts->values.words) return 0;
+    uint64_t bytes = packedBytes(n, counts->values.bits);
+    if (counts->numOverflow > 0) {
+        bytes += escapeBytes(n) + ((uint64_t)counts->numOverflow * sizeof(uint32_t) + 7) / 8 * 8;
+    }
+    return bytes;
+}
+
+// Image bytes spent on one level (all of its columns)
+size_t compactLevelBytes(const CompactIndex* index, int level) {
+    if (!index || level < 0 || level >= index->maxN) return 0;
+
+    const CompactLevel* lv = &index->levels[level];
+    uint64_t n = lv->size;
+    uint64_t bytes = packedBytes(n, lv->tokenIds.bits) + packedBytes(n, lv->rankOffsets.bits) +
+                     countsBytes(&lv->counts, n) + countsBytes(&lv->childTotals, n);
+    if (lv->firstChild.words) bytes += packedBytes(n + 1, lv->firstChild.bits);
+    return (size_t)bytes;
+}
+
+// Find tokenId among entries [begin, end) of a level; FrozenNotFound if absent
+uint32_t compactFindChild(const CompactIndex* index, int level, uint32_t begin, uint32_t end, uint32_t tokenId) {
+    const PackedArray* ids = &index->levels[level].tokenIds;
+    uint32_t lo = begin;
+    uint32_t hi = end;
+
+    while (hi - lo > LinearSearchThreshold) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (packedGet(ids, mid) < tokenId) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    while (lo < hi && packedGet(ids, lo) < tokenId) lo++;
+    return (lo < end && packedGet(ids, lo) == tokenId) ? lo : FrozenNotFound;
+}
+
+// Children of entry `entry` in `level` as a range of level + 1; false if none
+bool compactChildRange(const CompactIndex* index, int level, uint32_t entry, uint32_t* begin, uint32_t* end) {
+    if (!index || level + 1 >= index->maxN) return false;
+
+    const PackedArray* firstChild = &index->levels[level].firstChild;
+    *begin = packedGet(firstChild, entry);
+    *end = packedGet(firstChild, (uint64_t)entry + 1);
+    return *end > *begin;
+}
+
+// Find the entry for an n-gram of length n (stored in level n - 1)
+uint32_t compactFindPrefix(const CompactIndex* index, const uint32_t* tokens, int n) {
+    if (!index || !tokens || n < 1 || n > index->maxN) return FrozenNotFound;
+
+    uint32_t entry = compactFindChild(index, 0, 0, index->levels[0].size, tokens[0]);
+    for (int l = 1; l < n && entry != FrozenNotFound; l++) {
+        uint32_t begin, end;
+        if (!compactChildRange(index, l - 1, entry, &begin, &end)) return FrozenNotFound;
+        entry = compactFindChild(index, l, begin, end, tokens[l]);
+    }
+    return entry;
+}
+
+// True if every column of every level reads back as in the frozen index
+bool verifyCompactIndex(const CompactIndex* index, const FrozenIndex* frozen) {
+    if (!index || !frozen || index->maxN != frozen->maxN) return false;
+
+    for (int l = 0; l < frozen->maxN; l++) {
+        const FrozenLevel* lv = &frozen->levels[l];
+        if (index->levels[l].size != lv->size) return false;
+        bool hasChildren = (l + 1 < frozen->maxN);
+        for (uint32_t i = 0; i < lv->size; i++) {
+            if (compactToken(index, l, i) != lv->tokenIds[i] || compactCount(index, l, i) != lv->counts[i]) {
+                return false;
+            }
+            if (hasChildren) {
+                uint32_t begin, end;
+                compactChildRange(index, l, i, &begin, &end);
+                if (begin != lv->firstChild[i] || end != lv->firstChild[i + 1] ||
+                    compactChildTotal(index, l, i) != lv->childTotals[i]) {
+                    return false;
+                }
+                for (uint32_t r = begin; r < end; r++) {
+                    if (compactRanked(index, l + 1, begin, r) != frozen->levels[l + 1].ranked[r]) return false;
+                }
+            }
+        }
+    }
+    for (uint32_t r = 0; r < frozen->levels[0].size; r++) {
+        if (compactRanked(index, 0, 0, r) != frozen->levels[0].ranked[r]) return false;
+    }
+    return true;
+}
@@ -0,0 +1,343 @@
+#include "../include/corpus.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Upper bound on spans per line, keeping counts within an int
+#define MaxTokenSpans (1u << 30)
+
+// Open a corpus file, or standard input for "-"
+// Returns NULL with errno set if the file cannot be opened.
+CorpusReader* openCorpus(const char* path) {
+    if (!path) return NULL;
+
+    CorpusReader* reader = (CorpusReader*)calloc(1, sizeof(CorpusReader));
+    if (!reader) return NULL;
+
+    bool useStdin = (strcmp(path, CorpusStdin) == 0);
+    reader->fd = useStdin ? STDIN_FILENO : open(path, O_RDONLY);
+    if (reader->fd < 0) {
+        int saved = errno;
+        free(reader);
+        errno = saved;
+        return NULL;
+    }
+    reader->ownsFd = !useStdin;
+
+    // Regular files are mapped whole; pipes fall through to chunked reads
+    struct stat st;
+    if (fstat(reader->fd, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t)st.st_size <= SIZE_MAX) {
+        if (st.st_size == 0) {
+            reader->eof = true;
+            return reader;
+        }
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            reader->mapped = true;
+            reader->eof = true;
+            reader->data = (const char*)map;
+            reader->size = (size_t)st.st_size;
+        }
+    }
+    return reader;
+}
+
+// Close the corpus and release its mapping or buffer
+void closeCorpus(CorpusReader* reader) {
+    if (!reader) return;
+    if (reader->mapped) {
+        munmap((void*)reader->data, reader->size);
+    }
+    if (reader->ownsFd) {
+        close(reader->fd);
+    }
+    free(reader->buffer);
+    free(reader);
+}
+
+// Append more of the stream after the unconsumed bytes; false at end of input
+static bool fillCorpus(CorpusReader* reader, size_t want) {
+    if (reader->eof) return false;
+
+    // Move the unconsumed tail to the front
+    size_t unread = reader->size - reader->pos;
+    if (reader->pos > 0) {
+        memmove(reader->buffer, reader->buffer + reader->pos, unread);
+        reader->size = unread;
+        reader->pos = 0;
+    }
+
+    size_t needed = ((unread > want) ? unread : want) + CorpusReadSize;
+    if (needed > reader->capacity) {
+        size_t capacity = (reader->capacity * 2 > needed) ? reader->capacity * 2 : needed;
+        char* grown = (char*)realloc(reader->buffer, capacity);
+        if (!grown) {
+            fprintf(stderr, "Out of memory reading corpus\n");
+            reader->eof = true;
+            return false;
+        }
+        reader->buffer = grown;
+        reader->capacity = capacity;
+    }
+    reader->data = reader->buffer;
+
+    ssize_t got;
+    do {
+        got = read(reader->fd, reader->buffer + reader->size, reader->capacity - reader->size);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) {
+        if (got < 0) perror("Failed to read corpus");
+        reader->eof = true;
+        return false;
+    }
+    reader->size += (size_t)got;
+    return true;
+}
+
+// Next run of complete lines, at least minBytes long unless the input ends
+// The block ends at the first newline at or past minBytes (newline included);
+// the last line of the input may be unterminated.
+bool nextCorpusBlock(CorpusReader* reader, size_t minBytes, const char** block, size_t* length) {
+    if (!reader || !block || !length) return false;
+    if (minBytes == 0) minBytes = 1;
+
+    size_t from = minBytes - 1;  // offset from pos where the newline search resumes
+    while (1) {
+        size_t avail = reader->size - reader->pos;
+        if (avail > from) {
+            const char* start = reader->data + reader->pos;
+            const char* nl = (const char*)memchr(start + from, '\n', avail - from);
+            if (nl) {
+                *block = start;
+                *length = (size_t)(nl - start) + 1;
+                reader->pos += *length;
+                return true;
+            }
+            from = avail;
+        }
+        if (!fillCorpus(reader, minBytes)) break;
+    }
+
+    size_t avail = reader->size - reader->pos;
+    if (avail == 0) return false;
+    *block = reader->data + reader->pos;
+    *length = avail;
+    reader->pos += avail;
+    return true;
+}
+
+// Next line without its newline, of any length
+bool nextCorpusLine(CorpusReader* reader, const char** line, size_t* length) {
+    if (!nextCorpusBlock(reader, 1, line, length)) return false;
+    if (*length > 0 && (*line)[*length - 1] == '\n') {
+        (*length)--;
+    }
+    return true;
+}
+
+// Byte classes for ASCII, fixed rather than locale-dependent: the C locale's
+// isspace/ispunct, with NUL treated as a space. Bytes >= 0x80 are word bytes
+// unless they start one of the Unicode delimiters below.
+#define ByteWord 0
+#define ByteDelimiter 1
+
+static const unsigned char asciiClass[128] = {
+    [0x00] = ByteDelimiter,
+    [0x09] = ByteDelimiter, [0x0A] = ByteDelimiter, [0x0B] = ByteDelimiter,
+    [0x0C] = ByteDelimiter, [0x0D] = ByteDelimiter, [0x20] = ByteDelimiter,
+    [0x21 ... 0x2F] = ByteDelimiter, [0x3A ... 0x40] = ByteDelimiter,
+    [0x5B ... 0x60] = ByteDelimiter, [0x7B ... 0x7E] = ByteDelimiter,
+};
+
+// Lead bytes of every multi-byte delimiter; other non-ASCII bytes never end a word
+static inline bool isDelimiterLead(unsigned char c) {
+    return c == 0xC2 || c == 0xE2 || c == 0xE3;
+}
+
+// Length of the Unicode space or punctuation character at s, 0 if there is none:
+// U+00A0-U+00BF (no-break space, Latin-1 punctuation and signs), U+2000-U+205F
+// (spaces, dashes, quotes, ellipsis; not the joiners or direction marks
+// U+200C-U+200F) and U+3000-U+3003 (ideographic space and full stops)
+static size_t unicodeDelimiterLength(const unsigned char* s, size_t avail) {
+    if (s[0] == 0xC2) {
+        return (avail >= 2 && s[1] >= 0xA0 && s[1] <= 0xBF) ? 2 : 0;
+    }
+    if (avail < 3 || (s[1] & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80) return 0;
+    uint32_t cp = ((uint32_t)(s[0] & 0x0F) << 12) | ((uint32_t)(s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+    if (s[0] == 0xE2) {
+        return (cp >= 0x2000 && cp <= 0x205F && !(cp >= 0x200C && cp <= 0x200F)) ? 3 : 0;
+    }
+    return (s[0] == 0xE3 && cp <= 0x3003) ? 3 : 0;
+}
+
+// Delimiter bytes starting at text[i] (0: i starts a word byte)
+static inline size_t delimiterLength(const char* text, size_t length, size_t i) {
+    unsigned char c = (unsigned char)text[i];
+    if (c < 0x80) return asciiClass[c];
+    return isDelimiterLead(c) ? unicodeDelimiterLength((const unsigned char*)text + i, length - i) : 0;
+}
+
+#define WordBlock 16
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+// Lowercase a block of 16 bytes into out (all 16 are stored) and return how
+// many lead the block before its first delimiter or possible delimiter lead
+static inline size_t scanWordBlock(const char* text, char* out) {
+#if defined(__SSE2__)
+    const __m128i v = _mm_loadu_si128((const __m128i*)text);
+    // Unsigned lo <= v <= hi, as min(v - lo, hi - lo) == v - lo
+#define InRange(lo, hi) \
+    _mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8(v, _mm_set1_epi8((char)(lo))), _mm_set1_epi8((char)((hi) - (lo)))), \
+                   _mm_sub_epi8(v, _mm_set1_epi8((char)(lo))))
+    __m128i upper = InRange('A', 'Z');
+    __m128i alnum = _mm_or_si128(_mm_or_si128(upper, InRange('a', 'z')), InRange('0', '9'));
+    __m128i punct = _mm_andnot_si128(alnum, InRange(0x21, 0x7E));
+    __m128i space = _mm_or_si128(_mm_or_si128(InRange(0x09, 0x0D), _mm_cmpeq_epi8(v, _mm_set1_epi8(0x20))),
+                                 _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    __m128i lead = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xC2)),
+                                             _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xE2))),
+                                _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xE3)));
+#undef InRange
+    _mm_storeu_si128((__m128i*)out, _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8(0x20))));
+    uint32_t stops = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(punct, space), lead));
+    return stops ? (size_t)__builtin_ctz(stops) : WordBlock;
+#else
+    const uint8x16_t v = vld1q_u8((const uint8_t*)text);
+#define InRange(lo, hi) vcleq_u8(vsubq_u8(v, vdupq_n_u8(lo)), vdupq_n_u8((hi) - (lo)))
+    uint8x16_t upper = InRange('A', 'Z');
+    uint8x16_t alnum = vorrq_u8(vorrq_u8(upper, InRange('a', 'z')), InRange('0', '9'));
+    uint8x16_t punct = vbicq_u8(InRange(0x21, 0x7E), alnum);
+    uint8x16_t space = vorrq_u8(vorrq_u8(InRange(0x09, 0x0D), vceqq_u8(v, vdupq_n_u8(0x20))),
+                                vceqq_u8(v, vdupq_n_u8(0)));
+    uint8x16_t lead = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8(0xC2)), vceqq_u8(v, vdupq_n_u8(0xE2))),
+                               vceqq_u8(v, vdupq_n_u8(0xE3)));
+#undef InRange
+    vst1q_u8((uint8_t*)out, vaddq_u8(v, vandq_u8(upper, vdupq_n_u8(0x20))));
+    // Four mask bits per byte
+    uint8x16_t stop = vorrq_u8(vorrq_u8(punct, space), lead);
+    uint64_t stops = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(stop), 4)), 0);
+    return stops ? (size_t)__builtin_ctzll(stops) / 4 : WordBlock;
+#endif
+}
+#endif
+
+// Drop a multi-byte character cut off by truncation at the end of out[0, n)
+static size_t trimPartialCharacter(const char* out, size_t n) {
+    size_t start = n;
+    while (start > 0 && n - start < 3 && ((unsigned char)out[start - 1] & 0xC0) == 0x80) start--;
+    if (start == 0) return n;
+    unsigned char lead = (unsigned char)out[start - 1];
+    size_t expected = (lead >= 0xF0 && lead <= 0xF7) ? 4 : (lead >= 0xE0) ? 3 : (lead >= 0xC0) ? 2 : 1;
+    return (lead >= 0xC0 && lead <= 0xF7 && expected > n - start + 1) ? start - 1 : n;
+}
+
+// Scan the next token at or after *pos into out, lowercased and NUL-terminated
+// Words longer than MaxWordLen - 1 bytes are truncated (never inside a UTF-8
+// character) and their tail skipped. out must hold MaxWordLen bytes: the vector
+// path stores whole blocks past the token. Only ASCII letters are lowercased.
+// Returns the token length, 0 (out untouched) when no token is left.
+size_t scanToken(const char* text, size_t length, size_t* pos, char* out) {
+    size_t i = *pos;
+    size_t skip;
+    while (i < length && (skip = delimiterLength(text, length, i)) > 0) i += skip;
+    if (i == length) {
+        *pos = i;
+        return 0;
+    }
+
+    size_t n = 0;
+    bool truncated = false;
+    while (i < length) {
+#if defined(__SSE2__) || defined(__ARM_NEON)
+        // Whole blocks while they fit in the input and, untruncated, in out
+        if (i + WordBlock <= length && n + WordBlock <= MaxWordLen - 1) {
+            size_t run = scanWordBlock(text + i, out + n);
+            i += run;
+            n += run;
+            if (run == WordBlock) continue;
+        }
+        if (i == length) break;
+#endif
+        unsigned char c = (unsigned char)text[i];
+        if ((c < 0x80) ? asciiClass[c] : (isDelimiterLead(c) && delimiterLength(text, length, i))) break;
+        if (n < MaxWordLen - 1) {
+            out[n++] = (char)((c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c);
+        } else {
+            truncated = true;
+        }
+        i++;
+    }
+    if (truncated) n = trimPartialCharacter(out, n);
+    out[n] = '\0';
+    *pos = i;
+    return n;
+}
+
+// Initialize an empty token list
+void initTokenList(TokenList* list) {
+    if (list) memset(list, 0, sizeof(TokenList));
+}
+
+// Free a token list's buffers
+void freeTokenList(TokenList* list) {
+    if (!list) return;
+    free(list->spans);
+    free(list->ids);
+    free(list->chars);
+    memset(list, 0, sizeof(TokenList));
+}
+
+// Double the span and ID arrays
+static bool growTokenSpans(TokenList* list) {
+    if (list->capacity >= MaxTokenSpans) return false;
+    uint32_t capacity = list->capacity ? list->capacity * 2 : 64;
+
+    TokenSpan* spans = (TokenSpan*)realloc(list->spans, capacity * sizeof(TokenSpan));
+    if (!spans) return false;
+    list->spans = spans;
+    uint32_t* ids = (uint32_t*)realloc(list->ids, capacity * sizeof(uint32_t));
+    if (!ids) return false;
+    list->ids = ids;
+
+    list->capacity = capacity;
+    return true;
+}
+
+// Tokenize length bytes of text (no NUL needed) into the list
+// Returns the number of tokens; earlier spans are invalidated.
+uint32_t tokenizeText(TokenList* list, const char* text, size_t length) {
+    if (!list) return 0;
+    list->count = 0;
+    if (!text || length == 0) return 0;
+
+    // Each token is followed by a delimiter or the end of the text, so the
+    // tokens and their NULs never need more than length + 1 bytes; scanToken
+    // may write up to MaxWordLen bytes at the last one
+    if (list->charCapacity < length + MaxWordLen) {
+        free(list->chars);
+        list->chars = (char*)malloc(length + MaxWordLen);
+        list->charCapacity = list->chars ? length + MaxWordLen : 0;
+        if (!list->chars) return 0;
+    }
+
+    char* out = list->chars;
+    size_t pos = 0;
+    size_t n;
+    while ((n = scanToken(text, length, &pos, out)) > 0) {
+        if (list->count == list->capacity && !growTokenSpans(list)) break;
+        list->spans[list->count].text = out;
+        list->spans[list->count].length = (uint32_t)n;
+        list->count++;
+        out += n + 1;
+    }
+    return list->count;
+}
@@ -0,0 +1,203 @@
+#include "../include/evaluate.h"
+#include "../include/threadPool.h"
+#include <unistd.h>
+
+// Slices per thread in a batch, so uneven slices still balance out
+#define EvalSlicesPerThread 4
+
+// One line-aligned piece of a batch and the statistics gathered from it
+typedef struct {
+    const char* begin;
+    const char* end;
+    EvalStats stats;
+} EvalSlice;
+
+// Shared state for one batch
+typedef struct {
+    const LMModel* model;
+    EvalSlice* slices;
+    int topK;
+} EvalBatch;
+
+// Witten-Bell interpolated probability of tokenId after the cursor's context
+// Starts from an add-one unigram estimate and mixes in every context order
+// found in the image: P = (c(h,w) + T(h) * P_lower) / (c(h) + T(h)), where
+// T(h) is the number of distinct continuations of h.
+static double wittenBellProb(const LMModel* model, const PredictCursor* cursor, uint32_t tokenId) {
+    const FrozenIndex* fz = model->frozen;
+    double vocabSize = (model->vocab && model->vocab->size > 0) ? (double)model->vocab->size : 1.0;
+    double p = ((double)frozenUnigramCount(fz, tokenId) + 1.0) / ((double)model->totalTokens + vocabSize);
+
+    for (int L = 1; L <= cursor->length; L++) {
+        uint32_t entry = cursor->entries[L - 1];
+        uint32_t begin, end;
+        if (entry == FrozenNotFound || !frozenChildRange(fz, L - 1, entry, &begin, &end)) continue;
+
+        double total = (double)fz->levels[L - 1].childTotals[entry];
+        double types = (double)(end - begin);
+        uint32_t child = (tokenId != 0) ? frozenFindChild(fz, L, begin, end, tokenId) : FrozenNotFound;
+        double count = (child != FrozenNotFound) ? (double)fz->levels[L].counts[child] : 0.0;
+        p = (count + types * p) / (total + types);
+    }
+    return p;
+}
+
+// Longest context order with continuations in the image (0 if none)
+static int matchedOrder(const LMModel* model, const PredictCursor* cursor) {
+    for (int L = cursor->length; L >= 1; L--) {
+        uint32_t entry = cursor->entries[L - 1];
+        uint32_t begin, end;
+        if (entry != FrozenNotFound && frozenChildRange(model->frozen, L - 1, entry, &begin, &end)) return L;
+    }
+    return 0;
+}
+
+// Evaluate every line of a slice
+static void evaluateSlice(const LMModel* model, EvalSlice* slice, int topK) {
+    EvalStats* stats = &slice->stats;
+    TokenList tokens;
+    initTokenList(&tokens);
+    PredictScratch scratch = {0};
+    uint32_t topTokens[EvalMaxTopK];
+    float scores[EvalMaxTopK];
+
+    const char* p = slice->begin;
+    while (p < slice->end) {
+        const char* nl = (const char*)memchr(p, '\n', (size_t)(slice->end - p));
+        const char* lineEnd = nl ? nl : slice->end;
+        uint32_t count = tokenizeText(&tokens, p, (size_t)(lineEnd - p));
+        p = nl ? nl + 1 : slice->end;
+        if (count == 0) continue;
+        stats->lines++;
+
+        PredictCursor cursor;
+        initPredictCursor(&cursor, model);
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t gold = lookupToken(model->vocab, tokens.spans[i].text);
+            if (i > 0) {
+                memset(topTokens, 0, sizeof(uint32_t) * (size_t)topK);
+                memset(scores, 0, sizeof(float) * (size_t)topK);
+                predictFromCursor(model, &cursor, topTokens, scores, topK, &scratch);
+
+                bool hit = false;
+                for (int k = 0; k < topK && scores[k] > 0.0f; k++) {
+                    if (topTokens[k] == gold) { hit = true; break; }
+                }
+                int order = matchedOrder(model, &cursor);
+                stats->predictions++;
+                stats->orderPredictions[order]++;
+                if (hit) {
+                    stats->hits++;
+                    stats->orderHits[order]++;
+                }
+                if (gold == 0) stats->oov++;
+                stats->logProbSum += log(wittenBellProb(model, &cursor, gold));
+            }
+            advancePredictCursor(&cursor, gold);
+        }
+    }
+
+    freePredictScratch(&scratch);
+    freeTokenList(&tokens);
+}
+
+static void evaluateSlices(void* ctx, size_t begin, size_t end) {
+    const EvalBatch* batch = (const EvalBatch*)ctx;
+    for (size_t i = begin; i < end; i++) {
+        evaluateSlice(batch->model, &batch->slices[i], batch->topK);
+    }
+}
+
+// Add one slice's statistics to the totals
+static void mergeEvalStats(EvalStats* dst, const EvalStats* src) {
+    dst->lines += src->lines;
+    dst->predictions += src->predictions;
+    dst->hits += src->hits;
+    dst->oov += src->oov;
+    dst->logProbSum += src->logProbSum;
+    for (int i = 0; i < MaxN; i++) {
+        dst->orderPredictions[i] += src->orderPredictions[i];
+        dst->orderHits[i] += src->orderHits[i];
+    }
+}
+
+// Evaluate a corpus file ("-" for stdin) with numThreads threads (<= 0: all CPUs)
+bool evaluateFile(const LMModel* model, const char* filename, int topK, int numThreads, EvalStats* stats) {
+    if (!model || !filename || !stats) return false;
+    if (topK <= 0) topK = 5;
+    if (topK > EvalMaxTopK) topK = EvalMaxTopK;
+    memset(stats, 0, sizeof(EvalStats));
+    stats->topK = topK;
+    if (!model->frozen) return false;  // Never trained, loaded or finalized
+
+    CorpusReader* corpus = openCorpus(filename);
+    if (!corpus) {
+        perror("Failed to open corpus for eval");
+        return false;
+    }
+
+    // A private pool when a thread count is given, the shared one otherwise
+    ThreadPool* pool = NULL;
+    ThreadPool* ownPool = NULL;
+    if (numThreads <= 0) {
+        pool = sharedThreadPool();
+        numThreads = pool ? pool->numThreads + 1 : 1;
+    } else if (numThreads > 1) {
+        if (numThreads > MaxPoolThreads + 1) numThreads = MaxPoolThreads + 1;
+        pool = ownPool = createThreadPool(numThreads - 1);
+    }
+
+    int maxSlices = numThreads * EvalSlicesPerThread;
+    EvalSlice* slices = (EvalSlice*)malloc(sizeof(EvalSlice) * (size_t)maxSlices);
+    if (!slices) {
+        freeThreadPool(ownPool);
+        closeCorpus(corpus);
+        return false;
+    }
+
+    const char* block;
+    size_t size;
+    while (nextCorpusBlock(corpus, (size_t)maxSlices * EvalSliceBytes, &block, &size)) {
+        // Cut the batch into slices that end on line boundaries
+        const char* end = block + size;
+        const char* p = block;
+        int numSlices = 0;
+        while (p < end && numSlices < maxSlices) {
+            const char* cut = (numSlices == maxSlices - 1) ? end : p + EvalSliceBytes;
+            if (cut >= end) {
+                cut = end;
+            } else {
+                const char* nl = (const char*)memchr(cut, '\n', (size_t)(end - cut));
+                cut = nl ? nl + 1 : end;
+            }
+            EvalSlice* slice = &slices[numSlices++];
+            memset(slice, 0, sizeof(EvalSlice));
+            slice->begin = p;
+            slice->end = cut;
+            p = cut;
+        }
+
+        EvalBatch batch = { model, slices, topK };
+        threadPoolFor(pool, (size_t)numSlices, 1, evaluateSlices, &batch);
+
+        // Merged in slice order, so totals do not depend on scheduling
+        for (int i = 0; i < numSlices; i++) {
+            mergeEvalStats(stats, &slices[i].stats);
+        }
+    }
+
+    free(slices);
+    freeThreadPool(ownPool);
+    closeCorpus(corpus);
+    return true;
+}
+
+double evalHitRate(const EvalStats* stats) {
+    if (!stats || stats->predictions == 0) return 0.0;
+    return (double)stats->hits / (double)stats->predictions;
+}
+
+double evalPerplexity(const EvalStats* stats) {
+    if (!stats || stats->predictions == 0) return 0.0;
+    return exp(-stats->logProbSum / (double)stats->predictions);
+}
@@ -0,0 +1,864 @@
+#include "../include/frozen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Sections start on this boundary so the arrays can be read in place
+#define SectionAlignment 8
+
+// Older headers end before the offset tables their successors added
+#define FrozenHeaderSizeV1 offsetof(FrozenFileHeader, levelTotalOff)
+#define FrozenHeaderSizeV2 offsetof(FrozenFileHeader, unigramLogProbOff)
+
+static uint64_t alignSection(uint64_t offset) {
+    return (offset + (SectionAlignment - 1)) & ~(uint64_t)(SectionAlignment - 1);
+}
+
+// Entry index paired with its count, for ranking continuations
+typedef struct {
+    uint32_t count;
+    uint32_t entry;
+} RankEntry;
+
+static int compareRankEntries(const void* a, const void* b) {
+    const RankEntry* ra = (const RankEntry*)a;
+    const RankEntry* rb = (const RankEntry*)b;
+    if (ra->count != rb->count) return (ra->count < rb->count) ? 1 : -1;
+    return (ra->entry > rb->entry) - (ra->entry < rb->entry);
+}
+
+// Write the entries [begin, end) into ranked[begin, end) by count, highest first
+static void rankGroup(const uint32_t* counts, uint32_t begin, uint32_t end, uint32_t* ranked,
+                      RankEntry* scratch) {
+    uint32_t n = end - begin;
+    if (n == 0) return;
+    if (n == 1) {
+        ranked[begin] = begin;
+        return;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        scratch[i].count = counts[begin + i];
+        scratch[i].entry = begin + i;
+    }
+    qsort(scratch, n, sizeof(RankEntry), compareRankEntries);
+    for (uint32_t i = 0; i < n; i++) ranked[begin + i] = scratch[i].entry;
+}
+
+// Compute child totals and ranked orders from the token, count and child arrays
+// totals[l] is skipped for the highest order
+static bool buildDerivedTables(const FrozenLevel* levels, int maxN, uint32_t** totals, uint32_t** ranked) {
+    uint32_t largest = 1;
+    for (int l = 0; l < maxN; l++) {
+        if (levels[l].size > largest) largest = levels[l].size;
+    }
+    RankEntry* scratch = (RankEntry*)malloc((size_t)largest * sizeof(RankEntry));
+    if (!scratch) return false;
+
+    for (int l = 0; l < maxN; l++) {
+        const FrozenLevel* lv = &levels[l];
+        if (l + 1 < maxN) {
+            const uint32_t* childCounts = levels[l + 1].counts;
+            for (uint32_t i = 0; i < lv->size; i++) {
+                // 32-bit sum, matching the per-query denominator it replaces
+                uint32_t total = 0;
+                for (uint32_t c = lv->firstChild[i]; c < lv->firstChild[i + 1]; c++) total += childCounts[c];
+                totals[l][i] = total;
+            }
+        }
+        if (l == 0) {
+            rankGroup(lv->counts, 0, lv->size, ranked[0], scratch);
+        } else {
+            const FrozenLevel* parent = &levels[l - 1];
+            for (uint32_t p = 0; p < parent->size; p++) {
+                rankGroup(lv->counts, parent->firstChild[p], parent->firstChild[p + 1], ranked[l], scratch);
+            }
+        }
+    }
+
+    free(scratch);
+    return true;
+}
+
+float frozenUnigramLogProbOf(uint32_t count, uint64_t totalTokens) {
+    float p = (count > 0) ? ((float)count / (float)totalTokens) : (1.0f / (float)(totalTokens + 1));
+    return logf(fmaxf(p, 1e-9f));
+}
+
+// One log-probability per token ID from the unigram level
+static void buildUnigramLogProbs(const FrozenLevel* unigrams, uint32_t vocabSize, uint64_t totalTokens,
+                                 float* logProb) {
+    float unseen = frozenUnigramLogProbOf(0, totalTokens);
+    for (uint32_t i = 0; i < vocabSize; i++) logProb[i] = unseen;
+    for (uint32_t i = 0; i < unigrams->size; i++) {
+        uint32_t token = unigrams->tokenIds[i];
+        if (token < vocabSize) logProb[token] = frozenUnigramLogProbOf(unigrams->counts[i], totalTokens);
+    }
+}
+
+// Build the version 2 tables on the heap for a version 1 image
+static bool deriveLegacyTables(FrozenIndex* index) {
+    uint64_t words = 0;
+    for (int l = 0; l < index->maxN; l++) {
+        words += index->levels[l].size;
+        if (l + 1 < index->maxN) words += index->levels[l].size;
+    }
+    index->derived = (uint32_t*)malloc((size_t)(words ? words : 1) * sizeof(uint32_t));
+    if (!index->derived) return false;
+
+    uint32_t* totals[MaxN] = { NULL };
+    uint32_t* ranked[MaxN] = { NULL };
+    uint32_t* p = index->derived;
+    for (int l = 0; l < index->maxN; l++) {
+        ranked[l] = p;
+        p += index->levels[l].size;
+        if (l + 1 < index->maxN) {
+            totals[l] = p;
+            p += index->levels[l].size;
+        }
+        index->levels[l].ranked = ranked[l];
+        index->levels[l].childTotals = totals[l];
+    }
+    return buildDerivedTables(index->levels, index->maxN, totals, ranked);
+}
+
+// True if count elements of elemSize bytes at off lie inside an image of
+// size bytes, aligned for in-place reads (no sum can overflow)
+static bool sectionFits(uint64_t off, uint64_t count, uint64_t elemSize, size_t size) {
+    if (off > size || off % (elemSize < sizeof(uint32_t) ? elemSize : sizeof(uint32_t)) != 0) return false;
+    return count <= ((uint64_t)size - off) / elemSize;
+}
+
+// One pass over the indices the image is queried by: every one that is
+// followed in place must stay inside its array, and every token string
+// must end inside the string table. Linear in the image size.
+static bool validateFrozenContent(const FrozenIndex* index, uint64_t stringsSize, bool legacy) {
+    uint32_t vocabSize = index->vocabSize;
+    if (vocabSize > 0 && (stringsSize == 0 || index->vocabStrings[stringsSize - 1] != '\0')) return false;
+    for (uint32_t i = 0; i < vocabSize; i++) {
+        if (index->vocabOffsets[i] >= stringsSize || index->vocabSorted[i] >= vocabSize) return false;
+    }
+    if (index->vocabOffsets[vocabSize] > stringsSize) return false;
+
+    for (int l = 0; l < index->maxN; l++) {
+        const FrozenLevel* level = &index->levels[l];
+        for (uint32_t i = 0; i < level->size; i++) {
+            if (level->tokenIds[i] >= vocabSize) return false;
+            if (!legacy && level->ranked[i] >= level->size) return false;
+        }
+        if (!level->firstChild) continue;
+        // Child ranges start at 0, never shrink, and end inside the next level
+        if (level->firstChild[0] != 0) return false;
+        for (uint32_t i = 0; i < level->size; i++) {
+            if (level->firstChild[i + 1] < level->firstChild[i]) return false;
+        }
+        if (level->firstChild[level->size] > index->levels[l + 1].size) return false;
+    }
+    return true;
+}
+
+// Fill in the runtime view from the header of a validated image
+static FrozenIndex* createFrozenView(const unsigned char* image, size_t size, FrozenBacking backing) {
+    if (!image || size < FrozenHeaderSizeV1) return NULL;
+
+    const FrozenFileHeader* header = (const FrozenFileHeader*)image;
+    if (memcmp(header->magic, FrozenMagic, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "Not a frozen model image\n");
+        return NULL;
+    }
+    if (header->version < 1 || header->version > FrozenVersion) {
+        fprintf(stderr, "Unsupported frozen model version %u\n", header->version);
+        return NULL;
+    }
+    bool legacy = (header->version == 1);
+    bool hasLogProb = (header->version >= 3);
+    size_t headerSize = hasLogProb ? sizeof(FrozenFileHeader) : legacy ? FrozenHeaderSizeV1 : FrozenHeaderSizeV2;
+    if (size < headerSize) {
+        fprintf(stderr, "Corrupt frozen model image\n");
+        return NULL;
+    }
+    if (header->imageSize != size || header->maxN < 1 || header->maxN > MaxN) {
+        fprintf(stderr, "Corrupt frozen model image\n");
+        return NULL;
+    }
+
+    // Every section must lie inside the image
+    if (!sectionFits(header->vocabOffsetsOff, (uint64_t)header->vocabSize + 1, sizeof(uint32_t), size) ||
+        !sectionFits(header->vocabSortedOff, header->vocabSize, sizeof(uint32_t), size) ||
+        !sectionFits(header->vocabStringsOff, header->vocabStringsSize, 1, size) ||
+        (hasLogProb && !sectionFits(header->unigramLogProbOff, header->vocabSize, sizeof(float), size))) {
+        fprintf(stderr, "Corrupt frozen model image\n");
+        return NULL;
+    }
+    for (uint32_t l = 0; l < header->maxN; l++) {
+        uint64_t n = header->levelSize[l];
+        bool hasChildren = (l + 1 < header->maxN);
+        if (!sectionFits(header->levelTokenOff[l], n, sizeof(uint32_t), size) ||
+            !sectionFits(header->levelCountOff[l], n, sizeof(uint32_t), size) ||
+            (hasChildren && !sectionFits(header->levelChildOff[l], n + 1, sizeof(uint32_t), size))) {
+            fprintf(stderr, "Corrupt frozen model image\n");
+            return NULL;
+        }
+        if (!legacy &&
+            (!sectionFits(header->levelRankOff[l], n, sizeof(uint32_t), size) ||
+             (hasChildren && !sectionFits(header->levelTotalOff[l], n, sizeof(uint32_t), size)))) {
+            fprintf(stderr, "Corrupt frozen model image\n");
+            return NULL;
+        }
+    }
+
+    FrozenIndex* index = (FrozenIndex*)calloc(1, sizeof(FrozenIndex));
+    if (!index) return NULL;
+
+    index->maxN = (int)header->maxN;
+    index->totalTokens = header->totalTokens;
+    index->totalNgrams = header->totalNgrams;
+    index->vocabSize = header->vocabSize;
+    index->vocabOffsets = (const uint32_t*)(image + header->vocabOffsetsOff);
+    index->vocabSorted = (const uint32_t*)(image + header->vocabSortedOff);
+    index->vocabStrings = (const char*)(image + header->vocabStringsOff);
+    if (hasLogProb) index->unigramLogProb = (const float*)(image + header->unigramLogProbOff);
+    for (int l = 0; l < index->maxN; l++) {
+        FrozenLevel* level = &index->levels[l];
+        level->size = header->levelSize[l];
+        level->tokenIds = (const uint32_t*)(image + header->levelTokenOff[l]);
+        level->counts = (const uint32_t*)(image + header->levelCountOff[l]);
+        level->firstChild = (l + 1 < index->maxN) ?
+                            (const uint32_t*)(image + header->levelChildOff[l]) : NULL;
+        if (!legacy) {
+            level->ranked = (const uint32_t*)(image + header->levelRankOff[l]);
+            level->childTotals = (l + 1 < index->maxN) ?
+                                 (const uint32_t*)(image + header->levelTotalOff[l]) : NULL;
+        }
+    }
+    index->image = image;
+    index->imageSize = size;
+    index->backing = backing;
+
+    // Images built here or embedded at link time are trusted; files are not
+    if (backing == FrozenBackingMmap && !validateFrozenContent(index, header->vocabStringsSize, legacy)) {
+        fprintf(stderr, "Corrupt frozen model image\n");
+        free(index);
+        return NULL;
+    }
+    if (legacy && !deriveLegacyTables(index)) {
+        free(index->derived);
+        free(index);
+        return NULL;
+    }
+    if (!hasLogProb) {
+        index->derivedLogProb = (float*)malloc(((size_t)index->vocabSize + 1) * sizeof(float));
+        if (!index->derivedLogProb) {
+            free(index->derived);
+            free(index);
+            return NULL;
+        }
+        buildUnigramLogProbs(&index->levels[0], index->vocabSize, index->totalTokens, index->derivedLogProb);
+        index->unigramLogProb = index->derivedLogProb;
+    }
+    return index;
+}
+
+// Token string paired with its ID, for building the sorted lookup table
+typedef struct {
+    const char* text;
+    uint32_t id;
+} TokenEntry;
+
+static int compareTokenEntries(const void* a, const void* b) {
+    return strcmp(((const TokenEntry*)a)->text, ((const TokenEntry*)b)->text);
+}
+
+// Fill a current-version header for the given vocabulary and level sizes;
+// returns the image size
+static uint64_t layoutImage(FrozenFileHeader* header, const Vocabulary* vocab, int maxN,
+                            const uint32_t* levelSize, uint64_t totalTokens, uint64_t totalNgrams) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, FrozenMagic, sizeof(header->magic));
+    header->version = FrozenVersion;
+    header->maxN = (uint32_t)maxN;
+    header->totalTokens = totalTokens;
+    header->totalNgrams = totalNgrams;
+    header->vocabSize = vocab->size;
+
+    uint64_t stringsSize = 0;
+    for (uint32_t i = 0; i < vocab->size; i++) stringsSize += strlen(getTokenById(vocab, i)) + 1;
+
+    uint64_t offset = alignSection(sizeof(FrozenFileHeader));
+    header->vocabOffsetsOff = offset;
+    offset = alignSection(offset + ((uint64_t)vocab->size + 1) * sizeof(uint32_t));
+    header->vocabSortedOff = offset;
+    offset = alignSection(offset + (uint64_t)vocab->size * sizeof(uint32_t));
+    header->vocabStringsOff = offset;
+    header->vocabStringsSize = stringsSize;
+    offset = alignSection(offset + stringsSize);
+    header->unigramLogProbOff = offset;
+    offset = alignSection(offset + (uint64_t)vocab->size * sizeof(float));
+    for (int l = 0; l < maxN; l++) {
+        header->levelSize[l] = levelSize[l];
+        header->levelTokenOff[l] = offset;
+        offset = alignSection(offset + (uint64_t)levelSize[l] * sizeof(uint32_t));
+        header->levelCountOff[l] = offset;
+        offset = alignSection(offset + (uint64_t)levelSize[l] * sizeof(uint32_t));
+        if (l + 1 < maxN) {
+            header->levelChildOff[l] = offset;
+            offset = alignSection(offset + ((uint64_t)levelSize[l] + 1) * sizeof(uint32_t));
+            header->levelTotalOff[l] = offset;
+            offset = alignSection(offset + (uint64_t)levelSize[l] * sizeof(uint32_t));
+        }
+        header->levelRankOff[l] = offset;
+        offset = alignSection(offset + (uint64_t)levelSize[l] * sizeof(uint32_t));
+    }
+    header->imageSize = offset;
+    return offset;
+}
+
+// Copy the header and the vocabulary string table into a laid-out image
+static bool writeVocabSection(unsigned char* image, const FrozenFileHeader* header, const Vocabulary* vocab) {
+    TokenEntry* entries = (TokenEntry*)malloc(((size_t)vocab->size + 1) * sizeof(TokenEntry));
+    if (!entries) return false;
+    memcpy(image, header, sizeof(*header));
+
+    uint32_t* offsets = (uint32_t*)(image + header->vocabOffsetsOff);
+    uint32_t* sorted = (uint32_t*)(image + header->vocabSortedOff);
+    char* strings = (char*)(image + header->vocabStringsOff);
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < vocab->size; i++) {
+        const char* token = getTokenById(vocab, i);
+        size_t len = strlen(token) + 1;
+        offsets[i] = pos;
+        memcpy(strings + pos, token, len);
+        pos += (uint32_t)len;
+        entries[i].text = token;
+        entries[i].id = i;
+    }
+    offsets[vocab->size] = pos;
+    qsort(entries, vocab->size, sizeof(TokenEntry), compareTokenEntries);
+    for (uint32_t i = 0; i < vocab->size; i++) sorted[i] = entries[i].id;
+    free(entries);
+    return true;
+}
+
+// Flatten a mutable trie and vocabulary into a heap-backed image
+FrozenIndex* freezeNgrams(const NgramIndex* ngrams, const Vocabulary* vocab, uint64_t totalTokens) {
+    if (!ngrams || !vocab || !ngrams->root) return NULL;
+
+    int maxN = (ngrams->maxN < MaxN) ? ngrams->maxN : MaxN;
+
+    // Gather the nodes of every level in parent order
+    const NgramNode** nodes[MaxN] = { NULL };
+    uint32_t levelSize[MaxN] = { 0 };
+    bool ok = true;
+
+    levelSize[0] = ngrams->root->numChildren;
+    nodes[0] = (const NgramNode**)malloc(((size_t)levelSize[0] + 1) * sizeof(NgramNode*));
+    if (!nodes[0]) ok = false;
+    for (uint32_t i = 0; ok && i < levelSize[0]; i++) {
+        nodes[0][i] = &ngrams->root->children[i];
+    }
+    for (int l = 1; ok && l < maxN; l++) {
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < levelSize[l - 1]; i++) total += nodes[l - 1][i]->numChildren;
+        if (total >= FrozenNotFound) { ok = false; break; }
+        levelSize[l] = (uint32_t)total;
+        nodes[l] = (const NgramNode**)malloc(((size_t)total + 1) * sizeof(NgramNode*));
+        if (!nodes[l]) { ok = false; break; }
+        uint32_t k = 0;
+        for (uint32_t i = 0; i < levelSize[l - 1]; i++) {
+            const NgramNode* parent = nodes[l - 1][i];
+            for (uint32_t c = 0; c < parent->numChildren; c++) nodes[l][k++] = &parent->children[c];
+        }
+    }
+
+    // Lay out the sections
+    FrozenFileHeader header;
+    uint64_t offset = layoutImage(&header, vocab, maxN, levelSize, totalTokens, ngrams->totalNgrams);
+    unsigned char* image = ok ? (unsigned char*)calloc(1, (size_t)offset) : NULL;
+    if (image && !writeVocabSection(image, &header, vocab)) {
+        free(image);
+        image = NULL;
+    }
+    if (image) {
+        // N-gram levels
+        for (int l = 0; l < maxN; l++) {
+            uint32_t* tokenIds = (uint32_t*)(image + header.levelTokenOff[l]);
+            uint32_t* counts = (uint32_t*)(image + header.levelCountOff[l]);
+            uint32_t* firstChild = (l + 1 < maxN) ? (uint32_t*)(image + header.levelChildOff[l]) : NULL;
+            uint32_t child = 0;
+            for (uint32_t i = 0; i < levelSize[l]; i++) {
+                tokenIds[i] = nodes[l][i]->tokenId;
+                counts[i] = nodes[l][i]->count;
+                if (firstChild) {
+                    firstChild[i] = child;
+                    child += nodes[l][i]->numChildren;
+                }
+            }
+            if (firstChild) firstChild[levelSize[l]] = child;
+        }
+    }
+
+    for (int l = 0; l < maxN; l++) free(nodes[l]);
+    if (!image) return NULL;
+
+    FrozenIndex* index = createFrozenView(image, (size_t)offset, FrozenBackingHeap);
+    if (!index) {
+        free(image);
+        return NULL;
+    }
+
+    // Fill the ranking tables in place now that the level arrays are set
+    uint32_t* totals[MaxN] = { NULL };
+    uint32_t* ranked[MaxN] = { NULL };
+    for (int l = 0; l < maxN; l++) {
+        ranked[l] = (uint32_t*)(image + header.levelRankOff[l]);
+        if (l + 1 < maxN) totals[l] = (uint32_t*)(image + header.levelTotalOff[l]);
+    }
+    if (!buildDerivedTables(index->levels, maxN, totals, ranked)) {
+        freeFrozenIndex(index);
+        return NULL;
+    }
+    buildUnigramLogProbs(&index->levels[0], vocab->size, totalTokens, (float*)(image + header.unigramLogProbOff));
+    return index;
+}
+
+// Source entries of one merged level: base and delta entry (FrozenNotFound
+// where absent) and the first merged child of every entry
+typedef struct {
+    uint32_t* fromBase;
+    uint32_t* fromDelta;
+    uint32_t* firstChild;
+    uint32_t size;
+} MergedLevel;
+
+// Append the union of two sorted sibling runs to a merged level
+static void mergeRuns(MergedLevel* out, const FrozenLevel* base, uint32_t baseBegin, uint32_t baseEnd,
+                      const FrozenLevel* delta, uint32_t deltaBegin, uint32_t deltaEnd) {
+    uint32_t b = baseBegin, d = deltaBegin;
+    while (b < baseEnd || d < deltaEnd) {
+        uint32_t bt = (b < baseEnd) ? base->tokenIds[b] : UINT32_MAX;
+        uint32_t dt = (d < deltaEnd) ? delta->tokenIds[d] : UINT32_MAX;
+        bool takeBase = (b < baseEnd) && (d == deltaEnd || bt <= dt);
+        bool takeDelta = (d < deltaEnd) && (b == baseEnd || dt <= bt);
+        out->fromBase[out->size] = takeBase ? b++ : FrozenNotFound;
+        out->fromDelta[out->size] = takeDelta ? d++ : FrozenNotFound;
+        out->size++;
+    }
+}
+
+// Children of a source entry as a range of the next level (empty if absent)
+static void sourceChildren(const FrozenIndex* index, int level, uint32_t entry, uint32_t* begin, uint32_t* end) {
+    *begin = *end = 0;
+    if (entry != FrozenNotFound) frozenChildRange(index, level, entry, begin, end);
+}
+
+// Rank a merged group: a group with children from one side only keeps that
+// side's order, shifted; only groups both sides contributed to are sorted
+static void rankMergedGroup(const FrozenIndex* base, const FrozenIndex* delta, int level, const MergedLevel* merged,
+                            uint32_t begin, uint32_t end, const uint32_t* counts, uint32_t* ranked,
+                            RankEntry* scratch) {
+    if (begin == end) return;
+    bool allBase = true, allDelta = true;
+    for (uint32_t i = begin; i < end && (allBase || allDelta); i++) {
+        allBase &= (merged->fromDelta[i] == FrozenNotFound);
+        allDelta &= (merged->fromBase[i] == FrozenNotFound);
+    }
+    if (allBase || allDelta) {
+        const FrozenLevel* side = allBase ? &base->levels[level] : &delta->levels[level];
+        uint32_t first = allBase ? merged->fromBase[begin] : merged->fromDelta[begin];
+        for (uint32_t i = begin; i < end; i++) ranked[i] = side->ranked[first + (i - begin)] - first + begin;
+        return;
+    }
+    rankGroup(counts, begin, end, ranked, scratch);
+}
+
+// Merge two images whose token IDs agree (delta's vocabulary extends base's):
+// counts of shared n-grams add up, and the rest is copied. Groups only one
+// side touched keep their ranking, so the cost beyond copying the levels
+// follows the delta. vocab must cover both; NULL if the orders differ.
+FrozenIndex* mergeFrozenIndexes(const FrozenIndex* base, const FrozenIndex* delta, const Vocabulary* vocab,
+                                uint64_t totalTokens) {
+    if (!base || !delta || !vocab || base->maxN != delta->maxN || base->maxN < 1) return NULL;
+    int maxN = base->maxN;
+
+    // Line up the entries of every level in parent order
+    MergedLevel merged[MaxN];
+    memset(merged, 0, sizeof(merged));
+    uint32_t levelSize[MaxN] = { 0 };
+    bool ok = true;
+    for (int l = 0; ok && l < maxN; l++) {
+        uint64_t bound = (uint64_t)base->levels[l].size + delta->levels[l].size;
+        if (bound >= FrozenNotFound) { ok = false; break; }
+        merged[l].fromBase = (uint32_t*)malloc(((size_t)bound + 1) * sizeof(uint32_t));
+        merged[l].fromDelta = (uint32_t*)malloc(((size_t)bound + 1) * sizeof(uint32_t));
+        merged[l].firstChild = (uint32_t*)malloc(((size_t)bound + 1) * sizeof(uint32_t));
+        if (!merged[l].fromBase || !merged[l].fromDelta || !merged[l].firstChild) { ok = false; break; }
+
+        if (l == 0) {
+            mergeRuns(&merged[0], &base->levels[0], 0, base->levels[0].size, &delta->levels[0], 0,
+                      delta->levels[0].size);
+        } else {
+            MergedLevel* parent = &merged[l - 1];
+            for (uint32_t p = 0; p < parent->size; p++) {
+                uint32_t bb, be, db, de;
+                sourceChildren(base, l - 1, parent->fromBase[p], &bb, &be);
+                sourceChildren(delta, l - 1, parent->fromDelta[p], &db, &de);
+                parent->firstChild[p] = merged[l].size;
+                mergeRuns(&merged[l], &base->levels[l], bb, be, &delta->levels[l], db, de);
+            }
+            parent->firstChild[parent->size] = merged[l].size;
+        }
+        levelSize[l] = merged[l].size;
+    }
+
+    FrozenFileHeader header;
+    uint64_t offset = layoutImage(&header, vocab, maxN, levelSize, totalTokens,
+                                  base->totalNgrams + delta->totalNgrams);
+    unsigned char* image = ok ? (unsigned char*)calloc(1, (size_t)offset) : NULL;
+    if (image && !writeVocabSection(image, &header, vocab)) {
+        free(image);
+        image = NULL;
+    }
+
+    uint32_t largest = 1;
+    for (int l = 0; l < maxN; l++) {
+        if (levelSize[l] > largest) largest = levelSize[l];
+    }
+    RankEntry* scratch = image ? (RankEntry*)malloc((size_t)largest * sizeof(RankEntry)) : NULL;
+    if (!scratch) {
+        free(image);
+        image = NULL;
+    }
+
+    for (int l = 0; image && l < maxN; l++) {
+        const MergedLevel* m = &merged[l];
+        const FrozenLevel* bl = &base->levels[l];
+        const FrozenLevel* dl = &delta->levels[l];
+        uint32_t* tokenIds = (uint32_t*)(image + header.levelTokenOff[l]);
+        uint32_t* counts = (uint32_t*)(image + header.levelCountOff[l]);
+        uint32_t* totals = (l + 1 < maxN) ? (uint32_t*)(image + header.levelTotalOff[l]) : NULL;
+        uint32_t* ranked = (uint32_t*)(image + header.levelRankOff[l]);
+        for (uint32_t i = 0; i < m->size; i++) {
+            uint32_t b = m->fromBase[i], d = m->fromDelta[i];
+            tokenIds[i] = (b != FrozenNotFound) ? bl->tokenIds[b] : dl->tokenIds[d];
+            counts[i] = ((b != FrozenNotFound) ? bl->counts[b] : 0) + ((d != FrozenNotFound) ? dl->counts[d] : 0);
+            // Child totals add up like the counts, in the same 32 bits
+            if (totals) {
+                totals[i] = ((b != FrozenNotFound) ? bl->childTotals[b] : 0) +
+                            ((d != FrozenNotFound) ? dl->childTotals[d] : 0);
+            }
+        }
+        if (l + 1 < maxN) {
+            memcpy(image + header.levelChildOff[l], m->firstChild, ((size_t)m->size + 1) * sizeof(uint32_t));
+        }
+        if (l == 0) {
+            rankMergedGroup(base, delta, 0, m, 0, m->size, counts, ranked, scratch);
+        } else {
+            const MergedLevel* parent = &merged[l - 1];
+            for (uint32_t p = 0; p < parent->size; p++) {
+                rankMergedGroup(base, delta, l, m, parent->firstChild[p], parent->firstChild[p + 1], counts,
+                                ranked, scratch);
+            }
+        }
+    }
+
+    free(scratch);
+    for (int l = 0; l < maxN; l++) {
+        free(merged[l].fromBase);
+        free(merged[l].fromDelta);
+        free(merged[l].firstChild);
+    }
+    if (!image) return NULL;
+
+    FrozenIndex* index = createFrozenView(image, (size_t)offset, FrozenBackingHeap);
+    if (!index) {
+        free(image);
+        return NULL;
+    }
+    buildUnigramLogProbs(&index->levels[0], vocab->size, totalTokens, (float*)(image + header.unigramLogProbOff));
+    return index;
+}
+
+// Entries a run yields (FrozenNotFound if it cannot be opened or does not fit a level)
+static uint32_t countRun(const FrozenRunSource* source, int order) {
+    void* cursor = source->open(source->state, order);
+    if (!cursor) return FrozenNotFound;
+    uint32_t tokens[MaxN], count;
+    uint64_t n = 0;
+    while (n < FrozenNotFound && source->next(cursor, tokens, &count)) n++;
+    source->close(cursor);
+    return (uint32_t)n;
+}
+
+// Fill level l of a laid-out image from its run, and the child ranges and
+// totals of the level above: each new prefix starts the children of the
+// next parent equal to it, read from a second cursor in step
+static bool fillLevelFromRun(const FrozenRunSource* source, const FrozenFileHeader* header, unsigned char* image,
+                             int l, RankEntry* scratch) {
+    uint32_t size = header->levelSize[l];
+    uint32_t* tokenIds = (uint32_t*)(image + header->levelTokenOff[l]);
+    uint32_t* counts = (uint32_t*)(image + header->levelCountOff[l]);
+    uint32_t* ranked = (uint32_t*)(image + header->levelRankOff[l]);
+    uint32_t* firstChild = (l > 0) ? (uint32_t*)(image + header->levelChildOff[l - 1]) : NULL;
+    uint32_t* totals = (l > 0) ? (uint32_t*)(image + header->levelTotalOff[l - 1]) : NULL;
+    uint32_t parentSize = (l > 0) ? header->levelSize[l - 1] : 0;
+    size_t prefixBytes = (size_t)l * sizeof(uint32_t);
+
+    void* cursor = source->open(source->state, l + 1);
+    void* parents = (l > 0) ? source->open(source->state, l) : NULL;
+    bool ok = cursor && (l == 0 || parents);
+
+    uint32_t tokens[MaxN], previous[MaxN], parentTokens[MaxN];
+    uint32_t count, parentCount;
+    uint32_t i = 0, groupBegin = 0, p = 0;
+    if (firstChild) firstChild[0] = 0;
+    while (ok && source->next(cursor, tokens, &count)) {
+        if (i >= size || tokens[l] >= header->vocabSize) {
+            ok = false;
+            break;
+        }
+        if (l > 0 && (i == 0 || memcmp(tokens, previous, prefixBytes) != 0)) {
+            rankGroup(counts, groupBegin, i, ranked, scratch);
+            groupBegin = i;
+            if (i == 0) ok = source->next(parents, parentTokens, &parentCount);
+            while (ok && memcmp(parentTokens, tokens, prefixBytes) != 0) {
+                firstChild[++p] = i;
+                ok = p < parentSize && source->next(parents, parentTokens, &parentCount);
+            }
+            if (!ok) break;
+        } else if (i > groupBegin && tokens[l] <= previous[l]) {
+            ok = false;  // siblings out of order
+            break;
+        }
+        // 32-bit sum, as buildDerivedTables computes it
+        if (totals) totals[p] += count;
+        tokenIds[i] = tokens[l];
+        counts[i] = count;
+        memcpy(previous, tokens, sizeof(uint32_t) * (l + 1));
+        i++;
+    }
+    ok = ok && i == size;
+    if (ok) {
+        rankGroup(counts, groupBegin, i, ranked, scratch);
+        // Parents after the last group have no children
+        while (firstChild && p < parentSize) firstChild[++p] = i;
+    }
+
+    if (cursor) source->close(cursor);
+    if (parents) source->close(parents);
+    return ok;
+}
+
+// Write an image straight from sorted runs (e.g. merged count shards): one
+// pass per order sizes the levels, then each level is filled in place in a
+// file-backed mapping, so written pages go to disk rather than the heap and
+// no trie is built. Memory stays bounded by the vocabulary.
+bool writeFrozenFromRuns(const FrozenRunSource* source, const Vocabulary* vocab, int maxN, uint64_t totalTokens,
+                         uint64_t totalNgrams, const char* filename) {
+    if (!source || !vocab || !filename || maxN < 1 || maxN > MaxN) return false;
+
+    uint32_t levelSize[MaxN] = { 0 };
+    for (int l = 0; l < maxN; l++) {
+        levelSize[l] = countRun(source, l + 1);
+        if (levelSize[l] == FrozenNotFound) return false;
+    }
+    FrozenFileHeader header;
+    uint64_t offset = layoutImage(&header, vocab, maxN, levelSize, totalTokens, totalNgrams);
+
+    // Same temporary-and-rename as writeFrozenFile
+    char tempName[1024];
+    snprintf(tempName, sizeof(tempName), "%s.tmp", filename);
+    int fd = open(tempName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Failed to create frozen model file");
+        return false;
+    }
+    unsigned char* image = NULL;
+    if (ftruncate(fd, (off_t)offset) == 0) {
+        void* data = mmap(NULL, (size_t)offset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) image = (unsigned char*)data;
+    }
+    close(fd);
+
+    // Sibling groups hold distinct tokens, so none is larger than the vocabulary
+    RankEntry* scratch = (RankEntry*)malloc(((size_t)vocab->size + 1) * sizeof(RankEntry));
+    bool ok = image && scratch && writeVocabSection(image, &header, vocab);
+    for (int l = 0; ok && l < maxN; l++) ok = fillLevelFromRun(source, &header, image, l, scratch);
+    if (ok) {
+        FrozenLevel unigrams;
+        memset(&unigrams, 0, sizeof(unigrams));
+        unigrams.tokenIds = (const uint32_t*)(image + header.levelTokenOff[0]);
+        unigrams.counts = (const uint32_t*)(image + header.levelCountOff[0]);
+        unigrams.size = levelSize[0];
+        buildUnigramLogProbs(&unigrams, vocab->size, totalTokens, (float*)(image + header.unigramLogProbOff));
+    }
+    free(scratch);
+    if (image && munmap(image, (size_t)offset) != 0) ok = false;
+
+    if (ok && rename(tempName, filename) != 0) ok = false;
+    if (!ok) {
+        fprintf(stderr, "Failed to write frozen model file %s\n", filename);
+        remove(tempName);
+    }
+    return ok;
+}
+
+// Map a frozen model file read-only; pages are shared across processes
+FrozenIndex* mapFrozenFile(const char* filename) {
+    if (!filename) return NULL;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    // Older, smaller headers are checked by createFrozenView
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)FrozenHeaderSizeV1) {
+        fprintf(stderr, "Frozen model file %s is invalid\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void* data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Failed to map frozen model");
+        return NULL;
+    }
+
+    FrozenIndex* index = createFrozenView((const unsigned char*)data, size, FrozenBackingMmap);
+    if (!index) {
+        fprintf(stderr, "Frozen model file %s is invalid\n", filename);
+        munmap(data, size);
+    }
+    return index;
+}
+
+// Use an image that lives elsewhere (e.g. embedded) without copying it
+FrozenIndex* attachFrozenImage(const void* data, size_t size) {
+    if (!data) return NULL;
+
+    // The arrays are read in place, so misaligned data gets a private copy
+    if ((uintptr_t)data % SectionAlignment != 0) {
+        unsigned char* copy = (unsigned char*)malloc(size);
+        if (!copy) return NULL;
+        memcpy(copy, data, size);
+        FrozenIndex* index = createFrozenView(copy, size, FrozenBackingHeap);
+        if (!index) free(copy);
+        return index;
+    }
+
+    return createFrozenView((const unsigned char*)data, size, FrozenBackingStatic);
+}
+
+// Write the image to disk as a single file
+bool writeFrozenFile(const FrozenIndex* index, const char* filename) {
+    if (!index || !filename) return false;
+
+    // Write beside the target and rename over it: a server still mapping the
+    // old image keeps its pages instead of seeing the file truncated
+    char tempName[1024];
+    snprintf(tempName, sizeof(tempName), "%s.tmp", filename);
+    FILE* file = fopen(tempName, "wb");
+    if (!file) {
+        perror("Failed to create frozen model file");
+        return false;
+    }
+
+    bool ok = fwrite(index->image, 1, index->imageSize, file) == index->imageSize;
+    if (fclose(file) != 0) ok = false;
+    if (ok && rename(tempName, filename) != 0) ok = false;
+    if (!ok) {
+        perror("Failed to write frozen model file");
+        remove(tempName);
+    }
+    return ok;
+}
+
+// Bytes of the image (mapped, embedded or owned) plus the tables derived on load
+size_t frozenIndexMemory(const FrozenIndex* index) {
+    if (!index) return 0;
+    size_t bytes = sizeof(FrozenIndex) + index->imageSize;
+    if (index->derived) {
+        for (int l = 0; l < index->maxN; l++) {
+            bytes += (size_t)index->levels[l].size * sizeof(uint32_t) * ((l + 1 < index->maxN) ? 2 : 1);
+        }
+    }
+    if (index->derivedLogProb) bytes += ((size_t)index->vocabSize + 1) * sizeof(float);
+    return bytes;
+}
+
+// Free a frozen index and release its backing memory
+void freeFrozenIndex(FrozenIndex* index) {
+    if (!index) return;
+
+    if (index->backing == FrozenBackingHeap) {
+        free((void*)index->image);
+    } else if (index->backing == FrozenBackingMmap) {
+        munmap((void*)index->image, index->imageSize);
+    }
+
+    free(index->derived);
+    free(index->derivedLogProb);
+    free(index);
+}
+
+// Point a vocabulary at the image's string table (no copies)
+void attachFrozenVocabulary(const FrozenIndex* index, Vocabulary* vocab) {
+    if (!index || !vocab) return;
+
+    VocabularyView view;
+    view.offsets = index->vocabOffsets;
+    view.sorted = index->vocabSorted;
+    view.strings = index->vocabStrings;
+    attachVocabularyView(vocab, index->vocabSize, view);
+}
+
+// Re-add every n-gram of the image to a trie, walking levels depth-first
+static void thawEntry(const FrozenIndex* index, NgramIndex* ngrams, int level, uint32_t entry,
+                      uint32_t* tokens) {
+    const FrozenLevel* lv = &index->levels[level];
+    tokens[level] = lv->tokenIds[entry];
+    addNgramWithCount(ngrams, tokens, level + 1, lv->counts[entry]);
+
+    uint32_t begin, end;
+    if (level + 1 < ngrams->maxN && frozenChildRange(index, level, entry, &begin, &end)) {
+        for (uint32_t c = begin; c < end; c++) thawEntry(index, ngrams, level + 1, c, tokens);
+    }
+}
+
+// Rebuild mutable trie counts from the image (used before retraining)
+void thawFrozenNgrams(const FrozenIndex* index, NgramIndex* ngrams) {
+    if (!index || !ngrams || index->maxN < 1) return;
+
+    uint32_t tokens[MaxN];
+    for (uint32_t i = 0; i < index->levels[0].size; i++) {
+        thawEntry(index, ngrams, 0, i, tokens);
+    }
+    // Keep the recorded total rather than the sum of re-added counts
+    ngrams->totalNgrams = index->totalNgrams;
+}
+
+// Find the entry for an n-gram of length n (stored in level n - 1)
+uint32_t frozenFindPrefix(const FrozenIndex* index, const uint32_t* tokens, int n) {
+    if (!index || !tokens || n < 1 || n > index->maxN) return FrozenNotFound;
+
+    uint32_t entry = frozenFindChild(index, 0, 0, index->levels[0].size, tokens[0]);
+    for (int l = 1; l < n && entry != FrozenNotFound; l++) {
+        const uint32_t* firstChild = index->levels[l - 1].firstChild;
+        entry = frozenFindChild(index, l, firstChild[entry], firstChild[entry + 1], tokens[l]);
+    }
+    return entry;
+}
+
+// Count of a unigram, 0 if never seen
+uint32_t frozenUnigramCount(const FrozenIndex* index, uint32_t tokenId) {
+    if (!index || index->maxN < 1) return 0;
+
+    uint32_t entry = frozenFindChild(index, 0, 0, index->levels[0].size, tokenId);
+    return (entry != FrozenNotFound) ? index->levels[0].counts[entry] : 0;
+}
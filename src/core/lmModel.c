@@ -4,9 +4,37 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
-// Maximum number of candidate tokens to consider
-#define MaxCandidates 100
+// Continuations read from each backoff order's ranked list (at least k, at most MaxPredictK)
+#define ContinuationsPerOrder 32
+#define MaxPredictK 64
+
+// Candidates one prediction can add: MaxPredictK from each of the maxN - 1
+// trie orders and the maxN - 2 skip-gram lengths, so none is ever dropped
+#define MaxCandidates ((2 * MaxN - 3) * MaxPredictK)
+
+// Open-addressing slots for finding a candidate by token (power of two, >= 2 * MaxCandidates)
+#define CandidateSlotBits 10
+#define CandidateSlots (1 << CandidateSlotBits)
+
+// Skip-gram votes relative to a trie suffix with as many known tokens
+#define SkipGramWeight 0.5f
+
+// Backoff weights
+#define BackoffDecay 0.85f     // decay per step farther from the last token
+#define BetaUnigram 0.10f      // prior weight for the unigram log-probability
+
+// BackoffDecay^d for every distance a context can span, filled once with
+// the same powf calls scoring used to make, so the weights are bit-identical
+static float decayPowers[MaxN];
+static pthread_once_t decayPowersOnce = PTHREAD_ONCE_INIT;
+
+static void fillDecayPowers(void) {
+    for (int d = 0; d < MaxN; d++) decayPowers[d] = powf(BackoffDecay, (float)d);
+}
 
 // Create a new language model
 LMModel* createLMModel(int maxN) {
@@ -38,6 +66,12 @@ LMModel* createLMModel(int maxN) {
     
     model->maxN = maxN;
     model->totalTokens = 0;
+    model->frozen = NULL;
+    model->frozenOnly = false;
+    model->skipGrams = NULL;
+    model->useSkipGrams = false;  // opt-in: no measured hit-rate gain
+    model->cache = NULL;
+    setOrderKernels(model, true);
     
     return model;
 }
@@ -46,6 +80,7 @@ LMModel* createLMModel(int maxN) {
 void freeLMModel(LMModel* model) {
     if (!model) return;
     
+    // The vocabulary may borrow strings from the frozen image, so free it first
     if (model->vocab) {
         freeVocabulary(model->vocab);
     }
@@ -58,250 +93,283 @@ void freeLMModel(LMModel* model) {
         freePatternIndex(model->patterns);
     }
     
+    if (model->frozen) {
+        freeFrozenIndex(model->frozen);
+    }
+    
+    freeSkipGrams(model->skipGrams);
+    freePredictCache(model->cache);
     free(model);
 }
 
+// Cache up to maxEntries predictions (0 removes the cache)
+bool setPredictCache(LMModel* model, uint32_t maxEntries) {
+    if (!model) return false;
+    
+    PredictCache* cache = NULL;
+    if (maxEntries > 0) {
+        cache = createPredictCache(maxEntries);
+        if (!cache) return false;
+    }
+    freePredictCache(model->cache);
+    model->cache = cache;
+    return true;
+}
+
+// Memory held by each part of the model
+void modelMemoryStats(const LMModel* model, ModelMemoryStats* stats) {
+    if (!stats) return;
+    memset(stats, 0, sizeof(*stats));
+    if (!model) return;
+    
+    stats->vocabBytes = vocabularyMemory(model->vocab);
+    stats->ngramBytes = (model->ngrams && model->ngrams->arena) ? model->ngrams->arena->bytesReserved : 0;
+    stats->patternBytes = patternIndexMemory(model->patterns);
+    stats->skipGramBytes = skipGramMemory(model->skipGrams);
+    stats->frozenBytes = frozenIndexMemory(model->frozen);
+    stats->frozenMapped = model->frozen && model->frozen->backing == FrozenBackingMmap;
+    if (model->cache) {
+        PredictCacheStats cache;
+        predictCacheStats(model->cache, &cache);
+        stats->cacheBytes = cache.bytes;
+    }
+}
+
+// Rebuild the read-only inference view from the trie and vocabulary
+void finalizeModel(LMModel* model) {
+    if (!model || model->frozenOnly) return;
+    
+    FrozenIndex* frozen = freezeNgrams(model->ngrams, model->vocab, model->totalTokens);
+    if (!frozen) {
+        fprintf(stderr, "Failed to build frozen model view\n");
+    }
+    
+    if (model->frozen) {
+        freeFrozenIndex(model->frozen);
+    }
+    model->frozen = frozen;
+    clearPredictCache(model->cache);
+    
+    // Patterns only exist after training; a loaded model keeps its table
+    if (model->patterns && model->patterns->size > 0) {
+        freeSkipGrams(model->skipGrams);
+        model->skipGrams = buildSkipGrams(model->patterns);
+    }
+}
+
+// Make a mapped model writable by copying its counts into the trie
+void thawModel(LMModel* model) {
+    if (!model || !model->frozenOnly) return;
+    
+    thawVocabulary(model->vocab);
+    thawFrozenNgrams(model->frozen, model->ngrams);
+    model->frozenOnly = false;
+}
+
+// Swap in a frozen image as the model's only source of counts
+static bool installFrozenImage(LMModel* model, FrozenIndex* frozen) {
+    NgramIndex* fresh = createNgramIndex(model->maxN);
+    if (!fresh) {
+        freeFrozenIndex(frozen);
+        return false;
+    }
+    freeNgramIndex(model->ngrams);
+    model->ngrams = fresh;
+    
+    // Re-point the vocabulary before the previous image (if any) goes away
+    attachFrozenVocabulary(frozen, model->vocab);
+    if (model->frozen) {
+        freeFrozenIndex(model->frozen);
+    }
+    
+    model->frozen = frozen;
+    model->totalTokens = frozen->totalTokens;
+    model->frozenOnly = true;
+    clearPredictCache(model->cache);
+    return true;
+}
+
 // Train the model on a text file
 void trainFromFile(LMModel* model, const char* filename) {
     if (!model || !filename) return;
     
-    FILE* file = fopen(filename, "r");
-    if (!file) {
+    CorpusReader* corpus = openCorpus(filename);
+    if (!corpus) {
         perror("Failed to open training file");
         return;
     }
     
-    char line[4096];
-    while (fgets(line, sizeof(line), file)) {
-        // Remove newline character
-        size_t len = strlen(line);
-        if (len > 0 && line[len-1] == '\n') {
-            line[len-1] = '\0';
-        }
-        
-        // Tokenize the line
-        Sentence s = initSentence();
-        tokenizeLine(line, &s);
-        
-        if (s.length == 0) continue;
+    // Counts from a mapped image are read-only; continue from a private copy
+    thawModel(model);
+    
+    TokenList tokens;
+    initTokenList(&tokens);
+    const char* line;
+    size_t length;
+    while (nextCorpusLine(corpus, &line, &length)) {
+        uint32_t count = tokenizeText(&tokens, line, length);
+        if (count == 0) continue;
         
         // Convert tokens to IDs
-        uint32_t tokenIds[s.length];
-        for (int i = 0; i < s.length; i++) {
-            tokenIds[i] = getOrAddToken(model->vocab, s.sequence[i].text);
-            model->totalTokens++;
+        for (uint32_t i = 0; i < count; i++) {
+            tokens.ids[i] = getOrAddToken(model->vocab, tokens.spans[i].text);
         }
+        model->totalTokens += count;
         
         // Update n-gram counts
-        updateNgrams(model->ngrams, tokenIds, s.length);
+        updateNgrams(model->ngrams, tokens.ids, (int)count);
         
         // Extract patterns
-        extractPatternsFromSequence(model->patterns, tokenIds, s.length);
+        extractPatternsFromSequence(model->patterns, tokens.ids, (int)count);
+    }
+    
+    freeTokenList(&tokens);
+    closeCorpus(corpus);
+    
+    finalizeModel(model);
+}
+
+// Train on top of the loaded counts without rebuilding them: the new text
+// is counted into an empty trie, and that image is merged with the current
+// one. Existing token IDs stay; new tokens get the next IDs, exactly as a
+// full retrain over the old corpus followed by this one would number them.
+// Returns false (keeping the current model) if the counts cannot be merged.
+bool trainIncremental(LMModel* model, const char* filename, int numThreads) {
+    if (!model || !filename) return false;
+    if (!model->frozen || model->totalTokens == 0) {
+        trainFromFileParallel(model, filename, numThreads);
+        return model->frozen != NULL;
+    }
+    
+    // The base image keeps backing its counts; its strings are copied so the vocabulary can grow
+    if (!thawVocabulary(model->vocab)) return false;
+    NgramIndex* delta = createNgramIndex(model->maxN);
+    if (!delta) return false;
+    FrozenIndex* base = model->frozen;
+    SkipGramIndex* baseSkipGrams = model->skipGrams;
+    uint64_t baseTokens = model->totalTokens;
+    
+    // A model loaded from .ngrams also holds the base counts in its trie; the image has them too
+    freeNgramIndex(model->ngrams);
+    model->ngrams = delta;
+    model->frozen = NULL;
+    model->frozenOnly = false;
+    model->skipGrams = NULL;
+    model->totalTokens = 0;
+    
+    // A loaded model has no patterns, only the skip-grams built from them:
+    // seed those so the rebuilt table counts old and new occurrences
+    if (model->patterns->size == 0) addSkipGramPatterns(baseSkipGrams, model->patterns);
+    trainFromFileParallel(model, filename, numThreads);
+    
+    FrozenIndex* merged = model->frozen ? mergeFrozenIndexes(base, model->frozen, model->vocab,
+                                                             baseTokens + model->totalTokens) : NULL;
+    if (!merged) {
+        fprintf(stderr, "Failed to merge the new counts; keeping the current model\n");
+        freeSkipGrams(model->skipGrams);
+        model->skipGrams = baseSkipGrams;
+        freePatternIndex(model->patterns);
+        model->patterns = createPatternIndex(1000, model->maxN);
+        installFrozenImage(model, base);
+        return false;
     }
     
-    fclose(file);
+    // Frees the delta image; the trie starts empty again, as after a load
+    bool ok = installFrozenImage(model, merged);
+    freeFrozenIndex(base);
+    freeSkipGrams(baseSkipGrams);
+    return ok;
+}
+
+// Frozen view for writing; builds a temporary one if the model was never finalized
+static const FrozenIndex* acquireFrozenView(const LMModel* model, FrozenIndex** temp) {
+    *temp = NULL;
+    if (model->frozen) return model->frozen;
+    *temp = freezeNgrams(model->ngrams, model->vocab, model->totalTokens);
+    return *temp;
+}
+
+// Identify the counts a skip-gram table was built against
+static void skipGramStamp(const LMModel* model, SkipGramStamp* stamp) {
+    memset(stamp, 0, sizeof(*stamp));
+    stamp->totalTokens = model->totalTokens;
+    stamp->vocabSize = model->vocab ? model->vocab->size : 0;
+    stamp->vocabHash = vocabularyFingerprint(model->vocab);
 }
 
 // Save model to binary files
 void saveModel(const LMModel* model, const char* basePath) {
     if (!model || !basePath) return;
     
+    FrozenIndex* temp = NULL;
+    const FrozenIndex* fz = acquireFrozenView(model, &temp);
+    if (!fz) return;
+    
     char filename[1024];
     
     // Save vocabulary
     snprintf(filename, sizeof(filename), "%s.vocab", basePath);
     saveVocabulary(model->vocab, filename);
     
-    // Save unigrams and totalTokens
-    snprintf(filename, sizeof(filename), "%s.uni", basePath);
-    FILE* f = fopen(filename, "wb");
-    if (f) {
-        fwrite(&model->totalTokens, sizeof(uint64_t), 1, f);
-        
-        uint32_t unigramCount = 0;
-        {
-            NgramIterator* it = ngramIterator(model->ngrams);
-            uint32_t token, count;
-            while (nextNgram(it, &token, 1, &count)) unigramCount++;
-            freeNgramIterator(it);
-        }
-        fwrite(&unigramCount, sizeof(uint32_t), 1, f);
-        
-        NgramIterator* it = ngramIterator(model->ngrams);
-        uint32_t token, count;
-        while (nextNgram(it, &token, 1, &count)) {
-            fwrite(&token, sizeof(uint32_t), 1, f);
-            fwrite(&count, sizeof(uint32_t), 1, f);
-        }
-        freeNgramIterator(it);
-        fclose(f);
-    }
+    // Save every order's counts
+    snprintf(filename, sizeof(filename), "%s%s", basePath, NgramFileExtension);
+    saveNgramFile(fz, filename);
     
-    // Save bigrams
-    snprintf(filename, sizeof(filename), "%s.bi", basePath);
-    FILE* f2 = fopen(filename, "wb");
-    if (f2 && model->ngrams && model->ngrams->root) {
-        uint32_t bigramCount = 0;
-        NgramNode* first = model->ngrams->root->children;
-        while (first) {
-            NgramNode* second = first->children;
-            while (second) { bigramCount++; second = second->next; }
-            first = first->next;
-        }
-        fwrite(&bigramCount, sizeof(uint32_t), 1, f2);
-        
-        first = model->ngrams->root->children;
-        while (first) {
-            NgramNode* second = first->children;
-            while (second) {
-                fwrite(&first->tokenId, sizeof(uint32_t), 1, f2);
-                fwrite(&second->tokenId, sizeof(uint32_t), 1, f2);
-                fwrite(&second->count, sizeof(uint32_t), 1, f2);
-                second = second->next;
-            }
-            first = first->next;
-        }
-        fclose(f2);
+    // Save skip-grams, stamped with the model they belong to
+    if (model->skipGrams) {
+        SkipGramStamp stamp;
+        skipGramStamp(model, &stamp);
+        snprintf(filename, sizeof(filename), "%s%s", basePath, SkipGramExtension);
+        saveSkipGrams(model->skipGrams, &stamp, filename);
     }
     
-    // Save trigrams
-    snprintf(filename, sizeof(filename), "%s.tri", basePath);
-    FILE* f3 = fopen(filename, "wb");
-    if (f3 && model->ngrams && model->ngrams->root) {
-        uint32_t trigramCount = 0;
-        NgramNode* first = model->ngrams->root->children;
-        while (first) {
-            NgramNode* second = first->children;
-            while (second) {
-                NgramNode* third = second->children;
-                while (third) { trigramCount++; third = third->next; }
-                second = second->next;
-            }
-            first = first->next;
-        }
-        fwrite(&trigramCount, sizeof(uint32_t), 1, f3);
-        
-        first = model->ngrams->root->children;
-        while (first) {
-            NgramNode* second = first->children;
-            while (second) {
-                NgramNode* third = second->children;
-                while (third) {
-                    fwrite(&first->tokenId, sizeof(uint32_t), 1, f3);
-                    fwrite(&second->tokenId, sizeof(uint32_t), 1, f3);
-                    fwrite(&third->tokenId, sizeof(uint32_t), 1, f3);
-                    fwrite(&third->count, sizeof(uint32_t), 1, f3);
-                    third = third->next;
-                }
-                second = second->next;
-            }
-            first = first->next;
-        }
-        fclose(f3);
-    }
+    if (temp) freeFrozenIndex(temp);
 }
 
-#ifdef EMBEDDED_MODEL
-// Declare embedded binary data symbols (created by objcopy)
-extern const unsigned char _binary_data_bin_cevia_id_vocab_start[];
-extern const unsigned char _binary_data_bin_cevia_id_vocab_end[];
-extern const unsigned char _binary_data_bin_cevia_id_uni_start[];
-extern const unsigned char _binary_data_bin_cevia_id_uni_end[];
-extern const unsigned char _binary_data_bin_cevia_id_bi_start[];
-extern const unsigned char _binary_data_bin_cevia_id_bi_end[];
-extern const unsigned char _binary_data_bin_cevia_id_tri_start[];
-extern const unsigned char _binary_data_bin_cevia_id_tri_end[];
-
-// Load vocabulary from embedded data
-static void loadEmbeddedVocab(LMModel* model) {
-    const unsigned char* data = _binary_data_bin_cevia_id_vocab_start;
-    
-    // Read vocab size
-    uint32_t size = *(uint32_t*)data;
-    data += 4;
-    
-    // Read each token
-    for (uint32_t i = 0; i < size; i++) {
-        uint16_t len = *(uint16_t*)data;
-        data += 2;
-        
-        char token[256];
-        memcpy(token, data, len);
-        token[len] = '\0';
-        data += len;
-        
-        getOrAddToken(model->vocab, token);
-    }
-}
-
-// Load n-grams from embedded data
-static void loadEmbeddedNgrams(LMModel* model) {
-    // Load unigrams
-    const unsigned char* data = _binary_data_bin_cevia_id_uni_start;
+// Save the model as a single mmap-able frozen image
+bool saveFrozenModel(const LMModel* model, const char* filename) {
+    if (!model || !filename) return false;
     
-    // Read totalTokens
-    model->totalTokens = *(uint64_t*)data;
-    data += 8;
+    FrozenIndex* temp = NULL;
+    const FrozenIndex* fz = acquireFrozenView(model, &temp);
+    if (!fz) return false;
     
-    // Read unigram count
-    uint32_t uniCount = *(uint32_t*)data;
-    data += 4;
-    
-    // Read unigrams
-    for (uint32_t i = 0; i < uniCount; i++) {
-        uint32_t token = *(uint32_t*)data;
-        data += 4;
-        uint32_t count = *(uint32_t*)data;
-        data += 4;
-        
-        addNgramWithCount(model->ngrams, &token, 1, count);
-    }
-    
-    // Load bigrams
-    data = _binary_data_bin_cevia_id_bi_start;
-    uint32_t biCount = *(uint32_t*)data;
-    data += 4;
-    
-    for (uint32_t i = 0; i < biCount; i++) {
-        uint32_t tokens[2];
-        tokens[0] = *(uint32_t*)data; data += 4;
-        tokens[1] = *(uint32_t*)data; data += 4;
-        uint32_t count = *(uint32_t*)data; data += 4;
-        
-        addNgramWithCount(model->ngrams, tokens, 2, count);
-    }
-    
-    // Load trigrams
-    data = _binary_data_bin_cevia_id_tri_start;
-    uint32_t triCount = *(uint32_t*)data;
-    data += 4;
+    bool ok = writeFrozenFile(fz, filename);
+    if (temp) freeFrozenIndex(temp);
+    return ok;
+}
+
+// Map a frozen image and query it in place (no trie rebuild)
+bool mapFrozenModel(LMModel* model, const char* filename) {
+    if (!model || !filename) return false;
     
-    for (uint32_t i = 0; i < triCount; i++) {
-        uint32_t tokens[3];
-        tokens[0] = *(uint32_t*)data; data += 4;
-        tokens[1] = *(uint32_t*)data; data += 4;
-        tokens[2] = *(uint32_t*)data; data += 4;
-        uint32_t count = *(uint32_t*)data; data += 4;
-        
-        addNgramWithCount(model->ngrams, tokens, 3, count);
-    }
+    FrozenIndex* frozen = mapFrozenFile(filename);
+    if (!frozen) return false;
+    return installFrozenImage(model, frozen);
 }
 
+#ifdef EMBEDDED_MODEL
+// Declare embedded binary data symbols (created by objcopy)
+extern const unsigned char _binary_data_bin_cevia_id_cvm_start[];
+extern const unsigned char _binary_data_bin_cevia_id_cvm_end[];
+
 // Load model from embedded data
 void loadEmbeddedModel(LMModel* model) {
     if (!model) return;
     
     printf("Loading model from embedded data...\n");
-    loadEmbeddedVocab(model);
-    loadEmbeddedNgrams(model);
+    size_t size = (size_t)(_binary_data_bin_cevia_id_cvm_end - _binary_data_bin_cevia_id_cvm_start);
+    FrozenIndex* frozen = attachFrozenImage(_binary_data_bin_cevia_id_cvm_start, size);
+    if (!frozen || !installFrozenImage(model, frozen)) {
+        fprintf(stderr, "Embedded model image is invalid\n");
+        return;
+    }
     printf("✓ Loaded embedded model (vocab: %u tokens)\n", model->vocab->size);
 }
 #endif
 
-// Load model from files
-void loadModel(LMModel* model, const char* basePath) {
-    if (!model || !basePath) return;
-    
+// Load the n-gram counts from the frozen image, the .ngrams file or the legacy files
+static void loadCounts(LMModel* model, const char* basePath) {
 #ifdef EMBEDDED_MODEL
     // Use embedded data instead of files
     loadEmbeddedModel(model);
@@ -310,10 +378,29 @@ void loadModel(LMModel* model, const char* basePath) {
     
     char filename[1024];
     
+    // Prefer the single-file frozen image: it is mapped, not rebuilt
+    snprintf(filename, sizeof(filename), "%s%s", basePath, FrozenExtension);
+    if (access(filename, R_OK) == 0 && mapFrozenModel(model, filename)) {
+        return;
+    }
+    
+    // Count files are rebuilt into the trie
+    model->frozenOnly = false;
+    
     // Load vocabulary
     snprintf(filename, sizeof(filename), "%s.vocab", basePath);
     loadVocabulary(model->vocab, filename);
     
+    // All orders, delta-encoded
+    snprintf(filename, sizeof(filename), "%s%s", basePath, NgramFileExtension);
+    if (access(filename, R_OK) == 0 &&
+        loadNgramFile(model->ngrams, filename, model->vocab->size, &model->totalTokens)) {
+        finalizeModel(model);
+        return;
+    }
+    
+    // Legacy per-order files (up to trigrams)
+    
     // Load unigrams and totalTokens
     snprintf(filename, sizeof(filename), "%s.uni", basePath);
     FILE* f = fopen(filename, "rb");
@@ -321,11 +408,13 @@ void loadModel(LMModel* model, const char* basePath) {
         // Read totalTokens
         if (fread(&model->totalTokens, sizeof(uint64_t), 1, f) != 1) {
             fclose(f);
+            finalizeModel(model);
             return;
         }
         uint32_t unigramCount = 0;
         if (fread(&unigramCount, sizeof(uint32_t), 1, f) != 1) {
             fclose(f);
+            finalizeModel(model);
             return;
         }
         for (uint32_t i = 0; i < unigramCount; i++) {
@@ -373,156 +462,373 @@ void loadModel(LMModel* model, const char* basePath) {
         }
         fclose(f3);
     }
+    
+    finalizeModel(model);
 #endif  // EMBEDDED_MODEL
 }
 
-// Predict the next token given a context
-typedef struct {
-    uint32_t token;
-    uint32_t count;
-} TokenCount;
-
-static int compareTokenCountDesc(const void* a, const void* b) {
-    const TokenCount* ta = (const TokenCount*)a;
-    const TokenCount* tb = (const TokenCount*)b;
-    if (tb->count > ta->count) return 1;
-    if (tb->count < ta->count) return -1;
-    return 0;
+// Load model from files
+void loadModel(LMModel* model, const char* basePath) {
+    if (!model || !basePath) return;
+    
+    loadCounts(model, basePath);
+    
+#ifndef EMBEDDED_MODEL
+    // Skip-grams are optional: models saved without them just skip that stage,
+    // and so do models whose .skip was written for other counts (e.g. a merge)
+    char filename[1024];
+    snprintf(filename, sizeof(filename), "%s%s", basePath, SkipGramExtension);
+    SkipGramStamp stamp;
+    skipGramStamp(model, &stamp);
+    freeSkipGrams(model->skipGrams);
+    model->skipGrams = loadSkipGrams(filename, &stamp);
+    clearPredictCache(model->cache);
+#endif
+}
+
+// Candidate continuation and its accumulated score
+typedef struct { uint32_t token; float score; } CandScore;
+
+// Lookup slot: index into the candidate array, valid only for the epoch that wrote it
+typedef struct { uint32_t epoch; uint32_t index; } CandSlot;
+
+// Heap buffer with room for n entries, grown on demand
+static CandScore* scratchSortBuffer(PredictScratch* scratch, size_t n) {
+    if (n > scratch->sortCapacity) {
+        CandScore* grown = (CandScore*)realloc(scratch->sortBuffer, sizeof(CandScore) * n);
+        if (!grown) return NULL;
+        scratch->sortBuffer = grown;
+        scratch->sortCapacity = n;
+    }
+    return (CandScore*)scratch->sortBuffer;
+}
+
+// Candidate slots emptied in O(1): every prediction starts a new epoch
+static CandSlot* scratchCandSlots(PredictScratch* scratch) {
+    if (!scratch->candSlots) {
+        scratch->candSlots = calloc(CandidateSlots, sizeof(CandSlot));
+        if (!scratch->candSlots) return NULL;
+        scratch->candEpoch = 0;
+    }
+    // Epoch 0 marks slots never written; on wraparound clear them for real
+    if (++scratch->candEpoch == 0) {
+        memset(scratch->candSlots, 0, sizeof(CandSlot) * CandidateSlots);
+        scratch->candEpoch = 1;
+    }
+    return (CandSlot*)scratch->candSlots;
+}
+
+// Release buffers held by a scratch area
+void freePredictScratch(PredictScratch* scratch) {
+    if (!scratch) return;
+    free(scratch->sortBuffer);
+    free(scratch->candSlots);
+    scratch->sortBuffer = NULL;
+    scratch->sortCapacity = 0;
+    scratch->candSlots = NULL;
+    scratch->candEpoch = 0;
 }
 
 void predictNextToken(const LMModel* model, const char* context, 
                      uint32_t* topTokens, float* scores, int k) {
-    if (!model || !context || !topTokens || !scores || k <= 0) return;
-    
-    // Tokenize the context
-    Sentence s = initSentence();
-    tokenizeLine(context, &s);
-    
-    if (s.length == 0) return;
+    PredictScratch scratch = {0};
+    predictNextTokenScratch(model, context, topTokens, scores, k, &scratch);
+    freePredictScratch(&scratch);
+}
+
+// Context tokens the model can condition on
+static int contextOrder(const LMModel* model) {
+    int order = model->maxN - 1;
+    return (order < MaxN - 1) ? order : MaxN - 1;
+}
+
+// Same as predictNextToken, reusing the caller's buffers across calls
+void predictNextTokenScratch(const LMModel* model, const char* context,
+                             uint32_t* topTokens, float* scores, int k,
+                             PredictScratch* scratch) {
+    if (!model || !context || !topTokens || !scores || k <= 0 || !scratch) return;
+    
+    // Tokenize the context, keeping only the words prediction can use
+    char words[MaxN - 1][MaxWordLen];
+    int order = contextOrder(model);
+    if (order < 1) return;
+    size_t length = strlen(context);
+    size_t pos = 0;
+    int count = 0;
+    while (scanToken(context, length, &pos, words[count % order]) > 0) count++;
+    if (count == 0) return;
+    
+    // Look up the kept words, oldest first (0 for unknown words)
+    int used = (count < order) ? count : order;
+    uint32_t ctxIds[MaxN - 1];
+    for (int i = 0; i < used; i++) {
+        ctxIds[i] = lookupToken(model->vocab, words[(count - used + i) % order]);
+    }
+    predictNextTokenIds(model, ctxIds, used, topTokens, scores, k, scratch);
+}
+
+// Predict from context token IDs (oldest first); unknown tokens are ID 0
+// Only the last maxN - 1 IDs are used.
+void predictNextTokenIds(const LMModel* model, const uint32_t* contextIds, int length,
+                         uint32_t* topTokens, float* scores, int k,
+                         PredictScratch* scratch) {
+    if (!model || !contextIds || length <= 0) return;
+    
+    PredictCursor cursor;
+    initPredictCursor(&cursor, model);
+    int start = (length > cursor.order) ? length - cursor.order : 0;
+    for (int i = start; i < length; i++) {
+        advancePredictCursor(&cursor, contextIds[i]);
+    }
+    predictFromCursor(model, &cursor, topTokens, scores, k, scratch);
+}
+
+// Start a cursor with an empty context over the model's current image
+void initPredictCursor(PredictCursor* cursor, const LMModel* model) {
+    if (!cursor) return;
+    cursor->frozen = model ? model->frozen : NULL;
+    cursor->order = model ? contextOrder(model) : 0;
+    if (cursor->order < 0) cursor->order = 0;
+    cursor->length = 0;
+    cursor->kernels = model ? model->kernels : NULL;
+    for (int i = 0; i < MaxN - 1; i++) {
+        cursor->entries[i] = FrozenNotFound;
+        cursor->tokens[i] = 0;
+    }
+}
+
+// Kernels below take the context order (or length) as a parameter: each is
+// inlined once per order with it constant, so the per-order loops unroll and
+// the cursor arrays are indexed by constants, and once with the runtime value
+#define KernelInline __attribute__((always_inline)) inline
+
+// Append a token: the entry for the last L tokens is the child of the
+// entry for the previous L - 1, so one child search per order
+static KernelInline void advanceKernel(PredictCursor* cursor, uint32_t tokenId, const int order) {
+    const FrozenIndex* fz = cursor->frozen;
+    int searches = (tokenId != 0);
+    
+    for (int L = order; L >= 2; L--) {
+        uint32_t parent = cursor->entries[L - 2];
+        uint32_t begin, end;
+        cursor->entries[L - 1] = FrozenNotFound;
+        if (tokenId != 0 && parent != FrozenNotFound &&
+            frozenChildRange(fz, L - 2, parent, &begin, &end)) {
+            cursor->entries[L - 1] = frozenFindChild(fz, L - 1, begin, end, tokenId);
+            searches++;
+        }
+    }
+    // Unknown tokens break every suffix that contains them
+    cursor->entries[0] = (tokenId != 0) ? frozenFindChild(fz, 0, 0, fz->levels[0].size, tokenId)
+                                        : FrozenNotFound;
+    StatCount(StatCursorAdvances);
+    StatAdd(StatChildSearches, searches);
+    if (cursor->length < order) {
+        cursor->length++;
+    } else {
+        memmove(cursor->tokens, cursor->tokens + 1, sizeof(uint32_t) * (size_t)(cursor->length - 1));
+    }
+    cursor->tokens[cursor->length - 1] = tokenId;
+}
+
+// Add contrib to a token's candidate, inserting it on first sight
+static inline void addCandidate(CandScore* cand, int* candCount, CandSlot* slots, uint32_t epoch,
+                                uint32_t tokenId, float contrib) {
+    uint32_t slot = (tokenId * 2654435761u) >> (32 - CandidateSlotBits);
+    while (slots[slot].epoch == epoch && cand[slots[slot].index].token != tokenId) {
+        slot = (slot + 1) & (CandidateSlots - 1);
+    }
+    if (slots[slot].epoch != epoch) {
+        if (*candCount < MaxCandidates) {
+            slots[slot].epoch = epoch;
+            slots[slot].index = (uint32_t)*candCount;
+            cand[*candCount].token = tokenId;
+            cand[*candCount].score = contrib;
+            (*candCount)++;
+        }
+    } else {
+        cand[slots[slot].index].score += contrib;
+    }
+}
+
+// Ranking order: higher score first, lower token ID on ties
+static inline bool rankedBefore(const CandScore* a, const CandScore* b) {
+    return a->score > b->score || (a->score == b->score && a->token < b->token);
+}
+
+// Restore the heap below i, where heap[0] is the lowest-ranked kept candidate
+static void siftDownWorst(CandScore* heap, int size, int i) {
+    CandScore item = heap[i];
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= size) break;
+        if (child + 1 < size && rankedBefore(&heap[child], &heap[child + 1])) child++;
+        if (!rankedBefore(&item, &heap[child])) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = item;
+}
+
+// Best k of n candidates into out, ranked: O(n log k) with a k-entry heap
+static int selectTopCandidates(const CandScore* cand, int n, int k, CandScore* out) {
+    int size = 0;
+    for (int i = 0; i < n; i++) {
+        if (size < k) {
+            // Sift up: parents rank after their children
+            int j = size++;
+            while (j > 0) {
+                int parent = (j - 1) / 2;
+                if (!rankedBefore(&out[parent], &cand[i])) break;
+                out[j] = out[parent];
+                j = parent;
+            }
+            out[j] = cand[i];
+        } else if (rankedBefore(&cand[i], &out[0])) {
+            out[0] = cand[i];
+            siftDownWorst(out, size, 0);
+        }
+    }
+    // Pop the worst to the back until the array is ranked best first
+    for (int end = size - 1; end > 0; end--) {
+        CandScore worst = out[0];
+        out[0] = out[end];
+        out[end] = worst;
+        siftDownWorst(out, end, 0);
+    }
+    return size;
+}
+
+// Score the continuations of a cursor holding maxContext >= 1 tokens (fills all k outputs)
+static KernelInline void scoreKernel(const LMModel* model, const PredictCursor* cursor,
+                                     uint32_t* topTokens, float* scores, int k,
+                                     PredictScratch* scratch, const int maxContext) {
+    const FrozenIndex* fz = model->frozen;
     
     // Backward reasoning with multi-order backoff
     // Aggregate candidate scores from longest suffix to shortest, weighting longer fragments higher
-    const int maxContext = (s.length < (model->maxN - 1)) ? s.length : (model->maxN - 1);
-    typedef struct { uint32_t token; float score; } CandScore;
     CandScore cand[MaxCandidates];
     int candCount = 0;
-    // Weights
-    const float Decay = 0.85f;       // decay per step farther from last token
-    const float BetaUnigram = 0.10f; // prior weight for unigram log-probability
-    
-    // Temporary buffer for context token IDs
-    uint32_t ctxIds[model->maxN];
-    
-    for (int L = maxContext; L >= 1; L--) {
-        // Build suffix of length L
-        bool ok = true;
-        for (int i = 0; i < L; i++) {
-            const char* t = s.sequence[s.length - L + i].text;
-            uint32_t id = hashMapGet(model->vocab->tokenToId, t);
-            if (id == 0) { ok = false; break; }
-            ctxIds[i] = id;
-        }
-        if (!ok) continue;
-        
-        // Find prefix node for this suffix
-        NgramNode* node = findPrefixNode(model->ngrams, ctxIds, L);
-        if (!node || !node->children) continue;
+    CandSlot* slots = scratchCandSlots(scratch);
+    uint32_t epoch = scratch->candEpoch;
+    
+    // Approximation: a token outside the first perOrder continuations of every
+    // order is never scored, though its summed score could reach the top k.
+    // Against reading every continuation it changed no top-5 or top-10 list
+    // over 200k test contexts, at a fraction of the latency.
+    uint32_t perOrder = (uint32_t)((k < ContinuationsPerOrder) ? ContinuationsPerOrder :
+                                   (k > MaxPredictK) ? MaxPredictK : k);
+    pthread_once(&decayPowersOnce, fillDecayPowers);
+    int matched = 0;  // longest suffix that contributed
+    
+    for (int L = maxContext; slots && L >= 1; L--) {
+        // Entry of the last L tokens (tracked by the cursor); its children live in level L
+        uint32_t entry = cursor->entries[L - 1];
+        uint32_t begin, end;
+        if (entry == FrozenNotFound || !frozenChildRange(fz, L - 1, entry, &begin, &end)) continue;
+        const FrozenLevel* next = &fz->levels[L];
         
-        // Denominator: sum of children counts
-        uint32_t denom = 0;
-        for (NgramNode* ch = node->children; ch; ch = ch->next) denom += ch->count;
+        // Denominator: sum of children counts, precomputed at finalize
+        uint32_t denom = fz->levels[L - 1].childTotals[entry];
         if (denom == 0) continue;
+        if (!matched) matched = L;
         
         // Weight: prefer longer L and apply decay for more distant fragments
-        float w = (float)L * powf(Decay, (float)(maxContext - L));
+        float w = (float)L * decayPowers[maxContext - L];
         
-        // Accumulate normalized counts into candidate scores
-        for (NgramNode* ch = node->children; ch; ch = ch->next) {
-            float contrib = w * ((float)ch->count / (float)denom);
-            // Find or insert candidate
-            int idx = -1;
-            for (int j = 0; j < candCount; j++) { if (cand[j].token == ch->tokenId) { idx = j; break; } }
-            if (idx == -1) {
-                if (candCount < MaxCandidates) {
-                    cand[candCount].token = ch->tokenId;
-                    cand[candCount].score = contrib;
-                    candCount++;
-                }
-            } else {
-                cand[idx].score += contrib;
+        // Accumulate normalized counts of the top continuations into candidate scores
+        uint32_t last = (end - begin > perOrder) ? begin + perOrder : end;
+        for (uint32_t r = begin; r < last; r++) {
+            uint32_t c = next->ranked[r];
+            float contrib = w * ((float)next->counts[c] / (float)denom);
+            addCandidate(cand, &candCount, slots, epoch, next->tokenIds[c], contrib);
+        }
+    }
+    
+    // Skip-gram backoff: when the full context was never seen, the gapped
+    // contexts ending at it ("a b _" for "a b c") vote for continuations too
+    uint32_t full = cursor->entries[maxContext - 1];
+    uint32_t fullBegin, fullEnd;
+    bool skipGramHit = false;
+    if (slots && model->useSkipGrams && model->skipGrams &&
+        (full == FrozenNotFound || !frozenChildRange(fz, maxContext - 1, full, &fullBegin, &fullEnd))) {
+        for (int L = maxContext; L >= 2; L--) {
+            uint32_t key[MaxN - 1];
+            int concrete = 0;
+            for (int i = 0; i < L; i++) {
+                key[i] = PatternWildcardAt(i) ? WildcardToken : cursor->tokens[maxContext - L + i];
+                if (key[i] != WildcardToken) concrete++;
+            }
+            uint32_t begin, end, total;
+            if (concrete == L || !findSkipGram(model->skipGrams, key, L, &begin, &end, &total)) continue;
+            if (total == 0) continue;
+            skipGramHit = true;
+            
+            // Weighted like a trie suffix of the same number of known tokens, one step farther back
+            float w = SkipGramWeight * (float)concrete * decayPowers[maxContext - concrete];
+            uint32_t last = (end - begin > perOrder) ? begin + perOrder : end;
+            for (uint32_t r = begin; r < last; r++) {
+                float contrib = w * ((float)model->skipGrams->counts[r] / (float)total);
+                addCandidate(cand, &candCount, slots, epoch, model->skipGrams->tokenIds[r], contrib);
             }
         }
     }
     
-    // If we have candidates, sort and fill outputs
+    StatBackoffDepth(matched);
+    if (skipGramHit) StatCount(StatPredictSkipGrams);
+    
+    // If we have candidates, select the best k and fill outputs
     int filled = 0;
     if (candCount > 0) {
         // Add unigram prior to each candidate: Beta * log P_unigram
-        if (model->totalTokens > 0) {
+        // (log-probabilities precomputed at freeze; a view over another total recomputes them)
+        if (model->totalTokens > 0 && fz->totalTokens == model->totalTokens) {
             for (int i = 0; i < candCount; i++) {
-                uint32_t t = cand[i].token;
-                uint32_t tarr[1] = { t };
-                uint32_t c = getNgramCount(model->ngrams, tarr, 1);
-                float p = (c > 0) ? ((float)c / (float)model->totalTokens) : (1.0f / (float)(model->totalTokens + 1));
-                cand[i].score += BetaUnigram * logf(fmaxf(p, 1e-9f));
+                cand[i].score += BetaUnigram * frozenUnigramLogProb(fz, cand[i].token);
             }
-        }
-        // Convert to TokenCount-like array for sorting
-        TokenCount* arr = (TokenCount*)malloc(sizeof(TokenCount) * candCount);
-        if (arr) {
+        } else if (model->totalTokens > 0) {
             for (int i = 0; i < candCount; i++) {
-                arr[i].token = cand[i].token;
-                // Temporarily store score scaled to integer by 1e6 for sorting reuse
-                arr[i].count = (uint32_t)(cand[i].score * 1000000.0f);
+                uint32_t c = frozenUnigramCount(fz, cand[i].token);
+                cand[i].score += BetaUnigram * frozenUnigramLogProbOf(c, model->totalTokens);
             }
-            if (candCount > 1) qsort(arr, candCount, sizeof(TokenCount), compareTokenCountDesc);
+        }
+        // Ranked on the float scores themselves, which the prior can make negative
+        int keep = (candCount < k) ? candCount : k;
+        CandScore* best = scratchSortBuffer(scratch, (size_t)keep);
+        if (best) {
+            filled = selectTopCandidates(cand, candCount, keep, best);
+            // Softmax over the kept scores: positive and summing to 1 even when
+            // the prior pushed some below zero (best[0] is the largest)
+            float sum = 0.0f;
             for (int i = 0; i < k; i++) {
-                if (i < candCount) {
-                    topTokens[i] = arr[i].token;
-                    // Recover approximate score by rescaling; alternatively renormalize below
-                    scores[i] = (float)arr[i].count / 1000000.0f;
-                    filled++;
+                if (i < filled) {
+                    topTokens[i] = best[i].token;
+                    scores[i] = expf(best[i].score - best[0].score);
+                    sum += scores[i];
                 } else { topTokens[i] = 0; scores[i] = 0.0f; }
             }
-            free(arr);
-            // Optional: renormalize top-k scores to sum to 1
-            float sum = 0.0f; for (int i = 0; i < filled; i++) sum += scores[i];
-            if (sum > 0.0f) { for (int i = 0; i < filled; i++) scores[i] /= sum; }
+            for (int i = 0; i < filled; i++) scores[i] /= sum;
         }
     }
     
     if (!filled || filled < k) {
-        // Fallback: Unigram ranking
-        NgramIterator* it = ngramIterator(model->ngrams);
-        if (!it) return;
-        size_t uniCount = 0;
-        {
-            uint32_t token; uint32_t c;
-            while (nextNgram(it, &token, 1, &c)) { uniCount++; }
-        }
-        freeNgramIterator(it);
-        TokenCount* arr = NULL;
-        if (uniCount > 0) arr = (TokenCount*)malloc(sizeof(TokenCount) * uniCount);
-        size_t idx = 0;
-        it = ngramIterator(model->ngrams);
-        if (arr && it) {
-            uint32_t token; uint32_t c;
-            while (nextNgram(it, &token, 1, &c)) { arr[idx].token = token; arr[idx].count = c; idx++; }
-        }
-        if (it) freeNgramIterator(it);
-        if (arr && uniCount > 1) qsort(arr, uniCount, sizeof(TokenCount), compareTokenCountDesc);
-        // If some slots already filled by bigram, append from unigrams skipping duplicates
-        if (arr && model->totalTokens > 0) {
+        StatCount(StatPredictFallback);
+        // Fallback: unigram ranking, ranked once when the model was finalized
+        // (levels[0].ranked is rebuilt whenever the model is retrained)
+        const FrozenLevel* uni = &fz->levels[0];
+        if (uni->size > 0 && model->totalTokens > 0) {
+            // If some slots already filled by bigram, append from unigrams skipping duplicates
             int outIdx = filled;
-            for (size_t j = 0; j < uniCount && outIdx < k; j++) {
-                uint32_t cand = arr[j].token;
+            for (uint32_t j = 0; j < uni->size && outIdx < k; j++) {
+                uint32_t entry = uni->ranked[j];
+                uint32_t cand = uni->tokenIds[entry];
                 int dup = 0;
-                for (int t = 0; t < outIdx; t++) {
+                for (int t = 0; t < filled; t++) {
                     if (topTokens[t] == cand) { dup = 1; break; }
                 }
                 if (!dup) {
                     topTokens[outIdx] = cand;
-                    scores[outIdx] = (float)arr[j].count / (float)model->totalTokens;
+                    scores[outIdx] = (float)uni->counts[entry] / (float)model->totalTokens;
                     outIdx++;
                 }
             }
@@ -531,12 +837,116 @@ void predictNextToken(const LMModel* model, const char* context,
         } else {
             for (int i = 0; i < k; i++) { topTokens[i] = 0; scores[i] = 0.0f; }
         }
-        if (arr) free(arr);
     }
 }
 
+typedef void (*ScoreKernelFn)(const LMModel*, const PredictCursor*, uint32_t*, float*, int, PredictScratch*);
+
+struct OrderKernels {
+    void (*advance)(PredictCursor* cursor, uint32_t tokenId);
+    ScoreKernelFn score[MaxN];  // by context length, 1 .. order
+};
+
+// Orders with specialized kernels: every context order up to MaxN - 1
+#define ForEachKernelOrder(X) X(1) X(2) X(3) X(4)
+_Static_assert(MaxN == 5, "ForEachKernelOrder must list 1 .. MaxN - 1");
+
+#define DefineOrderKernels(N) \
+    static void advanceOrder##N(PredictCursor* cursor, uint32_t tokenId) { \
+        advanceKernel(cursor, tokenId, N); \
+    } \
+    static void scoreLength##N(const LMModel* model, const PredictCursor* cursor, uint32_t* topTokens, \
+                               float* scores, int k, PredictScratch* scratch) { \
+        scoreKernel(model, cursor, topTokens, scores, k, scratch, N); \
+    }
+ForEachKernelOrder(DefineOrderKernels)
+
+static void advanceGeneric(PredictCursor* cursor, uint32_t tokenId) {
+    advanceKernel(cursor, tokenId, cursor->order);
+}
+
+static void scoreGeneric(const LMModel* model, const PredictCursor* cursor, uint32_t* topTokens,
+                         float* scores, int k, PredictScratch* scratch) {
+    scoreKernel(model, cursor, topTokens, scores, k, scratch, cursor->length);
+}
+
+// A cursor of any order holds 1 .. order tokens; scoring picks the kernel by length
+#define OrderKernelEntry(N) \
+    { advanceOrder##N, { NULL, scoreLength1, scoreLength2, scoreLength3, scoreLength4 } },
+static const struct OrderKernels specializedKernels[MaxN] = {
+    { advanceGeneric, { NULL, NULL, NULL, NULL, NULL } },  // order 0: advancing and scoring return early
+    ForEachKernelOrder(OrderKernelEntry)
+};
+
+static const struct OrderKernels genericKernels = {
+    advanceGeneric,
+    { NULL, scoreGeneric, scoreGeneric, scoreGeneric, scoreGeneric }
+};
+
+// Pick the kernels for the model's context order; cursors initialized
+// afterwards use them
+void setOrderKernels(LMModel* model, bool specialized) {
+    if (!model) return;
+    model->kernels = specialized ? &specializedKernels[contextOrder(model)] : &genericKernels;
+}
+
+bool usesSpecializedKernels(const LMModel* model) {
+    return model && model->kernels != &genericKernels;
+}
+
+void advancePredictCursor(PredictCursor* cursor, uint32_t tokenId) {
+    if (!cursor || !cursor->frozen || cursor->order < 1 || !cursor->kernels) return;
+    cursor->kernels->advance(cursor, tokenId);
+}
+
+// Predict the token following the cursor's context
+void predictFromCursor(const LMModel* model, const PredictCursor* cursor,
+                       uint32_t* topTokens, float* scores, int k,
+                       PredictScratch* scratch) {
+    if (!model || !cursor || !topTokens || !scores || k <= 0 || !scratch) return;
+    if (cursor->length <= 0) return;
+    if (!model->frozen || model->frozen != cursor->frozen) return;  // Never trained, or the cursor is stale
+    ScoreKernelFn score = model->kernels->score[cursor->length];
+    StatTimerStart(started);
+    
+    if (!model->cache || k > PredictCacheMaxK) {
+        score(model, cursor, topTokens, scores, k, scratch);
+    } else {
+        // The cursor's tokens are exactly what scoring reads
+        PredictCacheKey key;
+        memcpy(key.tokens, cursor->tokens, sizeof(uint32_t) * (size_t)cursor->length);
+        key.length = (uint8_t)cursor->length;
+        key.k = (uint8_t)k;
+        key.skipGrams = (model->useSkipGrams && model->skipGrams) ? 1 : 0;
+        if (!predictCacheLookup(model->cache, &key, topTokens, scores)) {
+            score(model, cursor, topTokens, scores, k, scratch);
+            predictCacheInsert(model->cache, &key, topTokens, scores);
+        }
+    }
+    StatCount(StatPredictions);
+    StatTimerStop(StatLatencyPredict, started);
+}
+
+// Per-call random state (xorshift64*), so concurrent generations share nothing
+static float nextRandom(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return (float)((x * 0x2545F4914F6CDD1DULL) >> 40) / (float)(1 << 24);
+}
+
+// Seed differs per call even when several threads start in the same second
+static uint64_t seedRandom(void) {
+    static _Atomic uint64_t sequence = 0;
+    uint64_t seed = (uint64_t)time(NULL) * 0x9E3779B97F4A7C15ULL;
+    seed ^= (atomic_fetch_add(&sequence, 1) + 1) * 0xBF58476D1CE4E5B9ULL;
+    return seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
 // Helper: Sample token from probability distribution with temperature
-static uint32_t sampleToken(uint32_t* tokens, float* scores, int k, float temperature) {
+static uint32_t sampleToken(uint32_t* tokens, float* scores, int k, float temperature, uint64_t* rng) {
     if (k <= 0) return 0;
     
     // Greedy sampling (temperature = 0)
@@ -548,14 +958,19 @@ static uint32_t sampleToken(uint32_t* tokens, float* scores, int k, float temper
     float adjusted[64];  // Max k=64
     if (k > 64) k = 64;
     
+    // score^(1/T): one powf per candidate instead of expf(logf(score) / T)
+    float invTemperature = 1.0f / temperature;
     float sum = 0.0f;
+    int valid = 0;
     for (int i = 0; i < k; i++) {
         if (scores[i] <= 0.0f) break;
-        adjusted[i] = expf(logf(scores[i] + 1e-9f) / temperature);
+        adjusted[i] = (temperature == 1.0f) ? scores[i] + 1e-9f : powf(scores[i] + 1e-9f, invTemperature);
         sum += adjusted[i];
+        valid++;
     }
     
     if (sum <= 0.0f) return tokens[0];
+    k = valid;
     
     // Normalize
     for (int i = 0; i < k; i++) {
@@ -563,7 +978,7 @@ static uint32_t sampleToken(uint32_t* tokens, float* scores, int k, float temper
     }
     
     // Sample from distribution
-    float r = (float)rand() / (float)RAND_MAX;
+    float r = nextRandom(rng);
     float cumulative = 0.0f;
     for (int i = 0; i < k; i++) {
         cumulative += adjusted[i];
@@ -576,24 +991,21 @@ static uint32_t sampleToken(uint32_t* tokens, float* scores, int k, float temper
 }
 
 // Helper: Score response quality
-static float scoreResponse(const char* response, int tokenCount) {
-    float score = 0.0f;
-    
-    // Length scoring (prefer 5-15 tokens)
-    if (tokenCount < 3) {
-        score -= 10.0f;  // Too short
-    } else if (tokenCount > 20) {
-        score -= (tokenCount - 20) * 0.5f;  // Too long penalty
-    } else if (tokenCount >= 5 && tokenCount <= 15) {
-        score += 5.0f;  // Ideal length
-    }
+// Length scoring (prefer 5-15 tokens)
+static float lengthScore(int tokenCount) {
+    if (tokenCount < 3) return -10.0f;  // Too short
+    if (tokenCount > 20) return -(tokenCount - 20) * 0.5f;  // Too long penalty
+    if (tokenCount >= 5 && tokenCount <= 15) return 5.0f;  // Ideal length
+    return 0.0f;
+}
+
+static float scoreResponse(const uint32_t* tokens, int tokenCount) {
+    float score = lengthScore(tokenCount);
     
     // Check for repetition
-    Sentence s = initSentence();
-    tokenizeLine(response, &s);
-    for (int i = 0; i < s.length - 1; i++) {
-        for (int j = i + 1; j < s.length; j++) {
-            if (strcmp(s.sequence[i].text, s.sequence[j].text) == 0) {
+    for (int i = 0; i < tokenCount - 1; i++) {
+        for (int j = i + 1; j < tokenCount; j++) {
+            if (tokens[i] == tokens[j]) {
                 score -= 2.0f;  // Repetition penalty
             }
         }
@@ -644,7 +1056,7 @@ static int shouldStop(const char* generated, int tokenCount, const char* lastTok
 }
 
 // Helper: Detect repetition (improved)
-static int hasRepetition(uint32_t* tokenHistory, int count) {
+static int hasRepetition(const uint32_t* tokenHistory, int count) {
     if (count < 2) return 0;
     
     // Check if last 3 tokens are the same
@@ -671,77 +1083,59 @@ void generateResponse(const LMModel* model, const char* input,
                      char* output, int maxTokens, float temperature) {
     if (!model || !input || !output) return;
     
-    // Initialize random seed
-    static int seeded = 0;
-    if (!seeded) {
-        srand((unsigned int)time(NULL));
-        seeded = 1;
-    }
-    
-    // Tokenize input to get starting context
-    Sentence s = initSentence();
-    tokenizeLine(input, &s);
-    
-    if (s.length == 0) {
-        output[0] = '\0';
-        return;
-    }
-    
-    // Build initial context from last tokens (up to 7 for balance)
-    char context[512] = "";
-    int contextStart = (s.length > 7) ? (s.length - 7) : 0;
-    for (int i = contextStart; i < s.length; i++) {
-        if (i > contextStart) strcat(context, " ");
-        strcat(context, s.sequence[i].text);
+    uint64_t rng = seedRandom();
+    output[0] = '\0';
+    
+    // Tokenize the input once; from here on a cursor tracks the context in the trie
+    PredictCursor cursor;
+    initPredictCursor(&cursor, model);
+    size_t inputLength = strlen(input);
+    size_t pos = 0;
+    char word[MaxWordLen];
+    int inputTokens = 0;
+    while (scanToken(input, inputLength, &pos, word) > 0) {
+        advancePredictCursor(&cursor, lookupToken(model->vocab, word));
+        inputTokens++;
     }
+    if (inputTokens == 0) return;
     
     // Generation buffer
-    char generated[2048] = "";
-    uint32_t tokenHistory[100];
+    char generated[GenerateOutputSize] = "";
+    size_t generatedLength = 0;
+    uint32_t tokenHistory[MaxGeneratedTokens];
     int tokenCount = 0;
+    PredictScratch scratch = {0};
     
     // Generation loop
-    for (int i = 0; i < maxTokens && i < 100; i++) {
+    for (int i = 0; i < maxTokens && i < MaxGeneratedTokens; i++) {
+        StatTimerStart(stepStarted);
         // Predict next token
-        uint32_t topTokens[10];
-        float scores[10];
-        predictNextToken(model, context, topTokens, scores, 10);
+        uint32_t topTokens[10] = {0};
+        float scores[10] = {0};
+        predictFromCursor(model, &cursor, topTokens, scores, 10, &scratch);
         
         // Check if we got valid predictions
         if (scores[0] <= 0.0f) break;
         
         // Sample token based on temperature
-        uint32_t nextToken = sampleToken(topTokens, scores, 10, temperature);
+        uint32_t nextToken = sampleToken(topTokens, scores, 10, temperature, &rng);
         
         // Get token text
         const char* tokenText = getTokenById(model->vocab, nextToken);
-        if (!tokenText || strlen(tokenText) == 0) break;
+        size_t tokenLength = tokenText ? strlen(tokenText) : 0;
+        if (tokenLength == 0) break;
         
-        // Append to generated text
-        if (strlen(generated) > 0) {
-            strcat(generated, " ");
-        }
-        strcat(generated, tokenText);
+        // Append to generated text; stop once the output buffer is full
+        size_t needed = tokenLength + (generatedLength > 0 ? 1 : 0);
+        if (generatedLength + needed >= sizeof(generated)) break;
+        if (generatedLength > 0) generated[generatedLength++] = ' ';
+        memcpy(generated + generatedLength, tokenText, tokenLength + 1);
+        generatedLength += tokenLength;
         
-        // Update context: keep last 7 tokens for balance
-        char newContext[512];
-        Sentence ctxSent = initSentence();
-        tokenizeLine(context, &ctxSent);
-        
-        // Add new token
-        if (ctxSent.length < 7) {
-            snprintf(newContext, sizeof(newContext), "%s %s", context, tokenText);
-        } else {
-            // Keep last 6 tokens + new token
-            newContext[0] = '\0';
-            for (int j = ctxSent.length - 6; j < ctxSent.length; j++) {
-                if (strlen(newContext) > 0) strcat(newContext, " ");
-                strcat(newContext, ctxSent.sequence[j].text);
-            }
-            strcat(newContext, " ");
-            strcat(newContext, tokenText);
-        }
-        snprintf(context, sizeof(context), "%s", newContext);
+        // Advance the context by the new token
+        advancePredictCursor(&cursor, nextToken);
+        StatCount(StatGenerateSteps);
+        StatTimerStop(StatLatencyGenerateStep, stepStarted);
         
         // Store in history
         tokenHistory[tokenCount] = nextToken;
@@ -751,8 +1145,261 @@ void generateResponse(const LMModel* model, const char* input,
         if (shouldStop(generated, tokenCount, tokenText, scores[0])) break;
         if (hasRepetition(tokenHistory, tokenCount)) break;
     }
+    freePredictScratch(&scratch);
     
     // Copy to output
-    snprintf(output, 2048, "%s", generated);
+    snprintf(output, GenerateOutputSize, "%s", generated);
+}
+
+// One live hypothesis of the beam: children copy their parent's cursor,
+// so shared prefixes are never looked up again
+typedef struct {
+    PredictCursor cursor;
+    uint32_t tokens[MaxGeneratedTokens];
+    int length;
+    float logProb;      // sum of log scores of the chosen tokens
+    int repeats;        // pairs of equal tokens (scoreResponse's repetition count)
+    size_t textLength;  // bytes the reply text takes (without NUL)
+} BeamState;
+
+// Candidate extension of a live hypothesis
+typedef struct {
+    int parent;
+    int rank;       // position in the parent's predictions
+    uint32_t token;
+    float logProb;  // parent's logProb plus this token's
+    float topScore; // best score at the parent, used for the confidence stop
+} BeamExpansion;
+
+// Order expansions by log score (descending), then parent and rank
+static int compareExpansionDesc(const void* a, const void* b) {
+    const BeamExpansion* x = (const BeamExpansion*)a;
+    const BeamExpansion* y = (const BeamExpansion*)b;
+    if (x->logProb != y->logProb) return (x->logProb < y->logProb) ? 1 : -1;
+    if (x->parent != y->parent) return x->parent - y->parent;
+    return x->rank - y->rank;
+}
+
+// Cursors that predict identically: the same context tokens
+static bool sameCursorState(const PredictCursor* a, const PredictCursor* b) {
+    if (a->length != b->length) return false;
+    for (int i = 0; i < a->length; i++) {
+        if (a->tokens[i] != b->tokens[i]) return false;
+    }
+    return true;
+}
+
+// Prediction for one trie state, cached for the whole search
+typedef struct {
+    PredictCursor state;
+    bool valid;
+    uint32_t topTokens[BeamBranching];
+    float scores[BeamBranching];
+} BeamPrediction;
+
+// Predict through a direct-mapped cache keyed by the cursor's entries
+static const BeamPrediction* beamPredict(const LMModel* model, const PredictCursor* cursor,
+                                         BeamPrediction* cache, PredictScratch* scratch) {
+    uint64_t hash = (uint64_t)cursor->length;
+    for (int i = 0; i < cursor->length; i++) {
+        hash = (hash ^ cursor->entries[i]) * 0x9E3779B97F4A7C15ULL;
+    }
+    BeamPrediction* slot = &cache[(hash >> 32) & (BeamCacheSize - 1)];
+    if (slot->valid && sameCursorState(&slot->state, cursor)) return slot;
+    
+    slot->state = *cursor;
+    slot->valid = true;
+    memset(slot->topTokens, 0, sizeof(slot->topTokens));
+    memset(slot->scores, 0, sizeof(slot->scores));
+    predictFromCursor(model, cursor, slot->topTokens, slot->scores, BeamBranching, scratch);
+    return slot;
+}
+
+// Reranking score: response quality plus mean log score per token
+static float rankReply(const BeamState* beam) {
+    float fluency = (beam->length > 0) ? beam->logProb / (float)beam->length : 0.0f;
+    return scoreResponse(beam->tokens, beam->length) + fluency;
+}
+
+// Best rank any extension of a live hypothesis could still reach. The
+// repetition penalty only grows, and added tokens have log scores <= 0,
+// so a reply of final length F ranks at most lengthScore(F) + logProb / F.
+static float rankBound(const BeamState* beam, int maxTokens) {
+    float best = -INFINITY;
+    for (int length = beam->length; length <= maxTokens; length++) {
+        float bound = lengthScore(length) + beam->logProb / (float)length;
+        if (bound > best) best = bound;
+    }
+    return best - 2.0f * (float)beam->repeats;
+}
+
+// Keep a finished hypothesis if it ranks among the best `capacity` so far
+static void keepReply(GeneratedReply* replies, int* count, int capacity, const BeamState* beam) {
+    if (beam->length == 0) return;
+    float score = rankReply(beam);
+    
+    // A parent cut short by several expansions is only kept once
+    for (int i = 0; i < *count; i++) {
+        if (replies[i].length == beam->length &&
+            memcmp(replies[i].tokens, beam->tokens, sizeof(uint32_t) * (size_t)beam->length) == 0) {
+            return;
+        }
+    }
+    
+    int pos = *count;
+    if (pos == capacity) {
+        if (score <= replies[capacity - 1].score) return;
+        pos = capacity - 1;
+    } else {
+        (*count)++;
+    }
+    // Shift worse replies down (stable: earlier finishes win ties)
+    while (pos > 0 && replies[pos - 1].score < score) {
+        replies[pos] = replies[pos - 1];
+        pos--;
+    }
+    memcpy(replies[pos].tokens, beam->tokens, sizeof(uint32_t) * (size_t)beam->length);
+    replies[pos].length = beam->length;
+    replies[pos].score = score;
+}
+
+// Beam search: up to n replies, best first; returns how many were found
+// The beam keeps beamWidth open hypotheses (n when <= 0, at most
+// MaxBeamWidth); every hypothesis stops under the rules of generateResponse.
+int generateNBest(const LMModel* model, const char* input, int beamWidth, int maxTokens,
+                  GeneratedReply* replies, int n) {
+    if (!model || !input || !replies || n <= 0) return 0;
+    if (n > MaxBeamWidth) n = MaxBeamWidth;
+    int width = (beamWidth > 0) ? beamWidth : n;
+    if (width > MaxBeamWidth) width = MaxBeamWidth;
+    if (maxTokens > MaxGeneratedTokens) maxTokens = MaxGeneratedTokens;
+    
+    // Two generations of beam storage, swapped every step
+    BeamState storage[2][MaxBeamWidth];
+    BeamState* live = storage[0];
+    BeamState* next = storage[1];
+    BeamExpansion expansions[MaxBeamWidth * BeamBranching];
+    BeamPrediction cache[BeamCacheSize];
+    memset(cache, 0, sizeof(cache));
+    PredictScratch scratch = {0};
+    int numReplies = 0;
+    
+    // Root hypothesis: the prompt's context
+    initPredictCursor(&live[0].cursor, model);
+    size_t inputLength = strlen(input);
+    size_t pos = 0;
+    char word[MaxWordLen];
+    int inputTokens = 0;
+    while (scanToken(input, inputLength, &pos, word) > 0) {
+        advancePredictCursor(&live[0].cursor, lookupToken(model->vocab, word));
+        inputTokens++;
+    }
+    if (inputTokens == 0) return 0;
+    live[0].length = 0;
+    live[0].logProb = 0.0f;
+    live[0].repeats = 0;
+    live[0].textLength = 0;
+    int numLive = 1;
+    
+    for (int step = 0; step < maxTokens && numLive > 0; step++) {
+        // Expand every live hypothesis by its best continuations; hypotheses
+        // at a trie state seen before (same recent context) reuse its prediction
+        int numExpansions = 0;
+        for (int b = 0; b < numLive; b++) {
+            const BeamPrediction* prediction = beamPredict(model, &live[b].cursor, cache, &scratch);
+            const uint32_t* topTokens = prediction->topTokens;
+            const float* scores = prediction->scores;
+            if (scores[0] <= 0.0f) {
+                keepReply(replies, &numReplies, n, &live[b]);
+                continue;
+            }
+            for (int j = 0; j < BeamBranching && scores[j] > 0.0f; j++) {
+                BeamExpansion* e = &expansions[numExpansions++];
+                e->parent = b;
+                e->rank = j;
+                e->token = topTokens[j];
+                e->logProb = live[b].logProb + logf(scores[j]);
+                e->topScore = scores[0];
+            }
+        }
+        
+        // Best first; finished expansions become replies without using a
+        // beam slot, so one prediction can yield several candidates
+        qsort(expansions, (size_t)numExpansions, sizeof(BeamExpansion), compareExpansionDesc);
+        
+        int numNext = 0;
+        BeamState spare;
+        for (int i = 0; i < numExpansions; i++) {
+            const BeamExpansion* e = &expansions[i];
+            const BeamState* parent = &live[e->parent];
+            const char* tokenText = getTokenById(model->vocab, e->token);
+            size_t tokenLength = tokenText ? strlen(tokenText) : 0;
+            if (tokenLength == 0) {
+                keepReply(replies, &numReplies, n, parent);
+                continue;
+            }
+            size_t textLength = parent->textLength + tokenLength + (parent->length > 0 ? 1 : 0);
+            if (textLength >= GenerateOutputSize) {
+                keepReply(replies, &numReplies, n, parent);
+                continue;
+            }
+            
+            // Built in place when it may stay live, otherwise only to be kept
+            BeamState* child = (numNext < width) ? &next[numNext] : &spare;
+            memcpy(child->tokens, parent->tokens, sizeof(uint32_t) * (size_t)parent->length);
+            child->tokens[parent->length] = e->token;
+            child->length = parent->length + 1;
+            child->logProb = e->logProb;
+            child->repeats = parent->repeats;
+            for (int j = 0; j < parent->length; j++) {
+                if (parent->tokens[j] == e->token) child->repeats++;
+            }
+            child->textLength = textLength;
+            
+            if (shouldStop(NULL, child->length, tokenText, e->topScore) ||
+                hasRepetition(child->tokens, child->length)) {
+                keepReply(replies, &numReplies, n, child);
+            } else if (child == &spare) {
+                continue;  // beam is full
+            } else if (numReplies == n && rankBound(child, maxTokens) <= replies[n - 1].score) {
+                continue;  // nothing grown from here could displace a kept reply
+            } else {
+                // Only hypotheses that stay open need their trie position
+                child->cursor = parent->cursor;
+                advancePredictCursor(&child->cursor, e->token);
+                numNext++;
+            }
+        }
+        
+        BeamState* swap = live;
+        live = next;
+        next = swap;
+        numLive = numNext;
+    }
+    
+    // Hypotheses still open when the token budget ran out
+    for (int b = 0; b < numLive; b++) {
+        keepReply(replies, &numReplies, n, &live[b]);
+    }
+    freePredictScratch(&scratch);
+    return numReplies;
+}
+
+// Join a reply's tokens with spaces into output (size bytes)
+void formatReply(const LMModel* model, const GeneratedReply* reply, char* output, size_t size) {
+    if (!output || size == 0) return;
+    output[0] = '\0';
+    if (!model || !reply) return;
+    
+    size_t used = 0;
+    for (int i = 0; i < reply->length; i++) {
+        const char* tokenText = getTokenById(model->vocab, reply->tokens[i]);
+        size_t tokenLength = strlen(tokenText);
+        size_t needed = tokenLength + (used > 0 ? 1 : 0);
+        if (used + needed >= size) break;
+        if (used > 0) output[used++] = ' ';
+        memcpy(output + used, tokenText, tokenLength + 1);
+        used += tokenLength;
+    }
 }
 
@@ -0,0 +1,114 @@
+#include "../include/modelHandle.h"
+#include <sched.h>
+
+static ModelVersion* createVersion(LMModel* model, uint64_t generation) {
+    ModelVersion* version = (ModelVersion*)malloc(sizeof(ModelVersion));
+    if (!version) return NULL;
+    version->model = model;
+    atomic_init(&version->refs, 1);
+    version->generation = generation;
+    return version;
+}
+
+// Wrap a loaded model so it can be replaced while in use
+ModelHandle* createModelHandle(LMModel* model) {
+    if (!model) return NULL;
+
+    ModelHandle* handle = (ModelHandle*)calloc(1, sizeof(ModelHandle));
+    if (!handle) return NULL;
+
+    ModelVersion* version = createVersion(model, 0);
+    if (!version) {
+        free(handle);
+        return NULL;
+    }
+    atomic_init(&handle->current, version);
+    atomic_init(&handle->epoch, 0);
+    atomic_init(&handle->pins[0], 0);
+    atomic_init(&handle->pins[1], 0);
+    pthread_mutex_init(&handle->reloadLock, NULL);
+    return handle;
+}
+
+void freeModelHandle(ModelHandle* handle) {
+    if (!handle) return;
+    releaseModel(atomic_load(&handle->current));
+    pthread_mutex_destroy(&handle->reloadLock);
+    free(handle);
+}
+
+ModelVersion* acquireModel(ModelHandle* handle) {
+    if (!handle) return NULL;
+
+    // Pin the epoch we read; retry if a swap moved it before the pin landed
+    uint64_t epoch;
+    while (1) {
+        epoch = atomic_load(&handle->epoch);
+        atomic_fetch_add(&handle->pins[epoch & 1], 1);
+        if (atomic_load(&handle->epoch) == epoch) break;
+        atomic_fetch_sub(&handle->pins[epoch & 1], 1);
+    }
+    ModelVersion* version = atomic_load(&handle->current);
+    atomic_fetch_add(&version->refs, 1);
+    atomic_fetch_sub(&handle->pins[epoch & 1], 1);
+    return version;
+}
+
+void releaseModel(ModelVersion* version) {
+    if (!version) return;
+    if (atomic_fetch_sub(&version->refs, 1) == 1) {
+        freeLMModel(version->model);
+        free(version);
+    }
+}
+
+bool swapModel(ModelHandle* handle, LMModel* model) {
+    if (!handle || !model) return false;
+
+    pthread_mutex_lock(&handle->reloadLock);
+    ModelVersion* old = atomic_load(&handle->current);
+    ModelVersion* version = createVersion(model, old->generation + 1);
+    if (!version) {
+        pthread_mutex_unlock(&handle->reloadLock);
+        freeLMModel(model);
+        return false;
+    }
+    atomic_store(&handle->current, version);
+
+    // Readers pinned under the old epoch may hold the old pointer without
+    // a reference yet; new pins see the new pointer. Wait out the old ones.
+    uint64_t epoch = atomic_fetch_add(&handle->epoch, 1);
+    while (atomic_load(&handle->pins[epoch & 1]) != 0) sched_yield();
+    pthread_mutex_unlock(&handle->reloadLock);
+
+    // In-flight requests keep the old version alive until they release it
+    releaseModel(old);
+    return true;
+}
+
+bool reloadModel(ModelHandle* handle, const char* prefix) {
+    if (!handle || !prefix) return false;
+
+    // The current settings (and cache size) carry over; nothing here blocks readers
+    ModelVersion* current = acquireModel(handle);
+    int maxN = current->model->maxN;
+    bool useSkipGrams = current->model->useSkipGrams;
+    bool specialized = usesSpecializedKernels(current->model);
+    uint32_t cacheEntries = current->model->cache ? current->model->cache->capacity : 0;
+    releaseModel(current);
+
+    LMModel* model = createLMModel(maxN);
+    if (!model) return false;
+    loadModel(model, prefix);
+    // A missing model loads as an empty one rather than failing
+    if (!model->frozen || model->totalTokens == 0) {
+        fprintf(stderr, "Reload of %s failed; keeping the current model\n", prefix);
+        freeLMModel(model);
+        return false;
+    }
+    model->useSkipGrams = useSkipGrams;
+    setOrderKernels(model, specialized);
+    // A fresh cache: nothing cached from the old model carries over
+    setPredictCache(model, cacheEntries);
+    return swapModel(handle, model);
+}
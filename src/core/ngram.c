@@ -1,8 +1,15 @@
 #include "../include/ngram.h"
+#include "../include/stats.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+// Child runs at or below this size are scanned linearly; larger runs use binary search
+#define LinearSearchThreshold 8
+
+// Initial number of child slots allocated for a node
+#define InitialChildCapacity 2
+
 // Create a new n-gram index
 NgramIndex* createNgramIndex(int maxN) {
     if (maxN < 1) return NULL;
@@ -10,73 +17,94 @@ NgramIndex* createNgramIndex(int maxN) {
     NgramIndex* index = (NgramIndex*)malloc(sizeof(NgramIndex));
     if (!index) return NULL;
     
-    index->root = (NgramNode*)calloc(1, sizeof(NgramNode));
+    index->arena = createArena();
+    index->root = index->arena ? (NgramNode*)arenaAlloc(index->arena, sizeof(NgramNode)) : NULL;
     if (!index->root) {
+        freeArena(index->arena);
         free(index);
         return NULL;
     }
+    memset(index->root, 0, sizeof(NgramNode));
     
     index->maxN = maxN;
     index->totalNgrams = 0;
     return index;
 }
 
-// Free a node and all its children recursively
-static void freeNgramNode(NgramNode* node) {
-    if (!node) return;
+// Free n-gram index (the whole trie goes with its arena)
+void freeNgramIndex(NgramIndex* index) {
+    if (!index) return;
     
-    // Free siblings
-    if (node->next) {
-        freeNgramNode(node->next);
+    freeArena(index->arena);
+    free(index);
+}
+
+// Return the position of the first child whose tokenId is >= tokenId
+static uint32_t lowerBoundChild(const NgramNode* node, uint32_t tokenId) {
+    const NgramNode* children = node->children;
+    uint32_t lo = 0;
+    uint32_t hi = node->numChildren;
+    
+    while (hi - lo > LinearSearchThreshold) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (children[mid].tokenId < tokenId) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
     }
+    while (lo < hi && children[lo].tokenId < tokenId) lo++;
+    return lo;
+}
+
+// Find the direct child of a node with the given token ID
+NgramNode* findChildNode(const NgramNode* node, uint32_t tokenId) {
+    if (!node || node->numChildren == 0) return NULL;
     
-    // Free children
-    if (node->children) {
-        freeNgramNode(node->children);
+    uint32_t pos = lowerBoundChild(node, tokenId);
+    if (pos < node->numChildren && node->children[pos].tokenId == tokenId) {
+        return &node->children[pos];
     }
-    
-    free(node);
+    return NULL;
 }
 
-// Free n-gram index
-void freeNgramIndex(NgramIndex* index) {
-    if (!index) return;
+// Find a child or insert it at its sorted position
+// Token IDs are handed out in first-seen order, so new unigrams land at the
+// end of the root run and the memmove below is usually empty.
+NgramNode* getOrAddChildNode(Arena* arena, NgramNode* node, uint32_t tokenId) {
+    uint32_t pos = lowerBoundChild(node, tokenId);
+    if (pos < node->numChildren && node->children[pos].tokenId == tokenId) {
+        return &node->children[pos];
+    }
     
-    if (index->root) {
-        freeNgramNode(index->root);
+    // Grow the child array if needed
+    if (node->numChildren >= node->capacity) {
+        uint32_t newCapacity = node->capacity ? node->capacity * 2 : InitialChildCapacity;
+        NgramNode* grown = (NgramNode*)arenaAllocBlock(arena, newCapacity * sizeof(NgramNode));
+        if (!grown) return NULL;  // Memory allocation failed
+        if (node->numChildren > 0) memcpy(grown, node->children, node->numChildren * sizeof(NgramNode));
+        // The old array is recycled for the next node that needs this size
+        arenaFreeBlock(arena, node->children, node->capacity * sizeof(NgramNode));
+        node->children = grown;
+        node->capacity = newCapacity;
     }
     
-    free(index);
+    // Shift the tail to keep the run sorted
+    if (pos < node->numChildren) {
+        memmove(&node->children[pos + 1], &node->children[pos],
+                (node->numChildren - pos) * sizeof(NgramNode));
+    }
+    
+    NgramNode* child = &node->children[pos];
+    memset(child, 0, sizeof(NgramNode));
+    child->tokenId = tokenId;
+    node->numChildren++;
+    return child;
 }
 
 // Add an n-gram to the index
 void addNgram(NgramIndex* index, const uint32_t* tokens, int n) {
-    if (!index || !tokens || n < 1 || n > index->maxN) return;
-    
-    NgramNode* current = index->root;
-    
-    for (int i = 0; i < n; i++) {
-        uint32_t tokenId = tokens[i];
-        NgramNode** next = &(current->children);
-        
-        // Find the node for this token
-        while (*next && (*next)->tokenId != tokenId) {
-            next = &((*next)->next);
-        }
-        
-        // Create new node if not found
-        if (!*next) {
-            *next = (NgramNode*)calloc(1, sizeof(NgramNode));
-            if (!*next) return;  // Memory allocation failed
-            (*next)->tokenId = tokenId;
-        }
-        
-        current = *next;
-    }
-    
-    // Increment count for this n-gram
-    current->count++;
-    index->totalNgrams++;
+    addNgramWithCount(index, tokens, n, 1);
 }
 
 // Add an n-gram with an explicit count (used for loading from disk)
@@ -86,18 +114,10 @@ void addNgramWithCount(NgramIndex* index, const uint32_t* tokens, int n, uint32_
     NgramNode* current = index->root;
     
     for (int i = 0; i < n; i++) {
-        uint32_t tokenId = tokens[i];
-        NgramNode** next = &(current->children);
-        while (*next && (*next)->tokenId != tokenId) {
-            next = &((*next)->next);
-        }
-        if (!*next) {
-            *next = (NgramNode*)calloc(1, sizeof(NgramNode));
-            if (!*next) return;
-            (*next)->tokenId = tokenId;
-        }
-        current = *next;
+        current = getOrAddChildNode(index->arena, current, tokens[i]);
+        if (!current) return;  // Memory allocation failed
     }
+    
     // Add the provided count
     current->count += count;
     index->totalNgrams += count;
@@ -105,24 +125,8 @@ void addNgramWithCount(NgramIndex* index, const uint32_t* tokens, int n, uint32_
 
 // Get the count of a specific n-gram
 uint32_t getNgramCount(const NgramIndex* index, const uint32_t* tokens, int n) {
-    if (!index || !tokens || n < 1 || n > index->maxN) return 0;
-    
-    NgramNode* current = index->root;
-    
-    for (int i = 0; i < n; i++) {
-        uint32_t tokenId = tokens[i];
-        NgramNode* next = current->children;
-        
-        // Find the node for this token
-        while (next && next->tokenId != tokenId) {
-            next = next->next;
-        }
-        
-        if (!next) return 0;  // N-gram not found
-        current = next;
-    }
-    
-    return current->count;
+    const NgramNode* node = findPrefixNode(index, tokens, n);
+    return node ? node->count : 0;  // 0 if n-gram not found
 }
 
 // Create an iterator for traversing all n-grams
@@ -132,33 +136,50 @@ NgramIterator* ngramIterator(const NgramIndex* index) {
     NgramIterator* it = (NgramIterator*)malloc(sizeof(NgramIterator));
     if (!it) return NULL;
     
-    it->node = index->root;
-    it->depth = 0;
+    initNgramIterator(it, index, index->maxN);
     return it;
 }
 
-// Get the next n-gram from the iterator
+// Initialize an iterator over n-grams of order 1..maxN (caller-owned storage)
+void initNgramIterator(NgramIterator* it, const NgramIndex* index, int maxN) {
+    if (!it) return;
+    
+    memset(it, 0, sizeof(NgramIterator));
+    if (maxN > MaxN) maxN = MaxN;
+    if (index && maxN > index->maxN) maxN = index->maxN;
+    it->maxN = maxN;
+    it->depth = (index && index->root && maxN >= 1) ? 0 : -1;
+    if (it->depth == 0) it->stack[0] = index->root;
+}
+
+// Get the next n-gram (at most maxN tokens); returns its length, 0 when done
 int nextNgram(NgramIterator* it, uint32_t* tokens, int maxN, uint32_t* count) {
-    if (!it || !it->node || !tokens || maxN < 1) return 0;
-    
-    // This is a simplified implementation that only returns unigrams
-    // A full implementation would need to traverse the tree properly
-    static NgramNode* current = NULL;
-    
-    if (!current) {
-        current = it->node->children;
-    } else {
-        current = current->next;
-    }
-    
-    if (!current) {
-        current = NULL;
-        return 0;
+    if (!it || !tokens || !count || maxN < 1) return 0;
+    
+    int limit = (maxN < it->maxN) ? maxN : it->maxN;
+    while (it->depth >= 0) {
+        int d = it->depth;
+        const NgramNode* parent = it->stack[d];
+        if (it->pos[d] >= parent->numChildren || d >= limit) {
+            it->depth--;
+            continue;
+        }
+        
+        const NgramNode* node = &parent->children[it->pos[d]++];
+        it->tokens[d] = node->tokenId;
+        int n = d + 1;
+        memcpy(tokens, it->tokens, sizeof(uint32_t) * (size_t)n);
+        *count = node->count;
+        
+        // Descend next time if this n-gram has extensions within the limit
+        if (n < limit && node->numChildren > 0) {
+            it->depth = n;
+            it->stack[n] = node;
+            it->pos[n] = 0;
+        }
+        return n;
     }
-    
-    tokens[0] = current->tokenId;
-    *count = current->count;
-    return 1;  // Return 1 for unigram
+    return 0;
 }
 
 // Free an n-gram iterator
@@ -172,25 +193,43 @@ void updateNgrams(NgramIndex* index, const uint32_t* tokens, int length) {
     
     // For each position in the sequence
     for (int i = 0; i < length; i++) {
-        // For each possible n-gram length starting at this position
+        // Walk down once and count every prefix of the longest n-gram starting here
+        NgramNode* current = index->root;
         for (int n = 1; n <= index->maxN && (i + n) <= length; n++) {
-            addNgram(index, tokens + i, n);
+            current = getOrAddChildNode(index->arena, current, tokens[i + n - 1]);
+            if (!current) return;  // Memory allocation failed
+            current->count++;
+            index->totalNgrams++;
         }
     }
 }
 
+// Merge the subtree below src into dst, remapping token IDs
+uint64_t mergeNgramChildren(Arena* arena, NgramNode* dst, const NgramNode* src, const uint32_t* idMap) {
+    if (!dst || !src || !idMap) return 0;
+    
+    uint64_t added = 0;
+    for (uint32_t i = 0; i < src->numChildren; i++) {
+        const NgramNode* from = &src->children[i];
+        NgramNode* to = getOrAddChildNode(arena, dst, idMap[from->tokenId]);
+        if (!to) return added;  // Memory allocation failed
+        to->count += from->count;
+        added += from->count;
+        // `to` stays valid while recursing: only its own child array changes
+        added += mergeNgramChildren(arena, to, from, idMap);
+    }
+    return added;
+}
+
 // Find the node corresponding to a prefix sequence of length n
 NgramNode* findPrefixNode(const NgramIndex* index, const uint32_t* tokens, int n) {
     if (!index || !tokens || n < 1 || n > index->maxN) return NULL;
     NgramNode* current = index->root;
-    for (int i = 0; i < n; i++) {
-        uint32_t tokenId = tokens[i];
-        NgramNode* child = current ? current->children : NULL;
-        while (child && child->tokenId != tokenId) {
-            child = child->next;
-        }
-        if (!child) return NULL;
-        current = child;
+    int i = 0;
+    for (; i < n && current; i++) {
+        current = findChildNode(current, tokens[i]);
     }
+    StatCount(StatTrieLookups);
+    StatAdd(StatTrieNodes, i);
     return current;
 }
@@ -0,0 +1,167 @@
+#include "../include/ngramFile.h"
+#include "../include/serialize.h"
+
+// On-disk header, followed by the varint-coded levels
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t maxN;
+    uint64_t totalTokens;
+    uint64_t totalNgrams;
+    uint32_t levelSize[MaxN];  // n-grams of order level + 1
+    uint32_t reserved;
+} NgramFileHeaderRecord;
+
+// Write one group: its size, then token deltas and counts
+static void writeGroup(BufferedWriter* writer, const FrozenLevel* level, uint32_t begin, uint32_t end) {
+    writeVarint(writer, end - begin);
+    uint32_t previous = 0;
+    for (uint32_t i = begin; i < end; i++) {
+        writeVarint(writer, level->tokenIds[i] - previous);
+        writeVarint(writer, level->counts[i]);
+        previous = level->tokenIds[i];
+    }
+}
+
+// Write every order of a frozen trie to <prefix>.ngrams
+bool saveNgramFile(const FrozenIndex* index, const char* filename) {
+    if (!index || !filename || index->maxN < 1 || index->maxN > MaxN) return false;
+
+    // Same temporary-and-rename as writeFrozenFile
+    char tempName[1024];
+    snprintf(tempName, sizeof(tempName), "%s.tmp", filename);
+    BufferedWriter* writer = openWriter(tempName);
+    if (!writer) {
+        perror("Failed to create n-gram file");
+        return false;
+    }
+
+    NgramFileHeaderRecord header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, NgramFileMagic, sizeof(header.magic));
+    header.version = NgramFileVersion;
+    header.maxN = (uint32_t)index->maxN;
+    header.totalTokens = index->totalTokens;
+    header.totalNgrams = index->totalNgrams;
+    for (int l = 0; l < index->maxN; l++) header.levelSize[l] = index->levels[l].size;
+    writeBytes(writer, &header, sizeof(header));
+
+    writeGroup(writer, &index->levels[0], 0, index->levels[0].size);
+    for (int l = 1; l < index->maxN; l++) {
+        const FrozenLevel* parent = &index->levels[l - 1];
+        for (uint32_t p = 0; p < parent->size; p++) {
+            writeGroup(writer, &index->levels[l], parent->firstChild[p], parent->firstChild[p + 1]);
+        }
+    }
+
+    bool ok = closeWriter(writer);
+    if (ok && rename(tempName, filename) != 0) ok = false;
+    if (!ok) {
+        fprintf(stderr, "Failed to write n-gram file %s\n", filename);
+        remove(tempName);
+    }
+    return ok;
+}
+
+// Read one group into a fresh child array of parent; false if malformed
+static bool readGroup(ByteReader* reader, NgramIndex* ngrams, NgramNode* parent,
+                      NgramNode** nodes, uint32_t* used, uint32_t levelSize, uint32_t vocabSize) {
+    uint64_t n = readVarint(reader);
+    if (reader->failed || n > levelSize - *used) return false;
+    if (n == 0) return true;
+
+    NgramNode* children = (NgramNode*)arenaAllocBlock(ngrams->arena, (size_t)n * sizeof(NgramNode));
+    if (!children) return false;
+
+    uint64_t token = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t delta = readVarint(reader);
+        uint64_t count = readVarint(reader);
+        // Siblings are strictly ascending
+        if (reader->failed || (i > 0 && delta == 0) || count > UINT32_MAX) return false;
+        token += delta;
+        if (token >= vocabSize) return false;  // not this vocabulary's counts
+
+        NgramNode* child = &children[i];
+        child->tokenId = (uint32_t)token;
+        child->count = (uint32_t)count;
+        child->numChildren = 0;
+        child->capacity = 0;
+        child->children = NULL;
+        if (nodes) nodes[*used] = child;
+        (*used)++;
+    }
+    parent->children = children;
+    parent->numChildren = (uint32_t)n;
+    parent->capacity = (uint32_t)n;
+    return true;
+}
+
+// Rebuild an empty trie from <prefix>.ngrams, one level at a time
+// Orders above ngrams->maxN are skipped. Returns false, with the trie
+// left empty, if the file is missing, malformed or holds token IDs
+// outside the vocabulary (count and vocabulary files of different models).
+bool loadNgramFile(NgramIndex* ngrams, const char* filename, uint32_t vocabSize, uint64_t* totalTokens) {
+    if (!ngrams || !filename || ngrams->root->numChildren > 0) return false;
+
+    ByteReader reader;
+    if (!openReader(&reader, filename)) return false;
+
+    NgramFileHeaderRecord header;
+    if (!readBytes(&reader, &header, sizeof(header)) ||
+        memcmp(header.magic, NgramFileMagic, sizeof(header.magic)) != 0 ||
+        header.version != NgramFileVersion || header.maxN < 1 || header.maxN > MaxN) {
+        fprintf(stderr, "N-gram file %s is invalid\n", filename);
+        closeReader(&reader);
+        return false;
+    }
+
+    // Every record takes at least two bytes, which bounds the allocations
+    int levels = ((int)header.maxN < ngrams->maxN) ? (int)header.maxN : ngrams->maxN;
+    uint64_t records = 0;
+    for (int l = 0; l < levels; l++) records += header.levelSize[l];
+    bool ok = records <= (reader.size - reader.pos) / 2;
+
+    // Nodes of the previous and current level, in file order
+    NgramNode** previous = NULL;
+    NgramNode** current = NULL;
+    uint32_t previousSize = 0;
+    for (int l = 0; ok && l < levels; l++) {
+        uint32_t size = header.levelSize[l];
+        bool last = (l + 1 == levels);
+        current = last ? NULL : (NgramNode**)malloc(((size_t)size + 1) * sizeof(NgramNode*));
+        if (!last && !current) {
+            ok = false;
+            break;
+        }
+
+        uint32_t used = 0;
+        if (l == 0) {
+            ok = readGroup(&reader, ngrams, ngrams->root, current, &used, size, vocabSize);
+        } else {
+            for (uint32_t p = 0; ok && p < previousSize; p++) {
+                ok = readGroup(&reader, ngrams, previous[p], current, &used, size, vocabSize);
+            }
+        }
+        ok = ok && used == size;
+
+        free(previous);
+        previous = current;
+        current = NULL;
+        previousSize = size;
+    }
+    free(previous);
+    closeReader(&reader);
+
+    if (!ok) {
+        // Partial levels stay in the arena until the index is freed
+        ngrams->root->children = NULL;
+        ngrams->root->numChildren = 0;
+        ngrams->root->capacity = 0;
+        fprintf(stderr, "N-gram file %s is invalid\n", filename);
+        return false;
+    }
+    ngrams->totalNgrams = header.totalNgrams;
+    if (totalTokens) *totalTokens = header.totalTokens;
+    return true;
+}
@@ -0,0 +1,243 @@
+#include "../include/lmModel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Bytes of corpus handed to each worker per batch
+#define SliceBytes (4u << 20)
+
+// Upper bound on worker threads
+#define MaxTrainThreads 256
+
+// One worker's share of a batch and its thread-local tables (local token IDs)
+typedef struct {
+    const char* begin;
+    const char* end;
+    Vocabulary* vocab;
+    NgramIndex* ngrams;
+    PatternIndex* patterns;
+    TokenList tokens;
+    uint64_t totalTokens;
+    uint32_t* idMap;  // local token ID -> model token ID
+} TrainSlice;
+
+// Work item for merging one hash shard of the trie
+// Each shard allocates from its own arena, adopted by the model's trie afterwards.
+typedef struct {
+    NgramNode* root;
+    Arena* arena;
+    const TrainSlice* slices;
+    int numSlices;
+    int shard;
+    int numShards;
+    uint64_t added;
+} MergeShard;
+
+// Tokenize one line and count it into the slice's local tables
+static void countLine(TrainSlice* slice, const char* line, size_t length) {
+    TokenList* tokens = &slice->tokens;
+    uint32_t count = tokenizeText(tokens, line, length);
+    if (count == 0) return;
+
+    for (uint32_t i = 0; i < count; i++) {
+        tokens->ids[i] = getOrAddToken(slice->vocab, tokens->spans[i].text);
+    }
+    slice->totalTokens += count;
+
+    updateNgrams(slice->ngrams, tokens->ids, (int)count);
+    extractPatternsFromSequence(slice->patterns, tokens->ids, (int)count);
+}
+
+// Worker: count the slice line by line, straight from the corpus buffer
+static void* countSlice(void* arg) {
+    TrainSlice* slice = (TrainSlice*)arg;
+
+    const char* p = slice->begin;
+    while (p < slice->end) {
+        const char* nl = (const char*)memchr(p, '\n', (size_t)(slice->end - p));
+        const char* lineEnd = nl ? nl : slice->end;
+        countLine(slice, p, (size_t)(lineEnd - p));
+        p = nl ? nl + 1 : slice->end;
+    }
+    return NULL;
+}
+
+// Worker: merge every subtree whose first token falls in this shard
+static void* mergeShard(void* arg) {
+    MergeShard* job = (MergeShard*)arg;
+
+    // Slices are visited in order, but every count is a sum, so the result
+    // does not depend on which shard runs first
+    for (int t = 0; t < job->numSlices; t++) {
+        const TrainSlice* slice = &job->slices[t];
+        const NgramNode* localRoot = slice->ngrams->root;
+        for (uint32_t c = 0; c < localRoot->numChildren; c++) {
+            const NgramNode* from = &localRoot->children[c];
+            uint32_t id = slice->idMap[from->tokenId];
+            if ((int)(id % (uint32_t)job->numShards) != job->shard) continue;
+
+            NgramNode* to = findChildNode(job->root, id);
+            if (to) job->added += mergeNgramChildren(job->arena, to, from, slice->idMap);
+        }
+    }
+    return NULL;
+}
+
+// Run fn over every job on its own thread, falling back to inline on failure
+static void runWorkers(void* (*fn)(void*), void* jobs, size_t jobSize, int count) {
+    pthread_t threads[MaxTrainThreads];
+    bool started[MaxTrainThreads];
+
+    for (int t = 0; t < count; t++) {
+        void* job = (char*)jobs + (size_t)t * jobSize;
+        started[t] = (pthread_create(&threads[t], NULL, fn, job) == 0);
+        if (!started[t]) fn(job);
+    }
+    for (int t = 0; t < count; t++) {
+        if (started[t]) pthread_join(threads[t], NULL);
+    }
+}
+
+// Count one batch of complete lines in parallel and merge it into the model
+static void trainBatch(LMModel* model, const char* data, size_t size, int numThreads) {
+    TrainSlice slices[MaxTrainThreads];
+    memset(slices, 0, sizeof(TrainSlice) * (size_t)numThreads);
+
+    // Cut the batch into slices that end on line boundaries
+    const char* end = data + size;
+    const char* p = data;
+    int numSlices = 0;
+    for (int t = 0; t < numThreads && p < end; t++) {
+        const char* cut = (t == numThreads - 1) ? end : data + (size * (size_t)(t + 1)) / (size_t)numThreads;
+        if (cut < p) cut = p;
+        if (cut < end) {
+            const char* nl = (const char*)memchr(cut, '\n', (size_t)(end - cut));
+            cut = nl ? nl + 1 : end;
+        }
+
+        TrainSlice* slice = &slices[numSlices];
+        slice->begin = p;
+        slice->end = cut;
+        slice->vocab = createVocabulary();
+        slice->ngrams = createNgramIndex(model->ngrams->maxN);
+        slice->patterns = createPatternIndex(1000, model->patterns->maxPatternLength);
+        numSlices++;
+        p = cut;
+
+        if (!slice->vocab || !slice->ngrams || !slice->patterns) {
+            fprintf(stderr, "Failed to allocate training worker tables\n");
+            numSlices = -numSlices;
+            break;
+        }
+    }
+
+    if (numSlices > 0) {
+        runWorkers(countSlice, slices, sizeof(TrainSlice), numSlices);
+
+        // Assign model IDs slice by slice in local first-seen order, which
+        // reproduces the IDs a single-threaded pass would hand out
+        for (int t = 0; t < numSlices; t++) {
+            TrainSlice* slice = &slices[t];
+            slice->idMap = (uint32_t*)malloc(slice->vocab->size * sizeof(uint32_t));
+            if (!slice->idMap) continue;
+            for (uint32_t id = 0; id < slice->vocab->size; id++) {
+                // Special tokens share the same IDs in every vocabulary
+                slice->idMap[id] = (id < 3) ? id : getOrAddToken(model->vocab, getTokenById(slice->vocab, id));
+            }
+            model->totalTokens += slice->totalTokens;
+        }
+
+        // Unigrams first (this may grow the root's child array) ...
+        NgramNode* root = model->ngrams->root;
+        uint64_t added = 0;
+        for (int t = 0; t < numSlices; t++) {
+            const TrainSlice* slice = &slices[t];
+            if (!slice->idMap) continue;
+            for (uint32_t c = 0; c < slice->ngrams->root->numChildren; c++) {
+                const NgramNode* from = &slice->ngrams->root->children[c];
+                NgramNode* to = getOrAddChildNode(model->ngrams->arena, root, slice->idMap[from->tokenId]);
+                if (!to) continue;
+                to->count += from->count;
+                added += from->count;
+            }
+        }
+
+        // ... then the deeper levels, sharded by the ID of the first token
+        MergeShard shards[MaxTrainThreads];
+        int mergeable = 0;
+        for (int t = 0; t < numSlices && slices[t].idMap; t++) mergeable++;
+        for (int s = 0; s < numThreads; s++) {
+            shards[s].root = root;
+            // Without a private arena the shard would race on the shared one
+            shards[s].arena = createArena();
+            if (!shards[s].arena) mergeable = 0;
+            shards[s].slices = slices;
+            shards[s].numSlices = mergeable;
+            shards[s].shard = s;
+            shards[s].numShards = numThreads;
+            shards[s].added = 0;
+        }
+        runWorkers(mergeShard, shards, sizeof(MergeShard), numThreads);
+        for (int s = 0; s < numThreads; s++) {
+            added += shards[s].added;
+            arenaAdopt(model->ngrams->arena, shards[s].arena);
+            freeArena(shards[s].arena);
+        }
+        model->ngrams->totalNgrams += added;
+
+        // Patterns keep their first-seen order; counts of equal patterns add up
+        for (int t = 0; t < mergeable; t++) {
+            const PatternIndex* local = slices[t].patterns;
+            for (int i = 0; i < local->size; i++) {
+                const Pattern* pattern = &local->patterns[i];
+                uint32_t tokens[pattern->length];
+                for (int j = 0; j < pattern->length; j++) {
+                    tokens[j] = (pattern->tokens[j] == WildcardToken) ? WildcardToken
+                                                                      : slices[t].idMap[pattern->tokens[j]];
+                }
+                addPatternCount(model->patterns, tokens, pattern->length, pattern->count);
+            }
+        }
+    } else {
+        numSlices = -numSlices;
+    }
+
+    for (int t = 0; t < numSlices; t++) {
+        freeVocabulary(slices[t].vocab);
+        freeNgramIndex(slices[t].ngrams);
+        freePatternIndex(slices[t].patterns);
+        freeTokenList(&slices[t].tokens);
+        free(slices[t].idMap);
+    }
+}
+
+// Train with worker threads; produces the same model as trainFromFile
+void trainFromFileParallel(LMModel* model, const char* filename, int numThreads) {
+    if (!model || !filename) return;
+    if (numThreads <= 1) {
+        trainFromFile(model, filename);
+        return;
+    }
+    if (numThreads > MaxTrainThreads) numThreads = MaxTrainThreads;
+
+    CorpusReader* corpus = openCorpus(filename);
+    if (!corpus) {
+        perror("Failed to open training file");
+        return;
+    }
+
+    // Counts from a mapped image are read-only; continue from a private copy
+    thawModel(model);
+
+    // Batches of whole lines, taken in place from the mapping when possible
+    const char* block;
+    size_t length;
+    while (nextCorpusBlock(corpus, (size_t)numThreads * SliceBytes, &block, &length)) {
+        trainBatch(model, block, length, numThreads);
+    }
+
+    closeCorpus(corpus);
+
+    finalizeModel(model);
+}
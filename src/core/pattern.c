@@ -3,139 +3,245 @@
 #include <string.h>
 #include <stdio.h>
 
-// Maximum number of matching patterns to return
-#define MaxMatchingPatterns 100
+// Initial hash table size (power of two)
+#define InitialPatternSlots 1024
+
+// Start positions hashed ahead of their lookups
+#define PatternBatch 16
 
 // Create a new pattern index
 PatternIndex* createPatternIndex(int initialCapacity, int maxPatternLength) {
     if (initialCapacity <= 0 || maxPatternLength <= 0) return NULL;
-    
-    PatternIndex* index = (PatternIndex*)malloc(sizeof(PatternIndex));
+
+    PatternIndex* index = (PatternIndex*)calloc(1, sizeof(PatternIndex));
     if (!index) return NULL;
-    
+
     index->patterns = (Pattern*)calloc(initialCapacity, sizeof(Pattern));
-    if (!index->patterns) {
+    index->arena = createArena();
+    index->slots = (uint32_t*)malloc(InitialPatternSlots * sizeof(uint32_t));
+    if (!index->patterns || !index->arena || !index->slots) {
+        free(index->patterns);
+        freeArena(index->arena);
+        free(index->slots);
         free(index);
         return NULL;
     }
-    
+    memset(index->slots, 0xFF, InitialPatternSlots * sizeof(uint32_t));
+
     index->size = 0;
     index->capacity = initialCapacity;
     index->maxPatternLength = maxPatternLength;
-    
+    index->slotMask = InitialPatternSlots - 1;
+
     return index;
 }
 
-// Free a pattern
-static void freePattern(Pattern* pattern) {
-    if (pattern && pattern->tokens) {
-        free(pattern->tokens);
+// Free pattern index; pattern tokens go with the arena
+void freePatternIndex(PatternIndex* index) {
+    if (!index) return;
+
+    free(index->patterns);
+    free(index->slots);
+    freeArena(index->arena);
+    free(index);
+}
+
+// Hash of a pattern's (wildcard-masked) tokens, built one token at a time
+// so every prefix of a sequence is hashed in a single pass
+#define PatternHashSeed 2166136261u
+
+static inline uint32_t hashPatternStep(uint32_t h, uint32_t token) {
+    h = (h ^ token) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+static inline uint32_t hashPatternFinish(uint32_t h, int length) {
+    h ^= (uint32_t)length * 0x9E3779B9u;
+    h *= 0x85EBCA6Bu;
+    return h ^ (h >> 13);
+}
+
+static uint32_t hashPattern(const uint32_t* tokens, int length) {
+    uint32_t h = PatternHashSeed;
+    for (int i = 0; i < length; i++) {
+        h = hashPatternStep(h, tokens[i]);
     }
+    return hashPatternFinish(h, length);
 }
 
-// Free pattern index
-void freePatternIndex(PatternIndex* index) {
-    if (!index) return;
-    
-    if (index->patterns) {
-        for (int i = 0; i < index->size; i++) {
-            freePattern(&index->patterns[i]);
-        }
-        free(index->patterns);
+static bool samePattern(const Pattern* pattern, const uint32_t* tokens, int length) {
+    return pattern->length == length &&
+           memcmp(pattern->tokens, tokens, (size_t)length * sizeof(uint32_t)) == 0;
+}
+
+// Slot holding the pattern, or the empty slot where it would go
+static uint32_t findPatternSlot(const PatternIndex* index, const uint32_t* tokens, int length,
+                                uint32_t hash) {
+    uint32_t slot = hash & index->slotMask;
+    while (index->slots[slot] != PatternEmptySlot &&
+           !samePattern(&index->patterns[index->slots[slot]], tokens, length)) {
+        slot = (slot + 1) & index->slotMask;
     }
-    
-    free(index);
+    return slot;
 }
 
-// Add a pattern to the index
-void addPattern(PatternIndex* index, const uint32_t* tokens, int length) {
-    if (!index || !tokens || length <= 0 || length > index->maxPatternLength) return;
-    
+// Double the hash table once it is three quarters full
+static bool growPatternSlots(PatternIndex* index) {
+    uint32_t size = (index->slotMask + 1) * 2;
+    if (size == 0) return false;
+    uint32_t* slots = (uint32_t*)malloc((size_t)size * sizeof(uint32_t));
+    if (!slots) return false;
+    memset(slots, 0xFF, (size_t)size * sizeof(uint32_t));
+
+    uint32_t mask = size - 1;
+    for (int i = 0; i < index->size; i++) {
+        const Pattern* pattern = &index->patterns[i];
+        uint32_t slot = hashPattern(pattern->tokens, pattern->length) & mask;
+        while (slots[slot] != PatternEmptySlot) slot = (slot + 1) & mask;
+        slots[slot] = (uint32_t)i;
+    }
+    free(index->slots);
+    index->slots = slots;
+    index->slotMask = mask;
+    return true;
+}
+
+// Add count occurrences of a pattern with a known hash
+static void insertPattern(PatternIndex* index, const uint32_t* tokens, int length,
+                          uint32_t hash, uint32_t count) {
+    uint32_t slot = findPatternSlot(index, tokens, length, hash);
+    if (index->slots[slot] != PatternEmptySlot) {
+        Pattern* pattern = &index->patterns[index->slots[slot]];
+        pattern->count = (pattern->count > UINT32_MAX - count) ? UINT32_MAX : pattern->count + count;
+        return;
+    }
+
     // Check if we need to resize the patterns array
     if (index->size >= index->capacity) {
+        if (index->capacity > INT32_MAX / 2) return;  // IDs must stay clear of PatternEmptySlot
         int newCapacity = index->capacity * 2;
-        Pattern* newPatterns = (Pattern*)realloc(index->patterns, newCapacity * sizeof(Pattern));
+        Pattern* newPatterns = (Pattern*)realloc(index->patterns, (size_t)newCapacity * sizeof(Pattern));
         if (!newPatterns) return;  // Out of memory
-        
+
         index->patterns = newPatterns;
         index->capacity = newCapacity;
     }
-    
+
     // Initialize new pattern
     Pattern* pattern = &index->patterns[index->size];
-    pattern->tokens = (PatternToken*)malloc(length * sizeof(PatternToken));
+    pattern->tokens = (uint32_t*)arenaAlloc(index->arena, (size_t)length * sizeof(uint32_t));
     if (!pattern->tokens) return;  // Out of memory
-    
-    // Copy tokens
-    for (int i = 0; i < length; i++) {
-        pattern->tokens[i].tokenId = tokens[i];
-        pattern->tokens[i].isWildcard = (tokens[i] == WildcardToken);
-    }
-    
+
+    memcpy(pattern->tokens, tokens, (size_t)length * sizeof(uint32_t));
     pattern->length = length;
-    pattern->count = 1;  // Initial count
+    pattern->count = count;
+    index->slots[slot] = (uint32_t)index->size;
     index->size++;
-}
 
-// Check if a pattern matches a sequence of tokens
-static bool patternMatches(const Pattern* pattern, const uint32_t* tokens, int length) {
-    if (pattern->length != length) return false;
-    
-    for (int i = 0; i < length; i++) {
-        if (!pattern->tokens[i].isWildcard && 
-            pattern->tokens[i].tokenId != tokens[i]) {
-            return false;
-        }
+    if ((uint32_t)index->size > (index->slotMask + 1) / 4 * 3) {
+        growPatternSlots(index);
     }
-    
-    return true;
+}
+
+// Add count occurrences of a pattern, merging with an equal one
+void addPatternCount(PatternIndex* index, const uint32_t* tokens, int length, uint32_t count) {
+    if (!index || !tokens || length <= 0 || length > index->maxPatternLength || count == 0) return;
+    insertPattern(index, tokens, length, hashPattern(tokens, length), count);
+}
+
+// Add a pattern to the index
+void addPattern(PatternIndex* index, const uint32_t* tokens, int length) {
+    addPatternCount(index, tokens, length, 1);
+}
+
+// ID of the pattern with exactly these tokens (wildcards included), or -1
+int findPattern(const PatternIndex* index, const uint32_t* tokens, int length) {
+    if (!index || !tokens || length <= 0 || length > index->maxPatternLength) return -1;
+    uint32_t id = index->slots[findPatternSlot(index, tokens, length, hashPattern(tokens, length))];
+    return (id == PatternEmptySlot) ? -1 : (int)id;
+}
+
+static int compareUint32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
 }
 
 // Find all patterns that match the given sequence of tokens
-void findMatchingPatterns(const PatternIndex* index, const uint32_t* tokens, int length, 
+// A pattern matches when every position holds the query token or a
+// wildcard. Matches are pattern IDs in ascending order, at most
+// MaxMatchingPatterns; queries longer than maxPatternLength match nothing.
+void findMatchingPatterns(const PatternIndex* index, const uint32_t* tokens, int length,
                          uint32_t* matches, int* numMatches) {
     if (!index || !tokens || length <= 0 || !matches || !numMatches) return;
-    
+
     *numMatches = 0;
-    
-    for (int i = 0; i < index->size; i++) {
-        const Pattern* pattern = &index->patterns[i];
-        
-        if (pattern->length == length && patternMatches(pattern, tokens, length)) {
-            if (*numMatches < MaxMatchingPatterns) {
-                matches[(*numMatches)++] = i;  // Store pattern index
-            } else {
-                break;  // Reached maximum number of matches
-            }
-        }
+    if (length > index->maxPatternLength || length > 31) return;
+
+    // Masks run over the positions that are not wildcards already
+    uint32_t concrete = 0;
+    for (int i = 0; i < length; i++) {
+        if (tokens[i] != WildcardToken) concrete |= 1u << i;
     }
+
+    uint32_t masked[length];
+    uint32_t mask = 0;
+    do {
+        for (int i = 0; i < length; i++) {
+            masked[i] = (mask & (1u << i)) ? WildcardToken : tokens[i];
+        }
+        int id = findPattern(index, masked, length);
+        if (id >= 0 && *numMatches < MaxMatchingPatterns) {
+            matches[(*numMatches)++] = (uint32_t)id;
+        }
+        mask = (mask - concrete) & concrete;  // next subset of the concrete positions
+    } while (mask != 0);
+
+    if (*numMatches > 1) qsort(matches, *numMatches, sizeof(uint32_t), compareUint32);
 }
 
 // Extract patterns from a sequence of tokens
+// Each start position yields one pattern per length, with every third token
+// replaced by a wildcard. A batch of positions is hashed ahead and its table
+// slots prefetched, which hides most of the cache misses of the lookups.
 void extractPatternsFromSequence(PatternIndex* index, const uint32_t* tokens, int length) {
     if (!index || !tokens || length <= 0) return;
-    
-    // For each possible starting position
-    for (int start = 0; start < length; start++) {
-        // For each possible pattern length
-        for (int patternLen = 1; patternLen <= index->maxPatternLength && 
-                                (start + patternLen) <= length; patternLen++) {
-            
-            // Create a copy of the token sequence with some wildcards
-            uint32_t pattern[patternLen];
-            
-            // Simple pattern extraction: replace some tokens with wildcards
-            for (int i = 0; i < patternLen; i++) {
-                // Example: replace every 3rd token with a wildcard
-                if ((i + 1) % 3 == 0) {
-                    pattern[i] = WildcardToken;
-                } else {
-                    pattern[i] = tokens[start + i];
-                }
+
+    const int maxLength = index->maxPatternLength;
+    uint32_t pattern[maxLength];
+    uint32_t hashes[PatternBatch * maxLength];
+
+    for (int base = 0; base < length; base += PatternBatch) {
+        int stop = (length - base < PatternBatch) ? length : base + PatternBatch;
+
+        // Hash every prefix of each start position's sequence
+        for (int start = base; start < stop; start++) {
+            uint32_t* h = &hashes[(start - base) * maxLength];
+            uint32_t prefix = PatternHashSeed;
+            for (int i = 0; i < maxLength && start + i < length; i++) {
+                prefix = hashPatternStep(prefix, PatternWildcardAt(i) ? WildcardToken : tokens[start + i]);
+                h[i] = hashPatternFinish(prefix, i + 1);
+                __builtin_prefetch(&index->slots[h[i] & index->slotMask]);
+            }
+        }
+
+        for (int start = base; start < stop; start++) {
+            const uint32_t* h = &hashes[(start - base) * maxLength];
+            for (int patternLen = 1; patternLen <= maxLength && start + patternLen <= length; patternLen++) {
+                int i = patternLen - 1;
+                pattern[i] = PatternWildcardAt(i) ? WildcardToken : tokens[start + i];
+                insertPattern(index, pattern, patternLen, h[i], 1);
             }
-            
-            // Add the pattern to the index
-            addPattern(index, pattern, patternLen);
         }
     }
 }
+
+// Bytes held by the index (pattern array, tokens and hash table)
+size_t patternIndexMemory(const PatternIndex* index) {
+    if (!index) return 0;
+    size_t bytes = sizeof(PatternIndex);
+    bytes += (size_t)index->capacity * sizeof(Pattern);
+    bytes += (size_t)(index->slotMask + 1) * sizeof(uint32_t);
+    bytes += index->arena ? index->arena->bytesReserved : 0;
+    return bytes;
+}
@@ -0,0 +1,201 @@
+#include "../include/predictCache.h"
+
+static uint64_t hashKey(const PredictCacheKey* key) {
+    uint64_t h = ((uint64_t)key->length << 16) ^ ((uint64_t)key->k << 8) ^ key->skipGrams;
+    for (int i = 0; i < key->length; i++) {
+        h = (h ^ key->tokens[i]) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    h *= 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 31);
+}
+
+static bool sameKey(const PredictCacheKey* a, const PredictCacheKey* b) {
+    if (a->length != b->length || a->k != b->k || a->skipGrams != b->skipGrams) return false;
+    for (int i = 0; i < a->length; i++) {
+        if (a->tokens[i] != b->tokens[i]) return false;
+    }
+    return true;
+}
+
+// Shards take the high hash bits, buckets the low ones
+static PredictCacheShard* shardFor(PredictCache* cache, uint64_t hash) {
+    return &cache->shards[(hash >> 56) % (uint64_t)cache->numShards];
+}
+
+static void resetShard(PredictCacheShard* shard) {
+    for (uint32_t b = 0; b <= shard->bucketMask; b++) shard->buckets[b] = PredictCacheNoEntry;
+    shard->used = 0;
+    shard->newest = PredictCacheNoEntry;
+    shard->oldest = PredictCacheNoEntry;
+}
+
+// Cache of at most maxEntries predictions (NULL if maxEntries is 0)
+PredictCache* createPredictCache(uint32_t maxEntries) {
+    if (maxEntries == 0) return NULL;
+
+    PredictCache* cache = (PredictCache*)calloc(1, sizeof(PredictCache));
+    if (!cache) return NULL;
+
+    cache->numShards = (maxEntries < PredictCacheShards) ? (int)maxEntries : PredictCacheShards;
+    uint32_t perShard = (maxEntries + (uint32_t)cache->numShards - 1) / (uint32_t)cache->numShards;
+    uint32_t buckets = 1;
+    while (buckets < perShard) buckets <<= 1;
+
+    for (int s = 0; s < cache->numShards; s++) {
+        PredictCacheShard* shard = &cache->shards[s];
+        shard->entries = (PredictCacheEntry*)malloc(sizeof(PredictCacheEntry) * perShard);
+        shard->buckets = (uint32_t*)malloc(sizeof(uint32_t) * buckets);
+        pthread_mutex_init(&shard->lock, NULL);
+        if (!shard->entries || !shard->buckets) {
+            cache->numShards = s + 1;
+            freePredictCache(cache);
+            return NULL;
+        }
+        shard->capacity = perShard;
+        shard->bucketMask = buckets - 1;
+        resetShard(shard);
+    }
+    cache->capacity = perShard * (uint32_t)cache->numShards;
+    return cache;
+}
+
+void freePredictCache(PredictCache* cache) {
+    if (!cache) return;
+    for (int s = 0; s < cache->numShards; s++) {
+        free(cache->shards[s].entries);
+        free(cache->shards[s].buckets);
+        pthread_mutex_destroy(&cache->shards[s].lock);
+    }
+    free(cache);
+}
+
+// Invalidate every entry (on retrain or reload)
+void clearPredictCache(PredictCache* cache) {
+    if (!cache) return;
+    for (int s = 0; s < cache->numShards; s++) {
+        pthread_mutex_lock(&cache->shards[s].lock);
+        resetShard(&cache->shards[s]);
+        pthread_mutex_unlock(&cache->shards[s].lock);
+    }
+}
+
+uint32_t predictCacheEntriesForBytes(size_t maxBytes) {
+    // At most one bucket word per entry, rounded up to a power of two
+    size_t perEntry = sizeof(PredictCacheEntry) + 2 * sizeof(uint32_t);
+    size_t entries = maxBytes / perEntry;
+    return (entries > UINT32_MAX / 2) ? UINT32_MAX / 2 : (uint32_t)entries;
+}
+
+static void unlinkLru(PredictCacheShard* shard, uint32_t index) {
+    PredictCacheEntry* entry = &shard->entries[index];
+    if (entry->newer != PredictCacheNoEntry) shard->entries[entry->newer].older = entry->older;
+    else shard->newest = entry->older;
+    if (entry->older != PredictCacheNoEntry) shard->entries[entry->older].newer = entry->newer;
+    else shard->oldest = entry->newer;
+}
+
+static void pushNewest(PredictCacheShard* shard, uint32_t index) {
+    PredictCacheEntry* entry = &shard->entries[index];
+    entry->newer = PredictCacheNoEntry;
+    entry->older = shard->newest;
+    if (shard->newest != PredictCacheNoEntry) shard->entries[shard->newest].newer = index;
+    shard->newest = index;
+    if (shard->oldest == PredictCacheNoEntry) shard->oldest = index;
+}
+
+// Entry holding key, or PredictCacheNoEntry; caller holds the lock
+static uint32_t findEntry(const PredictCacheShard* shard, const PredictCacheKey* key, uint64_t hash) {
+    uint32_t index = shard->buckets[hash & shard->bucketMask];
+    while (index != PredictCacheNoEntry) {
+        const PredictCacheEntry* entry = &shard->entries[index];
+        if (entry->hash == hash && sameKey(&entry->key, key)) return index;
+        index = entry->chain;
+    }
+    return PredictCacheNoEntry;
+}
+
+static void unlinkBucket(PredictCacheShard* shard, uint32_t index) {
+    uint32_t* link = &shard->buckets[shard->entries[index].hash & shard->bucketMask];
+    while (*link != index) link = &shard->entries[*link].chain;
+    *link = shard->entries[index].chain;
+}
+
+bool predictCacheLookup(PredictCache* cache, const PredictCacheKey* key, uint32_t* topTokens, float* scores) {
+    if (!cache || !key || key->k > PredictCacheMaxK) return false;
+
+    uint64_t hash = hashKey(key);
+    PredictCacheShard* shard = shardFor(cache, hash);
+    pthread_mutex_lock(&shard->lock);
+    uint32_t index = findEntry(shard, key, hash);
+    if (index == PredictCacheNoEntry) {
+        shard->misses++;
+        pthread_mutex_unlock(&shard->lock);
+        return false;
+    }
+    const PredictCacheEntry* entry = &shard->entries[index];
+    memcpy(topTokens, entry->topTokens, sizeof(uint32_t) * key->k);
+    memcpy(scores, entry->scores, sizeof(float) * key->k);
+    if (shard->newest != index) {
+        unlinkLru(shard, index);
+        pushNewest(shard, index);
+    }
+    shard->hits++;
+    pthread_mutex_unlock(&shard->lock);
+    return true;
+}
+
+// Remember a prediction, evicting the shard's least recently used entry if full
+void predictCacheInsert(PredictCache* cache, const PredictCacheKey* key, const uint32_t* topTokens,
+                        const float* scores) {
+    if (!cache || !key || key->k > PredictCacheMaxK) return;
+
+    uint64_t hash = hashKey(key);
+    PredictCacheShard* shard = shardFor(cache, hash);
+    pthread_mutex_lock(&shard->lock);
+
+    // Another thread may have missed on the same key and inserted it first
+    uint32_t index = findEntry(shard, key, hash);
+    if (index != PredictCacheNoEntry) {
+        unlinkLru(shard, index);
+    } else {
+        if (shard->used < shard->capacity) {
+            index = shard->used++;
+        } else {
+            index = shard->oldest;
+            unlinkLru(shard, index);
+            unlinkBucket(shard, index);
+            shard->evictions++;
+        }
+        PredictCacheEntry* entry = &shard->entries[index];
+        entry->key = *key;
+        entry->hash = hash;
+        uint32_t* bucket = &shard->buckets[hash & shard->bucketMask];
+        entry->chain = *bucket;
+        *bucket = index;
+    }
+    PredictCacheEntry* entry = &shard->entries[index];
+    memcpy(entry->topTokens, topTokens, sizeof(uint32_t) * key->k);
+    memcpy(entry->scores, scores, sizeof(float) * key->k);
+    pushNewest(shard, index);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void predictCacheStats(PredictCache* cache, PredictCacheStats* stats) {
+    if (!stats) return;
+    memset(stats, 0, sizeof(PredictCacheStats));
+    if (!cache) return;
+
+    for (int s = 0; s < cache->numShards; s++) {
+        PredictCacheShard* shard = &cache->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        stats->entries += shard->used;
+        stats->bytes += sizeof(PredictCacheEntry) * shard->capacity + sizeof(uint32_t) * (shard->bucketMask + 1);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    stats->capacity = cache->capacity;
+    stats->bytes += sizeof(PredictCache);
+}
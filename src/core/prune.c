@@ -0,0 +1,259 @@
+#include "../include/prune.h"
+
+// Score of an n-gram that must outlive any budget (unigrams)
+#define PruneKeepScore INFINITY
+
+// Log-ratio cap; the scaled divergence stays below one count
+#define PruneMaxDivergence 20.0
+
+// Frozen n-gram table bytes for these level sizes
+uint64_t frozenTableBytes(const uint32_t* levelSize, int maxN) {
+    uint64_t bytes = 0;
+    for (int l = 0; l < maxN; l++) {
+        bool inner = (l + 1 < maxN);
+        bytes += (uint64_t)levelSize[l] * (inner ? FrozenInnerEntryBytes : FrozenLeafEntryBytes);
+        if (inner) bytes += sizeof(uint32_t);  // the extra first-child offset
+    }
+    return bytes;
+}
+
+// Return the child arrays below node to the arena
+static void releaseSubtree(Arena* arena, NgramNode* node) {
+    for (uint32_t i = 0; i < node->numChildren; i++) releaseSubtree(arena, &node->children[i]);
+    arenaFreeBlock(arena, node->children, node->capacity * sizeof(NgramNode));
+    node->children = NULL;
+    node->numChildren = 0;
+    node->capacity = 0;
+}
+
+// Drop the children of node that are not marked in keep[], keeping order
+static uint64_t compactChildren(Arena* arena, NgramNode* node, const bool* keep) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < node->numChildren; i++) {
+        if (keep[i]) {
+            if (kept != i) node->children[kept] = node->children[i];
+            kept++;
+        } else {
+            releaseSubtree(arena, &node->children[i]);
+        }
+    }
+    uint64_t removed = node->numChildren - kept;
+    node->numChildren = kept;
+    return removed;
+}
+
+// N-grams in the subtree below node (node itself excluded)
+static uint64_t subtreeSize(const NgramNode* node) {
+    uint64_t n = node->numChildren;
+    for (uint32_t i = 0; i < node->numChildren; i++) n += subtreeSize(&node->children[i]);
+    return n;
+}
+
+static uint64_t pruneCountsBelow(Arena* arena, NgramNode* node, int depth, int maxDepth,
+                                 const uint32_t* minCount) {
+    if (depth >= maxDepth || node->numChildren == 0) return 0;
+
+    uint64_t removed = 0;
+    bool keep[node->numChildren];
+    for (uint32_t i = 0; i < node->numChildren; i++) {
+        NgramNode* child = &node->children[i];
+        keep[i] = (depth == 0) || child->count >= minCount[depth];
+        if (keep[i]) {
+            removed += pruneCountsBelow(arena, child, depth + 1, maxDepth, minCount);
+        } else {
+            removed += subtreeSize(child);
+        }
+    }
+    return removed + compactChildren(arena, node, keep);
+}
+
+// Drop every n-gram of order l + 1 seen fewer than minCount[l] times,
+// with its extensions; returns the number of n-grams removed
+uint64_t pruneByCount(NgramIndex* ngrams, const uint32_t* minCount) {
+    if (!ngrams || !minCount) return 0;
+    return pruneCountsBelow(ngrams->arena, ngrams->root, 0, ngrams->maxN, minCount);
+}
+
+// Pruning scores, one per node in depth-first pre-order
+typedef struct {
+    float* scores;
+    uint8_t* levels;
+    size_t next;
+    double totalTokens;
+} ScoreWalk;
+
+// Score the children of node (order depth) and return their highest score
+// suffix is the node of node's n-gram minus its oldest token (the root for
+// unigrams, NULL if that n-gram is missing).
+static float scoreChildren(ScoreWalk* walk, const NgramNode* node, const NgramNode* suffix,
+                           int depth, int maxDepth) {
+    float highest = 0.0f;
+    for (uint32_t i = 0; i < node->numChildren && depth < maxDepth; i++) {
+        const NgramNode* child = &node->children[i];
+        size_t slot = walk->next++;
+
+        // The child's own backoff n-gram: the suffix extended by its token
+        const NgramNode* backoff = suffix ? findChildNode(suffix, child->tokenId) : NULL;
+        float score = PruneKeepScore;
+        if (depth > 0) {
+            double contextCount = (node->count > 0) ? (double)node->count : 1.0;
+            double suffixCount = (depth > 1 && suffix && suffix->count > 0) ? (double)suffix->count : walk->totalTokens;
+            double backoffCount = (backoff && backoff->count > 0) ? (double)backoff->count : 0.5;
+            double p = (double)child->count / contextCount;
+            double q = backoffCount / suffixCount;
+            double divergence = fmin(fabs(log(p / q)), PruneMaxDivergence);
+            score = (float)(((double)child->count + divergence / (PruneMaxDivergence + 1.0)) / walk->totalTokens);
+        }
+
+        // Extensions go first, so a parent scores at least as high as its children
+        // (bigrams back off to unigrams, i.e. their suffix is the root)
+        float below = scoreChildren(walk, child, (depth == 0) ? suffix : backoff, depth + 1, maxDepth);
+        if (below > score) score = below;
+        walk->scores[slot] = score;
+        walk->levels[slot] = (uint8_t)depth;
+        if (score > highest) highest = score;
+    }
+    return highest;
+}
+
+// Drop the nodes scoring at or below threshold, walking in the scoring order
+static uint64_t pruneScoresBelow(Arena* arena, NgramNode* node, int depth, int maxDepth,
+                                 const float* scores, size_t* next, float threshold) {
+    if (depth >= maxDepth || node->numChildren == 0) return 0;
+
+    uint64_t removed = 0;
+    bool keep[node->numChildren];
+    for (uint32_t i = 0; i < node->numChildren; i++) {
+        keep[i] = scores[(*next)++] > threshold;
+        // Dropped subtrees are still walked so the indices stay in step
+        removed += pruneScoresBelow(arena, &node->children[i], depth + 1, maxDepth, scores, next, threshold);
+    }
+    // Subtrees of dropped children were pruned to nothing above
+    return removed + compactChildren(arena, node, keep);
+}
+
+// A node's score with the level it lives in, for ranking
+typedef struct {
+    float score;
+    uint32_t level;
+} ScoredEntry;
+
+static int compareScoredDesc(const void* a, const void* b) {
+    float x = ((const ScoredEntry*)a)->score;
+    float y = ((const ScoredEntry*)b)->score;
+    return (x < y) - (x > y);
+}
+
+// Drop the least informative n-grams until the frozen tables fit byteBudget
+// Returns the number of n-grams removed.
+uint64_t pruneToBudget(NgramIndex* ngrams, uint64_t totalTokens, uint64_t byteBudget) {
+    if (!ngrams || byteBudget == 0 || totalTokens == 0) return 0;
+
+    int maxN = (ngrams->maxN < MaxN) ? ngrams->maxN : MaxN;
+    uint64_t nodes = subtreeSize(ngrams->root);
+    if (nodes == 0) return 0;
+
+    ScoreWalk walk;
+    walk.scores = (float*)malloc((size_t)nodes * sizeof(float));
+    walk.levels = (uint8_t*)malloc((size_t)nodes);
+    walk.next = 0;
+    walk.totalTokens = (double)totalTokens;
+    if (!walk.scores || !walk.levels) {
+        free(walk.scores);
+        free(walk.levels);
+        return 0;
+    }
+    scoreChildren(&walk, ngrams->root, ngrams->root, 0, maxN);
+    if (walk.next != nodes) {  // deeper than maxN: not a trie this index built
+        free(walk.scores);
+        free(walk.levels);
+        return 0;
+    }
+
+    uint32_t levelSize[MaxN] = { 0 };
+    for (size_t i = 0; i < nodes; i++) levelSize[walk.levels[i]]++;
+
+    // Keep the best-scoring entries while their table bytes fit
+    float threshold = -1.0f;
+    ScoredEntry* ranked = NULL;
+    if (frozenTableBytes(levelSize, maxN) > byteBudget) {
+        ranked = (ScoredEntry*)malloc((size_t)nodes * sizeof(ScoredEntry));
+    }
+    if (ranked) {
+        for (size_t i = 0; i < nodes; i++) {
+            ranked[i].score = walk.scores[i];
+            ranked[i].level = walk.levels[i];
+        }
+        qsort(ranked, (size_t)nodes, sizeof(ScoredEntry), compareScoredDesc);
+
+        uint64_t used = sizeof(uint32_t) * (uint64_t)(maxN - 1);
+        size_t keep = 0;
+        while (keep < nodes) {
+            bool inner = ((int)ranked[keep].level + 1 < maxN);
+            uint64_t cost = inner ? FrozenInnerEntryBytes : FrozenLeafEntryBytes;
+            if (used + cost > byteBudget && ranked[keep].score != PruneKeepScore) break;
+            used += cost;
+            keep++;
+        }
+        // Ties with the first entry that does not fit go with it
+        if (keep < nodes) threshold = ranked[keep].score;
+        free(ranked);
+    }
+
+    uint64_t removed = 0;
+    if (threshold >= 0.0f) {
+        size_t next = 0;
+        removed = pruneScoresBelow(ngrams->arena, ngrams->root, 0, maxN, walk.scores, &next, threshold);
+    }
+    free(walk.scores);
+    free(walk.levels);
+    return removed;
+}
+
+// Apply both stages to a trie
+static uint64_t pruneNgrams(NgramIndex* ngrams, uint64_t totalTokens, const PruneOptions* options) {
+    uint64_t removed = pruneByCount(ngrams, options->minCount);
+    return removed + pruneToBudget(ngrams, totalTokens, options->byteBudget);
+}
+
+// Prune the model's trie and rebuild its frozen view; returns n-grams removed
+uint64_t pruneModel(LMModel* model, const PruneOptions* options) {
+    if (!model || !options) return 0;
+
+    // Counts from a mapped image are read-only; prune a private copy
+    thawModel(model);
+    uint64_t removed = pruneNgrams(model->ngrams, model->totalTokens, options);
+    finalizeModel(model);
+    return removed;
+}
+
+// Evaluate a pruned copy of the model on a held-out file (the model is unchanged)
+bool evaluatePruning(const LMModel* model, const PruneOptions* options, const char* heldout,
+                     int topK, int numThreads, PruneResult* result) {
+    if (!model || !model->frozen || !options || !heldout || !result) return false;
+    memset(result, 0, sizeof(PruneResult));
+
+    NgramIndex* ngrams = createNgramIndex(model->maxN);
+    if (!ngrams) return false;
+    thawFrozenNgrams(model->frozen, ngrams);
+    pruneNgrams(ngrams, model->totalTokens, options);
+    FrozenIndex* pruned = freezeNgrams(ngrams, model->vocab, model->totalTokens);
+    freeNgramIndex(ngrams);
+    if (!pruned) return false;
+
+    uint32_t levelSize[MaxN] = { 0 };
+    for (int l = 0; l < pruned->maxN; l++) {
+        levelSize[l] = pruned->levels[l].size;
+        result->ngrams += levelSize[l];
+    }
+    result->tableBytes = frozenTableBytes(levelSize, pruned->maxN);
+    result->imageBytes = pruned->imageSize;
+
+    // Same model, other counts: a shallow copy pointed at the pruned image
+    LMModel view = *model;
+    view.frozen = pruned;
+    view.cache = NULL;  // cached results belong to the unpruned view
+    bool ok = evaluateFile(&view, heldout, topK, numThreads, &result->eval);
+    freeFrozenIndex(pruned);
+    return ok;
+}
@@ -0,0 +1,125 @@
+#include "../include/serialize.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Create (truncate) a file for buffered writing; NULL with errno set on failure
+BufferedWriter* openWriter(const char* filename) {
+    if (!filename) return NULL;
+
+    BufferedWriter* writer = (BufferedWriter*)malloc(sizeof(BufferedWriter));
+    if (!writer) return NULL;
+
+    writer->file = fopen(filename, "wb");
+    if (!writer->file) {
+        free(writer);
+        return NULL;
+    }
+    writer->used = 0;
+    writer->failed = false;
+    return writer;
+}
+
+static void flushWriter(BufferedWriter* writer) {
+    if (writer->used > 0 && !writer->failed &&
+        fwrite(writer->buffer, 1, writer->used, writer->file) != writer->used) {
+        writer->failed = true;
+    }
+    writer->used = 0;
+}
+
+void writeBytes(BufferedWriter* writer, const void* data, size_t length) {
+    if (!writer || writer->failed) return;
+
+    // Large runs bypass the buffer
+    if (length >= WriterBufferSize) {
+        flushWriter(writer);
+        if (fwrite(data, 1, length, writer->file) != length) writer->failed = true;
+        return;
+    }
+    if (writer->used + length > WriterBufferSize) flushWriter(writer);
+    memcpy(writer->buffer + writer->used, data, length);
+    writer->used += length;
+}
+
+// Unsigned LEB128: seven bits per byte, high bit set on all but the last
+void writeVarint(BufferedWriter* writer, uint64_t value) {
+    if (!writer || writer->failed) return;
+    if (writer->used + MaxVarintBytes > WriterBufferSize) flushWriter(writer);
+
+    unsigned char* out = writer->buffer + writer->used;
+    while (value >= 0x80) {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+    writer->used = (size_t)(out - writer->buffer);
+}
+
+// Flush and close; false if any write failed
+bool closeWriter(BufferedWriter* writer) {
+    if (!writer) return false;
+
+    flushWriter(writer);
+    bool ok = !writer->failed;
+    if (fclose(writer->file) != 0) ok = false;
+    free(writer);
+    return ok;
+}
+
+// Map a whole file for reading; false (errno set) if it cannot be opened
+bool openReader(ByteReader* reader, const char* filename) {
+    if (!reader || !filename) return false;
+    memset(reader, 0, sizeof(ByteReader));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return false;
+    }
+    if (st.st_size > 0) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+        reader->data = (const unsigned char*)map;
+        reader->size = (size_t)st.st_size;
+    }
+    close(fd);
+    return true;
+}
+
+void closeReader(ByteReader* reader) {
+    if (!reader) return;
+    if (reader->data) munmap((void*)reader->data, reader->size);
+    memset(reader, 0, sizeof(ByteReader));
+}
+
+bool readBytes(ByteReader* reader, void* out, size_t length) {
+    if (reader->failed || reader->size - reader->pos < length) {
+        reader->failed = true;
+        return false;
+    }
+    memcpy(out, reader->data + reader->pos, length);
+    reader->pos += length;
+    return true;
+}
+
+// Returns 0 and sets failed on a truncated or overlong encoding
+uint64_t readVarint(ByteReader* reader) {
+    if (reader->failed) return 0;
+    uint64_t value = 0;
+    for (int shift = 0; shift < 7 * MaxVarintBytes && reader->pos < reader->size; shift += 7) {
+        unsigned char byte = reader->data[reader->pos++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    reader->failed = true;
+    return 0;
+}
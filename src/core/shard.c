@@ -0,0 +1,427 @@
+#include "../include/shard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Every vocabulary starts with these (see createVocabulary); they sort first, in this order
+static const char* const ReservedTokens[] = { "<unk>", "<s>", "</s>" };
+#define NumReservedTokens 3
+
+static int reservedRank(const char* token) {
+    for (int i = 0; i < NumReservedTokens; i++) {
+        if (strcmp(token, ReservedTokens[i]) == 0) return i;
+    }
+    return NumReservedTokens;
+}
+
+// Shard key order; numbering a merged vocabulary in it keeps the reserved IDs
+static int compareShardKeys(const char* a, const char* b) {
+    int ra = reservedRank(a), rb = reservedRank(b);
+    if (ra != rb) return ra - rb;
+    return (ra < NumReservedTokens) ? 0 : strcmp(a, b);
+}
+
+typedef struct {
+    const char* text;
+    uint32_t id;
+} ShardToken;
+
+static int compareShardTokens(const void* a, const void* b) {
+    return compareShardKeys(((const ShardToken*)a)->text, ((const ShardToken*)b)->text);
+}
+
+// Entry of a sibling group with its token's key, for visiting groups in key order
+typedef struct {
+    uint32_t key;
+    uint32_t entry;
+} ShardChild;
+
+static int compareShardChildren(const void* a, const void* b) {
+    uint32_t ka = ((const ShardChild*)a)->key, kb = ((const ShardChild*)b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+typedef struct {
+    const FrozenIndex* index;
+    const uint32_t* keyOf;       // token ID -> index in the key-ordered table
+    FILE* file;
+    ShardChild* groups[MaxN];    // one sibling group per depth
+    uint32_t record[MaxN + 1];
+    int order;
+    uint64_t written;
+} ShardWriter;
+
+// Write the n-grams of the writer's order below entries [begin, end) of
+// level, depth first with siblings in key order, so records come out sorted
+static bool writeRunGroup(ShardWriter* writer, int level, uint32_t begin, uint32_t end) {
+    if (level >= writer->order || level >= MaxN) return false;
+    const FrozenLevel* lv = &writer->index->levels[level];
+    ShardChild* group = writer->groups[level];
+    uint32_t n = end - begin;
+    for (uint32_t i = 0; i < n; i++) {
+        group[i].key = writer->keyOf[lv->tokenIds[begin + i]];
+        group[i].entry = begin + i;
+    }
+    if (n > 1) qsort(group, n, sizeof(ShardChild), compareShardChildren);
+
+    for (uint32_t i = 0; i < n; i++) {
+        writer->record[level] = group[i].key;
+        if (level + 1 == writer->order) {
+            writer->record[level + 1] = lv->counts[group[i].entry];
+            size_t words = (size_t)writer->order + 1;
+            if (fwrite(writer->record, sizeof(uint32_t), words, writer->file) != words) return false;
+            writer->written++;
+        } else {
+            uint32_t childBegin, childEnd;
+            if (frozenChildRange(writer->index, level, group[i].entry, &childBegin, &childEnd) &&
+                !writeRunGroup(writer, level + 1, childBegin, childEnd)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Write a model's counts as a count shard
+bool writeCountShard(const FrozenIndex* index, const char* filename) {
+    if (!index || !filename || index->maxN < 1) return false;
+
+    uint32_t vocabSize = index->vocabSize;
+    ShardToken* tokens = (ShardToken*)malloc(((size_t)vocabSize + 1) * sizeof(ShardToken));
+    uint32_t* keyOf = (uint32_t*)malloc(((size_t)vocabSize + 1) * sizeof(uint32_t));
+    ShardWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    bool ok = tokens && keyOf;
+    for (int l = 0; ok && l < index->maxN; l++) {
+        writer.groups[l] = (ShardChild*)malloc(((size_t)vocabSize + 1) * sizeof(ShardChild));
+        ok = writer.groups[l] != NULL;
+    }
+
+    ShardFileHeader header;
+    memset(&header, 0, sizeof(header));
+    if (ok) {
+        for (uint32_t i = 0; i < vocabSize; i++) {
+            tokens[i].text = index->vocabStrings + index->vocabOffsets[i];
+            tokens[i].id = i;
+        }
+        qsort(tokens, vocabSize, sizeof(ShardToken), compareShardTokens);
+        for (uint32_t k = 0; k < vocabSize; k++) keyOf[tokens[k].id] = k;
+
+        // Every section holds 32-bit words, so they follow each other unpadded
+        memcpy(header.magic, ShardMagic, sizeof(header.magic));
+        header.version = ShardVersion;
+        header.maxN = (uint32_t)index->maxN;
+        header.totalTokens = index->totalTokens;
+        header.totalNgrams = index->totalNgrams;
+        header.vocabSize = vocabSize;
+        uint64_t offset = sizeof(ShardFileHeader);
+        for (int l = 0; l < index->maxN; l++) {
+            header.runSize[l] = index->levels[l].size;
+            header.runOff[l] = offset;
+            offset += header.runSize[l] * (uint64_t)(l + 2) * sizeof(uint32_t);
+        }
+        header.vocabOffsetsOff = offset;
+        offset += ((uint64_t)vocabSize + 1) * sizeof(uint32_t);
+        header.vocabStringsOff = offset;
+        for (uint32_t k = 0; k < vocabSize; k++) header.vocabStringsSize += strlen(tokens[k].text) + 1;
+        header.fileSize = offset + header.vocabStringsSize;
+    }
+
+    char tempName[1024];
+    snprintf(tempName, sizeof(tempName), "%s.tmp", filename);
+    writer.file = ok ? fopen(tempName, "wb") : NULL;
+    if (ok && !writer.file) perror("Failed to create count shard");
+    ok = writer.file && fwrite(&header, sizeof(header), 1, writer.file) == 1;
+
+    writer.index = index;
+    writer.keyOf = keyOf;
+    for (int l = 0; ok && l < index->maxN; l++) {
+        writer.order = l + 1;
+        writer.written = 0;
+        ok = writeRunGroup(&writer, 0, 0, index->levels[0].size) && writer.written == header.runSize[l];
+    }
+
+    // String table in key order
+    uint32_t pos = 0;
+    for (uint32_t k = 0; ok && k <= vocabSize; k++) {
+        ok = fwrite(&pos, sizeof(uint32_t), 1, writer.file) == 1;
+        if (k < vocabSize) pos += (uint32_t)strlen(tokens[k].text) + 1;
+    }
+    for (uint32_t k = 0; ok && k < vocabSize; k++) {
+        size_t len = strlen(tokens[k].text) + 1;
+        ok = fwrite(tokens[k].text, 1, len, writer.file) == len;
+    }
+
+    if (writer.file && fclose(writer.file) != 0) ok = false;
+    if (ok && rename(tempName, filename) != 0) ok = false;
+    if (!ok && writer.file) {
+        perror("Failed to write count shard");
+        remove(tempName);
+    }
+
+    for (int l = 0; l < MaxN; l++) free(writer.groups[l]);
+    free(keyOf);
+    free(tokens);
+    return ok;
+}
+
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    const ShardFileHeader* header;
+    const uint32_t* vocabOffsets;
+    const char* vocabStrings;
+    uint32_t* toGlobal;  // shard token index -> merged token ID
+} CountShard;
+
+static const char* shardToken(const CountShard* shard, uint32_t index) {
+    return shard->vocabStrings + shard->vocabOffsets[index];
+}
+
+// Map a shard read-only and check that every section and token index is in bounds;
+// the check reads each run once, through the page cache rather than the heap
+static bool mapCountShard(CountShard* shard, const char* filename) {
+    memset(shard, 0, sizeof(*shard));
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ShardFileHeader)) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    shard->data = (const unsigned char*)data;
+    shard->size = (size_t)st.st_size;
+
+    const ShardFileHeader* header = (const ShardFileHeader*)data;
+    shard->header = header;
+    if (memcmp(header->magic, ShardMagic, sizeof(header->magic)) != 0 || header->version != ShardVersion ||
+        header->maxN < 1 || header->maxN > MaxN || header->fileSize != shard->size ||
+        header->vocabStringsSize == 0 || header->vocabStringsOff + header->vocabStringsSize != shard->size ||
+        header->vocabOffsetsOff + ((uint64_t)header->vocabSize + 1) * sizeof(uint32_t) > header->vocabStringsOff) {
+        return false;
+    }
+    shard->vocabOffsets = (const uint32_t*)(shard->data + header->vocabOffsetsOff);
+    shard->vocabStrings = (const char*)(shard->data + header->vocabStringsOff);
+    if (shard->vocabStrings[header->vocabStringsSize - 1] != '\0') return false;
+    for (uint32_t k = 0; k < header->vocabSize; k++) {
+        if (shard->vocabOffsets[k] >= header->vocabStringsSize) return false;
+    }
+
+    for (uint32_t l = 0; l < header->maxN; l++) {
+        uint64_t words = header->runSize[l] * (uint64_t)(l + 2);
+        if (header->runOff[l] % sizeof(uint32_t) != 0 ||
+            header->runOff[l] + words * sizeof(uint32_t) > header->vocabOffsetsOff) {
+            return false;
+        }
+        const uint32_t* run = (const uint32_t*)(shard->data + header->runOff[l]);
+        for (uint64_t r = 0; r < header->runSize[l]; r++) {
+            for (uint32_t j = 0; j <= l; j++) {
+                if (run[r * (l + 2) + j] >= header->vocabSize) return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void unmapCountShard(CountShard* shard) {
+    if (shard->data) munmap((void*)shard->data, shard->size);
+    free(shard->toGlobal);
+}
+
+// Merge the shards' key-ordered string tables into one vocabulary numbered
+// in key order, and map each shard's token indexes onto it
+static Vocabulary* mergeShardVocabularies(CountShard* shards, int numShards) {
+    Vocabulary* vocab = createVocabulary();
+    uint32_t* next = (uint32_t*)calloc((size_t)numShards, sizeof(uint32_t));
+    bool ok = vocab && next;
+    for (int s = 0; ok && s < numShards; s++) {
+        shards[s].toGlobal = (uint32_t*)malloc(((size_t)shards[s].header->vocabSize + 1) * sizeof(uint32_t));
+        ok = shards[s].toGlobal != NULL;
+    }
+
+    while (ok) {
+        const char* smallest = NULL;
+        for (int s = 0; s < numShards; s++) {
+            if (next[s] == shards[s].header->vocabSize) continue;
+            const char* token = shardToken(&shards[s], next[s]);
+            if (!smallest || compareShardKeys(token, smallest) < 0) smallest = token;
+        }
+        if (!smallest) break;
+
+        uint32_t id = getOrAddToken(vocab, smallest);
+        ok = strcmp(getTokenById(vocab, id), smallest) == 0;
+        for (int s = 0; ok && s < numShards; s++) {
+            if (next[s] == shards[s].header->vocabSize || strcmp(shardToken(&shards[s], next[s]), smallest) != 0) {
+                continue;
+            }
+            shards[s].toGlobal[next[s]++] = id;
+            // A table out of key order would break the merge order of the runs
+            ok = next[s] == shards[s].header->vocabSize ||
+                 compareShardKeys(smallest, shardToken(&shards[s], next[s])) < 0;
+        }
+    }
+
+    free(next);
+    if (!ok) {
+        if (vocab) fprintf(stderr, "Count shard vocabularies cannot be merged\n");
+        freeVocabulary(vocab);
+        return NULL;
+    }
+    return vocab;
+}
+
+typedef struct {
+    CountShard* shards;
+    int numShards;
+} ShardSet;
+
+typedef struct {
+    const uint32_t* record;
+    const uint32_t* end;
+    const uint32_t* toGlobal;
+} ShardRunCursor;
+
+// k-way merge of one order's runs; the heap holds runs by their next record
+typedef struct {
+    ShardRunCursor* runs;
+    int* heap;
+    int heapSize;
+    int order;
+} ShardMergeCursor;
+
+static int compareRunHeads(const ShardMergeCursor* merge, int a, int b) {
+    const ShardRunCursor* ra = &merge->runs[a];
+    const ShardRunCursor* rb = &merge->runs[b];
+    for (int j = 0; j < merge->order; j++) {
+        uint32_t ta = ra->toGlobal[ra->record[j]];
+        uint32_t tb = rb->toGlobal[rb->record[j]];
+        if (ta != tb) return (ta < tb) ? -1 : 1;
+    }
+    return 0;
+}
+
+static bool runHeadEquals(const ShardRunCursor* run, int order, const uint32_t* tokens) {
+    for (int j = 0; j < order; j++) {
+        if (run->toGlobal[run->record[j]] != tokens[j]) return false;
+    }
+    return true;
+}
+
+static void siftDownRun(ShardMergeCursor* merge, int i) {
+    while (1) {
+        int smallest = i;
+        int left = 2 * i + 1, right = 2 * i + 2;
+        if (left < merge->heapSize && compareRunHeads(merge, merge->heap[left], merge->heap[smallest]) < 0) {
+            smallest = left;
+        }
+        if (right < merge->heapSize && compareRunHeads(merge, merge->heap[right], merge->heap[smallest]) < 0) {
+            smallest = right;
+        }
+        if (smallest == i) return;
+        int t = merge->heap[i];
+        merge->heap[i] = merge->heap[smallest];
+        merge->heap[smallest] = t;
+        i = smallest;
+    }
+}
+
+static void* openShardRuns(void* state, int order) {
+    const ShardSet* set = (const ShardSet*)state;
+    ShardMergeCursor* merge = (ShardMergeCursor*)calloc(1, sizeof(ShardMergeCursor));
+    if (!merge) return NULL;
+    merge->runs = (ShardRunCursor*)malloc(sizeof(ShardRunCursor) * (size_t)set->numShards);
+    merge->heap = (int*)malloc(sizeof(int) * (size_t)set->numShards);
+    if (!merge->runs || !merge->heap) {
+        free(merge->runs);
+        free(merge->heap);
+        free(merge);
+        return NULL;
+    }
+    merge->order = order;
+
+    for (int s = 0; s < set->numShards; s++) {
+        const CountShard* shard = &set->shards[s];
+        ShardRunCursor* run = &merge->runs[s];
+        run->record = (const uint32_t*)(shard->data + shard->header->runOff[order - 1]);
+        run->end = run->record + shard->header->runSize[order - 1] * (uint64_t)(order + 1);
+        run->toGlobal = shard->toGlobal;
+        if (run->record != run->end) merge->heap[merge->heapSize++] = s;
+    }
+    for (int i = merge->heapSize / 2 - 1; i >= 0; i--) siftDownRun(merge, i);
+    return merge;
+}
+
+// Next n-gram over all shards, its counts summed (saturating at 32 bits)
+static bool nextShardRun(void* cursor, uint32_t* tokens, uint32_t* count) {
+    ShardMergeCursor* merge = (ShardMergeCursor*)cursor;
+    if (merge->heapSize == 0) return false;
+
+    const ShardRunCursor* top = &merge->runs[merge->heap[0]];
+    for (int j = 0; j < merge->order; j++) tokens[j] = top->toGlobal[top->record[j]];
+    uint64_t total = 0;
+    do {
+        ShardRunCursor* run = &merge->runs[merge->heap[0]];
+        total += run->record[merge->order];
+        run->record += merge->order + 1;
+        if (run->record == run->end) merge->heap[0] = merge->heap[--merge->heapSize];
+        if (merge->heapSize > 0) siftDownRun(merge, 0);
+    } while (merge->heapSize > 0 && runHeadEquals(&merge->runs[merge->heap[0]], merge->order, tokens));
+
+    *count = (total > UINT32_MAX) ? UINT32_MAX : (uint32_t)total;
+    return true;
+}
+
+static void closeShardRuns(void* cursor) {
+    ShardMergeCursor* merge = (ShardMergeCursor*)cursor;
+    free(merge->runs);
+    free(merge->heap);
+    free(merge);
+}
+
+// Merge count shards from any number of nodes into one frozen model file.
+// The shards are mapped and read in order, and the merged runs go straight
+// into the image, so memory is bounded by the vocabulary and the number of
+// shards, not by the total corpus.
+bool mergeCountShards(const char* const* shardFiles, int numShards, const char* filename) {
+    if (!shardFiles || numShards < 1 || !filename) return false;
+
+    CountShard* shards = (CountShard*)calloc((size_t)numShards, sizeof(CountShard));
+    if (!shards) return false;
+    bool ok = true;
+    uint64_t totalTokens = 0, totalNgrams = 0;
+    for (int s = 0; ok && s < numShards; s++) {
+        ok = mapCountShard(&shards[s], shardFiles[s]);
+        if (!ok) {
+            fprintf(stderr, "Invalid count shard: %s\n", shardFiles[s]);
+        } else if (shards[s].header->maxN != shards[0].header->maxN) {
+            fprintf(stderr, "Count shard %s has order %u, expected %u\n", shardFiles[s], shards[s].header->maxN,
+                    shards[0].header->maxN);
+            ok = false;
+        }
+        if (ok) {
+            totalTokens += shards[s].header->totalTokens;
+            totalNgrams += shards[s].header->totalNgrams;
+        }
+    }
+
+    Vocabulary* vocab = ok ? mergeShardVocabularies(shards, numShards) : NULL;
+    if (vocab) {
+        ShardSet set = { shards, numShards };
+        FrozenRunSource source = { &set, openShardRuns, nextShardRun, closeShardRuns };
+        ok = writeFrozenFromRuns(&source, vocab, (int)shards[0].header->maxN, totalTokens, totalNgrams, filename);
+    } else {
+        ok = false;
+    }
+
+    freeVocabulary(vocab);
+    for (int s = 0; s < numShards; s++) unmapCountShard(&shards[s]);
+    free(shards);
+    return ok;
+}
@@ -0,0 +1,308 @@
+#include "../include/skipgram.h"
+
+// On-disk header, followed by the arrays in declaration order
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t keyStride;
+    uint32_t numKeys;
+    uint32_t numEntries;
+} SkipGramFileHeader;
+// Version 2 follows the header with a SkipGramStamp
+
+// One skip-gram while building
+typedef struct {
+    uint32_t key[SkipGramKeyStride];
+    uint32_t length;
+    uint32_t token;
+    uint32_t count;
+} SkipGramRecord;
+
+static int compareSkipGramRecords(const void* a, const void* b) {
+    const SkipGramRecord* x = (const SkipGramRecord*)a;
+    const SkipGramRecord* y = (const SkipGramRecord*)b;
+    if (x->length != y->length) return (x->length < y->length) ? -1 : 1;
+    for (int i = 0; i < SkipGramKeyStride; i++) {
+        if (x->key[i] != y->key[i]) return (x->key[i] < y->key[i]) ? -1 : 1;
+    }
+    if (x->count != y->count) return (x->count > y->count) ? -1 : 1;
+    return (x->token > y->token) - (x->token < y->token);
+}
+
+static uint32_t hashSkipGramKey(const uint32_t* key, int length) {
+    uint32_t h = 2166136261u ^ (uint32_t)length;
+    for (int i = 0; i < length; i++) {
+        h = (h ^ key[i]) * 16777619u;
+        h ^= h >> 15;
+    }
+    return h;
+}
+
+// Allocate the arrays for numKeys keys and numEntries continuations
+static SkipGramIndex* allocSkipGrams(uint32_t numKeys, uint32_t numEntries) {
+    SkipGramIndex* index = (SkipGramIndex*)calloc(1, sizeof(SkipGramIndex));
+    if (!index) return NULL;
+
+    uint32_t slots = 16;
+    while (slots < numKeys * 2u && slots < (1u << 31)) slots <<= 1;
+
+    index->numKeys = numKeys;
+    index->numEntries = numEntries;
+    index->keyLengths = (uint8_t*)malloc((size_t)numKeys + 1);
+    index->keyTokens = (uint32_t*)malloc(((size_t)numKeys * SkipGramKeyStride + 1) * sizeof(uint32_t));
+    index->firstEntry = (uint32_t*)malloc(((size_t)numKeys + 1) * sizeof(uint32_t));
+    index->totals = (uint32_t*)malloc(((size_t)numKeys + 1) * sizeof(uint32_t));
+    index->tokenIds = (uint32_t*)malloc(((size_t)numEntries + 1) * sizeof(uint32_t));
+    index->counts = (uint32_t*)malloc(((size_t)numEntries + 1) * sizeof(uint32_t));
+    index->slots = (uint32_t*)malloc((size_t)slots * sizeof(uint32_t));
+    index->slotMask = slots - 1;
+    if (!index->keyLengths || !index->keyTokens || !index->firstEntry || !index->totals ||
+        !index->tokenIds || !index->counts || !index->slots) {
+        freeSkipGrams(index);
+        return NULL;
+    }
+    index->firstEntry[0] = 0;
+    return index;
+}
+
+// Hash every key into the slot table
+static void hashSkipGramKeys(SkipGramIndex* index) {
+    memset(index->slots, 0xFF, ((size_t)index->slotMask + 1) * sizeof(uint32_t));
+    for (uint32_t k = 0; k < index->numKeys; k++) {
+        const uint32_t* key = &index->keyTokens[(size_t)k * SkipGramKeyStride];
+        uint32_t slot = hashSkipGramKey(key, index->keyLengths[k]) & index->slotMask;
+        while (index->slots[slot] != PatternEmptySlot) slot = (slot + 1) & index->slotMask;
+        index->slots[slot] = k;
+    }
+}
+
+// Collect the skip-grams seen at least SkipGramMinCount times
+SkipGramIndex* buildSkipGrams(const PatternIndex* patterns) {
+    if (!patterns || patterns->size == 0) return NULL;
+
+    // A skip-gram needs a concrete last token and a gap before it
+    size_t n = 0;
+    for (int i = 0; i < patterns->size; i++) {
+        const Pattern* pattern = &patterns->patterns[i];
+        int length = pattern->length - 1;
+        if (length < 2 || length > SkipGramKeyStride || pattern->count < SkipGramMinCount) continue;
+        if (pattern->tokens[length] == WildcardToken) continue;
+        bool gapped = false;
+        for (int j = 0; j < length; j++) gapped |= (pattern->tokens[j] == WildcardToken);
+        if (gapped) n++;
+    }
+    if (n == 0 || n > UINT32_MAX - 1) return NULL;
+
+    SkipGramRecord* records = (SkipGramRecord*)calloc(n, sizeof(SkipGramRecord));
+    if (!records) return NULL;
+    size_t r = 0;
+    for (int i = 0; i < patterns->size && r < n; i++) {
+        const Pattern* pattern = &patterns->patterns[i];
+        int length = pattern->length - 1;
+        if (length < 2 || length > SkipGramKeyStride || pattern->count < SkipGramMinCount) continue;
+        if (pattern->tokens[length] == WildcardToken) continue;
+        bool gapped = false;
+        for (int j = 0; j < length; j++) gapped |= (pattern->tokens[j] == WildcardToken);
+        if (!gapped) continue;
+
+        memcpy(records[r].key, pattern->tokens, (size_t)length * sizeof(uint32_t));
+        records[r].length = (uint32_t)length;
+        records[r].token = pattern->tokens[length];
+        records[r].count = pattern->count;
+        r++;
+    }
+    qsort(records, n, sizeof(SkipGramRecord), compareSkipGramRecords);
+
+    uint32_t numKeys = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i == 0 || records[i].length != records[i - 1].length ||
+            memcmp(records[i].key, records[i - 1].key, sizeof(records[i].key)) != 0) {
+            numKeys++;
+        }
+    }
+
+    SkipGramIndex* index = allocSkipGrams(numKeys, (uint32_t)n);
+    if (!index) {
+        free(records);
+        return NULL;
+    }
+
+    uint32_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i == 0 || records[i].length != records[i - 1].length ||
+            memcmp(records[i].key, records[i - 1].key, sizeof(records[i].key)) != 0) {
+            index->keyLengths[k] = (uint8_t)records[i].length;
+            memcpy(&index->keyTokens[(size_t)k * SkipGramKeyStride], records[i].key, sizeof(records[i].key));
+            index->totals[k] = 0;
+            k++;
+            index->firstEntry[k] = index->firstEntry[k - 1];
+        }
+        uint64_t total = (uint64_t)index->totals[k - 1] + records[i].count;
+        index->totals[k - 1] = (total > UINT32_MAX) ? UINT32_MAX : (uint32_t)total;
+        index->tokenIds[i] = records[i].token;
+        index->counts[i] = records[i].count;
+        index->firstEntry[k]++;
+    }
+    free(records);
+
+    hashSkipGramKeys(index);
+    return index;
+}
+
+// Re-add every skip-gram as a pattern with its count, so a later
+// buildSkipGrams over patterns holding new counts keeps the old ones
+void addSkipGramPatterns(const SkipGramIndex* index, PatternIndex* patterns) {
+    if (!index || !patterns) return;
+
+    uint32_t tokens[SkipGramKeyStride + 1];
+    for (uint32_t k = 0; k < index->numKeys; k++) {
+        int length = index->keyLengths[k];
+        memcpy(tokens, &index->keyTokens[(size_t)k * SkipGramKeyStride], (size_t)length * sizeof(uint32_t));
+        for (uint32_t e = index->firstEntry[k]; e < index->firstEntry[k + 1]; e++) {
+            tokens[length] = index->tokenIds[e];
+            addPatternCount(patterns, tokens, length + 1, index->counts[e]);
+        }
+    }
+}
+
+// Bytes held by the index
+size_t skipGramMemory(const SkipGramIndex* index) {
+    if (!index) return 0;
+    size_t bytes = sizeof(SkipGramIndex);
+    bytes += (size_t)index->numKeys * (sizeof(uint8_t) + SkipGramKeyStride * sizeof(uint32_t) + 2 * sizeof(uint32_t));
+    bytes += sizeof(uint32_t);  // firstEntry[numKeys]
+    bytes += (size_t)index->numEntries * 2 * sizeof(uint32_t);
+    bytes += (size_t)(index->slotMask + 1) * sizeof(uint32_t);
+    return bytes;
+}
+
+void freeSkipGrams(SkipGramIndex* index) {
+    if (!index) return;
+    free(index->keyLengths);
+    free(index->keyTokens);
+    free(index->firstEntry);
+    free(index->totals);
+    free(index->tokenIds);
+    free(index->counts);
+    free(index->slots);
+    free(index);
+}
+
+// Write the table to <prefix>.skip
+bool saveSkipGrams(const SkipGramIndex* index, const SkipGramStamp* stamp, const char* filename) {
+    if (!index || !stamp || !filename) return false;
+
+    // Same temporary-and-rename as writeFrozenFile
+    char tempName[1024];
+    snprintf(tempName, sizeof(tempName), "%s.tmp", filename);
+    FILE* file = fopen(tempName, "wb");
+    if (!file) {
+        perror("Failed to create skip-gram file");
+        return false;
+    }
+
+    SkipGramFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SkipGramMagic, sizeof(header.magic));
+    header.version = SkipGramVersion;
+    header.keyStride = SkipGramKeyStride;
+    header.numKeys = index->numKeys;
+    header.numEntries = index->numEntries;
+
+    size_t keys = index->numKeys;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(stamp, sizeof(*stamp), 1, file) == 1 &&
+              fwrite(index->keyLengths, 1, keys, file) == keys &&
+              fwrite(index->keyTokens, sizeof(uint32_t), keys * SkipGramKeyStride, file) == keys * SkipGramKeyStride &&
+              fwrite(index->firstEntry, sizeof(uint32_t), keys + 1, file) == keys + 1 &&
+              fwrite(index->totals, sizeof(uint32_t), keys, file) == keys &&
+              fwrite(index->tokenIds, sizeof(uint32_t), index->numEntries, file) == index->numEntries &&
+              fwrite(index->counts, sizeof(uint32_t), index->numEntries, file) == index->numEntries;
+    if (fclose(file) != 0) ok = false;
+    if (ok && rename(tempName, filename) != 0) ok = false;
+    if (!ok) {
+        fprintf(stderr, "Failed to write skip-gram file %s\n", filename);
+        remove(tempName);
+    }
+    return ok;
+}
+
+// Read a table written by saveSkipGrams; NULL if absent or invalid
+SkipGramIndex* loadSkipGrams(const char* filename, const SkipGramStamp* expected) {
+    if (!filename || !expected) return NULL;
+    FILE* file = fopen(filename, "rb");
+    if (!file) return NULL;
+
+    SkipGramFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, SkipGramMagic, sizeof(header.magic)) != 0 ||
+        header.version < 1 || header.version > SkipGramVersion || header.keyStride != SkipGramKeyStride ||
+        header.numKeys > (1u << 30) || header.numEntries == UINT32_MAX) {
+        fprintf(stderr, "Skip-gram file %s is invalid\n", filename);
+        fclose(file);
+        return NULL;
+    }
+    if (header.version >= 2) {
+        SkipGramStamp stamp;
+        if (fread(&stamp, sizeof(stamp), 1, file) != 1 || stamp.vocabSize != expected->vocabSize ||
+            stamp.totalTokens != expected->totalTokens || stamp.vocabHash != expected->vocabHash) {
+            fprintf(stderr, "Skip-gram file %s belongs to another model; ignoring it\n", filename);
+            fclose(file);
+            return NULL;
+        }
+    }
+
+    SkipGramIndex* index = allocSkipGrams(header.numKeys, header.numEntries);
+    if (!index) {
+        fclose(file);
+        return NULL;
+    }
+
+    size_t keys = header.numKeys;
+    bool ok = fread(index->keyLengths, 1, keys, file) == keys &&
+              fread(index->keyTokens, sizeof(uint32_t), keys * SkipGramKeyStride, file) == keys * SkipGramKeyStride &&
+              fread(index->firstEntry, sizeof(uint32_t), keys + 1, file) == keys + 1 &&
+              fread(index->totals, sizeof(uint32_t), keys, file) == keys &&
+              fread(index->tokenIds, sizeof(uint32_t), index->numEntries, file) == index->numEntries &&
+              fread(index->counts, sizeof(uint32_t), index->numEntries, file) == index->numEntries;
+    fclose(file);
+
+    // Offsets must be ascending and within the entries, tokens within the vocabulary
+    for (size_t k = 0; ok && k < keys; k++) {
+        ok = index->keyLengths[k] >= 1 && index->keyLengths[k] <= SkipGramKeyStride &&
+             index->firstEntry[k] <= index->firstEntry[k + 1];
+        for (int i = 0; ok && i < SkipGramKeyStride; i++) {
+            uint32_t token = index->keyTokens[k * SkipGramKeyStride + i];
+            ok = token == WildcardToken || token < expected->vocabSize;
+        }
+    }
+    for (uint32_t e = 0; ok && e < index->numEntries; e++) ok = index->tokenIds[e] < expected->vocabSize;
+    if (!ok || index->firstEntry[0] != 0 || index->firstEntry[keys] != index->numEntries) {
+        fprintf(stderr, "Skip-gram file %s is invalid\n", filename);
+        freeSkipGrams(index);
+        return NULL;
+    }
+
+    hashSkipGramKeys(index);
+    return index;
+}
+
+// Continuations [begin, end) of a gapped context of length tokens; false if unseen
+bool findSkipGram(const SkipGramIndex* index, const uint32_t* key, int length,
+                  uint32_t* begin, uint32_t* end, uint32_t* total) {
+    if (!index || !key || length < 1 || length > SkipGramKeyStride) return false;
+
+    uint32_t slot = hashSkipGramKey(key, length) & index->slotMask;
+    while (index->slots[slot] != PatternEmptySlot) {
+        uint32_t k = index->slots[slot];
+        if (index->keyLengths[k] == length &&
+            memcmp(&index->keyTokens[(size_t)k * SkipGramKeyStride], key, (size_t)length * sizeof(uint32_t)) == 0) {
+            *begin = index->firstEntry[k];
+            *end = index->firstEntry[k + 1];
+            *total = index->totals[k];
+            return true;
+        }
+        slot = (slot + 1) & index->slotMask;
+    }
+    return false;
+}
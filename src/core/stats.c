@@ -0,0 +1,218 @@
+#include "../include/stats.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef CEVIA_NO_STATS
+
+__thread StatsBlock* statsLocal = NULL;
+
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static StatsBlock* liveBlocks = NULL;  // one per thread that counted something
+static StatsSnapshot retired;          // totals of threads that have exited
+static StatsBlock fallbackBlock;       // shared (lossy but safe) if a block cannot be allocated
+static pthread_key_t statsKey;
+static pthread_once_t statsKeyOnce = PTHREAD_ONCE_INIT;
+
+static void addBlock(StatsSnapshot* sum, StatsBlock* block) {
+    for (int c = 0; c < StatCounterCount; c++) {
+        sum->counters[c] += atomic_load_explicit(&block->counters[c], memory_order_relaxed);
+    }
+    for (int d = 0; d < MaxN; d++) {
+        sum->backoffDepth[d] += atomic_load_explicit(&block->backoffDepth[d], memory_order_relaxed);
+    }
+    for (int h = 0; h < StatLatencyCount; h++) {
+        StatHistogram* histogram = &sum->latency[h];
+        histogram->count += atomic_load_explicit(&block->latencyCount[h], memory_order_relaxed);
+        histogram->sumNanos += atomic_load_explicit(&block->latencySum[h], memory_order_relaxed);
+        for (int b = 0; b < StatLatencyBuckets; b++) {
+            histogram->buckets[b] += atomic_load_explicit(&block->latencyBuckets[h][b], memory_order_relaxed);
+        }
+    }
+}
+
+// A thread's counters outlive it: fold them into the retired totals
+static void retireBlock(void* arg) {
+    StatsBlock* block = (StatsBlock*)arg;
+    pthread_mutex_lock(&statsLock);
+    addBlock(&retired, block);
+    if (block->prev) block->prev->next = block->next;
+    else liveBlocks = block->next;
+    if (block->next) block->next->prev = block->prev;
+    pthread_mutex_unlock(&statsLock);
+    statsLocal = NULL;
+    free(block);
+}
+
+static void createStatsKey(void) {
+    pthread_key_create(&statsKey, retireBlock);
+}
+
+// First count on this thread: give it a block of its own, on its own cache lines
+StatsBlock* registerStatsThread(void) {
+    pthread_once(&statsKeyOnce, createStatsKey);
+    size_t size = (sizeof(StatsBlock) + 63) & ~(size_t)63;
+    StatsBlock* block = (StatsBlock*)aligned_alloc(64, size);
+    if (!block) return &fallbackBlock;
+    memset(block, 0, size);
+
+    pthread_mutex_lock(&statsLock);
+    block->next = liveBlocks;
+    if (liveBlocks) liveBlocks->prev = block;
+    liveBlocks = block;
+    pthread_mutex_unlock(&statsLock);
+
+    pthread_setspecific(statsKey, block);
+    statsLocal = block;
+    return block;
+}
+
+static void clearBlock(StatsBlock* block) {
+    for (int c = 0; c < StatCounterCount; c++) atomic_store_explicit(&block->counters[c], 0, memory_order_relaxed);
+    for (int d = 0; d < MaxN; d++) atomic_store_explicit(&block->backoffDepth[d], 0, memory_order_relaxed);
+    for (int h = 0; h < StatLatencyCount; h++) {
+        atomic_store_explicit(&block->latencyCount[h], 0, memory_order_relaxed);
+        atomic_store_explicit(&block->latencySum[h], 0, memory_order_relaxed);
+        for (int b = 0; b < StatLatencyBuckets; b++) {
+            atomic_store_explicit(&block->latencyBuckets[h][b], 0, memory_order_relaxed);
+        }
+    }
+}
+
+void readStats(StatsSnapshot* snapshot) {
+    if (!snapshot) return;
+    pthread_mutex_lock(&statsLock);
+    *snapshot = retired;
+    for (StatsBlock* block = liveBlocks; block; block = block->next) addBlock(snapshot, block);
+    addBlock(snapshot, &fallbackBlock);
+    pthread_mutex_unlock(&statsLock);
+    snapshot->enabled = true;
+}
+
+void resetStats(void) {
+    pthread_mutex_lock(&statsLock);
+    memset(&retired, 0, sizeof(retired));
+    for (StatsBlock* block = liveBlocks; block; block = block->next) clearBlock(block);
+    clearBlock(&fallbackBlock);
+    pthread_mutex_unlock(&statsLock);
+}
+
+#else
+
+void readStats(StatsSnapshot* snapshot) {
+    if (snapshot) memset(snapshot, 0, sizeof(*snapshot));
+}
+
+void resetStats(void) {
+}
+
+#endif // CEVIA_NO_STATS
+
+double statMeanNanos(const StatHistogram* histogram) {
+    return (histogram && histogram->count) ? (double)histogram->sumNanos / (double)histogram->count : 0.0;
+}
+
+uint64_t statQuantileNanos(const StatHistogram* histogram, double quantile) {
+    if (!histogram || histogram->count == 0) return 0;
+    uint64_t rank = (uint64_t)(quantile * (double)histogram->count);
+    if (rank >= histogram->count) rank = histogram->count - 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < StatLatencyBuckets; b++) {
+        seen += histogram->buckets[b];
+        if (seen > rank) return (uint64_t)1 << b;
+    }
+    return (uint64_t)1 << (StatLatencyBuckets - 1);
+}
+
+// Appends to a bounded buffer while counting what a full one would hold
+typedef struct {
+    char* out;
+    size_t size;
+    size_t length;
+} TextSink;
+
+static void emit(TextSink* sink, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void emit(TextSink* sink, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t room = (sink->length < sink->size) ? sink->size - sink->length : 0;
+    int n = vsnprintf(room ? sink->out + sink->length : NULL, room, format, args);
+    va_end(args);
+    if (n > 0) sink->length += (size_t)n;
+}
+
+static const struct {
+    const char* name;
+    const char* help;
+} CounterInfo[StatCounterCount] = {
+    { "cevia_predictions_total", "Predictions answered, cache hits included" },
+    { "cevia_predict_fallback_total", "Scored predictions padded from the unigram ranking" },
+    { "cevia_predict_skipgram_total", "Scored predictions that backed off to skip-grams" },
+    { "cevia_cursor_advances_total", "Tokens appended to prediction cursors" },
+    { "cevia_child_searches_total", "Frozen trie child searches made by cursor appends" },
+    { "cevia_trie_lookups_total", "Mutable trie prefix lookups" },
+    { "cevia_trie_nodes_visited_total", "Mutable trie nodes visited by prefix lookups" },
+    { "cevia_hash_lookups_total", "Vocabulary hash map lookups" },
+    { "cevia_hash_probes_total", "Hash map slots probed by those lookups" },
+    { "cevia_generate_steps_total", "Tokens produced by generation" },
+};
+
+static const struct {
+    const char* name;
+    const char* help;
+} LatencyInfo[StatLatencyCount] = {
+    { "cevia_predict_latency_seconds", "Latency of one prediction" },
+    { "cevia_generate_step_latency_seconds", "Latency of one generated token" },
+    { "cevia_serve_request_latency_seconds", "Latency of one serve request line" },
+};
+
+size_t formatPrometheusStats(const StatsSnapshot* snapshot, const ModelMemoryStats* memory, char* out,
+                             size_t size) {
+    TextSink sink = { out, size, 0 };
+    if (size > 0) out[0] = '\0';
+
+    if (snapshot && snapshot->enabled) {
+        for (int c = 0; c < StatCounterCount; c++) {
+            emit(&sink, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", CounterInfo[c].name, CounterInfo[c].help,
+                 CounterInfo[c].name, CounterInfo[c].name, (unsigned long long)snapshot->counters[c]);
+        }
+        emit(&sink, "# HELP cevia_predict_backoff_depth_total Scored predictions by longest context matched\n"
+                    "# TYPE cevia_predict_backoff_depth_total counter\n");
+        for (int d = 0; d < MaxN; d++) {
+            emit(&sink, "cevia_predict_backoff_depth_total{context=\"%d\"} %llu\n", d,
+                 (unsigned long long)snapshot->backoffDepth[d]);
+        }
+        for (int h = 0; h < StatLatencyCount; h++) {
+            const StatHistogram* histogram = &snapshot->latency[h];
+            const char* name = LatencyInfo[h].name;
+            emit(&sink, "# HELP %s %s\n# TYPE %s histogram\n", name, LatencyInfo[h].help, name);
+            uint64_t cumulative = 0;
+            for (int b = 0; b + 1 < StatLatencyBuckets; b++) {
+                cumulative += histogram->buckets[b];
+                emit(&sink, "%s_bucket{le=\"%.9g\"} %llu\n", name, (double)((uint64_t)1 << b) * 1e-9,
+                     (unsigned long long)cumulative);
+            }
+            emit(&sink, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9g\n%s_count %llu\n", name,
+                 (unsigned long long)histogram->count, name, (double)histogram->sumNanos * 1e-9, name,
+                 (unsigned long long)histogram->count);
+        }
+    }
+
+    if (memory) {
+        emit(&sink, "# HELP cevia_model_memory_bytes Memory held by the model, by subsystem\n"
+                    "# TYPE cevia_model_memory_bytes gauge\n");
+        emit(&sink, "cevia_model_memory_bytes{subsystem=\"vocab\"} %zu\n", memory->vocabBytes);
+        emit(&sink, "cevia_model_memory_bytes{subsystem=\"ngrams\"} %zu\n", memory->ngramBytes);
+        emit(&sink, "cevia_model_memory_bytes{subsystem=\"patterns\"} %zu\n", memory->patternBytes);
+        emit(&sink, "cevia_model_memory_bytes{subsystem=\"skipgrams\"} %zu\n", memory->skipGramBytes);
+        emit(&sink, "cevia_model_memory_bytes{subsystem=\"frozen\"} %zu\n", memory->frozenBytes);
+        emit(&sink, "cevia_model_memory_bytes{subsystem=\"cache\"} %zu\n", memory->cacheBytes);
+        emit(&sink, "# HELP cevia_model_frozen_mapped Whether the frozen image is a shared file mapping\n"
+                    "# TYPE cevia_model_frozen_mapped gauge\ncevia_model_frozen_mapped %d\n",
+             memory->frozenMapped ? 1 : 0);
+    }
+    return sink.length;
+}
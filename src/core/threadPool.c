@@ -0,0 +1,142 @@
+#include "../include/threadPool.h"
+#include <unistd.h>
+
+// Remove a task from the queue once all of its indices are claimed
+static void unlinkTask(ThreadPool* pool, ThreadPoolTask* task) {
+    ThreadPoolTask** p = &pool->head;
+    while (*p && *p != task) p = &(*p)->link;
+    if (*p) *p = task->link;
+}
+
+// Claim the next chunk of a task; caller holds the lock
+static void claimChunk(ThreadPool* pool, ThreadPoolTask* task, size_t* begin, size_t* end) {
+    *begin = task->next;
+    *end = (task->count - *begin > task->grain) ? *begin + task->grain : task->count;
+    task->next = *end;
+    if (task->next >= task->count) unlinkTask(pool, task);
+}
+
+// Record finished indices; caller holds the lock
+static void finishChunk(ThreadPoolTask* task, size_t n) {
+    task->remaining -= n;
+    if (task->remaining == 0) pthread_cond_signal(&task->done);
+}
+
+static void* poolWorker(void* arg) {
+    ThreadPool* pool = (ThreadPool*)arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->head && !pool->stopping) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (!pool->head) break;  // Stopping and nothing left to do
+
+        ThreadPoolTask* task = pool->head;
+        size_t begin, end;
+        claimChunk(pool, task, &begin, &end);
+        pthread_mutex_unlock(&pool->lock);
+
+        task->fn(task->ctx, begin, end);
+
+        pthread_mutex_lock(&pool->lock);
+        finishChunk(task, end - begin);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Create a pool with numThreads workers (0 runs every task on the caller)
+ThreadPool* createThreadPool(int numThreads) {
+    if (numThreads < 0) numThreads = 0;
+    if (numThreads > MaxPoolThreads) numThreads = MaxPoolThreads;
+
+    ThreadPool* pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    if (!pool) return NULL;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    for (int i = 0; i < numThreads; i++) {
+        if (pthread_create(&pool->threads[pool->numThreads], NULL, poolWorker, pool) != 0) break;
+        pool->numThreads++;
+    }
+    return pool;
+}
+
+// Stop and join all workers
+void freeThreadPool(ThreadPool* pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->numThreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+// Run fn over [0, count) in chunks of grain indices and wait for completion
+void threadPoolFor(ThreadPool* pool, size_t count, size_t grain, ThreadPoolRangeFn fn, void* ctx) {
+    if (count == 0 || !fn) return;
+    if (grain == 0) grain = 1;
+
+    // Not worth a hand-off
+    if (!pool || pool->numThreads == 0 || count <= grain) {
+        fn(ctx, 0, count);
+        return;
+    }
+
+    ThreadPoolTask task;
+    task.fn = fn;
+    task.ctx = ctx;
+    task.count = count;
+    task.grain = grain;
+    task.next = 0;
+    task.remaining = count;
+    pthread_cond_init(&task.done, NULL);
+
+    pthread_mutex_lock(&pool->lock);
+    task.link = pool->head;
+    pool->head = &task;
+    pthread_cond_broadcast(&pool->wake);
+
+    // Help with our own task instead of idling
+    while (task.next < task.count) {
+        size_t begin, end;
+        claimChunk(pool, &task, &begin, &end);
+        pthread_mutex_unlock(&pool->lock);
+
+        fn(ctx, begin, end);
+
+        pthread_mutex_lock(&pool->lock);
+        finishChunk(&task, end - begin);
+    }
+    while (task.remaining > 0) {
+        pthread_cond_wait(&task.done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_cond_destroy(&task.done);
+}
+
+static ThreadPool* sharedPool = NULL;
+static pthread_once_t sharedPoolOnce = PTHREAD_ONCE_INIT;
+
+static void createSharedPool(void) {
+    // The submitting thread works too, so one CPU needs no workers
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = (cpus > 1) ? (int)(cpus - 1) : 0;
+    sharedPool = createThreadPool(workers);
+}
+
+// Process-wide pool, created on first use and kept for the process lifetime
+ThreadPool* sharedThreadPool(void) {
+    pthread_once(&sharedPoolOnce, createSharedPool);
+    return sharedPool;
+}
@@ -1,4 +1,6 @@
 #include "../include/vocab.h"
+#include "../include/corpus.h"
+#include "../include/arena.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,7 +17,7 @@ Vocabulary* createVocabulary() {
     }
     
     vocab->capacity = MaxVocabSize;
-    vocab->idToToken = (char**)calloc(vocab->capacity, sizeof(char*));
+    vocab->idToToken = (const char**)calloc(vocab->capacity, sizeof(char*));
     if (!vocab->idToToken) {
         freeHashMap(vocab->tokenToId);
         free(vocab);
@@ -23,6 +25,7 @@ Vocabulary* createVocabulary() {
     }
     
     vocab->size = 0;
+    memset(&vocab->view, 0, sizeof(vocab->view));
     
     // Add special tokens
     getOrAddToken(vocab, "<unk>");  // Unknown token
@@ -32,33 +35,104 @@ Vocabulary* createVocabulary() {
     return vocab;
 }
 
+// Release the mutable storage (the hash map owns the strings)
+static void clearVocabularyStorage(Vocabulary* vocab) {
+    if (vocab->tokenToId) {
+        freeHashMap(vocab->tokenToId);
+        vocab->tokenToId = NULL;
+    }
+    
+    free(vocab->idToToken);
+    vocab->idToToken = NULL;
+}
+
+// Bytes held by the vocabulary (a borrowed string table belongs to its image)
+size_t vocabularyMemory(const Vocabulary* vocab) {
+    if (!vocab) return 0;
+    size_t bytes = sizeof(Vocabulary);
+    if (vocab->view.strings) return bytes;
+    bytes += (size_t)vocab->capacity * sizeof(char*);
+    if (vocab->tokenToId) {
+        bytes += sizeof(HashMap) + (size_t)vocab->tokenToId->capacity * sizeof(HashMapSlot);
+        bytes += vocab->tokenToId->keys ? vocab->tokenToId->keys->bytesReserved : 0;
+    }
+    return bytes;
+}
+
+// Hash of the token strings in ID order: equal only if every ID names the same token
+uint64_t vocabularyFingerprint(const Vocabulary* vocab) {
+    uint64_t hash = 0;
+    if (!vocab) return hash;
+    for (uint32_t id = 0; id < vocab->size; id++) {
+        const char* token = getTokenById(vocab, id);
+        hash = hash * 0x9E3779B97F4A7C15ULL + hashString(token ? token : "", token ? strlen(token) : 0);
+    }
+    return hash;
+}
+
 // Free vocabulary memory
 void freeVocabulary(Vocabulary* vocab) {
     if (!vocab) return;
     
-    if (vocab->tokenToId) {
-        freeHashMap(vocab->tokenToId);
+    if (!vocab->view.strings) {
+        clearVocabularyStorage(vocab);
     }
     
-    if (vocab->idToToken) {
-        for (uint32_t i = 0; i < vocab->size; i++) {
-            if (vocab->idToToken[i]) {
-                free(vocab->idToToken[i]);
-            }
-        }
-        free(vocab->idToToken);
+    free(vocab);
+}
+
+// Point the vocabulary at a borrowed, read-only string table
+void attachVocabularyView(Vocabulary* vocab, uint32_t size, VocabularyView view) {
+    if (!vocab || !view.strings || !view.offsets || !view.sorted) return;
+    
+    if (!vocab->view.strings) {
+        clearVocabularyStorage(vocab);
     }
     
-    free(vocab);
+    vocab->view = view;
+    vocab->size = size;
+    vocab->capacity = size;
+}
+
+// Copy a borrowed string table into owned storage so tokens can be added
+bool thawVocabulary(Vocabulary* vocab) {
+    if (!vocab) return false;
+    if (!vocab->view.strings) return true;  // Already mutable
+    
+    VocabularyView view = vocab->view;
+    uint32_t size = vocab->size;
+    
+    HashMap* map = createHashMap();
+    uint32_t capacity = (size * 2 > MaxVocabSize) ? size * 2 : MaxVocabSize;
+    const char** tokens = (const char**)calloc(capacity, sizeof(char*));
+    if (!map || !tokens || !hashMapReserve(map, size)) {
+        if (map) freeHashMap(map);
+        free(tokens);
+        return false;
+    }
+    
+    for (uint32_t i = 0; i < size; i++) {
+        tokens[i] = hashMapPut(map, view.strings + view.offsets[i], i);
+        if (!tokens[i]) tokens[i] = "<unk>";
+    }
+    
+    vocab->tokenToId = map;
+    vocab->idToToken = tokens;
+    vocab->capacity = capacity;
+    memset(&vocab->view, 0, sizeof(vocab->view));
+    return true;
 }
 
 // Get token ID, add to vocabulary if not exists
 uint32_t getOrAddToken(Vocabulary* vocab, const char* token) {
     if (!vocab || !token) return 0;  // 0 is <unk> token ID
     
+    // A borrowed table is read-only; take a private copy first
+    if (vocab->view.strings && !thawVocabulary(vocab)) return 0;
+    
     // Check if token exists
-    uint32_t id = hashMapGet(vocab->tokenToId, token);
-    if (id != 0) {
+    uint32_t id;
+    if (hashMapFind(vocab->tokenToId, token, &id)) {
         return id;
     }
     
@@ -66,20 +140,19 @@ uint32_t getOrAddToken(Vocabulary* vocab, const char* token) {
     if (vocab->size >= vocab->capacity) {
         // Resize idToToken array if needed
         uint32_t newCapacity = vocab->capacity * 2;
-        char** newArray = (char**)realloc(vocab->idToToken, newCapacity * sizeof(char*));
+        const char** newArray = (const char**)realloc(vocab->idToToken, newCapacity * sizeof(char*));
         if (!newArray) return 0;  // Return <unk> on failure
         
         vocab->idToToken = newArray;
         vocab->capacity = newCapacity;
     }
     
-    // Allocate and store new token
-    char* tokenCopy = strdup(token);
-    if (!tokenCopy) return 0;  // Return <unk> on failure
-    
+    // Intern the string; the map's copy is shared with idToToken
     uint32_t newId = vocab->size;
-    vocab->idToToken[newId] = tokenCopy;
-    hashMapPut(vocab->tokenToId, token, newId);
+    const char* interned = hashMapPut(vocab->tokenToId, token, newId);
+    if (!interned) return 0;  // Return <unk> on failure
+    
+    vocab->idToToken[newId] = interned;
     vocab->size++;
     
     return newId;
@@ -90,60 +163,93 @@ const char* getTokenById(const Vocabulary* vocab, uint32_t id) {
     if (!vocab || id >= vocab->size) {
         return "<unk>";
     }
+    if (vocab->view.strings) {
+        return vocab->view.strings + vocab->view.offsets[id];
+    }
     return vocab->idToToken[id];
 }
 
+// Look up a token ID without adding it, returns 0 (<unk>) if not found
+uint32_t lookupToken(const Vocabulary* vocab, const char* token) {
+    if (!vocab || !token) return 0;
+    
+    if (!vocab->view.strings) {
+        return hashMapGet(vocab->tokenToId, token);
+    }
+    
+    // Binary search over the IDs sorted by string
+    const VocabularyView* view = &vocab->view;
+    uint32_t lo = 0;
+    uint32_t hi = vocab->size;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t id = view->sorted[mid];
+        int cmp = strcmp(view->strings + view->offsets[id], token);
+        if (cmp == 0) return id;
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return 0;  // Not found
+}
+
 // Build vocabulary from text file
 void buildVocabularyFromFile(Vocabulary* vocab, const char* filename) {
     if (!vocab || !filename) return;
     
-    FILE* file = fopen(filename, "r");
-    if (!file) {
+    CorpusReader* corpus = openCorpus(filename);
+    if (!corpus) {
         perror("Failed to open file");
         return;
     }
     
-    char line[4096];
-    while (fgets(line, sizeof(line), file)) {
-        // Remove newline character
-        size_t len = strlen(line);
-        if (len > 0 && line[len-1] == '\n') {
-            line[len-1] = '\0';
-        }
-        
-        // Tokenize line and add tokens to vocabulary
-        Sentence s = initSentence();
-        tokenizeLine(line, &s);
-        
-        for (int i = 0; i < s.length; i++) {
-            getOrAddToken(vocab, s.sequence[i].text);
+    // Tokenize each line and add its tokens to the vocabulary
+    TokenList tokens;
+    initTokenList(&tokens);
+    const char* line;
+    size_t length;
+    while (nextCorpusLine(corpus, &line, &length)) {
+        uint32_t count = tokenizeText(&tokens, line, length);
+        for (uint32_t i = 0; i < count; i++) {
+            getOrAddToken(vocab, tokens.spans[i].text);
         }
     }
     
-    fclose(file);
+    freeTokenList(&tokens);
+    closeCorpus(corpus);
 }
 
 // Save vocabulary to binary file
 void saveVocabulary(const Vocabulary* vocab, const char* filename) {
     if (!vocab || !filename) return;
     
-    FILE* file = fopen(filename, "wb");
+    // Written beside the target and renamed over it, so a reload never reads half a file
+    char tempName[1024];
+    snprintf(tempName, sizeof(tempName), "%s.tmp", filename);
+    FILE* file = fopen(tempName, "wb");
     if (!file) {
         perror("Failed to create file");
         return;
     }
     
     // Write number of tokens
-    fwrite(&vocab->size, sizeof(uint32_t), 1, file);
+    bool ok = fwrite(&vocab->size, sizeof(uint32_t), 1, file) == 1;
     
     // Write each token
-    for (uint32_t i = 0; i < vocab->size; i++) {
-        uint16_t len = (uint16_t)strlen(vocab->idToToken[i]);
-        fwrite(&len, sizeof(uint16_t), 1, file);
-        fwrite(vocab->idToToken[i], sizeof(char), len, file);
+    for (uint32_t i = 0; ok && i < vocab->size; i++) {
+        const char* token = getTokenById(vocab, i);
+        uint16_t len = (uint16_t)strlen(token);
+        ok = fwrite(&len, sizeof(uint16_t), 1, file) == 1 && fwrite(token, sizeof(char), len, file) == len;
     }
     
-    fclose(file);
+    if (fclose(file) != 0) ok = false;
+    if (ok && rename(tempName, filename) != 0) ok = false;
+    if (!ok) {
+        perror("Failed to write vocabulary file");
+        remove(tempName);
+    }
 }
 
 // Load vocabulary from file
@@ -157,12 +263,10 @@ void loadVocabulary(Vocabulary* vocab, const char* filename) {
     }
     
     // Clear existing vocabulary
-    if (vocab->tokenToId) freeHashMap(vocab->tokenToId);
-    if (vocab->idToToken) {
-        for (uint32_t i = 0; i < vocab->size; i++) {
-            if (vocab->idToToken[i]) free(vocab->idToToken[i]);
-        }
-        free(vocab->idToToken);
+    if (vocab->view.strings) {
+        memset(&vocab->view, 0, sizeof(vocab->view));
+    } else {
+        clearVocabularyStorage(vocab);
     }
     
     vocab->tokenToId = createHashMap();
@@ -175,8 +279,8 @@ void loadVocabulary(Vocabulary* vocab, const char* filename) {
     vocab->capacity = vocab->size * 2;  // Allocate extra space
     
     // Allocate token array
-    vocab->idToToken = (char**)calloc(vocab->capacity, sizeof(char*));
-    if (!vocab->idToToken) {
+    vocab->idToToken = (const char**)calloc(vocab->capacity, sizeof(char*));
+    if (!vocab->idToToken || !hashMapReserve(vocab->tokenToId, vocab->size)) {
         fclose(file);
         return;
     }
@@ -202,8 +306,9 @@ void loadVocabulary(Vocabulary* vocab, const char* filename) {
         }
         token[len] = '\0';
         
-        vocab->idToToken[i] = token;
-        hashMapPut(vocab->tokenToId, token, i);
+        const char* interned = hashMapPut(vocab->tokenToId, token, i);
+        free(token);
+        vocab->idToToken[i] = interned ? interned : "<unk>";
     }
     
     fclose(file);
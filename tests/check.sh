@@ -0,0 +1,153 @@
+#!/bin/sh
+# Regression checks for the on-disk formats: round trips through the CLI
+# and loaders fed truncated or mismatched files.
+# Usage: tests/check.sh <cevia binary> <corpus> <work directory>
+set -u
+
+CEVIA=$1
+CORPUS=$2
+WORK=$3
+FAILED=0
+
+pass() { echo "  ok    $1"; }
+fail() { echo "  FAIL  $1"; FAILED=1; }
+
+# check <description> <command...>: passes when the command succeeds
+check() {
+    description=$1
+    shift
+    if "$@" >/dev/null 2>&1; then pass "$description"; else fail "$description"; fi
+}
+
+# Lines of stderr and stdout of loading PREFIX and evaluating the corpus
+evalOutput() {
+    "$CEVIA" eval "$CORPUS" --model-prefix "$1" --threads 1 2>&1 | grep -v "Throughput"
+}
+
+rm -rf "$WORK"
+mkdir -p "$WORK"
+echo "Format checks in $WORK"
+
+# Reference model: .vocab, .ngrams, .skip and .cvm
+"$CEVIA" train "$CORPUS" --model-prefix "$WORK/ref" >/dev/null 2>&1 || { echo "  FAIL  train"; exit 1; }
+evalOutput "$WORK/ref" > "$WORK/ref.eval"
+
+# .ngrams: a model rebuilt from the count files matches the trained one
+mkdir -p "$WORK/ngrams"
+for ext in vocab ngrams skip; do cp "$WORK/ref.$ext" "$WORK/ngrams/m.$ext"; done
+evalOutput "$WORK/ngrams/m" > "$WORK/ngrams/m.eval"
+check ".ngrams load predicts like the trained model" cmp "$WORK/ref.eval" "$WORK/ngrams/m.eval"
+"$CEVIA" freeze "$WORK/ngrams/m" >/dev/null 2>&1
+check "freeze from .ngrams reproduces the trained .cvm byte for byte" cmp "$WORK/ref.cvm" "$WORK/ngrams/m.cvm"
+
+# .ngrams: truncated, bad magic, and counts of another vocabulary are rejected
+size=$(wc -c < "$WORK/ref.ngrams")
+mkdir -p "$WORK/bad"
+cp "$WORK/ref.vocab" "$WORK/bad/t.vocab"
+head -c $((size / 2)) "$WORK/ref.ngrams" > "$WORK/bad/t.ngrams"
+check "truncated .ngrams is rejected" sh -c "'$CEVIA' eval '$CORPUS' --model-prefix '$WORK/bad/t' 2>&1 | grep -q 'is invalid'"
+cp "$WORK/ref.vocab" "$WORK/bad/m.vocab"
+{ printf 'XEVIANGM'; tail -c +9 "$WORK/ref.ngrams"; } > "$WORK/bad/m.ngrams"
+check ".ngrams with a bad magic is rejected" sh -c "'$CEVIA' eval '$CORPUS' --model-prefix '$WORK/bad/m' 2>&1 | grep -q 'is invalid'"
+head -n 20 "$CORPUS" > "$WORK/small.txt"
+"$CEVIA" train "$WORK/small.txt" --model-prefix "$WORK/small" >/dev/null 2>&1
+cp "$WORK/small.vocab" "$WORK/bad/v.vocab"
+cp "$WORK/ref.ngrams" "$WORK/bad/v.ngrams"
+check ".ngrams paired with another model's .vocab is rejected" \
+      sh -c "'$CEVIA' eval '$CORPUS' --model-prefix '$WORK/bad/v' 2>&1 | grep -q 'is invalid'"
+
+# Perplexity, OOV rate and pair count: what a renumbered vocabulary must not change
+evalTotals() {
+    evalOutput "$1" | grep -E "Pairs evaluated|Perplexity|OOV rate"
+}
+
+# Bytes of skip-gram table the model at PREFIX loads
+skipGramBytes() {
+    "$CEVIA" stats --model-prefix "$1" 2>/dev/null | awk '/Skip-grams/ { print $2 }'
+}
+
+# .cvs: shards of two halves merge to the counts of one training run
+lines=$(wc -l < "$CORPUS")
+head -n $((lines / 2)) "$CORPUS" > "$WORK/half1.txt"
+tail -n +$((lines / 2 + 1)) "$CORPUS" > "$WORK/half2.txt"
+"$CEVIA" train "$WORK/half1.txt" --shard "$WORK/half1.cvs" >/dev/null 2>&1
+"$CEVIA" train "$WORK/half2.txt" --shard "$WORK/half2.cvs" >/dev/null 2>&1
+mkdir -p "$WORK/merge"
+check "merge of two shards succeeds" "$CEVIA" merge "$WORK/merge/m" "$WORK/half1.cvs" "$WORK/half2.cvs"
+evalTotals "$WORK/ref" > "$WORK/ref.totals"
+evalTotals "$WORK/merge/m" > "$WORK/merge/m.totals"
+check "merged model has the perplexity of a single training run" cmp "$WORK/ref.totals" "$WORK/merge/m.totals"
+"$CEVIA" merge "$WORK/merge/r" "$WORK/half2.cvs" "$WORK/half1.cvs" >/dev/null 2>&1
+check "merge does not depend on shard order" cmp "$WORK/merge/m.cvm" "$WORK/merge/r.cvm"
+
+# .cvs: truncated and bad-magic shards fail the merge without leaving an image
+size=$(wc -c < "$WORK/half1.cvs")
+head -c $((size - 16)) "$WORK/half1.cvs" > "$WORK/bad/short.cvs"
+{ printf 'XEVIACSH'; tail -c +9 "$WORK/half1.cvs"; } > "$WORK/bad/magic.cvs"
+for shard in short magic; do
+    if "$CEVIA" merge "$WORK/bad/$shard" "$WORK/bad/$shard.cvs" "$WORK/half2.cvs" >/dev/null 2>&1 ||
+       [ -e "$WORK/bad/$shard.cvm" ] || [ -e "$WORK/bad/$shard.cvm.tmp" ]; then
+        fail "$shard shard is rejected by merge"
+    else
+        pass "$shard shard is rejected by merge"
+    fi
+done
+
+# merge over a trained prefix removes its stale count and skip-gram files
+mkdir -p "$WORK/over"
+for ext in vocab ngrams skip cvm; do cp "$WORK/ref.$ext" "$WORK/over/p.$ext"; done
+"$CEVIA" merge "$WORK/over/p" "$WORK/half1.cvs" "$WORK/half2.cvs" >/dev/null 2>&1
+check "merge removes stale .vocab, .ngrams and .skip" \
+      sh -c "[ ! -e '$WORK/over/p.vocab' ] && [ ! -e '$WORK/over/p.ngrams' ] && [ ! -e '$WORK/over/p.skip' ]"
+
+# .skip: the trained table loads; tables of other models or with bad IDs do not
+bytes=$(skipGramBytes "$WORK/ref")
+check "trained .skip loads" [ "${bytes:-0}" -gt 0 ]
+cp "$WORK/ref.skip" "$WORK/over/p.skip"
+check "pre-merge .skip is ignored next to the merged image" \
+      sh -c "'$CEVIA' stats --model-prefix '$WORK/over/p' 2>&1 | grep -q 'belongs to another model'"
+check "ignored .skip leaves no table loaded" [ "$(skipGramBytes "$WORK/over/p")" -eq 0 ]
+mkdir -p "$WORK/skip"
+for name in short other ids; do cp "$WORK/ref.cvm" "$WORK/skip/$name.cvm"; done
+size=$(wc -c < "$WORK/ref.skip")
+head -c $((size - 4)) "$WORK/ref.skip" > "$WORK/skip/short.skip"
+check "truncated .skip is rejected" \
+      sh -c "'$CEVIA' stats --model-prefix '$WORK/skip/short' 2>&1 | grep -q 'is invalid'"
+"$CEVIA" train "$WORK/half1.txt" --model-prefix "$WORK/half1" >/dev/null 2>&1
+cp "$WORK/half1.skip" "$WORK/skip/other.skip"
+check ".skip of another model is rejected" \
+      sh -c "'$CEVIA' stats --model-prefix '$WORK/skip/other' 2>&1 | grep -q 'belongs to another model'"
+# The first continuation ID sits 8 bytes per entry before the end (IDs, then counts)
+entries=$(od -An -tu4 -j20 -N4 "$WORK/ref.skip" | tr -d ' ')
+cp "$WORK/ref.skip" "$WORK/skip/ids.skip"
+printf '\376\377\377\177' | dd of="$WORK/skip/ids.skip" bs=1 seek=$((size - 8 * entries)) conv=notrunc 2>/dev/null
+check ".skip with a continuation outside the vocabulary is rejected" \
+      sh -c "'$CEVIA' stats --model-prefix '$WORK/skip/ids' 2>&1 | grep -q 'is invalid'"
+
+# .cvm: truncated, bad magic, and offsets or child ranges out of range are
+# rejected (no .vocab/.ngrams beside them to fall back to)
+mkdir -p "$WORK/frozen"
+size=$(wc -c < "$WORK/ref.cvm")
+head -c $((size / 2)) "$WORK/ref.cvm" > "$WORK/frozen/short.cvm"
+check "truncated .cvm is rejected" \
+      sh -c "'$CEVIA' stats --model-prefix '$WORK/frozen/short' 2>&1 | grep -q 'is invalid'"
+{ printf 'XEVIAFRZ'; tail -c +9 "$WORK/ref.cvm"; } > "$WORK/frozen/magic.cvm"
+check ".cvm with a bad magic is rejected" \
+      sh -c "'$CEVIA' stats --model-prefix '$WORK/frozen/magic' 2>&1 | grep -q 'is invalid'"
+# Header: levelSize[] at byte 80, levelTokenOff[] at 104, levelChildOff[] at 184
+cp "$WORK/ref.cvm" "$WORK/frozen/offset.cvm"
+printf '\360\377\377\377' | dd of="$WORK/frozen/offset.cvm" bs=1 seek=112 conv=notrunc 2>/dev/null
+check ".cvm with a level offset past the end is rejected" \
+      sh -c "'$CEVIA' stats --model-prefix '$WORK/frozen/offset' 2>&1 | grep -q 'is invalid'"
+unigrams=$(od -An -tu4 -j80 -N4 "$WORK/ref.cvm" | tr -d ' ')
+childOff=$(od -An -tu4 -j184 -N4 "$WORK/ref.cvm" | tr -d ' ')
+cp "$WORK/ref.cvm" "$WORK/frozen/child.cvm"
+printf '\376\377\377\177' | dd of="$WORK/frozen/child.cvm" bs=1 seek=$((childOff + 4 * unigrams)) conv=notrunc 2>/dev/null
+check ".cvm with a child range past the next level is rejected" \
+      sh -c "'$CEVIA' stats --model-prefix '$WORK/frozen/child' 2>&1 | grep -q 'is invalid'"
+
+if [ "$FAILED" -ne 0 ]; then
+    echo "Format checks failed"
+    exit 1
+fi
+echo "All format checks passed"